@@ -6,93 +6,65 @@
  */
 
 #include "../core/alex.h"
+#include "../core/alex_ingest.h"
 
 #include <iomanip>
 #include <cstdint>
 #include "flags.h"
 #include "utils.h"
 #include <memory>
+#include <thread>
 
 // Modify these if running your own workload
 #define KEY_TYPE uint64_t
 #define PAYLOAD_TYPE double
-// 添加一个打印节点信息的函数
-struct NodeInfo {
-    double slope;
-    double intercept;
-    KEY_TYPE min_key;
-    KEY_TYPE max_key;
-};
-
-std::vector<NodeInfo> all_node_info;
-
-int count_lines(const std::string& file_path) {
-    std::ifstream infile(file_path.c_str());
-    int count = std::count(std::istreambuf_iterator<char>(infile),
-                           std::istreambuf_iterator<char>(), '\n');
-    return count;
-}
-
-
-void print_node_info(alex::AlexNode<KEY_TYPE, PAYLOAD_TYPE>* node, int node_num) {
-  std::cout << "Node #" << node_num << " information:\n";
-
-  if (node->is_leaf_) {
-    auto datanode = static_cast<alex::AlexDataNode<KEY_TYPE, PAYLOAD_TYPE>*>(node);
-    
-    if (datanode->key_slots_ != nullptr) {
-      std::cout << "  - Data Node - First key: " << datanode->key_slots_[1] << "\n";
-    }
-    // std::cout << "  - Number of shifts: " << datanode->num_shifts_ << "\n";
-    // std::cout << "  - Number of lookups: " << datanode->num_lookups_ << "\n";
-    // std::cout << "  - Number of resizes: " << datanode->num_resizes_ << "\n";
-    NodeInfo info;
-    info.slope = datanode->model_.a_;
-    info.intercept = datanode->model_.b_;
-    info.min_key = datanode->min_key_;
-    info.max_key = datanode->max_key_;
-    
-    all_node_info.push_back(info);
-  } else {
-    auto modelnode = static_cast<alex::AlexModelNode<KEY_TYPE, PAYLOAD_TYPE>*>(node);
-    std::cout << "  - Model Node - Number of children: " << modelnode->num_children_ << "\n";
+// Writes the stats of all nodes in one pass, see alex_structure.h
+void export_structure(const alex::Alex<KEY_TYPE, PAYLOAD_TYPE>& index,
+                      const std::string& filename) {
+  auto snapshot = index.export_structure();
+  std::ofstream outfile(filename, std::ios::binary | std::ios::trunc);
+  if (!snapshot.write(outfile)) {
+    std::cout << "Could not write " << filename << std::endl;
+    return;
   }
+  std::cout << "Data nodes: " << snapshot.num_data_nodes()
+            << ", model nodes: " << snapshot.num_model_nodes()
+            << ", max depth: " << snapshot.max_depth
+            << ", structure exported to " << filename << std::endl;
 }
 
-void export_node_info_to_file(const std::string& filename) {
-    std::ofstream outfile(filename.c_str());
-    for (const auto& info : all_node_info) {
-        outfile << info.slope << "," << info.intercept << "," << info.min_key << "," << info.max_key << "\n";
-    }
-    outfile.close();
+// Path of the text key file of a user
+std::string user_file_path(PAYLOAD_TYPE usr_id) {
+  return "./avg/user_" + std::to_string(static_cast<int>(usr_id)) + ".txt";
 }
 
-KEY_TYPE* generateKeys(std::map<std::string, std::string>& flags, int& total_num_keys, PAYLOAD_TYPE usr_id) {
+KEY_TYPE* generateKeys(std::map<std::string, std::string>& flags, long long& total_num_keys, PAYLOAD_TYPE usr_id) {
   std::string keys_file_type = get_required(flags, "keys_file_type");
 
   // Construct the user-specific file path
-  std::string user_file_path = "./avg/user_" + std::to_string(static_cast<int>(usr_id)) + ".txt";
+  std::string user_file_path = ::user_file_path(usr_id);
 
-  // Count lines in the user-specific file to determine total_num_keys
-  total_num_keys = count_lines(user_file_path);
-
-  // Load keys
-  KEY_TYPE* keys = new KEY_TYPE[total_num_keys];
+  // Load keys. The number of keys is the number of lines in the file. Text
+  // files are parsed once and then loaded from their binary cache, which is
+  // also the file that the binary file type reads.
+  KEY_TYPE* keys = nullptr;
   if (keys_file_type == "binary") {
-    load_binary_data(keys, total_num_keys, user_file_path);
+    keys = load_binary_keys<KEY_TYPE>(binary_cache_path<KEY_TYPE>(user_file_path), total_num_keys);
   } else if (keys_file_type == "text") {
-    load_text_data(keys, total_num_keys, user_file_path);
+    keys = load_text_keys_cached<KEY_TYPE>(user_file_path, total_num_keys);
   } else {
     std::cerr << "--keys_file_type must be either 'binary' or 'text'" << std::endl;
-    delete[] keys; // 在错误情况下，不要忘记释放已分配的内存
     return nullptr;
   }
+  if (keys == nullptr) {
+    std::cerr << "Could not load keys from " << user_file_path << std::endl;
+  }
 
   return keys;
 }
-std::unique_ptr<std::pair<KEY_TYPE, PAYLOAD_TYPE>[]> buildvalue(KEY_TYPE* keys, int init_num_keys, PAYLOAD_TYPE usr_id) {
+std::unique_ptr<std::pair<KEY_TYPE, PAYLOAD_TYPE>[]> buildvalue(KEY_TYPE* keys, long long init_num_keys, PAYLOAD_TYPE usr_id) {
     std::unique_ptr<std::pair<KEY_TYPE, PAYLOAD_TYPE>[]> values(new std::pair<KEY_TYPE, PAYLOAD_TYPE>[init_num_keys]);
-    for (int i = 0; i < init_num_keys; i++) {
+    for (long long i = 0; i < init_num_keys; i++) {
         values[i].first = keys[i];
         values[i].second = usr_id;
     }
@@ -102,52 +74,80 @@ std::unique_ptr<std::pair<KEY_TYPE, PAYLOAD_TYPE>[]> buildvalue(KEY_TYPE* keys,
 std::unique_ptr<alex::Alex<KEY_TYPE, PAYLOAD_TYPE>> buildIndex(
     std::map<std::string, std::string>& flags, 
     std::unique_ptr<std::pair<KEY_TYPE, PAYLOAD_TYPE>[]> values, 
-    int total_num_keys) {
+    long long total_num_keys) {
   
   // Create ALEX and bulk load
+  int num_threads = stoi(get_with_default(
+      flags, "bulk_load_threads",
+      std::to_string(std::max(1u, std::thread::hardware_concurrency()))));
   auto index = std::make_unique<alex::Alex<KEY_TYPE, PAYLOAD_TYPE>>();
-  std::sort(values.get(), values.get() + total_num_keys,
-            [](auto const& a, auto const& b) { return a.first < b.first; });
+  index->set_num_bulk_load_threads(num_threads);
+  alex::parallel_sort(
+      values.get(), values.get() + total_num_keys,
+      [](auto const& a, auto const& b) { return a.first < b.first; },
+      num_threads);
   index->bulk_load(values.get(), total_num_keys);
   return index;
 }
 
+// Streams the keys of a user into the index: reader threads parse blocks of
+// the key file into sorted chunks, while the index inserts the chunks that
+// are already parsed. Text files are read from their binary cache if it is up
+// to date.
 void insertKeysForUser(alex::Alex<KEY_TYPE, PAYLOAD_TYPE>* index, 
                        std::map<std::string, std::string>& flags, 
                        PAYLOAD_TYPE usr_id) {
-    // Construct the user-specific file path
-    std::string user_file_path = "./avg/user_" + std::to_string(static_cast<int>(usr_id)) + ".txt";
-
-    // Calculate number of keys for the user by counting lines in the file
-    int num_keys_for_user = count_lines(user_file_path);
-
-    // Generate keys for the given user
-    auto keys_for_user = generateKeys(flags, num_keys_for_user, usr_id);
-    
-    // Generate values for the given user
-    auto values_for_user = buildvalue(keys_for_user, num_keys_for_user, usr_id);
+    const size_t kIngestBlockSize = 1 << 22;
+    std::string keys_file_type = get_required(flags, "keys_file_type");
+    std::string file_path = user_file_path(usr_id);
+    std::string cache_path = binary_cache_path<KEY_TYPE>(file_path);
+    bool binary = keys_file_type == "binary";
+    if (keys_file_type == "text") {
+        std::error_code error;
+        auto text_time = std::filesystem::last_write_time(file_path, error);
+        auto cache_time = std::filesystem::last_write_time(cache_path, error);
+        binary = !error && cache_time >= text_time;
+    } else if (!binary) {
+        std::cerr << "--keys_file_type must be either 'binary' or 'text'" << std::endl;
+        return;
+    }
+    int num_threads = stoi(get_with_default(
+        flags, "ingest_threads",
+        std::to_string(std::max(1u, std::thread::hardware_concurrency()))));
 
     // Start the insertion process
     auto inserts_start_time = std::chrono::high_resolution_clock::now();
 
-    for (int j = 0; j < num_keys_for_user; j++) {
-        try {
-            index->insert(keys_for_user[j], values_for_user[j].second);
-        } catch (std::bad_alloc& ba) {
-            std::cerr << "Failed to insert key for user " << usr_id 
-                      << " at position " << j << ": " << ba.what() << '\n';
-            delete[] keys_for_user;  // Remember to free memory in case of exceptions
-            return;
-        }
+    typedef alex::IngestSession<alex::Alex<KEY_TYPE, PAYLOAD_TYPE>> Session;
+    Session session(*index, std::max(2, num_threads));
+    bool read = for_each_key_block<KEY_TYPE>(
+        binary ? cache_path : file_path, binary, kIngestBlockSize,
+        num_threads, [&](std::vector<KEY_TYPE>& keys) {
+            Session::Chunk chunk = session.get_chunk();
+            chunk.reserve(keys.size());
+            for (KEY_TYPE key : keys) {
+                chunk.emplace_back(key, usr_id);
+            }
+            session.submit(std::move(chunk));
+        });
+    long long num_inserted = 0;
+    try {
+        num_inserted = session.finish();
+    } catch (std::bad_alloc& ba) {
+        std::cerr << "Failed to insert keys for user " << usr_id 
+                  << ": " << ba.what() << '\n';
+        return;
+    }
+    if (!read) {
+        std::cerr << "Could not load keys for user " << usr_id << std::endl;
+        return;
     }
 
     auto inserts_end_time = std::chrono::high_resolution_clock::now();
     double insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
                              inserts_end_time - inserts_start_time).count();
-    std::cout << "Time taken to insert keys for user " << usr_id << ": " 
-              << insert_time << " nanoseconds" << std::endl;
-
-    delete[] keys_for_user;
+    std::cout << "Time taken to insert " << num_inserted << " keys for user "
+              << usr_id << ": " << insert_time << " nanoseconds" << std::endl;
 }
 
                        
@@ -165,6 +165,8 @@ void insertKeysForUser(alex::Alex<KEY_TYPE, PAYLOAD_TYPE>* index,
  * --lookup_distribution    lookup keys distribution (options: uniform or zipf)
  * --time_limit             time limit, in minutes
  * --print_batch_stats      whether to output stats for each batch
+ * --ingest_threads         threads that parse the keys of users 1-9 while
+ *                          they are inserted
  */
 int main(int argc, char* argv[]) {
   
@@ -172,15 +174,18 @@ int main(int argc, char* argv[]) {
   std::string keys_file_type = get_required(flags, "keys_file_type");
   PAYLOAD_TYPE usr_id = stoi(get_required(flags, "init_usr_id"));
   
-  int total_num_keys;
+  long long total_num_keys;
   auto keys = generateKeys(flags, total_num_keys, usr_id);
+  if (keys == nullptr) {
+    return 1;
+  }
   
   auto values = buildvalue(keys, total_num_keys, usr_id);
   auto index = buildIndex(flags, std::move(values), total_num_keys);
   std::cout << "bulk over" << std::endl; 
 
   // Run workload
-  int i = total_num_keys;
+  long long i = total_num_keys;
   // long long cumulative_inserts = 0;
   // long long cumulative_lookups = 0;
   // // auto batch_size = stoi(get_required(flags, "batch_size"));
@@ -195,20 +200,7 @@ int main(int argc, char* argv[]) {
   // PAYLOAD_TYPE sum = 0;
   std::cout << std::scientific;
   std::cout << std::setprecision(3);
-  alex::Alex<KEY_TYPE, PAYLOAD_TYPE>::NodeIterator node_it(index.get());
-  int num = 0;
-  for (; !node_it.is_end(); node_it.next()) {
-    auto node = node_it.current();
-    if (node->is_leaf_) {
-      num++;
-      print_node_info(node, num);
-    }
-  }
-  std::cout << "Total number of data nodes: " << num << std::endl;
-
-  // Export node information to a file
-  export_node_info_to_file("node_info.txt");
-  std::cout << "Node information exported to node_info.txt" << std::endl;
+  export_structure(*index, "node_structure.bin");
 
 
 
@@ -223,23 +215,9 @@ int main(int argc, char* argv[]) {
     insertion_times[user - 1] = std::chrono::duration_cast<std::chrono::nanoseconds>(
                                     end_time - start_time).count();
 
-    // Update all_node_info after each insertion
-    all_node_info.clear();
-    alex::Alex<KEY_TYPE, PAYLOAD_TYPE>::NodeIterator node_it(index.get());
-    int num = 0;
-    for (; !node_it.is_end(); node_it.next()) {
-      auto node = node_it.current();
-      if (node->is_leaf_) {
-        num++;
-        print_node_info(node, num);
-      }
-    }
-
-    // Export node information after each insertion
-    std::string filename = "node_info_after_user_" + std::to_string(user) + ".txt";
-    export_node_info_to_file(filename);
-    std::cout << "Node information after inserting keys for user " << user 
-              << " exported to " << filename << std::endl;
+    // Export the structure after each insertion
+    export_structure(*index, "node_structure_after_user_" +
+                                 std::to_string(user) + ".bin");
   }
 
   // Print insertion times
@@ -35,8 +35,8 @@ int main(int argc, char* argv[]) {
   auto flags = parse_flags(argc, argv);
   std::string keys_file_path = get_required(flags, "keys_file");
   std::string keys_file_type = get_required(flags, "keys_file_type");
-  auto init_num_keys = stoi(get_required(flags, "init_num_keys"));
-  auto total_num_keys = stoi(get_required(flags, "total_num_keys"));
+  auto init_num_keys = stoll(get_required(flags, "init_num_keys"));
+  auto total_num_keys = stoll(get_required(flags, "total_num_keys"));
   auto batch_size = stoi(get_required(flags, "batch_size"));
   auto insert_frac = stod(get_with_default(flags, "insert_frac", "0.5"));
   std::string lookup_distribution =
@@ -59,7 +59,7 @@ int main(int argc, char* argv[]) {
   // Combine bulk loaded keys with randomly generated payloads
   auto values = new std::pair<KEY_TYPE, PAYLOAD_TYPE>[init_num_keys];
   std::mt19937_64 gen_payload(std::random_device{}());
-  for (int i = 0; i < init_num_keys; i++) {
+  for (long long i = 0; i < init_num_keys; i++) {
     values[i].first = keys[i];
     values[i].second = static_cast<PAYLOAD_TYPE>(gen_payload());
   }
@@ -71,7 +71,7 @@ int main(int argc, char* argv[]) {
   index.bulk_load(values, init_num_keys);
 
   // Run workload
-  int i = init_num_keys;
+  long long i = init_num_keys;
   long long cumulative_inserts = 0;
   long long cumulative_lookups = 0;
   int num_inserts_per_batch = static_cast<int>(batch_size * insert_frac);
@@ -100,10 +100,11 @@ int main(int argc, char* argv[]) {
                   << std::endl;
         return 1;
       }
+      auto payloads = new PAYLOAD_TYPE*[num_lookups_per_batch];
       auto lookups_start_time = std::chrono::high_resolution_clock::now();
+      index.get_payloads(lookup_keys, num_lookups_per_batch, payloads);
       for (int j = 0; j < num_lookups_per_batch; j++) {
-        KEY_TYPE key = lookup_keys[j];
-        PAYLOAD_TYPE* payload = index.get_payload(key);
+        PAYLOAD_TYPE* payload = payloads[j];
         if (payload) {
           sum += *payload;
         }
@@ -115,12 +116,13 @@ int main(int argc, char* argv[]) {
       cumulative_lookup_time += batch_lookup_time;
       cumulative_lookups += num_lookups_per_batch;
       delete[] lookup_keys;
+      delete[] payloads;
     }
 
     // Do inserts
-    int num_actual_inserts =
-        std::min(num_inserts_per_batch, total_num_keys - i);
-    int num_keys_after_batch = i + num_actual_inserts;
+    auto num_actual_inserts = static_cast<int>(
+        std::min<long long>(num_inserts_per_batch, total_num_keys - i));
+    long long num_keys_after_batch = i + num_actual_inserts;
     auto inserts_start_time = std::chrono::high_resolution_clock::now();
     for (; i < num_keys_after_batch; i++) {
       index.insert(keys[i], static_cast<PAYLOAD_TYPE>(gen_payload()));
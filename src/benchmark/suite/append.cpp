@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Insert-only append workload: bulk loads the smallest keys, then inserts the
+ * remaining keys in ascending order, so that every insert goes to the
+ * rightmost data node, as when ingesting timestamps or sequence numbers.
+ *
+ * Flags, besides the common flags in bench.h:
+ * --init_frac  fraction of keys to bulk load (default 0.1)
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "append", [](auto& run) {
+    using T = typename std::decay_t<decltype(run.keys())>::value_type;
+    std::vector<T> keys = run.keys();
+    std::sort(keys.begin(), keys.end());
+    auto init_num_keys = static_cast<size_t>(
+        keys.size() * run.config().get_double("init_frac", 0.1));
+    if (init_num_keys == 0 || init_num_keys == keys.size()) {
+      std::cerr << "--init_frac leaves no keys to bulk load or to insert"
+                << std::endl;
+      return false;
+    }
+    run.bulk_load_keys(keys.data(), init_num_keys);
+    size_t num_inserts = std::min(run.ops_with_warmup(),
+                                  keys.size() - init_num_keys);
+    auto& index = run.index();
+    auto& gen = run.gen();
+    run.measure("insert", num_inserts, [&](size_t i) {
+      index.insert(keys[init_num_keys + i], static_cast<bench::Payload>(gen()));
+    });
+    return true;
+  });
+}
@@ -0,0 +1,647 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Harness of the benchmark suite. Every workload is a separate program, e.g.
+ *   g++ -std=c++17 -O3 -march=native -pthread read_only.cpp -o read_only
+ * that defines the operations of the workload and calls run_benchmark().
+ * The harness loads or generates the keys, builds a fresh index for every
+ * repetition, runs warmup operations, measures throughput and sampled
+ * latencies, and writes the results as JSON to stdout or --json_output.
+ * Progress messages go to stderr.
+ *
+ * Common flags:
+ * --key_type           uint64 (default), uint32, int64 or double
+ * --keys_file          file with one key per line (text) or raw keys (binary).
+ *                      Without it, --num_keys keys are generated.
+ * --keys_file_type     text (default) or binary
+ * --keys_dir           directory with one text file of keys per key set,
+ *                      named user_0.txt, user_1.txt, ... (as in ./avg)
+ * --num_keys           number of keys to use (default: all keys of the file,
+ *                      or 10M generated keys)
+ * --num_key_sets       number of key sets, e.g. users of the multi-user
+ *                      workload (default 1, or all files of --keys_dir).
+ *                      Without --keys_dir, the keys are split evenly.
+ * --key_distribution   generated keys: uniform (default), lognormal or
+ *                      sequential
+ * --num_ops            number of measured operations per phase
+ * --warmup_ops         operations run before each phase is measured
+ * --repetitions        number of times the workload is run (default 3)
+ * --seed               seed of all random choices (default 42)
+ * --latency_sample     measure the latency of every N-th operation (default
+ *                      8). Timing an operation adds two clock reads.
+ * --pin_cpu            pins the benchmark thread to this CPU
+ * --bulk_load_threads  threads used to bulk load (default 1)
+ * --json_output        file to write the results to, instead of stdout
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../../core/alex.h"
+#include "../flags.h"
+#include "../utils.h"
+
+namespace bench {
+
+typedef uint64_t Payload;
+
+template <class T>
+using Index = alex::Alex<T, Payload>;
+
+struct Config {
+  std::map<std::string, std::string> flags;
+  std::string key_type;
+  size_t num_ops = 0;
+  size_t warmup_ops = 0;
+  int repetitions = 0;
+  uint64_t seed = 0;
+  int latency_sample = 0;
+  int pin_cpu = -1;
+  int bulk_load_threads = 1;
+
+  std::string get(const std::string& key, const std::string& defval) const {
+    return get_with_default(flags, key, defval);
+  }
+  double get_double(const std::string& key, double defval) const {
+    return std::stod(get(key, std::to_string(defval)));
+  }
+  long long get_int(const std::string& key, long long defval) const {
+    return std::stoll(get(key, std::to_string(defval)));
+  }
+};
+
+/*** Measurements ***/
+
+// Throughput and latency of one phase of a workload
+struct PhaseResult {
+  std::string name;
+  size_t num_ops = 0;
+  double seconds = 0;
+  alex::LatencyHistogram::Snapshot latency;
+};
+
+// Results of one repetition of a workload
+struct RepetitionResult {
+  double bulk_load_seconds = 0;
+  std::vector<PhaseResult> phases;
+  // Shape of the index at the end of the repetition
+  long long num_keys = 0;
+  int num_model_nodes = 0;
+  int num_data_nodes = 0;
+  long long model_size_bytes = 0;
+  long long data_size_bytes = 0;
+};
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Keeps the compiler from optimizing away the computation of value
+template <class V>
+void consume(const V& value) {
+  static volatile V sink;
+  sink = value;
+  (void)sink;
+}
+
+inline bool pin_thread(int cpu) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+/*** Keys ***/
+
+template <class T>
+std::vector<T> generate_keys(const std::string& distribution, size_t num_keys,
+                             uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::vector<T> keys(num_keys);
+  // Keeps integer keys of all types in range
+  const double max_key = std::min<double>(
+      1e15, static_cast<double>(std::numeric_limits<T>::max()) / 2);
+  if (distribution == "sequential") {
+    for (size_t i = 0; i < num_keys; i++) {
+      keys[i] = static_cast<T>(i);
+    }
+    return keys;
+  } else if (distribution == "lognormal") {
+    std::lognormal_distribution<double> dis(0, 2);
+    for (T& key : keys) {
+      key = static_cast<T>(std::min(dis(gen) * 1e6, max_key));
+    }
+  } else {
+    std::uniform_real_distribution<double> dis(0, max_key);
+    for (T& key : keys) {
+      key = static_cast<T>(dis(gen));
+    }
+  }
+  return keys;
+}
+
+// Loads the keys of a text or binary file. Returns false if the file cannot
+// be read.
+template <class T>
+bool load_keys(const std::string& path, const std::string& file_type,
+               std::vector<T>& keys) {
+  long long num_keys = 0;
+  T* array = file_type == "binary" ? load_binary_keys<T>(path, num_keys)
+                                   : load_text_keys_cached<T>(path, num_keys);
+  if (array == nullptr) {
+    return false;
+  }
+  keys.assign(array, array + num_keys);
+  delete[] array;
+  return true;
+}
+
+// Keys of all key sets, concatenated
+template <class T>
+struct KeySets {
+  std::vector<T> keys;
+  // Key set i is [boundaries[i], boundaries[i + 1]) of keys
+  std::vector<size_t> boundaries;
+};
+
+template <class T>
+bool load_key_sets(const Config& config, KeySets<T>& key_sets) {
+  std::vector<T>& keys = key_sets.keys;
+  std::vector<size_t>& boundaries = key_sets.boundaries;
+  boundaries.assign(1, 0);
+  int num_key_sets = static_cast<int>(config.get_int("num_key_sets", 0));
+  std::string keys_dir = config.get("keys_dir", "");
+  std::string keys_file = config.get("keys_file", "");
+  if (!keys_dir.empty()) {
+    for (int i = 0; num_key_sets <= 0 || i < num_key_sets; i++) {
+      std::string path = keys_dir + "/user_" + std::to_string(i) + ".txt";
+      std::vector<T> set_keys;
+      if (!load_keys(path, "text", set_keys)) {
+        if (num_key_sets > 0 || i == 0) {
+          std::cerr << "Could not load keys from " << path << std::endl;
+          return false;
+        }
+        break;
+      }
+      keys.insert(keys.end(), set_keys.begin(), set_keys.end());
+      boundaries.push_back(keys.size());
+    }
+    return true;
+  }
+
+  if (!keys_file.empty()) {
+    if (!load_keys(keys_file, config.get("keys_file_type", "text"), keys)) {
+      std::cerr << "Could not load keys from " << keys_file << std::endl;
+      return false;
+    }
+    keys.resize(std::min<size_t>(
+        keys.size(), config.get_int("num_keys", keys.size())));
+  } else {
+    keys = generate_keys<T>(config.get("key_distribution", "uniform"),
+                            config.get_int("num_keys", 10000000), config.seed);
+  }
+  num_key_sets = std::max(num_key_sets, 1);
+  for (int i = 1; i <= num_key_sets; i++) {
+    boundaries.push_back(keys.size() * i / num_key_sets);
+  }
+  return !keys.empty();
+}
+
+/*** Workload runs ***/
+
+// State of one repetition of a workload. Workloads bulk load the index, then
+// measure phases of operations.
+template <class T>
+class Run {
+ public:
+  Run(const Config& config, const KeySets<T>& key_sets)
+      : config_(config),
+        keys_(key_sets.keys),
+        boundaries_(key_sets.boundaries),
+        gen_(config.seed) {}
+
+  const Config& config() const { return config_; }
+  // All keys, in file or generation order
+  const std::vector<T>& keys() const { return keys_; }
+  int num_key_sets() const { return static_cast<int>(boundaries_.size()) - 1; }
+  // Key set i is [key_set_begin(i), key_set_begin(i + 1)) of keys()
+  size_t key_set_begin(int i) const { return boundaries_[i]; }
+  Index<T>& index() { return *index_; }
+  std::mt19937_64& gen() { return gen_; }
+  RepetitionResult& result() { return result_; }
+
+  // Number of operations that a phase runs, including warmup
+  size_t ops_with_warmup() const {
+    return config_.num_ops + config_.warmup_ops;
+  }
+
+  // Creates the index and bulk loads keys [first, last) of keys()
+  void bulk_load(size_t first, size_t last) {
+    bulk_load_keys(keys_.data() + first, last - first);
+  }
+
+  // Creates the index and bulk loads the keys, which need not be sorted
+  void bulk_load_keys(const T* keys, size_t num_keys) {
+    std::vector<std::pair<T, Payload>> values(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+      values[i] = {keys[i], static_cast<Payload>(gen_())};
+    }
+    auto start = std::chrono::steady_clock::now();
+    index_.reset(new Index<T>());
+    index_->set_num_bulk_load_threads(config_.bulk_load_threads);
+    alex::parallel_sort(
+        values.begin(), values.end(),
+        [](auto const& a, auto const& b) { return a.first < b.first; },
+        config_.bulk_load_threads);
+    index_->bulk_load(values.data(), static_cast<long long>(values.size()));
+    result_.bulk_load_seconds = seconds_since(start);
+  }
+
+  // Samples num keys out of keys [0, num_existing) of keys(), either uniformly
+  // or with the scrambled zipf distribution
+  std::vector<T> sample_keys(size_t num, size_t num_existing,
+                             const std::string& distribution) {
+    std::vector<T> sampled(num);
+    if (distribution == "zipf") {
+      ScrambledZipfianGenerator zipf_gen(
+          static_cast<long long>(num_existing), gen_());
+      for (T& key : sampled) {
+        key = keys_[zipf_gen.nextValue()];
+      }
+    } else {
+      std::uniform_int_distribution<size_t> dis(0, num_existing - 1);
+      for (T& key : sampled) {
+        key = keys_[dis(gen_)];
+      }
+    }
+    return sampled;
+  }
+
+  // Runs op(i) for i in [0, num_ops). Unless warmup is false, the first
+  // warmup_ops operations are not measured. The latency of every
+  // latency_sample-th measured operation is recorded.
+  template <class F>
+  void measure(const std::string& name, size_t num_ops, F op,
+               bool warmup = true) {
+    size_t warmup_ops = warmup ? std::min(config_.warmup_ops, num_ops) : 0;
+    for (size_t i = 0; i < warmup_ops; i++) {
+      op(i);
+    }
+    alex::LatencyHistogram latency;
+    size_t sample = static_cast<size_t>(std::max(config_.latency_sample, 1));
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = warmup_ops; i < num_ops; i++) {
+      if ((i - warmup_ops) % sample == 0) {
+        uint64_t op_start = alex::LatencyStats::now_ns();
+        op(i);
+        latency.record(alex::LatencyStats::now_ns() - op_start);
+      } else {
+        op(i);
+      }
+    }
+    add_phase(name, num_ops - warmup_ops, seconds_since(start), latency);
+  }
+
+  // Like measure(), but every operation is an insert with probability
+  // insert_frac and a lookup otherwise. Records the mixed phase, and the
+  // lookups and inserts as separate phases. Stops early when
+  // insert(num_inserts) returns false, which means that the workload ran out
+  // of keys to insert.
+  template <class LookupF, class InsertF>
+  void measure_mixed(const std::string& name, size_t num_ops,
+                     double insert_frac, LookupF lookup, InsertF insert) {
+    std::bernoulli_distribution is_insert(insert_frac);
+    std::vector<char> kinds(num_ops);
+    for (char& kind : kinds) {
+      kind = is_insert(gen_);
+    }
+    alex::LatencyHistogram latency[2];
+    size_t num_kind_ops[2] = {0, 0};
+    double kind_seconds[2] = {0, 0};
+    size_t warmup_ops = std::min(config_.warmup_ops, num_ops);
+    size_t sample = static_cast<size_t>(std::max(config_.latency_sample, 1));
+    size_t num_lookups = 0;
+    size_t num_inserts = 0;
+    size_t i = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (; i < num_ops; i++) {
+      if (i == warmup_ops) {
+        start = std::chrono::steady_clock::now();
+      }
+      int kind = kinds[i];
+      bool timed = i >= warmup_ops && (i - warmup_ops) % sample == 0;
+      uint64_t op_start = timed ? alex::LatencyStats::now_ns() : 0;
+      if (kind) {
+        if (!insert(num_inserts++)) {
+          break;
+        }
+      } else {
+        lookup(num_lookups++);
+      }
+      if (timed) {
+        uint64_t op_ns = alex::LatencyStats::now_ns() - op_start;
+        latency[kind].record(op_ns);
+        kind_seconds[kind] += op_ns * 1e-9;
+      }
+      if (i >= warmup_ops) {
+        num_kind_ops[kind]++;
+      }
+    }
+    double seconds = seconds_since(start);
+    size_t num_measured = num_kind_ops[0] + num_kind_ops[1];
+    alex::LatencyHistogram::Snapshot mixed = latency[0].snapshot();
+    mixed.merge(latency[1].snapshot());
+    add_phase(name, num_measured, seconds, mixed);
+    // Time of lookups and inserts is estimated from the sampled operations
+    const char* kind_names[2] = {"lookup", "insert"};
+    double sampled_seconds = kind_seconds[0] + kind_seconds[1];
+    for (int kind = 0; kind < 2; kind++) {
+      double share = sampled_seconds > 0 ? kind_seconds[kind] / sampled_seconds
+                                         : 0;
+      add_phase(name + "." + kind_names[kind], num_kind_ops[kind],
+                seconds * share, latency[kind].snapshot());
+    }
+  }
+
+  void add_phase(const std::string& name, size_t num_ops, double seconds,
+                 const alex::LatencyHistogram& latency) {
+    add_phase(name, num_ops, seconds, latency.snapshot());
+  }
+
+  void add_phase(const std::string& name, size_t num_ops, double seconds,
+                 const alex::LatencyHistogram::Snapshot& latency) {
+    PhaseResult phase;
+    phase.name = name;
+    phase.num_ops = num_ops;
+    phase.seconds = seconds;
+    phase.latency = latency;
+    result_.phases.push_back(phase);
+    std::cerr << "  " << name << ": " << num_ops << " ops, "
+              << (seconds > 0 ? num_ops / seconds : 0) << " ops/sec, p99 "
+              << latency.percentile_ns(0.99) << " ns" << std::endl;
+  }
+
+  // Records the shape of the index
+  void finish() {
+    if (!index_) {
+      return;
+    }
+    result_.num_keys = static_cast<long long>(index_->size());
+    result_.num_model_nodes = index_->get_stats().num_model_nodes;
+    result_.num_data_nodes = index_->get_stats().num_data_nodes;
+    result_.model_size_bytes = index_->model_size();
+    result_.data_size_bytes = index_->data_size();
+  }
+
+ private:
+  const Config& config_;
+  const std::vector<T>& keys_;
+  const std::vector<size_t>& boundaries_;
+  std::mt19937_64 gen_;
+  std::unique_ptr<Index<T>> index_;
+  RepetitionResult result_;
+};
+
+/*** Mixed workloads ***/
+
+// Bulk loads the first --init_frac of the keys, then runs --num_ops
+// operations, each of which is an insert of the next key with probability
+// --insert_frac, and otherwise a lookup of a bulk loaded key drawn from
+// --distribution
+template <class T>
+bool run_mixed_workload(Run<T>& run, double default_insert_frac) {
+  const Config& config = run.config();
+  double insert_frac = config.get_double("insert_frac", default_insert_frac);
+  double init_frac = config.get_double("init_frac", 0.5);
+  size_t num_keys = run.keys().size();
+  auto init_num_keys = static_cast<size_t>(num_keys * init_frac);
+  if (init_num_keys == 0) {
+    std::cerr << "--init_frac leaves no keys to bulk load" << std::endl;
+    return false;
+  }
+  run.bulk_load(0, init_num_keys);
+  std::vector<T> lookups = run.sample_keys(
+      run.ops_with_warmup(), init_num_keys,
+      config.get("distribution", "uniform"));
+  Index<T>& index = run.index();
+  const std::vector<T>& keys = run.keys();
+  std::mt19937_64& gen = run.gen();
+  Payload sum = 0;
+  run.measure_mixed(
+      "mixed", run.ops_with_warmup(), insert_frac,
+      [&](size_t i) {
+        Payload* payload = index.get_payload(lookups[i]);
+        if (payload) {
+          sum += *payload;
+        }
+      },
+      [&](size_t i) {
+        if (init_num_keys + i >= num_keys) {
+          return false;
+        }
+        index.insert(keys[init_num_keys + i], static_cast<Payload>(gen()));
+        return true;
+      });
+  consume(sum);
+  return true;
+}
+
+/*** JSON output ***/
+
+inline std::string json_string(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+inline void write_latency_json(std::ostream& os,
+                               const alex::LatencyHistogram::Snapshot& l) {
+  os << "{\"samples\": " << l.count << ", \"mean\": " << l.mean_ns()
+     << ", \"p50\": " << l.percentile_ns(0.5)
+     << ", \"p90\": " << l.percentile_ns(0.9)
+     << ", \"p99\": " << l.percentile_ns(0.99)
+     << ", \"p999\": " << l.percentile_ns(0.999) << ", \"max\": " << l.max_ns
+     << "}";
+}
+
+inline void write_phase_json(std::ostream& os, const PhaseResult& phase) {
+  os << "{\"name\": " << json_string(phase.name)
+     << ", \"ops\": " << phase.num_ops << ", \"seconds\": " << phase.seconds
+     << ", \"throughput_ops_per_sec\": "
+     << (phase.seconds > 0 ? phase.num_ops / phase.seconds : 0)
+     << ", \"latency_ns\": ";
+  write_latency_json(os, phase.latency);
+  os << "}";
+}
+
+template <class V>
+V median(std::vector<V> values) {
+  std::sort(values.begin(), values.end());
+  return values.empty() ? V() : values[values.size() / 2];
+}
+
+inline void write_results_json(std::ostream& os, const std::string& workload,
+                               const Config& config,
+                               const std::vector<RepetitionResult>& results) {
+  os << std::setprecision(9);
+  os << "{\n  \"workload\": " << json_string(workload)
+     << ",\n  \"key_type\": " << json_string(config.key_type)
+     << ",\n  \"flags\": {";
+  bool first = true;
+  for (const auto& flag : config.flags) {
+    os << (first ? "" : ", ") << json_string(flag.first) << ": "
+       << json_string(flag.second);
+    first = false;
+  }
+  os << "},\n  \"repetitions\": [";
+  for (size_t r = 0; r < results.size(); r++) {
+    const RepetitionResult& result = results[r];
+    os << (r == 0 ? "" : ",") << "\n    {\"bulk_load_seconds\": "
+       << result.bulk_load_seconds << ", \"num_keys\": " << result.num_keys
+       << ", \"num_model_nodes\": " << result.num_model_nodes
+       << ", \"num_data_nodes\": " << result.num_data_nodes
+       << ", \"model_size_bytes\": " << result.model_size_bytes
+       << ", \"data_size_bytes\": " << result.data_size_bytes
+       << ",\n     \"phases\": [";
+    for (size_t p = 0; p < result.phases.size(); p++) {
+      os << (p == 0 ? "" : ",") << "\n       ";
+      write_phase_json(os, result.phases[p]);
+    }
+    os << "]}";
+  }
+  // Median over repetitions of each phase, matched by position
+  os << "\n  ],\n  \"summary\": [";
+  size_t num_phases = results.empty() ? 0 : results[0].phases.size();
+  for (size_t p = 0; p < num_phases; p++) {
+    std::vector<double> throughputs;
+    std::vector<uint64_t> p50s, p99s, p999s;
+    for (const RepetitionResult& result : results) {
+      if (p >= result.phases.size()) {
+        continue;
+      }
+      const PhaseResult& phase = result.phases[p];
+      throughputs.push_back(phase.seconds > 0 ? phase.num_ops / phase.seconds
+                                              : 0);
+      p50s.push_back(phase.latency.percentile_ns(0.5));
+      p99s.push_back(phase.latency.percentile_ns(0.99));
+      p999s.push_back(phase.latency.percentile_ns(0.999));
+    }
+    os << (p == 0 ? "" : ",") << "\n    {\"name\": "
+       << json_string(results[0].phases[p].name)
+       << ", \"median_throughput_ops_per_sec\": " << median(throughputs)
+       << ", \"median_p50_ns\": " << median(p50s)
+       << ", \"median_p99_ns\": " << median(p99s)
+       << ", \"median_p999_ns\": " << median(p999s) << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+/*** Entry point ***/
+
+template <class T, class Workload>
+int run_repetitions(const std::string& name, const Config& config,
+                    Workload& workload) {
+  KeySets<T> key_sets;
+  if (!load_key_sets(config, key_sets)) {
+    std::cerr << "No keys" << std::endl;
+    return 1;
+  }
+
+  std::vector<RepetitionResult> results;
+  for (int r = 0; r < config.repetitions; r++) {
+    std::cerr << name << " repetition " << r + 1 << "/" << config.repetitions
+              << std::endl;
+    Run<T> run(config, key_sets);
+    if (!workload(run)) {
+      return 1;
+    }
+    run.finish();
+    results.push_back(run.result());
+  }
+
+  std::string json_output = config.get("json_output", "");
+  if (json_output.empty()) {
+    write_results_json(std::cout, name, config, results);
+  } else {
+    std::ofstream os(json_output.c_str());
+    write_results_json(os, name, config, results);
+    if (!os) {
+      std::cerr << "Could not write " << json_output << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Parses the common flags and runs the workload for the key type given by
+// --key_type. workload is called with a Run<T>& for every repetition, and
+// returns false on errors.
+template <class Workload>
+int run_benchmark(int argc, char** argv, const std::string& name,
+                  Workload workload) {
+  Config config;
+  config.flags = parse_flags(argc, argv);
+  config.key_type = config.get("key_type", "uint64");
+  config.num_ops = config.get_int("num_ops", 10000000);
+  config.warmup_ops = config.get_int("warmup_ops", 100000);
+  config.repetitions = static_cast<int>(config.get_int("repetitions", 3));
+  config.seed = config.get_int("seed", 42);
+  config.latency_sample = static_cast<int>(config.get_int("latency_sample", 8));
+  config.pin_cpu = static_cast<int>(config.get_int("pin_cpu", -1));
+  config.bulk_load_threads =
+      static_cast<int>(config.get_int("bulk_load_threads", 1));
+  if (config.pin_cpu >= 0 && !pin_thread(config.pin_cpu)) {
+    std::cerr << "Could not pin to CPU " << config.pin_cpu << std::endl;
+  }
+
+  if (config.key_type == "uint64") {
+    return run_repetitions<uint64_t>(name, config, workload);
+  } else if (config.key_type == "uint32") {
+    return run_repetitions<uint32_t>(name, config, workload);
+  } else if (config.key_type == "int64") {
+    return run_repetitions<int64_t>(name, config, workload);
+  } else if (config.key_type == "double") {
+    return run_repetitions<double>(name, config, workload);
+  }
+  std::cerr << "--key_type must be uint64, uint32, int64 or double"
+            << std::endl;
+  return 1;
+}
+}
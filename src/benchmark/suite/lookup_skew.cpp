@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Lookup skew workload: bulk loads all keys, then looks up existing keys drawn
+ * uniformly and then drawn from the scrambled zipf distribution, whose hot
+ * keys are spread over the key space. Both phases use the same index, so the
+ * difference between them is the effect of caching hot paths.
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "lookup_skew", [](auto& run) {
+    size_t num_keys = run.keys().size();
+    run.bulk_load(0, num_keys);
+    auto& index = run.index();
+    bench::Payload sum = 0;
+    for (const char* distribution : {"uniform", "zipf"}) {
+      auto lookups =
+          run.sample_keys(run.ops_with_warmup(), num_keys, distribution);
+      run.measure(distribution, lookups.size(), [&](size_t i) {
+        bench::Payload* payload = index.get_payload(lookups[i]);
+        if (payload) {
+          sum += *payload;
+        }
+      });
+    }
+    bench::consume(sum);
+    return true;
+  });
+}
@@ -0,0 +1,78 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Multi-user sequential ingest workload: bulk loads the keys of the first user,
+ * then ingests the keys of every other user in turn, and looks up keys of all
+ * ingested users after each user. Users are the key sets of --keys_dir (e.g.
+ * --keys_dir=avg --key_type=double) or the generated keys split evenly into
+ * --num_key_sets users.
+ *
+ * Flags, besides the common flags in bench.h:
+ * --ingest_mode  single (default) inserts one key at a time, batch inserts the
+ *                keys of a user with one range insert
+ *
+ * Unlike the other workloads, --num_ops only bounds the lookups after each
+ * user, and ingest phases are not warmed up.
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "multi_user_ingest", [](auto& run) {
+    using T = typename std::decay_t<decltype(run.keys())>::value_type;
+    const auto& keys = run.keys();
+    int num_users = run.num_key_sets();
+    if (num_users < 2) {
+      std::cerr << "Needs at least two users, see --num_key_sets" << std::endl;
+      return false;
+    }
+    bool batch = run.config().get("ingest_mode", "single") == "batch";
+    run.bulk_load(run.key_set_begin(0), run.key_set_begin(1));
+    auto& index = run.index();
+    auto& gen = run.gen();
+    bench::Payload sum = 0;
+    size_t total_ingested = 0;
+    double total_seconds = 0;
+    for (int user = 1; user < num_users; user++) {
+      size_t begin = run.key_set_begin(user);
+      size_t end = run.key_set_begin(user + 1);
+      std::string name = "user_" + std::to_string(user);
+      if (batch) {
+        std::vector<std::pair<T, bench::Payload>> values(end - begin);
+        for (size_t i = begin; i < end; i++) {
+          values[i - begin] = {keys[i], static_cast<bench::Payload>(gen())};
+        }
+        auto start = std::chrono::steady_clock::now();
+        index.insert(values.begin(), values.end());
+        double seconds = bench::seconds_since(start);
+        alex::LatencyHistogram latency;
+        run.add_phase(name + ".ingest", end - begin, seconds, latency);
+        total_seconds += seconds;
+      } else {
+        run.measure(
+            name + ".ingest", end - begin,
+            [&](size_t i) {
+              index.insert(keys[begin + i],
+                           static_cast<bench::Payload>(gen()));
+            },
+            false);
+        total_seconds += run.result().phases.back().seconds;
+      }
+      total_ingested += end - begin;
+
+      auto lookups = run.sample_keys(
+          std::min(run.ops_with_warmup(), end), end, "uniform");
+      run.measure(name + ".lookup", lookups.size(), [&](size_t i) {
+        bench::Payload* payload = index.get_payload(lookups[i]);
+        if (payload) {
+          sum += *payload;
+        }
+      });
+    }
+    alex::LatencyHistogram::Snapshot no_latency;
+    run.add_phase("ingest", total_ingested, total_seconds, no_latency);
+    bench::consume(sum);
+    return true;
+  });
+}
@@ -0,0 +1,36 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Range scan workload: bulk loads all keys, then runs short range scans, each
+ * of which finds the lower bound of an existing key and sums the payloads of
+ * the next keys.
+ *
+ * Flags, besides the common flags in bench.h:
+ * --scan_length   number of keys per scan (default 100)
+ * --distribution  start keys: uniform (default) or zipf
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "range_scan", [](auto& run) {
+    size_t num_keys = run.keys().size();
+    run.bulk_load(0, num_keys);
+    auto scan_length =
+        static_cast<int>(run.config().get_int("scan_length", 100));
+    auto starts =
+        run.sample_keys(run.ops_with_warmup(), num_keys,
+                        run.config().get("distribution", "uniform"));
+    auto& index = run.index();
+    bench::Payload sum = 0;
+    run.measure("scan", starts.size(), [&](size_t i) {
+      auto it = index.lower_bound(starts[i]);
+      for (int j = 0; j < scan_length && it != index.end(); j++, it++) {
+        sum += it.payload();
+      }
+    });
+    bench::consume(sum);
+    return true;
+  });
+}
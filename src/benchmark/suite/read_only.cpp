@@ -0,0 +1,31 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Read-only workload: bulk loads all keys, then looks up existing keys.
+ *
+ * Flags, besides the common flags in bench.h:
+ * --distribution  lookup keys: uniform (default) or zipf
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "read_only", [](auto& run) {
+    size_t num_keys = run.keys().size();
+    run.bulk_load(0, num_keys);
+    auto lookups =
+        run.sample_keys(run.ops_with_warmup(), num_keys,
+                        run.config().get("distribution", "uniform"));
+    auto& index = run.index();
+    bench::Payload sum = 0;
+    run.measure("lookup", lookups.size(), [&](size_t i) {
+      bench::Payload* payload = index.get_payload(lookups[i]);
+      if (payload) {
+        sum += *payload;
+      }
+    });
+    bench::consume(sum);
+    return true;
+  });
+}
@@ -0,0 +1,20 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Write-heavy workload: bulk loads half of the keys, then runs 50% lookups of
+ * bulk loaded keys and 50% inserts of the remaining keys.
+ *
+ * Flags, besides the common flags in bench.h:
+ * --init_frac     fraction of keys to bulk load (default 0.5)
+ * --insert_frac   fraction of operations that are inserts (default 0.5)
+ * --distribution  lookup keys: uniform (default) or zipf
+ */
+
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+  return bench::run_benchmark(argc, argv, "write_heavy", [](auto& run) {
+    return bench::run_mixed_workload(run, 0.5);
+  });
+}
@@ -1,10 +1,308 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT license.
 
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "zipf.h"
 
+/*** Parallel text key loading ***/
+
+// Block of a file in memory. The file is memory-mapped where supported, and
+// otherwise read into a buffer.
+class FileContents {
+ public:
+  explicit FileContents(const std::string& file_path) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+      size_ = static_cast<size_t>(file_stat.st_size);
+      void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        madvise(mapping, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(mapping);
+        mapped_ = true;
+      }
+    }
+    ::close(fd);
+    if (mapped_ || size_ == 0) {
+      return;
+    }
+#endif
+    std::ifstream is(file_path.c_str(), std::ios::binary | std::ios::ate);
+    if (!is.is_open()) {
+      return;
+    }
+    buffer_.resize(static_cast<size_t>(is.tellg()));
+    is.seekg(0);
+    is.read(&buffer_[0], std::streamsize(buffer_.size()));
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+  FileContents(const FileContents& other) = delete;
+  FileContents& operator=(const FileContents& other) = delete;
+
+  ~FileContents() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (mapped_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  bool is_open() const { return data_ != nullptr; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::string buffer_;
+};
+
+// Parses the first number on each line in [begin, end), skipping lines that
+// do not start with a number
+template <class T>
+void parse_text_keys(const char* begin, const char* end, std::vector<T>& keys) {
+  const char* cur = begin;
+  while (cur < end) {
+    while (cur < end && (*cur == ' ' || *cur == '\t')) {
+      cur++;
+    }
+    T key;
+    auto result = std::from_chars(cur, end, key);
+    if (result.ec == std::errc()) {
+      keys.push_back(key);
+      cur = result.ptr;
+    }
+    auto line_end = static_cast<const char*>(std::memchr(cur, '\n', end - cur));
+    cur = line_end ? line_end + 1 : end;
+  }
+}
+
+// Parses a text file with one key per line. The file is split into one chunk
+// per thread at line boundaries, and each thread parses its chunk in a single
+// pass. Returns the keys of each chunk in file order. Fails if the file cannot
+// be read.
+template <class T>
+bool parse_text_file(const std::string& file_path,
+                     std::vector<std::vector<T>>& chunk_keys,
+                     int num_threads = 0) {
+  FileContents file(file_path);
+  if (!file.is_open()) {
+    return false;
+  }
+  // Small chunks are not worth a thread
+  const size_t kMinChunkSize = 1 << 20;
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = static_cast<int>(std::max<size_t>(
+      1, std::min<size_t>(num_threads, file.size() / kMinChunkSize)));
+
+  const char* file_begin = file.data();
+  const char* file_end = file.data() + file.size();
+  std::vector<const char*> boundaries(num_threads + 1, file_end);
+  boundaries[0] = file_begin;
+  for (int i = 1; i < num_threads; i++) {
+    const char* split = file_begin + file.size() / num_threads * i;
+    split = std::max(split, boundaries[i - 1]);
+    auto line_end =
+        static_cast<const char*>(std::memchr(split, '\n', file_end - split));
+    boundaries[i] = line_end ? line_end + 1 : file_end;
+  }
+
+  chunk_keys.assign(num_threads, std::vector<T>());
+  auto parse_chunk = [&](int i) {
+    // Lines hold at least a digit and a newline
+    chunk_keys[i].reserve((boundaries[i + 1] - boundaries[i]) / 8);
+    parse_text_keys(boundaries[i], boundaries[i + 1], chunk_keys[i]);
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(parse_chunk, i);
+  }
+  parse_chunk(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return true;
+}
+
+// Loads all keys of a text file with one key per line into a new array, and
+// sets num_keys to their number. Returns nullptr if the file cannot be read.
+template <class T>
+T* load_text_keys(const std::string& file_path, long long& num_keys) {
+  std::vector<std::vector<T>> chunk_keys;
+  if (!parse_text_file(file_path, chunk_keys)) {
+    return nullptr;
+  }
+  size_t total = 0;
+  for (const auto& keys : chunk_keys) {
+    total += keys.size();
+  }
+  auto array = new T[std::max<size_t>(total, 1)];
+  T* out = array;
+  for (const auto& keys : chunk_keys) {
+    out = std::copy(keys.begin(), keys.end(), out);
+  }
+  num_keys = static_cast<long long>(total);
+  return array;
+}
+
+/*** Binary key cache ***/
+
+template <class T>
+bool save_binary_data(const T data[], long long length,
+                      const std::string& file_path) {
+  std::ofstream os(file_path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!os.is_open()) {
+    return false;
+  }
+  os.write(reinterpret_cast<const char*>(data),
+           std::streamsize(length * sizeof(T)));
+  os.close();
+  return !os.fail();
+}
+
+// Loads all keys of a binary file into a new array, and sets num_keys to their
+// number. Returns nullptr if the file cannot be read.
+template <class T>
+T* load_binary_keys(const std::string& file_path, long long& num_keys) {
+  FileContents file(file_path);
+  if (!file.is_open()) {
+    return nullptr;
+  }
+  size_t total = file.size() / sizeof(T);
+  auto array = new T[std::max<size_t>(total, 1)];
+  std::memcpy(array, file.data(), total * sizeof(T));
+  num_keys = static_cast<long long>(total);
+  return array;
+}
+
+// Path of the binary key cache of a text key file. The path names the key
+// type, e.g. user_0.txt.u64.bin, so that caches of the same text file for
+// different key types do not overwrite each other.
+template <class T>
+std::string binary_cache_path(const std::string& file_path) {
+  const char* kind = std::is_floating_point<T>::value ? "f"
+                     : std::is_signed<T>::value       ? "i"
+                                                      : "u";
+  return file_path + "." + kind + std::to_string(sizeof(T) * 8) + ".bin";
+}
+
+// Same as load_text_keys(), but loads the keys from the binary cache next to
+// the text file if the cache is newer than the text file. Otherwise, parses the
+// text file and writes the cache for later runs.
+template <class T>
+T* load_text_keys_cached(const std::string& file_path,
+                         long long& num_keys) {
+  std::string cache_path = binary_cache_path<T>(file_path);
+  std::error_code error;
+  auto text_time = std::filesystem::last_write_time(file_path, error);
+  if (error) {
+    return nullptr;
+  }
+  auto cache_time = std::filesystem::last_write_time(cache_path, error);
+  if (!error && cache_time >= text_time) {
+    T* keys = load_binary_keys<T>(cache_path, num_keys);
+    if (keys != nullptr) {
+      return keys;
+    }
+  }
+  T* keys = load_text_keys<T>(file_path, num_keys);
+  if (keys != nullptr && !save_binary_data(keys, num_keys, cache_path)) {
+    std::cerr << "Could not write key cache " << cache_path << std::endl;
+  }
+  return keys;
+}
+
+/*** Streaming key loading ***/
+
+// Reads a key file in blocks of about block_size bytes, and calls
+// f(keys) with the keys of each block, where keys is a std::vector<T>& that f
+// may move from. Text blocks end at line boundaries. num_threads threads read
+// blocks at the same time, each calling f for its own blocks, so f must be
+// thread-safe, and blocks are passed in no particular order. Only the blocks
+// being parsed are held in memory. Returns false if the file cannot be read.
+template <class T, class F>
+bool for_each_key_block(const std::string& file_path, bool binary,
+                        size_t block_size, int num_threads, F f) {
+  FileContents file(file_path);
+  if (!file.is_open()) {
+    return false;
+  }
+  if (binary) {
+    block_size = std::max(block_size / sizeof(T), size_t(1)) * sizeof(T);
+  }
+  std::atomic<size_t> next_block{0};
+  size_t num_blocks = (file.size() + block_size - 1) / block_size;
+  auto read_blocks = [&] {
+    std::vector<T> keys;
+    for (size_t block = next_block++; block < num_blocks;
+         block = next_block++) {
+      keys.clear();
+      size_t begin = block * block_size;
+      size_t end = std::min(begin + block_size, file.size());
+      if (binary) {
+        end = end / sizeof(T) * sizeof(T);
+        keys.resize((end - begin) / sizeof(T));
+        std::memcpy(keys.data(), file.data() + begin, end - begin);
+      } else {
+        // A block parses the lines that start in it
+        const char* file_end = file.data() + file.size();
+        const char* first = file.data() + begin;
+        const char* last = file.data() + end;
+        if (begin > 0 && first[-1] != '\n') {
+          auto line_end = static_cast<const char*>(
+              std::memchr(first, '\n', file_end - first));
+          first = line_end ? line_end + 1 : file_end;
+        }
+        if (last > file.data() && last < file_end && last[-1] != '\n') {
+          auto line_end = static_cast<const char*>(
+              std::memchr(last, '\n', file_end - last));
+          last = line_end ? line_end + 1 : file_end;
+        }
+        if (first < last) {
+          parse_text_keys(first, last, keys);
+        }
+      }
+      f(keys);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.emplace_back(read_blocks);
+  }
+  read_blocks();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return true;
+}
+
 template <class T>
-bool load_binary_data(T data[], int length, const std::string& file_path) {
+bool load_binary_data(T data[], long long length,
+                      const std::string& file_path) {
   std::ifstream is(file_path.c_str(), std::ios::binary | std::ios::in);
   if (!is.is_open()) {
     return false;
@@ -15,57 +313,46 @@ bool load_binary_data(T data[], int length, const std::string& file_path) {
 }
 
 template <class T>
-bool load_text_data(T array[], int length, const std::string& file_path) {
-  std::ifstream is(file_path.c_str());
-  if (!is.is_open()) {
+bool load_text_data(T array[], long long length,
+                    const std::string& file_path) {
+  std::vector<std::vector<T>> chunk_keys;
+  if (!parse_text_file(file_path, chunk_keys)) {
     return false;
   }
-  int i = 0;
-  std::string str;
-  while (std::getline(is, str) && i < length) {
-    std::istringstream ss(str);
-    ss >> array[i];
-    i++;
+  long long i = 0;
+  for (const auto& keys : chunk_keys) {
+    long long num_copied =
+        std::min(length - i, static_cast<long long>(keys.size()));
+    std::copy(keys.begin(), keys.begin() + num_copied, array + i);
+    i += num_copied;
   }
-  is.close();
   return true;
 }
 
-template<class T>
-bool load_keys_from_file(T *array, int length, const std::string &file_path) {
-    std::ifstream is(file_path.c_str());
-    if (!is.is_open()) {
-        return false;
-    }
-    int i = 0;
-    std::string str;
-    while (std::getline(is, str) && i < length) {
-        std::istringstream ss(str);
-        ss >> array[i];
-        i++;
-    }
-    is.close();
-    return true;
+template <class T>
+bool load_keys_from_file(T* array, long long length,
+                         const std::string& file_path) {
+  return load_text_data(array, length, file_path);
 }
 
 template <class T>
-T* get_search_keys(T array[], int num_keys, int num_searches) {
+T* get_search_keys(T array[], long long num_keys, int num_searches) {
   std::mt19937_64 gen(std::random_device{}());
-  std::uniform_int_distribution<int> dis(0, num_keys - 1);
+  std::uniform_int_distribution<long long> dis(0, num_keys - 1);
   auto* keys = new T[num_searches];
   for (int i = 0; i < num_searches; i++) {
-    int pos = dis(gen);
+    long long pos = dis(gen);
     keys[i] = array[pos];
   }
   return keys;
 }
 
 template <class T>
-T* get_search_keys_zipf(T array[], int num_keys, int num_searches) {
+T* get_search_keys_zipf(T array[], long long num_keys, int num_searches) {
   auto* keys = new T[num_searches];
   ScrambledZipfianGenerator zipf_gen(num_keys);
   for (int i = 0; i < num_searches; i++) {
-    int pos = zipf_gen.nextValue();
+    long long pos = zipf_gen.nextValue();
     keys[i] = array[pos];
   }
   return keys;
@@ -10,34 +10,36 @@ class ScrambledZipfianGenerator {
   static constexpr double ZETAN = 26.46902820178302;
   static constexpr double ZIPFIAN_CONSTANT = 0.99;
 
-  int num_keys_;
+  long long num_keys_;
   double alpha_;
   double eta_;
   std::mt19937_64 gen_;
   std::uniform_real_distribution<double> dis_;
 
-  explicit ScrambledZipfianGenerator(int num_keys)
-      : num_keys_(num_keys), gen_(std::random_device{}()), dis_(0, 1) {
+  explicit ScrambledZipfianGenerator(long long num_keys,
+                                     uint64_t seed = std::random_device{}())
+      : num_keys_(num_keys), gen_(seed), dis_(0, 1) {
     double zeta2theta = zeta(2);
     alpha_ = 1. / (1. - ZIPFIAN_CONSTANT);
     eta_ = (1 - std::pow(2. / num_keys_, 1 - ZIPFIAN_CONSTANT)) /
            (1 - zeta2theta / ZETAN);
   }
 
-  int nextValue() {
+  long long nextValue() {
     double u = dis_(gen_);
     double uz = u * ZETAN;
 
-    int ret;
+    long long ret;
     if (uz < 1.0) {
       ret = 0;
     } else if (uz < 1.0 + std::pow(0.5, ZIPFIAN_CONSTANT)) {
       ret = 1;
     } else {
-      ret = (int)(num_keys_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+      ret = (long long)(num_keys_ * std::pow(eta_ * u - eta_ + 1, alpha_));
     }
 
-    ret = fnv1a(ret) % num_keys_;
+    // Only the low 32 bits are hashed, as before key counts were 64-bit
+    ret = fnv1a(static_cast<int>(ret)) % num_keys_;
     return ret;
   }
 
@@ -1,3000 +1,6103 @@
-// Copyright (c) Microsoft Corporation.
-// Licensed under the MIT license.
-
-/*
- * ALEX with key type T and payload type P, combined type V=std::pair<T, P>.
- * Iterating through keys is done using an "Iterator".
- * Iterating through tree nodes is done using a "NodeIterator".
- *
- * Core user-facing API of Alex:
- * - Alex()
- * - void bulk_load(V values[], int num_keys)
- * - void insert(T key, P payload)
- * - int erase_one(T key)
- * - int erase(T key)
- * - Iterator find(T key)  // for exact match
- * - Iterator begin()
- * - Iterator end()
- * - Iterator lower_bound(T key)
- * - Iterator upper_bound(T key)
- *
- * User-facing API of Iterator:
- * - void operator ++ ()  // post increment
- * - V operator * ()  // does not return reference to V by default
- * - const T& key ()
- * - P& payload ()
- * - bool is_end()
- * - bool operator == (const Iterator & rhs)
- * - bool operator != (const Iterator & rhs)
- */
-
-#pragma once
-
-#include <fstream>
-#include <iostream>
-#include <stack>
-#include <type_traits>
-
-#include "alex_base.h"
-#include "alex_fanout_tree.h"
-#include "alex_nodes.h"
-
-// Whether we account for floating-point precision issues when traversing down
-// ALEX.
-// These issues rarely occur in practice but can cause incorrect behavior.
-// Turning this on will cause slight performance overhead due to extra
-// computation and possibly accessing two data nodes to perform a lookup.
-#define ALEX_SAFE_LOOKUP 1
-
-namespace alex {
-
-template <class T, class P, class Compare = AlexCompare,
-          class Alloc = std::allocator<std::pair<T, P>>,
-          bool allow_duplicates = true>
-class Alex {
-  static_assert(std::is_arithmetic<T>::value, "ALEX key type must be numeric.");
-  static_assert(std::is_same<Compare, AlexCompare>::value,
-                "Must use AlexCompare.");
-
- public:
-  // Value type, returned by dereferencing an iterator
-  typedef std::pair<T, P> V;
-
-  // ALEX class aliases
-  typedef Alex<T, P, Compare, Alloc, allow_duplicates> self_type;
-  typedef AlexModelNode<T, P, Alloc> model_node_type;
-  typedef AlexDataNode<T, P, Compare, Alloc, allow_duplicates> data_node_type;
-
-  // Forward declaration for iterators
-  class Iterator;
-  class ConstIterator;
-  class ReverseIterator;
-  class ConstReverseIterator;
-  class NodeIterator;  // Iterates through all nodes with pre-order traversal
-
-  AlexNode<T, P>* root_node_ = nullptr;
-  model_node_type* superroot_ =
-      nullptr;  // phantom node that is the root's parent
-
-  /* User-changeable parameters */
-  struct Params {
-    // When bulk loading, Alex can use provided knowledge of the expected
-    // fraction of operations that will be inserts
-    // For simplicity, operations are either point lookups ("reads") or inserts
-    // ("writes)
-    // i.e., 0 means we expect a read-only workload, 1 means write-only
-    double expected_insert_frac = 1;
-    // Maximum node size, in bytes. By default, 16MB.
-    // Higher values result in better average throughput, but worse tail/max
-    // insert latency
-    int max_node_size = 1 << 24;
-    // Approximate model computation: bulk load faster by using sampling to
-    // train models
-    bool approximate_model_computation = true;
-    // Approximate cost computation: bulk load faster by using sampling to
-    // compute cost
-    bool approximate_cost_computation = false;
-  };
-  Params params_;
-
-  /* Setting max node size automatically changes these parameters */
-  struct DerivedParams {
-    // The defaults here assume the default max node size of 16MB
-    int max_fanout = 1 << 21;  // assumes 8-byte pointers
-    int max_data_node_slots = (1 << 24) / sizeof(V);
-  };
-  DerivedParams derived_params_;
-
-  /* Counters, useful for benchmarking and profiling */
-  struct Stats {
-    int num_keys = 0;
-    int num_model_nodes = 0;  // num model nodes
-    int num_data_nodes = 0;   // num data nodes
-    int num_expand_and_scales = 0;
-    int num_expand_and_retrains = 0;
-    int num_downward_splits = 0;
-    int num_sideways_splits = 0;
-    int num_model_node_expansions = 0;
-    int num_model_node_splits = 0;
-    long long num_downward_split_keys = 0;
-    long long num_sideways_split_keys = 0;
-    long long num_model_node_expansion_pointers = 0;
-    long long num_model_node_split_pointers = 0;
-    mutable long long num_node_lookups = 0;
-    mutable long long num_lookups = 0;
-    long long num_inserts = 0;
-    double splitting_time = 0;
-    double cost_computation_time = 0;
-  };
-  Stats stats_;
-
-  /* These are for research purposes, a user should not change these */
-  struct ExperimentalParams {
-    // Fanout selection method used during bulk loading: 0 means use bottom-up
-    // fanout tree, 1 means top-down
-    int fanout_selection_method = 0;
-    // Policy when a data node experiences significant cost deviation.
-    // 0 means always split node in 2
-    // 1 means decide between no splitting or splitting in 2
-    // 2 means use a full fanout tree to decide the splitting strategy
-    int splitting_policy_method = 1;
-    // Splitting upwards means that a split can propagate all the way up to the
-    // root, like a B+ tree
-    // Splitting upwards can result in a better RMI, but has much more overhead
-    // than splitting sideways
-    bool allow_splitting_upwards = false;
-  };
-  ExperimentalParams experimental_params_;
-
-  /* Structs used internally */
-
- private:
-  /* Statistics related to the key domain.
-   * The index can hold keys outside the domain, but lookups/inserts on those
-   * keys will be inefficient.
-   * If enough keys fall outside the key domain, then we expand the key domain.
-   */
-  struct InternalStats {
-    T key_domain_min_ = std::numeric_limits<T>::max();
-    T key_domain_max_ = std::numeric_limits<T>::lowest();
-    int num_keys_above_key_domain = 0;
-    int num_keys_below_key_domain = 0;
-    int num_keys_at_last_right_domain_resize = 0;
-    int num_keys_at_last_left_domain_resize = 0;
-  };
-  InternalStats istats_;
-
-  /* Save the traversal path down the RMI by having a linked list of these
-   * structs. */
-  struct TraversalNode {
-    model_node_type* node = nullptr;
-    int bucketID = -1;
-  };
-
-  /* Used when finding the best way to propagate up the RMI when splitting
-   * upwards.
-   * Cost is in terms of additional model size created through splitting
-   * upwards, measured in units of pointers.
-   * One instance of this struct is created for each node on the traversal path.
-   * User should take into account the cost of metadata for new model nodes
-   * (base_cost). */
-  struct SplitDecisionCosts {
-    static constexpr double base_cost =
-        static_cast<double>(sizeof(model_node_type)) / sizeof(void*);
-    // Additional cost due to this node if propagation stops at this node.
-    // Equal to 0 if redundant slot exists, otherwise number of new pointers due
-    // to node expansion.
-    double stop_cost = 0;
-    // Additional cost due to this node if propagation continues past this node.
-    // Equal to number of new pointers due to node splitting, plus size of
-    // metadata of new model node.
-    double split_cost = 0;
-  };
-
-  // At least this many keys must be outside the domain before a domain
-  // expansion is triggered.
-  static const int kMinOutOfDomainKeys = 5;
-  // After this many keys are outside the domain, a domain expansion must be
-  // triggered.
-  static const int kMaxOutOfDomainKeys = 1000;
-  // When the number of max out-of-domain (OOD) keys is between the min and
-  // max, expand the domain if the number of OOD keys is greater than the
-  // expected number of OOD due to randomness by greater than the tolereance
-  // factor.
-  static const int kOutOfDomainToleranceFactor = 2;
-
-  Compare key_less_ = Compare();
-  Alloc allocator_ = Alloc();
-
-  /*** Constructors and setters ***/
-
- public:
-  Alex() {
-    // Set up root as empty data node
-    auto empty_data_node = new (data_node_allocator().allocate(1))
-        data_node_type(key_less_, allocator_);
-    empty_data_node->bulk_load(nullptr, 0);
-    root_node_ = empty_data_node;
-    stats_.num_data_nodes++;
-    create_superroot();
-  }
-
-  Alex(const Compare& comp, const Alloc& alloc = Alloc())
-      : key_less_(comp), allocator_(alloc) {
-    // Set up root as empty data node
-    auto empty_data_node = new (data_node_allocator().allocate(1))
-        data_node_type(key_less_, allocator_);
-    empty_data_node->bulk_load(nullptr, 0);
-    root_node_ = empty_data_node;
-    stats_.num_data_nodes++;
-    create_superroot();
-  }
-
-  Alex(const Alloc& alloc) : allocator_(alloc) {
-    // Set up root as empty data node
-    auto empty_data_node = new (data_node_allocator().allocate(1))
-        data_node_type(key_less_, allocator_);
-    empty_data_node->bulk_load(nullptr, 0);
-    root_node_ = empty_data_node;
-    stats_.num_data_nodes++;
-    create_superroot();
-  }
-
-  ~Alex() {
-    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-         node_it.next()) {
-      delete_node(node_it.current());
-    }
-    delete_node(superroot_);
-  }
-
-  // Initializes with range [first, last). The range does not need to be
-  // sorted. This creates a temporary copy of the data. If possible, we
-  // recommend directly using bulk_load() instead.
-  template <class InputIterator>
-  explicit Alex(InputIterator first, InputIterator last, const Compare& comp,
-                const Alloc& alloc = Alloc())
-      : key_less_(comp), allocator_(alloc) {
-    std::vector<V> values;
-    for (auto it = first; it != last; ++it) {
-      values.push_back(*it);
-    }
-    std::sort(values.begin(), values.end(),
-              [this](auto const& a, auto const& b) {
-                return key_less_(a.first, b.first);
-              });
-    bulk_load(values.data(), static_cast<int>(values.size()));
-  }
-
-  // Initializes with range [first, last). The range does not need to be
-  // sorted. This creates a temporary copy of the data. If possible, we
-  // recommend directly using bulk_load() instead.
-  template <class InputIterator>
-  explicit Alex(InputIterator first, InputIterator last,
-                const Alloc& alloc = Alloc())
-      : allocator_(alloc) {
-    std::vector<V> values;
-    for (auto it = first; it != last; ++it) {
-      values.push_back(*it);
-    }
-    std::sort(values.begin(), values.end(),
-              [this](auto const& a, auto const& b) {
-                return key_less_(a.first, b.first);
-              });
-    bulk_load(values.data(), static_cast<int>(values.size()));
-  }
-
-  explicit Alex(const self_type& other)
-      : params_(other.params_),
-        derived_params_(other.derived_params_),
-        stats_(other.stats_),
-        experimental_params_(other.experimental_params_),
-        istats_(other.istats_),
-        key_less_(other.key_less_),
-        allocator_(other.allocator_) {
-    superroot_ =
-        static_cast<model_node_type*>(copy_tree_recursive(other.superroot_));
-    root_node_ = superroot_->children_[0];
-  }
-
-  Alex& operator=(const self_type& other) {
-    if (this != &other) {
-      for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-           node_it.next()) {
-        delete_node(node_it.current());
-      }
-      delete_node(superroot_);
-      params_ = other.params_;
-      derived_params_ = other.derived_params_;
-      experimental_params_ = other.experimental_params_;
-      istats_ = other.istats_;
-      stats_ = other.stats_;
-      key_less_ = other.key_less_;
-      allocator_ = other.allocator_;
-      superroot_ =
-          static_cast<model_node_type*>(copy_tree_recursive(other.superroot_));
-      root_node_ = superroot_->children_[0];
-    }
-    return *this;
-  }
-
-  void swap(const self_type& other) {
-    std::swap(params_, other.params_);
-    std::swap(derived_params_, other.derived_params_);
-    std::swap(experimental_params_, other.experimental_params_);
-    std::swap(istats_, other.istats_);
-    std::swap(stats_, other.stats_);
-    std::swap(key_less_, other.key_less_);
-    std::swap(allocator_, other.allocator_);
-    std::swap(superroot_, other.superroot_);
-    std::swap(root_node_, other.root_node_);
-  }
-
- private:
-  // Deep copy of tree starting at given node
-  AlexNode<T, P>* copy_tree_recursive(const AlexNode<T, P>* node) {
-    if (!node) return nullptr;
-    if (node->is_leaf_) {
-      return new (data_node_allocator().allocate(1))
-          data_node_type(*static_cast<const data_node_type*>(node));
-    } else {
-      auto node_copy = new (model_node_allocator().allocate(1))
-          model_node_type(*static_cast<const model_node_type*>(node));
-      int cur = 0;
-      while (cur < node_copy->num_children_) {
-        AlexNode<T, P>* child_node = node_copy->children_[cur];
-        AlexNode<T, P>* child_node_copy = copy_tree_recursive(child_node);
-        int repeats = 1 << child_node_copy->duplication_factor_;
-        for (int i = cur; i < cur + repeats; i++) {
-          node_copy->children_[i] = child_node_copy;
-        }
-        cur += repeats;
-      }
-      return node_copy;
-    }
-  }
-
- public:
-  // When bulk loading, Alex can use provided knowledge of the expected fraction
-  // of operations that will be inserts
-  // For simplicity, operations are either point lookups ("reads") or inserts
-  // ("writes)
-  // i.e., 0 means we expect a read-only workload, 1 means write-only
-  // This is only useful if you set it before bulk loading
-  void set_expected_insert_frac(double expected_insert_frac) {
-    assert(expected_insert_frac >= 0 && expected_insert_frac <= 1);
-    params_.expected_insert_frac = expected_insert_frac;
-  }
-
-  // Maximum node size, in bytes.
-  // Higher values result in better average throughput, but worse tail/max
-  // insert latency.
-  void set_max_node_size(int max_node_size) {
-    assert(max_node_size >= sizeof(V));
-    params_.max_node_size = max_node_size;
-    derived_params_.max_fanout = params_.max_node_size / sizeof(void*);
-    derived_params_.max_data_node_slots = params_.max_node_size / sizeof(V);
-  }
-
-  // Bulk load faster by using sampling to train models.
-  // This is only useful if you set it before bulk loading.
-  void set_approximate_model_computation(bool approximate_model_computation) {
-    params_.approximate_model_computation = approximate_model_computation;
-  }
-
-  // Bulk load faster by using sampling to compute cost.
-  // This is only useful if you set it before bulk loading.
-  void set_approximate_cost_computation(bool approximate_cost_computation) {
-    params_.approximate_cost_computation = approximate_cost_computation;
-  }
-
-  /*** General helpers ***/
-
- public:
-// Return the data node that contains the key (if it exists).
-// Also optionally return the traversal path to the data node.
-// traversal_path should be empty when calling this function.
-// The returned traversal path begins with superroot and ends with the data
-// node's parent.
-#if ALEX_SAFE_LOOKUP
-  forceinline data_node_type* get_leaf(
-      T key, std::vector<TraversalNode>* traversal_path = nullptr) const {
-    if (traversal_path) {
-      traversal_path->push_back({superroot_, 0});
-    }
-    AlexNode<T, P>* cur = root_node_;
-    if (cur->is_leaf_) {
-      return static_cast<data_node_type*>(cur);
-    }
-
-    while (true) {
-      auto node = static_cast<model_node_type*>(cur);
-      double bucketID_prediction = node->model_.predict_double(key);
-      int bucketID = static_cast<int>(bucketID_prediction);
-      bucketID =
-          std::min<int>(std::max<int>(bucketID, 0), node->num_children_ - 1);
-      if (traversal_path) {
-        traversal_path->push_back({node, bucketID});
-      }
-      cur = node->children_[bucketID];
-      if (cur->is_leaf_) {
-        stats_.num_node_lookups += cur->level_;
-        auto leaf = static_cast<data_node_type*>(cur);
-        // Doesn't really matter if rounding is incorrect, we just want it to be
-        // fast.
-        // So we don't need to use std::round or std::lround.
-        int bucketID_prediction_rounded =
-            static_cast<int>(bucketID_prediction + 0.5);
-        double tolerance =
-            10 * std::numeric_limits<double>::epsilon() * bucketID_prediction;
-        // https://stackoverflow.com/questions/17333/what-is-the-most-effective-way-for-float-and-double-comparison
-        if (std::abs(bucketID_prediction - bucketID_prediction_rounded) <=
-            tolerance) {
-          if (bucketID_prediction_rounded <= bucketID_prediction) {
-            if (leaf->prev_leaf_ && leaf->prev_leaf_->last_key() >= key) {
-              if (traversal_path) {
-                // Correct the traversal path
-                correct_traversal_path(leaf, *traversal_path, true);
-              }
-              return leaf->prev_leaf_;
-            }
-          } else {
-            if (leaf->next_leaf_ && leaf->next_leaf_->first_key() <= key) {
-              if (traversal_path) {
-                // Correct the traversal path
-                correct_traversal_path(leaf, *traversal_path, false);
-              }
-              return leaf->next_leaf_;
-            }
-          }
-        }
-        return leaf;
-      }
-    }
-  }
-#else
-  data_node_type* get_leaf(
-      T key, std::vector<TraversalNode>* traversal_path = nullptr) const {
-    if (traversal_path) {
-      traversal_path->push_back({superroot_, 0});
-    }
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      auto node = static_cast<model_node_type*>(cur);
-      int bucketID = node->model_.predict(key);
-      bucketID =
-          std::min<int>(std::max<int>(bucketID, 0), node->num_children_ - 1);
-      if (traversal_path) {
-        traversal_path->push_back({node, bucketID});
-      }
-      cur = node->children_[bucketID];
-    }
-
-    stats_.num_node_lookups += cur->level_;
-    return static_cast<data_node_type*>(cur);
-  }
-#endif
-
- private:
-  // Make a correction to the traversal path to instead point to the leaf node
-  // that is to the left or right of the current leaf node.
-  inline void correct_traversal_path(data_node_type* leaf,
-                                     std::vector<TraversalNode>& traversal_path,
-                                     bool left) const {
-    if (left) {
-      int repeats = 1 << leaf->duplication_factor_;
-      TraversalNode& tn = traversal_path.back();
-      model_node_type* parent = tn.node;
-      // First bucket whose pointer is to leaf
-      int start_bucketID = tn.bucketID - (tn.bucketID % repeats);
-      if (start_bucketID == 0) {
-        // Traverse back up the traversal path to make correction
-        while (start_bucketID == 0) {
-          traversal_path.pop_back();
-          repeats = 1 << parent->duplication_factor_;
-          tn = traversal_path.back();
-          parent = tn.node;
-          start_bucketID = tn.bucketID - (tn.bucketID % repeats);
-        }
-        int correct_bucketID = start_bucketID - 1;
-        tn.bucketID = correct_bucketID;
-        AlexNode<T, P>* cur = parent->children_[correct_bucketID];
-        while (!cur->is_leaf_) {
-          auto node = static_cast<model_node_type*>(cur);
-          traversal_path.push_back({node, node->num_children_ - 1});
-          cur = node->children_[node->num_children_ - 1];
-        }
-        assert(cur == leaf->prev_leaf_);
-      } else {
-        tn.bucketID = start_bucketID - 1;
-      }
-    } else {
-      int repeats = 1 << leaf->duplication_factor_;
-      TraversalNode& tn = traversal_path.back();
-      model_node_type* parent = tn.node;
-      // First bucket whose pointer is not to leaf
-      int end_bucketID = tn.bucketID - (tn.bucketID % repeats) + repeats;
-      if (end_bucketID == parent->num_children_) {
-        // Traverse back up the traversal path to make correction
-        while (end_bucketID == parent->num_children_) {
-          traversal_path.pop_back();
-          repeats = 1 << parent->duplication_factor_;
-          tn = traversal_path.back();
-          parent = tn.node;
-          end_bucketID = tn.bucketID - (tn.bucketID % repeats) + repeats;
-        }
-        int correct_bucketID = end_bucketID;
-        tn.bucketID = correct_bucketID;
-        AlexNode<T, P>* cur = parent->children_[correct_bucketID];
-        while (!cur->is_leaf_) {
-          auto node = static_cast<model_node_type*>(cur);
-          traversal_path.push_back({node, 0});
-          cur = node->children_[0];
-        }
-        assert(cur == leaf->next_leaf_);
-      } else {
-        tn.bucketID = end_bucketID;
-      }
-    }
-  }
-
-  // Return left-most data node
-  data_node_type* first_data_node() const {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      cur = static_cast<model_node_type*>(cur)->children_[0];
-    }
-    return static_cast<data_node_type*>(cur);
-  }
-
-  // Return right-most data node
-  data_node_type* last_data_node() const {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      auto node = static_cast<model_node_type*>(cur);
-      cur = node->children_[node->num_children_ - 1];
-    }
-    return static_cast<data_node_type*>(cur);
-  }
-
-  // Returns minimum key in the index
-  T get_min_key() const { return first_data_node()->first_key(); }
-
-  // Returns maximum key in the index
-  T get_max_key() const { return last_data_node()->last_key(); }
-
-  // Link all data nodes together. Used after bulk loading.
-  void link_all_data_nodes() {
-    data_node_type* prev_leaf = nullptr;
-    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-         node_it.next()) {
-      AlexNode<T, P>* cur = node_it.current();
-      if (cur->is_leaf_) {
-        auto node = static_cast<data_node_type*>(cur);
-        if (prev_leaf != nullptr) {
-          prev_leaf->next_leaf_ = node;
-          node->prev_leaf_ = prev_leaf;
-        }
-        prev_leaf = node;
-      }
-    }
-  }
-
-  // Link the new data nodes together when old data node is replaced by two new
-  // data nodes.
-  void link_data_nodes(const data_node_type* old_leaf,
-                       data_node_type* left_leaf, data_node_type* right_leaf) {
-    if (old_leaf->prev_leaf_ != nullptr) {
-      old_leaf->prev_leaf_->next_leaf_ = left_leaf;
-    }
-    left_leaf->prev_leaf_ = old_leaf->prev_leaf_;
-    left_leaf->next_leaf_ = right_leaf;
-    right_leaf->prev_leaf_ = left_leaf;
-    right_leaf->next_leaf_ = old_leaf->next_leaf_;
-    if (old_leaf->next_leaf_ != nullptr) {
-      old_leaf->next_leaf_->prev_leaf_ = right_leaf;
-    }
-  }
-
-  /*** Allocators and comparators ***/
-
- public:
-  Alloc get_allocator() const { return allocator_; }
-
-  Compare key_comp() const { return key_less_; }
-
- private:
-  typename model_node_type::alloc_type model_node_allocator() {
-    return typename model_node_type::alloc_type(allocator_);
-  }
-
-  typename data_node_type::alloc_type data_node_allocator() {
-    return typename data_node_type::alloc_type(allocator_);
-  }
-
-  typename model_node_type::pointer_alloc_type pointer_allocator() {
-    return typename model_node_type::pointer_alloc_type(allocator_);
-  }
-
-  void delete_node(AlexNode<T, P>* node) {
-    if (node == nullptr) {
-      return;
-    } else if (node->is_leaf_) {
-      data_node_allocator().destroy(static_cast<data_node_type*>(node));
-      data_node_allocator().deallocate(static_cast<data_node_type*>(node), 1);
-    } else {
-      model_node_allocator().destroy(static_cast<model_node_type*>(node));
-      model_node_allocator().deallocate(static_cast<model_node_type*>(node), 1);
-    }
-  }
-
-  // True if a == b
-  template <class K>
-  forceinline bool key_equal(const T& a, const K& b) const {
-    return !key_less_(a, b) && !key_less_(b, a);
-  }
-
-  /*** Bulk loading ***/
-
- public:
-  // values should be the sorted array of key-payload pairs.
-  // The number of elements should be num_keys.
-  // The index must be empty when calling this method.
-  void bulk_load(const V values[], int num_keys) {
-    if (stats_.num_keys > 0 || num_keys <= 0) {
-      return;
-    }
-    delete_node(root_node_);  // delete the empty root node from constructor
-
-    stats_.num_keys = num_keys;
-
-    // Build temporary root model, which outputs a CDF in the range [0, 1]
-    root_node_ =
-        new (model_node_allocator().allocate(1)) model_node_type(0, allocator_);
-    T min_key = values[0].first;
-    T max_key = values[num_keys - 1].first;
-    root_node_->model_.a_ = 1.0 / (max_key - min_key);
-    root_node_->model_.b_ = -1.0 * min_key * root_node_->model_.a_;
-
-    // Compute cost of root node
-    LinearModel<T> root_data_node_model;
-    data_node_type::build_model(values, num_keys, &root_data_node_model,
-                                params_.approximate_model_computation);
-    DataNodeStats stats;
-    root_node_->cost_ = data_node_type::compute_expected_cost(
-        values, num_keys, data_node_type::kInitDensity_,
-        params_.expected_insert_frac, &root_data_node_model,
-        params_.approximate_cost_computation, &stats);
-
-    // Recursively bulk load
-    bulk_load_node(values, num_keys, root_node_, num_keys,
-                   &root_data_node_model);
-
-    if (root_node_->is_leaf_) {
-      static_cast<data_node_type*>(root_node_)
-          ->expected_avg_exp_search_iterations_ = stats.num_search_iterations;
-      static_cast<data_node_type*>(root_node_)->expected_avg_shifts_ =
-          stats.num_shifts;
-    }
-
-    create_superroot();
-    update_superroot_key_domain();
-    link_all_data_nodes();
-  }
-
- private:
-  // Only call this after creating a root node
-  void create_superroot() {
-    if (!root_node_) return;
-    delete_node(superroot_);
-    superroot_ = new (model_node_allocator().allocate(1))
-        model_node_type(static_cast<short>(root_node_->level_ - 1), allocator_);
-    superroot_->num_children_ = 1;
-    superroot_->children_ =
-        new (pointer_allocator().allocate(1)) AlexNode<T, P>*[1];
-    update_superroot_pointer();
-  }
-
-  // Updates the key domain based on the min/max keys and retrains the model.
-  // Should only be called immediately after bulk loading or when the root node
-  // is a data node.
-  void update_superroot_key_domain() {
-    assert(stats_.num_inserts == 0 || root_node_->is_leaf_);
-    istats_.key_domain_min_ = get_min_key();
-    istats_.key_domain_max_ = get_max_key();
-    istats_.num_keys_at_last_right_domain_resize = stats_.num_keys;
-    istats_.num_keys_at_last_left_domain_resize = stats_.num_keys;
-    istats_.num_keys_above_key_domain = 0;
-    istats_.num_keys_below_key_domain = 0;
-    superroot_->model_.a_ =
-        1.0 / (istats_.key_domain_max_ - istats_.key_domain_min_);
-    superroot_->model_.b_ =
-        -1.0 * istats_.key_domain_min_ * superroot_->model_.a_;
-  }
-
-  void update_superroot_pointer() {
-    superroot_->children_[0] = root_node_;
-    superroot_->level_ = static_cast<short>(root_node_->level_ - 1);
-  }
-
-  // Recursively bulk load a single node.
-  // Assumes node has already been trained to output [0, 1), has cost.
-  // Figures out the optimal partitioning of children.
-  // node is trained as if it's a model node.
-  // data_node_model is what the node's model would be if it were a data node of
-  // dense keys.
-  void bulk_load_node(const V values[], int num_keys, AlexNode<T, P>*& node,
-                      int total_keys,
-                      const LinearModel<T>* data_node_model = nullptr) {
-    // Automatically convert to data node when it is impossible to be better
-    // than current cost
-    if (num_keys <= derived_params_.max_data_node_slots *
-                        data_node_type::kInitDensity_ &&
-        (node->cost_ < kNodeLookupsWeight || node->model_.a_ == 0)) {
-      stats_.num_data_nodes++;
-      auto data_node = new (data_node_allocator().allocate(1))
-          data_node_type(node->level_, derived_params_.max_data_node_slots,
-                         key_less_, allocator_);
-      data_node->bulk_load(values, num_keys, data_node_model,
-                           params_.approximate_model_computation);
-      data_node->cost_ = node->cost_;
-      delete_node(node);
-      node = data_node;
-      return;
-    }
-
-    // Use a fanout tree to determine the best way to divide the key space into
-    // child nodes
-    std::vector<fanout_tree::FTNode> used_fanout_tree_nodes;
-    std::pair<int, double> best_fanout_stats;
-    if (experimental_params_.fanout_selection_method == 0) {
-      int max_data_node_keys = static_cast<int>(
-          derived_params_.max_data_node_slots * data_node_type::kInitDensity_);
-      best_fanout_stats = fanout_tree::find_best_fanout_bottom_up<T, P>(
-          values, num_keys, node, total_keys, used_fanout_tree_nodes,
-          derived_params_.max_fanout, max_data_node_keys,
-          params_.expected_insert_frac, params_.approximate_model_computation,
-          params_.approximate_cost_computation, key_less_);
-    } else if (experimental_params_.fanout_selection_method == 1) {
-      best_fanout_stats = fanout_tree::find_best_fanout_top_down<T, P>(
-          values, num_keys, node, total_keys, used_fanout_tree_nodes,
-          derived_params_.max_fanout, params_.expected_insert_frac,
-          params_.approximate_model_computation,
-          params_.approximate_cost_computation, key_less_);
-    }
-    int best_fanout_tree_depth = best_fanout_stats.first;
-    double best_fanout_tree_cost = best_fanout_stats.second;
-
-    // Decide whether this node should be a model node or data node
-    if (best_fanout_tree_cost < node->cost_ ||
-        num_keys > derived_params_.max_data_node_slots *
-                       data_node_type::kInitDensity_) {
-      // Convert to model node based on the output of the fanout tree
-      stats_.num_model_nodes++;
-      auto model_node = new (model_node_allocator().allocate(1))
-          model_node_type(node->level_, allocator_);
-      if (best_fanout_tree_depth == 0) {
-        // slightly hacky: we assume this means that the node is relatively
-        // uniform but we need to split in
-        // order to satisfy the max node size, so we compute the fanout that
-        // would satisfy that condition
-        // in expectation
-        best_fanout_tree_depth =
-            static_cast<int>(std::log2(static_cast<double>(num_keys) /
-                                       derived_params_.max_data_node_slots)) +
-            1;
-        used_fanout_tree_nodes.clear();
-        int max_data_node_keys = static_cast<int>(
-            derived_params_.max_data_node_slots * data_node_type::kInitDensity_);
-        fanout_tree::compute_level<T, P>(
-            values, num_keys, node, total_keys, used_fanout_tree_nodes,
-            best_fanout_tree_depth, max_data_node_keys,
-            params_.expected_insert_frac, params_.approximate_model_computation,
-            params_.approximate_cost_computation);
-      }
-      int fanout = 1 << best_fanout_tree_depth;
-      model_node->model_.a_ = node->model_.a_ * fanout;
-      model_node->model_.b_ = node->model_.b_ * fanout;
-      model_node->num_children_ = fanout;
-      model_node->children_ =
-          new (pointer_allocator().allocate(fanout)) AlexNode<T, P>*[fanout];
-
-      // Instantiate all the child nodes and recurse
-      int cur = 0;
-      for (fanout_tree::FTNode& tree_node : used_fanout_tree_nodes) {
-        auto child_node = new (model_node_allocator().allocate(1))
-            model_node_type(static_cast<short>(node->level_ + 1), allocator_);
-        child_node->cost_ = tree_node.cost;
-        child_node->duplication_factor_ =
-            static_cast<uint8_t>(best_fanout_tree_depth - tree_node.level);
-        int repeats = 1 << child_node->duplication_factor_;
-        double left_value = static_cast<double>(cur) / fanout;
-        double right_value = static_cast<double>(cur + repeats) / fanout;
-        double left_boundary = (left_value - node->model_.b_) / node->model_.a_;
-        double right_boundary =
-            (right_value - node->model_.b_) / node->model_.a_;
-        child_node->model_.a_ = 1.0 / (right_boundary - left_boundary);
-        child_node->model_.b_ = -child_node->model_.a_ * left_boundary;
-        model_node->children_[cur] = child_node;
-        LinearModel<T> child_data_node_model(tree_node.a, tree_node.b);
-        bulk_load_node(values + tree_node.left_boundary,
-                       tree_node.right_boundary - tree_node.left_boundary,
-                       model_node->children_[cur], total_keys,
-                       &child_data_node_model);
-        model_node->children_[cur]->duplication_factor_ =
-            static_cast<uint8_t>(best_fanout_tree_depth - tree_node.level);
-        if (model_node->children_[cur]->is_leaf_) {
-          static_cast<data_node_type*>(model_node->children_[cur])
-              ->expected_avg_exp_search_iterations_ =
-              tree_node.expected_avg_search_iterations;
-          static_cast<data_node_type*>(model_node->children_[cur])
-              ->expected_avg_shifts_ = tree_node.expected_avg_shifts;
-        }
-        for (int i = cur + 1; i < cur + repeats; i++) {
-          model_node->children_[i] = model_node->children_[cur];
-        }
-        cur += repeats;
-      }
-
-      delete_node(node);
-      node = model_node;
-    } else {
-      // Convert to data node
-      stats_.num_data_nodes++;
-      auto data_node = new (data_node_allocator().allocate(1))
-          data_node_type(node->level_, derived_params_.max_data_node_slots,
-                         key_less_, allocator_);
-      data_node->bulk_load(values, num_keys, data_node_model,
-                           params_.approximate_model_computation);
-      data_node->cost_ = node->cost_;
-      delete_node(node);
-      node = data_node;
-    }
-  }
-
-  // Caller needs to set the level, duplication factor, and neighbor pointers of
-  // the returned data node
-  data_node_type* bulk_load_leaf_node_from_existing(
-      const data_node_type* existing_node, int left, int right,
-      bool compute_cost = true, const fanout_tree::FTNode* tree_node = nullptr,
-      bool reuse_model = false, bool keep_left = false,
-      bool keep_right = false) {
-    auto node = new (data_node_allocator().allocate(1))
-        data_node_type(key_less_, allocator_);
-    stats_.num_data_nodes++;
-    if (tree_node) {
-      // Use the model and num_keys saved in the tree node so we don't have to
-      // recompute it
-      LinearModel<T> precomputed_model(tree_node->a, tree_node->b);
-      node->bulk_load_from_existing(existing_node, left, right, keep_left,
-                                    keep_right, &precomputed_model,
-                                    tree_node->num_keys);
-    } else if (reuse_model) {
-      // Use the model from the existing node
-      // Assumes the model is accurate
-      int num_actual_keys = existing_node->num_keys_in_range(left, right);
-      LinearModel<T> precomputed_model(existing_node->model_);
-      precomputed_model.b_ -= left;
-      precomputed_model.expand(static_cast<double>(num_actual_keys) /
-                               (right - left));
-      node->bulk_load_from_existing(existing_node, left, right, keep_left,
-                                    keep_right, &precomputed_model,
-                                    num_actual_keys);
-    } else {
-      node->bulk_load_from_existing(existing_node, left, right, keep_left,
-                                    keep_right);
-    }
-    node->max_slots_ = derived_params_.max_data_node_slots;
-    if (compute_cost) {
-      node->cost_ = node->compute_expected_cost(existing_node->frac_inserts());
-    }
-    return node;
-  }
-
-  /*** Lookup ***/
-
- public:
-  // Looks for an exact match of the key
-  // If the key does not exist, returns an end iterator
-  // If there are multiple keys with the same value, returns an iterator to the
-  // right-most key
-  // If you instead want an iterator to the left-most key with the input value,
-  // use lower_bound()
-  typename self_type::Iterator find(const T& key) {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_key(key);
-    if (idx < 0) {
-      return end();
-    } else {
-      return Iterator(leaf, idx);
-    }
-  }
-
-  typename self_type::ConstIterator find(const T& key) const {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_key(key);
-    if (idx < 0) {
-      return cend();
-    } else {
-      return ConstIterator(leaf, idx);
-    }
-  }
-
-  size_t count(const T& key) {
-    ConstIterator it = lower_bound(key);
-    size_t num_equal = 0;
-    while (!it.is_end() && key_equal(it.key(), key)) {
-      num_equal++;
-      ++it;
-    }
-    return num_equal;
-  }
-
-  // Returns an iterator to the first key no less than the input value
-  typename self_type::Iterator lower_bound(const T& key) {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_lower(key);
-    return Iterator(leaf, idx);  // automatically handles the case where idx ==
-                                 // leaf->data_capacity
-  }
-
-  typename self_type::ConstIterator lower_bound(const T& key) const {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_lower(key);
-    return ConstIterator(leaf, idx);  // automatically handles the case where
-                                      // idx == leaf->data_capacity
-  }
-
-  // Returns an iterator to the first key greater than the input value
-  typename self_type::Iterator upper_bound(const T& key) {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_upper(key);
-    return Iterator(leaf, idx);  // automatically handles the case where idx ==
-                                 // leaf->data_capacity
-  }
-
-  typename self_type::ConstIterator upper_bound(const T& key) const {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_upper(key);
-    return ConstIterator(leaf, idx);  // automatically handles the case where
-                                      // idx == leaf->data_capacity
-  }
-
-  std::pair<Iterator, Iterator> equal_range(const T& key) {
-    return std::pair<Iterator, Iterator>(lower_bound(key), upper_bound(key));
-  }
-
-  std::pair<ConstIterator, ConstIterator> equal_range(const T& key) const {
-    return std::pair<ConstIterator, ConstIterator>(lower_bound(key),
-                                                   upper_bound(key));
-  }
-
-  // Directly returns a pointer to the payload found through find(key)
-  // This avoids the overhead of creating an iterator
-  // Returns null pointer if there is no exact match of the key
-  P* get_payload(const T& key) const {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    int idx = leaf->find_key(key);
-    if (idx < 0) {
-      return nullptr;
-    } else {
-      return &(leaf->get_payload(idx));
-    }
-  }
-
-  // Looks for the last key no greater than the input value
-  // Conceptually, this is equal to the last key before upper_bound()
-  typename self_type::Iterator find_last_no_greater_than(const T& key) {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    const int idx = leaf->upper_bound(key) - 1;
-    if (idx >= 0) {
-      return Iterator(leaf, idx);
-    }
-
-    // Edge case: need to check previous data node(s)
-    while (true) {
-      if (leaf->prev_leaf_ == nullptr) {
-        return Iterator(leaf, 0);
-      }
-      leaf = leaf->prev_leaf_;
-      if (leaf->num_keys_ > 0) {
-        return Iterator(leaf, leaf->last_pos());
-      }
-    }
-  }
-
-  // Directly returns a pointer to the payload found through
-  // find_last_no_greater_than(key)
-  // This avoids the overhead of creating an iterator
-  P* get_payload_last_no_greater_than(const T& key) {
-    stats_.num_lookups++;
-    data_node_type* leaf = get_leaf(key);
-    const int idx = leaf->upper_bound(key) - 1;
-    if (idx >= 0) {
-      return &(leaf->get_payload(idx));
-    }
-
-    // Edge case: Need to check previous data node(s)
-    while (true) {
-      if (leaf->prev_leaf_ == nullptr) {
-        return &(leaf->get_payload(leaf->first_pos()));
-      }
-      leaf = leaf->prev_leaf_;
-      if (leaf->num_keys_ > 0) {
-        return &(leaf->get_payload(leaf->last_pos()));
-      }
-    }
-  }
-
-  typename self_type::Iterator begin() {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      cur = static_cast<model_node_type*>(cur)->children_[0];
-    }
-    return Iterator(static_cast<data_node_type*>(cur), 0);
-  }
-
-  typename self_type::Iterator end() {
-    Iterator it = Iterator();
-    it.cur_leaf_ = nullptr;
-    it.cur_idx_ = 0;
-    return it;
-  }
-
-  typename self_type::ConstIterator cbegin() const {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      cur = static_cast<model_node_type*>(cur)->children_[0];
-    }
-    return ConstIterator(static_cast<data_node_type*>(cur), 0);
-  }
-
-  typename self_type::ConstIterator cend() const {
-    ConstIterator it = ConstIterator();
-    it.cur_leaf_ = nullptr;
-    it.cur_idx_ = 0;
-    return it;
-  }
-
-  typename self_type::ReverseIterator rbegin() {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      auto model_node = static_cast<model_node_type*>(cur);
-      cur = model_node->children_[model_node->num_children_ - 1];
-    }
-    auto data_node = static_cast<data_node_type*>(cur);
-    return ReverseIterator(data_node, data_node->data_capacity_ - 1);
-  }
-
-  typename self_type::ReverseIterator rend() {
-    ReverseIterator it = ReverseIterator();
-    it.cur_leaf_ = nullptr;
-    it.cur_idx_ = 0;
-    return it;
-  }
-
-  typename self_type::ConstReverseIterator crbegin() const {
-    AlexNode<T, P>* cur = root_node_;
-
-    while (!cur->is_leaf_) {
-      auto model_node = static_cast<model_node_type*>(cur);
-      cur = model_node->children_[model_node->num_children_ - 1];
-    }
-    auto data_node = static_cast<data_node_type*>(cur);
-    return ConstReverseIterator(data_node, data_node->data_capacity_ - 1);
-  }
-
-  typename self_type::ConstReverseIterator crend() const {
-    ConstReverseIterator it = ConstReverseIterator();
-    it.cur_leaf_ = nullptr;
-    it.cur_idx_ = 0;
-    return it;
-  }
-
-  /*** Insert ***/
-
- public:
-  std::pair<Iterator, bool> insert(const V& value) {
-    return insert(value.first, value.second);
-  }
-
-  template <class InputIterator>
-  void insert(InputIterator first, InputIterator last) {
-    for (auto it = first; it != last; ++it) {
-      insert(*it);
-    }
-  }
-
-  // This will NOT do an update of an existing key.
-  // To perform an update or read-modify-write, do a lookup and modify the
-  // payload's value.
-  // Returns iterator to inserted element, and whether the insert happened or
-  // not.
-  // Insert does not happen if duplicates are not allowed and duplicate is
-  // found.
-  std::pair<Iterator, bool> insert(const T& key, const P& payload) {
-    // If enough keys fall outside the key domain, expand the root to expand the
-    // key domain
-    if (key > istats_.key_domain_max_) {
-      istats_.num_keys_above_key_domain++;
-      if (should_expand_right()) {
-        expand_root(key, false);  // expand to the right
-      }
-    } else if (key < istats_.key_domain_min_) {
-      istats_.num_keys_below_key_domain++;
-      if (should_expand_left()) {
-        expand_root(key, true);  // expand to the left
-      }
-    }
-
-    data_node_type* leaf = get_leaf(key);
-
-    // Nonzero fail flag means that the insert did not happen
-    std::pair<int, int> ret = leaf->insert(key, payload);
-    int fail = ret.first;
-    int insert_pos = ret.second;
-    if (fail == -1) {
-      // Duplicate found and duplicates not allowed
-      return {Iterator(leaf, insert_pos), false};
-    }
-
-    // If no insert, figure out what to do with the data node to decrease the
-    // cost
-    if (fail) {
-      std::vector<TraversalNode> traversal_path;
-      get_leaf(key, &traversal_path);
-      model_node_type* parent = traversal_path.back().node;
-
-      while (fail) {
-        auto start_time = std::chrono::high_resolution_clock::now();
-        stats_.num_expand_and_scales += leaf->num_resizes_;
-
-        if (parent == superroot_) {
-          update_superroot_key_domain();
-        }
-        int bucketID = parent->model_.predict(key);
-        bucketID = std::min<int>(std::max<int>(bucketID, 0),
-                                 parent->num_children_ - 1);
-        std::vector<fanout_tree::FTNode> used_fanout_tree_nodes;
-
-        int fanout_tree_depth = 1;
-        if (experimental_params_.splitting_policy_method == 0 || fail >= 2) {
-          // always split in 2. No extra work required here
-        } else if (experimental_params_.splitting_policy_method == 1) {
-          // decide between no split (i.e., expand and retrain) or splitting in
-          // 2
-          fanout_tree_depth = fanout_tree::find_best_fanout_existing_node<T, P>(
-              parent, bucketID, stats_.num_keys, used_fanout_tree_nodes, 2);
-        } else if (experimental_params_.splitting_policy_method == 2) {
-          // use full fanout tree to decide fanout
-          fanout_tree_depth = fanout_tree::find_best_fanout_existing_node<T, P>(
-              parent, bucketID, stats_.num_keys, used_fanout_tree_nodes,
-              derived_params_.max_fanout);
-        }
-        int best_fanout = 1 << fanout_tree_depth;
-        stats_.cost_computation_time +=
-            std::chrono::duration_cast<std::chrono::nanoseconds>(
-                std::chrono::high_resolution_clock::now() - start_time)
-                .count();
-
-        if (fanout_tree_depth == 0) {
-          // expand existing data node and retrain model
-          leaf->resize(data_node_type::kMinDensity_, true,
-                       leaf->is_append_mostly_right(),
-                       leaf->is_append_mostly_left());
-          fanout_tree::FTNode& tree_node = used_fanout_tree_nodes[0];
-          leaf->cost_ = tree_node.cost;
-          leaf->expected_avg_exp_search_iterations_ =
-              tree_node.expected_avg_search_iterations;
-          leaf->expected_avg_shifts_ = tree_node.expected_avg_shifts;
-          leaf->reset_stats();
-          stats_.num_expand_and_retrains++;
-        } else {
-          // split data node: always try to split sideways/upwards, only split
-          // downwards if necessary
-          bool reuse_model = (fail == 3);
-          if (experimental_params_.allow_splitting_upwards) {
-            // allow splitting upwards
-            assert(experimental_params_.splitting_policy_method != 2);
-            int stop_propagation_level = best_split_propagation(traversal_path);
-            if (stop_propagation_level <= superroot_->level_) {
-              parent = split_downwards(parent, bucketID, fanout_tree_depth,
-                                       used_fanout_tree_nodes, reuse_model);
-            } else {
-              split_upwards(key, stop_propagation_level, traversal_path,
-                            reuse_model, &parent);
-            }
-          } else {
-            // either split sideways or downwards
-            bool should_split_downwards =
-                (parent->num_children_ * best_fanout /
-                         (1 << leaf->duplication_factor_) >
-                     derived_params_.max_fanout ||
-                 parent->level_ == superroot_->level_);
-            if (should_split_downwards) {
-              parent = split_downwards(parent, bucketID, fanout_tree_depth,
-                                       used_fanout_tree_nodes, reuse_model);
-            } else {
-              split_sideways(parent, bucketID, fanout_tree_depth,
-                             used_fanout_tree_nodes, reuse_model);
-            }
-          }
-          leaf = static_cast<data_node_type*>(parent->get_child_node(key));
-        }
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = end_time - start_time;
-        stats_.splitting_time +=
-            std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
-                .count();
-
-        // Try again to insert the key
-        ret = leaf->insert(key, payload);
-        fail = ret.first;
-        insert_pos = ret.second;
-        if (fail == -1) {
-          // Duplicate found and duplicates not allowed
-          return {Iterator(leaf, insert_pos), false};
-        }
-      }
-    }
-    stats_.num_inserts++;
-    stats_.num_keys++;
-    return {Iterator(leaf, insert_pos), true};
-  }
-
- private:
-  // Our criteria for when to expand the root, thereby expanding the key domain.
-  // We want to strike a balance between expanding too aggressively and too
-  // slowly.
-  // Specifically, the number of inserted keys falling to the right of the key
-  // domain must have one of two properties: (1) above some maximum threshold,
-  // or
-  // (2) above some minimum threshold and the number is much more than we would
-  // expect from randomness alone.
-  bool should_expand_right() const {
-    return (!root_node_->is_leaf_ &&
-            ((istats_.num_keys_above_key_domain >= kMinOutOfDomainKeys &&
-              istats_.num_keys_above_key_domain >=
-                  kOutOfDomainToleranceFactor *
-                      (stats_.num_keys /
-                           istats_.num_keys_at_last_right_domain_resize -
-                       1)) ||
-             istats_.num_keys_above_key_domain >= kMaxOutOfDomainKeys));
-  }
-
-  // Similar to should_expand_right, but for insertions to the left of the key
-  // domain.
-  bool should_expand_left() const {
-    return (!root_node_->is_leaf_ &&
-            ((istats_.num_keys_below_key_domain >= kMinOutOfDomainKeys &&
-              istats_.num_keys_below_key_domain >=
-                  kOutOfDomainToleranceFactor *
-                      (stats_.num_keys /
-                           istats_.num_keys_at_last_left_domain_resize -
-                       1)) ||
-             istats_.num_keys_below_key_domain >= kMaxOutOfDomainKeys));
-  }
-
-  // When splitting upwards, find best internal node to propagate upwards to.
-  // Returns the level of that node. Returns superroot's level if splitting
-  // sideways not possible.
-  int best_split_propagation(const std::vector<TraversalNode>& traversal_path,
-                             bool verbose = false) const {
-    if (root_node_->is_leaf_) {
-      return superroot_->level_;
-    }
-
-    // Find costs on the path down to data node
-    std::vector<SplitDecisionCosts> traversal_costs;
-    for (const TraversalNode& tn : traversal_path) {
-      double stop_cost;
-      AlexNode<T, P>* next = tn.node->children_[tn.bucketID];
-      if (next->duplication_factor_ > 0) {
-        stop_cost = 0;
-      } else {
-        stop_cost =
-            tn.node->num_children_ >= derived_params_.max_fanout
-                ? std::numeric_limits<double>::max()
-                : tn.node->num_children_ + SplitDecisionCosts::base_cost;
-      }
-      traversal_costs.push_back(
-          {stop_cost,
-           tn.node->num_children_ <= 2
-               ? 0
-               : tn.node->num_children_ / 2 + SplitDecisionCosts::base_cost});
-    }
-
-    // Compute back upwards to find the optimal node to stop propagation.
-    // Ignore the superroot (the first node in the traversal path).
-    double cumulative_cost = 0;
-    double best_cost = std::numeric_limits<double>::max();
-    int best_path_level = superroot_->level_;
-    for (int i = traversal_costs.size() - 1; i >= 0; i--) {
-      SplitDecisionCosts& c = traversal_costs[i];
-      if (c.stop_cost != std::numeric_limits<double>::max() &&
-          cumulative_cost + c.stop_cost < best_cost) {
-        best_cost = cumulative_cost + c.stop_cost;
-        best_path_level = traversal_path[i].node->level_;
-      }
-      cumulative_cost += c.split_cost;
-    }
-
-    if (verbose) {
-      std::cout << "[Best split propagation] best level: " << best_path_level
-                << ", parent level: " << traversal_path.back().node->level_
-                << ", best cost: " << best_cost
-                << ", traversal path (level/addr/n_children): ";
-      for (const TraversalNode& tn : traversal_path) {
-        std::cout << tn.node->level_ << "/" << tn.node << "/"
-                  << tn.node->num_children_ << " ";
-      }
-      std::cout << std::endl;
-    }
-    return best_path_level;
-  }
-
-  // Expand the key value space that is covered by the index.
-  // Expands the root node (which is a model node).
-  // If the root node is at the max node size, then we split the root and create
-  // a new root node.
-  void expand_root(T key, bool expand_left) {
-    auto root = static_cast<model_node_type*>(root_node_);
-
-    // Find the new bounds of the key domain.
-    // Need to be careful to avoid overflows in the key type.
-    T domain_size = istats_.key_domain_max_ - istats_.key_domain_min_;
-    int expansion_factor;
-    T new_domain_min = istats_.key_domain_min_;
-    T new_domain_max = istats_.key_domain_max_;
-    data_node_type* outermost_node;
-    if (expand_left) {
-      auto key_difference = static_cast<double>(istats_.key_domain_min_ -
-                                                std::min(key, get_min_key()));
-      expansion_factor = pow_2_round_up(static_cast<int>(
-          std::ceil((key_difference + domain_size) / domain_size)));
-      // Check for overflow. To avoid overflow on signed types while doing
-      // this check, we do comparisons using half of the relevant quantities.
-      T half_expandable_domain =
-          istats_.key_domain_max_ / 2 - std::numeric_limits<T>::lowest() / 2;
-      T half_expanded_domain_size = expansion_factor / 2 * domain_size;
-      if (half_expandable_domain < half_expanded_domain_size) {
-        new_domain_min = std::numeric_limits<T>::lowest();
-      } else {
-        new_domain_min = istats_.key_domain_max_;
-        new_domain_min -= half_expanded_domain_size;
-        new_domain_min -= half_expanded_domain_size;
-      }
-      istats_.num_keys_at_last_left_domain_resize = stats_.num_keys;
-      istats_.num_keys_below_key_domain = 0;
-      outermost_node = first_data_node();
-    } else {
-      auto key_difference = static_cast<double>(std::max(key, get_max_key()) -
-                                                istats_.key_domain_max_);
-      expansion_factor = pow_2_round_up(static_cast<int>(
-          std::ceil((key_difference + domain_size) / domain_size)));
-      // Check for overflow. To avoid overflow on signed types while doing
-      // this check, we do comparisons using half of the relevant quantities.
-      T half_expandable_domain =
-          std::numeric_limits<T>::max() / 2 - istats_.key_domain_min_ / 2;
-      T half_expanded_domain_size = expansion_factor / 2 * domain_size;
-      if (half_expandable_domain < half_expanded_domain_size) {
-        new_domain_max = std::numeric_limits<T>::max();
-      } else {
-        new_domain_max = istats_.key_domain_min_;
-        new_domain_max += half_expanded_domain_size;
-        new_domain_max += half_expanded_domain_size;
-      }
-      istats_.num_keys_at_last_right_domain_resize = stats_.num_keys;
-      istats_.num_keys_above_key_domain = 0;
-      outermost_node = last_data_node();
-    }
-    assert(expansion_factor > 1);
-
-    // Modify the root node appropriately
-    int new_nodes_start;  // index of first pointer to a new node
-    int new_nodes_end;    // exclusive
-    if (static_cast<size_t>(root->num_children_) * expansion_factor <=
-        static_cast<size_t>(derived_params_.max_fanout)) {
-      // Expand root node
-      stats_.num_model_node_expansions++;
-      stats_.num_model_node_expansion_pointers += root->num_children_;
-
-      int new_num_children = root->num_children_ * expansion_factor;
-      auto new_children = new (pointer_allocator().allocate(new_num_children))
-          AlexNode<T, P>*[new_num_children];
-      int copy_start;
-      if (expand_left) {
-        copy_start = new_num_children - root->num_children_;
-        new_nodes_start = 0;
-        new_nodes_end = copy_start;
-        root->model_.b_ += new_num_children - root->num_children_;
-      } else {
-        copy_start = 0;
-        new_nodes_start = root->num_children_;
-        new_nodes_end = new_num_children;
-      }
-      for (int i = 0; i < root->num_children_; i++) {
-        new_children[copy_start + i] = root->children_[i];
-      }
-      pointer_allocator().deallocate(root->children_, root->num_children_);
-      root->children_ = new_children;
-      root->num_children_ = new_num_children;
-    } else {
-      // Create new root node
-      auto new_root = new (model_node_allocator().allocate(1))
-          model_node_type(static_cast<short>(root->level_ - 1), allocator_);
-      new_root->model_.a_ = root->model_.a_ / root->num_children_;
-      new_root->model_.b_ = root->model_.b_ / root->num_children_;
-      if (expand_left) {
-        new_root->model_.b_ += expansion_factor - 1;
-      }
-      new_root->num_children_ = expansion_factor;
-      new_root->children_ = new (pointer_allocator().allocate(expansion_factor))
-          AlexNode<T, P>*[expansion_factor];
-      if (expand_left) {
-        new_root->children_[expansion_factor - 1] = root;
-        new_nodes_start = 0;
-      } else {
-        new_root->children_[0] = root;
-        new_nodes_start = 1;
-      }
-      new_nodes_end = new_nodes_start + expansion_factor - 1;
-      root_node_ = new_root;
-      update_superroot_pointer();
-      root = new_root;
-    }
-    // Determine if new nodes represent a range outside the key type's domain.
-    // This happens when we're preventing overflows.
-    int in_bounds_new_nodes_start = new_nodes_start;
-    int in_bounds_new_nodes_end = new_nodes_end;
-    if (expand_left) {
-      in_bounds_new_nodes_start =
-          std::max(new_nodes_start, root->model_.predict(new_domain_min));
-    } else {
-      in_bounds_new_nodes_end =
-          std::min(new_nodes_end, root->model_.predict(new_domain_max) + 1);
-    }
-
-    // Fill newly created child pointers of the root node with new data nodes.
-    // To minimize empty new data nodes, we create a new data node per n child
-    // pointers, where n is the number of pointers to existing nodes.
-    // Requires reassigning some keys from the outermost pre-existing data node
-    // to the new data nodes.
-    int n = root->num_children_ - (new_nodes_end - new_nodes_start);
-    assert(root->num_children_ % n == 0);
-    auto new_node_duplication_factor =
-        static_cast<uint8_t>(log_2_round_down(n));
-    if (expand_left) {
-      T left_boundary_value = istats_.key_domain_min_;
-      int left_boundary = outermost_node->lower_bound(left_boundary_value);
-      data_node_type* next = outermost_node;
-      for (int i = new_nodes_end; i > new_nodes_start; i -= n) {
-        if (i <= in_bounds_new_nodes_start) {
-          // Do not initialize nodes that fall outside the key type's domain
-          break;
-        }
-        int right_boundary = left_boundary;
-        if (i - n <= in_bounds_new_nodes_start) {
-          left_boundary = 0;
-        } else {
-          left_boundary_value -= domain_size;
-          left_boundary = outermost_node->lower_bound(left_boundary_value);
-        }
-        data_node_type* new_node = bulk_load_leaf_node_from_existing(
-            outermost_node, left_boundary, right_boundary, true);
-        new_node->level_ = static_cast<short>(root->level_ + 1);
-        new_node->duplication_factor_ = new_node_duplication_factor;
-        if (next) {
-          next->prev_leaf_ = new_node;
-        }
-        new_node->next_leaf_ = next;
-        next = new_node;
-        for (int j = i - 1; j >= i - n; j--) {
-          root->children_[j] = new_node;
-        }
-      }
-    } else {
-      T right_boundary_value = istats_.key_domain_max_;
-      int right_boundary = outermost_node->lower_bound(right_boundary_value);
-      data_node_type* prev = nullptr;
-      for (int i = new_nodes_start; i < new_nodes_end; i += n) {
-        if (i >= in_bounds_new_nodes_end) {
-          // Do not initialize nodes that fall outside the key type's domain
-          break;
-        }
-        int left_boundary = right_boundary;
-        if (i + n >= in_bounds_new_nodes_end) {
-          right_boundary = outermost_node->data_capacity_;
-        } else {
-          right_boundary_value += domain_size;
-          right_boundary = outermost_node->lower_bound(right_boundary_value);
-        }
-        data_node_type* new_node = bulk_load_leaf_node_from_existing(
-            outermost_node, left_boundary, right_boundary, true);
-        new_node->level_ = static_cast<short>(root->level_ + 1);
-        new_node->duplication_factor_ = new_node_duplication_factor;
-        if (prev) {
-          prev->next_leaf_ = new_node;
-        }
-        new_node->prev_leaf_ = prev;
-        prev = new_node;
-        for (int j = i; j < i + n; j++) {
-          root->children_[j] = new_node;
-        }
-      }
-    }
-
-    // Connect leaf nodes and remove reassigned keys from outermost pre-existing
-    // node.
-    if (expand_left) {
-      outermost_node->erase_range(new_domain_min, istats_.key_domain_min_);
-      auto last_new_leaf =
-          static_cast<data_node_type*>(root->children_[new_nodes_end - 1]);
-      outermost_node->prev_leaf_ = last_new_leaf;
-      last_new_leaf->next_leaf_ = outermost_node;
-    } else {
-      outermost_node->erase_range(istats_.key_domain_max_, new_domain_max,
-                                  true);
-      auto first_new_leaf =
-          static_cast<data_node_type*>(root->children_[new_nodes_start]);
-      outermost_node->next_leaf_ = first_new_leaf;
-      first_new_leaf->prev_leaf_ = outermost_node;
-    }
-
-    istats_.key_domain_min_ = new_domain_min;
-    istats_.key_domain_max_ = new_domain_max;
-  }
-
-  // Splits downwards in the manner determined by the fanout tree and updates
-  // the pointers of the parent.
-  // If no fanout tree is provided, then splits downward in two. Returns the
-  // newly created model node.
-  model_node_type* split_downwards(
-      model_node_type* parent, int bucketID, int fanout_tree_depth,
-      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
-      bool reuse_model) {
-    auto leaf = static_cast<data_node_type*>(parent->children_[bucketID]);
-    stats_.num_downward_splits++;
-    stats_.num_downward_split_keys += leaf->num_keys_;
-
-    // Create the new model node that will replace the current data node
-    int fanout = 1 << fanout_tree_depth;
-    auto new_node = new (model_node_allocator().allocate(1))
-        model_node_type(leaf->level_, allocator_);
-    new_node->duplication_factor_ = leaf->duplication_factor_;
-    new_node->num_children_ = fanout;
-    new_node->children_ =
-        new (pointer_allocator().allocate(fanout)) AlexNode<T, P>*[fanout];
-
-    int repeats = 1 << leaf->duplication_factor_;
-    int start_bucketID =
-        bucketID - (bucketID % repeats);  // first bucket with same child
-    int end_bucketID =
-        start_bucketID + repeats;  // first bucket with different child
-    double left_boundary_value =
-        (start_bucketID - parent->model_.b_) / parent->model_.a_;
-    double right_boundary_value =
-        (end_bucketID - parent->model_.b_) / parent->model_.a_;
-    new_node->model_.a_ =
-        1.0 / (right_boundary_value - left_boundary_value) * fanout;
-    new_node->model_.b_ = -new_node->model_.a_ * left_boundary_value;
-
-    // Create new data nodes
-    if (used_fanout_tree_nodes.empty()) {
-      assert(fanout_tree_depth == 1);
-      create_two_new_data_nodes(leaf, new_node, fanout_tree_depth, reuse_model);
-    } else {
-      create_new_data_nodes(leaf, new_node, fanout_tree_depth,
-                            used_fanout_tree_nodes);
-    }
-
-    delete_node(leaf);
-    stats_.num_data_nodes--;
-    stats_.num_model_nodes++;
-    for (int i = start_bucketID; i < end_bucketID; i++) {
-      parent->children_[i] = new_node;
-    }
-    if (parent == superroot_) {
-      root_node_ = new_node;
-      update_superroot_pointer();
-    }
-
-    return new_node;
-  }
-
-  // Splits data node sideways in the manner determined by the fanout tree.
-  // If no fanout tree is provided, then splits sideways in two.
-  void split_sideways(model_node_type* parent, int bucketID,
-                      int fanout_tree_depth,
-                      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
-                      bool reuse_model) {
-    auto leaf = static_cast<data_node_type*>(parent->children_[bucketID]);
-    stats_.num_sideways_splits++;
-    stats_.num_sideways_split_keys += leaf->num_keys_;
-
-    int fanout = 1 << fanout_tree_depth;
-    int repeats = 1 << leaf->duplication_factor_;
-    if (fanout > repeats) {
-      // Expand the pointer array in the parent model node if there are not
-      // enough redundant pointers
-      stats_.num_model_node_expansions++;
-      stats_.num_model_node_expansion_pointers += parent->num_children_;
-      int expansion_factor =
-          parent->expand(fanout_tree_depth - leaf->duplication_factor_);
-      repeats *= expansion_factor;
-      bucketID *= expansion_factor;
-    }
-    int start_bucketID =
-        bucketID - (bucketID % repeats);  // first bucket with same child
-
-    if (used_fanout_tree_nodes.empty()) {
-      assert(fanout_tree_depth == 1);
-      create_two_new_data_nodes(
-          leaf, parent,
-          std::max(fanout_tree_depth,
-                   static_cast<int>(leaf->duplication_factor_)),
-          reuse_model, start_bucketID);
-    } else {
-      // Extra duplication factor is required when there are more redundant
-      // pointers than necessary
-      int extra_duplication_factor =
-          std::max(0, leaf->duplication_factor_ - fanout_tree_depth);
-      create_new_data_nodes(leaf, parent, fanout_tree_depth,
-                            used_fanout_tree_nodes, start_bucketID,
-                            extra_duplication_factor);
-    }
-
-    delete_node(leaf);
-    stats_.num_data_nodes--;
-  }
-
-  // Create two new data nodes by equally dividing the key space of the old data
-  // node, insert the new
-  // nodes as children of the parent model node starting from a given position,
-  // and link the new data nodes together.
-  // duplication_factor denotes how many child pointer slots were assigned to
-  // the old data node.
-  void create_two_new_data_nodes(data_node_type* old_node,
-                                 model_node_type* parent,
-                                 int duplication_factor, bool reuse_model,
-                                 int start_bucketID = 0) {
-    assert(duplication_factor >= 1);
-    int num_buckets = 1 << duplication_factor;
-    int end_bucketID = start_bucketID + num_buckets;
-    int mid_bucketID = start_bucketID + num_buckets / 2;
-
-    bool append_mostly_right = old_node->is_append_mostly_right();
-    int appending_right_bucketID = std::min<int>(
-        std::max<int>(parent->model_.predict(old_node->max_key_), 0),
-        parent->num_children_ - 1);
-    bool append_mostly_left = old_node->is_append_mostly_left();
-    int appending_left_bucketID = std::min<int>(
-        std::max<int>(parent->model_.predict(old_node->min_key_), 0),
-        parent->num_children_ - 1);
-
-    int right_boundary = old_node->lower_bound(
-        (mid_bucketID - parent->model_.b_) / parent->model_.a_);
-    // Account for off-by-one errors due to floating-point precision issues.
-    while (right_boundary < old_node->data_capacity_ &&
-           old_node->get_key(right_boundary) != data_node_type::kEndSentinel_ &&
-           parent->model_.predict(old_node->get_key(right_boundary)) <
-               mid_bucketID) {
-      right_boundary = std::min(
-          old_node->get_next_filled_position(right_boundary, false) + 1,
-          old_node->data_capacity_);
-    }
-    data_node_type* left_leaf = bulk_load_leaf_node_from_existing(
-        old_node, 0, right_boundary, true, nullptr, reuse_model,
-        append_mostly_right && start_bucketID <= appending_right_bucketID &&
-            appending_right_bucketID < mid_bucketID,
-        append_mostly_left && start_bucketID <= appending_left_bucketID &&
-            appending_left_bucketID < mid_bucketID);
-    data_node_type* right_leaf = bulk_load_leaf_node_from_existing(
-        old_node, right_boundary, old_node->data_capacity_, true, nullptr,
-        reuse_model,
-        append_mostly_right && mid_bucketID <= appending_right_bucketID &&
-            appending_right_bucketID < end_bucketID,
-        append_mostly_left && mid_bucketID <= appending_left_bucketID &&
-            appending_left_bucketID < end_bucketID);
-    left_leaf->level_ = static_cast<short>(parent->level_ + 1);
-    right_leaf->level_ = static_cast<short>(parent->level_ + 1);
-    left_leaf->duplication_factor_ =
-        static_cast<uint8_t>(duplication_factor - 1);
-    right_leaf->duplication_factor_ =
-        static_cast<uint8_t>(duplication_factor - 1);
-
-    for (int i = start_bucketID; i < mid_bucketID; i++) {
-      parent->children_[i] = left_leaf;
-    }
-    for (int i = mid_bucketID; i < end_bucketID; i++) {
-      parent->children_[i] = right_leaf;
-    }
-    link_data_nodes(old_node, left_leaf, right_leaf);
-  }
-
-  // Create new data nodes from the keys in the old data node according to the
-  // fanout tree, insert the new
-  // nodes as children of the parent model node starting from a given position,
-  // and link the new data nodes together.
-  // Helper for splitting when using a fanout tree.
-  void create_new_data_nodes(
-      const data_node_type* old_node, model_node_type* parent,
-      int fanout_tree_depth,
-      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
-      int start_bucketID = 0, int extra_duplication_factor = 0) {
-    bool append_mostly_right = old_node->is_append_mostly_right();
-    int appending_right_bucketID = std::min<int>(
-        std::max<int>(parent->model_.predict(old_node->max_key_), 0),
-        parent->num_children_ - 1);
-    bool append_mostly_left = old_node->is_append_mostly_left();
-    int appending_left_bucketID = std::min<int>(
-        std::max<int>(parent->model_.predict(old_node->min_key_), 0),
-        parent->num_children_ - 1);
-
-    // Create the new data nodes
-    int cur = start_bucketID;  // first bucket with same child
-    data_node_type* prev_leaf =
-        old_node->prev_leaf_;  // used for linking the new data nodes
-    int left_boundary = 0;
-    int right_boundary = 0;
-    // Keys may be re-assigned to an adjacent fanout tree node due to off-by-one
-    // errors
-    int num_reassigned_keys = 0;
-    for (fanout_tree::FTNode& tree_node : used_fanout_tree_nodes) {
-      left_boundary = right_boundary;
-      auto duplication_factor = static_cast<uint8_t>(
-          fanout_tree_depth - tree_node.level + extra_duplication_factor);
-      int child_node_repeats = 1 << duplication_factor;
-      bool keep_left = append_mostly_right && cur <= appending_right_bucketID &&
-                       appending_right_bucketID < cur + child_node_repeats;
-      bool keep_right = append_mostly_left && cur <= appending_left_bucketID &&
-                        appending_left_bucketID < cur + child_node_repeats;
-      right_boundary = tree_node.right_boundary;
-      // Account for off-by-one errors due to floating-point precision issues.
-      tree_node.num_keys -= num_reassigned_keys;
-      num_reassigned_keys = 0;
-      while (right_boundary < old_node->data_capacity_ &&
-             old_node->get_key(right_boundary) !=
-                 data_node_type::kEndSentinel_ &&
-             parent->model_.predict(old_node->get_key(right_boundary)) <
-                 cur + child_node_repeats) {
-        num_reassigned_keys++;
-        right_boundary = std::min(
-            old_node->get_next_filled_position(right_boundary, false) + 1,
-            old_node->data_capacity_);
-      }
-      tree_node.num_keys += num_reassigned_keys;
-      data_node_type* child_node = bulk_load_leaf_node_from_existing(
-          old_node, left_boundary, right_boundary, false, &tree_node, false,
-          keep_left, keep_right);
-      child_node->level_ = static_cast<short>(parent->level_ + 1);
-      child_node->cost_ = tree_node.cost;
-      child_node->duplication_factor_ = duplication_factor;
-      child_node->expected_avg_exp_search_iterations_ =
-          tree_node.expected_avg_search_iterations;
-      child_node->expected_avg_shifts_ = tree_node.expected_avg_shifts;
-      child_node->prev_leaf_ = prev_leaf;
-      if (prev_leaf != nullptr) {
-        prev_leaf->next_leaf_ = child_node;
-      }
-      for (int i = cur; i < cur + child_node_repeats; i++) {
-        parent->children_[i] = child_node;
-      }
-      cur += child_node_repeats;
-      prev_leaf = child_node;
-    }
-    prev_leaf->next_leaf_ = old_node->next_leaf_;
-    if (old_node->next_leaf_ != nullptr) {
-      old_node->next_leaf_->prev_leaf_ = prev_leaf;
-    }
-  }
-
-  // Splits the data node in two and propagates the split upwards along the
-  // traversal path.
-  // Of the two newly created data nodes, returns the one that key falls into.
-  // Returns the parent model node of the new data nodes through new_parent.
-  data_node_type* split_upwards(
-      T key, int stop_propagation_level,
-      const std::vector<TraversalNode>& traversal_path, bool reuse_model,
-      model_node_type** new_parent, bool verbose = false) {
-    assert(stop_propagation_level >= root_node_->level_);
-    std::vector<AlexNode<T, P>*> to_delete;  // nodes that need to be deleted
-
-    // Split the data node into two new data nodes
-    const TraversalNode& parent_path_node = traversal_path.back();
-    model_node_type* parent = parent_path_node.node;
-    auto leaf = static_cast<data_node_type*>(
-        parent->children_[parent_path_node.bucketID]);
-    int leaf_repeats = 1 << (leaf->duplication_factor_);
-    int leaf_start_bucketID =
-        parent_path_node.bucketID - (parent_path_node.bucketID % leaf_repeats);
-    double leaf_mid_bucketID = leaf_start_bucketID + leaf_repeats / 2.0;
-    int leaf_end_bucketID =
-        leaf_start_bucketID + leaf_repeats;  // first bucket with next child
-    stats_.num_sideways_splits++;
-    stats_.num_sideways_split_keys += leaf->num_keys_;
-
-    // Determine if either of the two new data nodes will need to adapt to
-    // append-mostly behavior
-    bool append_mostly_right = leaf->is_append_mostly_right();
-    bool left_half_appending_right = false, right_half_appending_right = false;
-    if (append_mostly_right) {
-      double appending_right_bucketID =
-          parent->model_.predict_double(leaf->max_key_);
-      if (appending_right_bucketID >= leaf_start_bucketID &&
-          appending_right_bucketID < leaf_mid_bucketID) {
-        left_half_appending_right = true;
-      } else if (appending_right_bucketID >= leaf_mid_bucketID &&
-                 appending_right_bucketID < leaf_end_bucketID) {
-        right_half_appending_right = true;
-      }
-    }
-    bool append_mostly_left = leaf->is_append_mostly_left();
-    bool left_half_appending_left = false, right_half_appending_left = false;
-    if (append_mostly_left) {
-      double appending_left_bucketID =
-          parent->model_.predict_double(leaf->min_key_);
-      if (appending_left_bucketID >= leaf_start_bucketID &&
-          appending_left_bucketID < leaf_mid_bucketID) {
-        left_half_appending_left = true;
-      } else if (appending_left_bucketID >= leaf_mid_bucketID &&
-                 appending_left_bucketID < leaf_end_bucketID) {
-        right_half_appending_left = true;
-      }
-    }
-
-    int mid_boundary = leaf->lower_bound(
-        (leaf_mid_bucketID - parent->model_.b_) / parent->model_.a_);
-    data_node_type* left_leaf = bulk_load_leaf_node_from_existing(
-        leaf, 0, mid_boundary, true, nullptr, reuse_model,
-        append_mostly_right && left_half_appending_right,
-        append_mostly_left && left_half_appending_left);
-    data_node_type* right_leaf = bulk_load_leaf_node_from_existing(
-        leaf, mid_boundary, leaf->data_capacity_, true, nullptr, reuse_model,
-        append_mostly_right && right_half_appending_right,
-        append_mostly_left && right_half_appending_left);
-    // This is the expected duplication factor; it will be correct once we
-    // split/expand the parent
-    left_leaf->duplication_factor_ = leaf->duplication_factor_;
-    right_leaf->duplication_factor_ = leaf->duplication_factor_;
-    left_leaf->level_ = leaf->level_;
-    right_leaf->level_ = leaf->level_;
-    link_data_nodes(leaf, left_leaf, right_leaf);
-    to_delete.push_back(leaf);
-    stats_.num_data_nodes--;
-
-    if (verbose) {
-      std::cout << "[Splitting upwards data node] level " << leaf->level_
-                << ", node addr: " << leaf
-                << ", node repeats in parent: " << leaf_repeats
-                << ", node indexes in parent: [" << leaf_start_bucketID << ", "
-                << leaf_end_bucketID << ")"
-                << ", left leaf indexes: [0, " << mid_boundary << ")"
-                << ", right leaf indexes: [" << mid_boundary << ", "
-                << leaf->data_capacity_ << ")"
-                << ", new nodes addr: " << left_leaf << "," << right_leaf
-                << std::endl;
-    }
-
-    // The new data node that the key falls into is the one we return
-    data_node_type* new_data_node;
-    if (parent->model_.predict_double(key) < leaf_mid_bucketID) {
-      new_data_node = left_leaf;
-    } else {
-      new_data_node = right_leaf;
-    }
-
-    // Split all internal nodes from the parent up to the highest node along the
-    // traversal path.
-    // As this happens, the entries of the traversal path will go stale, which
-    // is fine because we no longer use them.
-    // Splitting an internal node involves dividing the child pointers into two
-    // halves, and doubling the relevant half.
-    AlexNode<T, P>* prev_left_split = left_leaf;
-    AlexNode<T, P>* prev_right_split = right_leaf;
-    int path_idx = static_cast<int>(traversal_path.size()) - 1;
-    while (traversal_path[path_idx].node->level_ > stop_propagation_level) {
-      // Decide which half to double
-      const TraversalNode& path_node = traversal_path[path_idx];
-      model_node_type* cur_node = path_node.node;
-      stats_.num_model_node_splits++;
-      stats_.num_model_node_split_pointers += cur_node->num_children_;
-      bool double_left_half = path_node.bucketID < cur_node->num_children_ / 2;
-      model_node_type* left_split = nullptr;
-      model_node_type* right_split = nullptr;
-
-      // If one of the resulting halves will only have one child pointer, we
-      // should "pull up" that child
-      bool pull_up_left_child = false, pull_up_right_child = false;
-      AlexNode<T, P>* left_half_first_child = cur_node->children_[0];
-      AlexNode<T, P>* right_half_first_child =
-          cur_node->children_[cur_node->num_children_ / 2];
-      if (double_left_half &&
-          (1 << right_half_first_child->duplication_factor_) ==
-              cur_node->num_children_ / 2) {
-        // pull up right child if all children in the right half are the same
-        pull_up_right_child = true;
-        left_split = new (model_node_allocator().allocate(1))
-            model_node_type(cur_node->level_, allocator_);
-      } else if (!double_left_half &&
-                 (1 << left_half_first_child->duplication_factor_) ==
-                     cur_node->num_children_ / 2) {
-        // pull up left child if all children in the left half are the same
-        pull_up_left_child = true;
-        right_split = new (model_node_allocator().allocate(1))
-            model_node_type(cur_node->level_, allocator_);
-      } else {
-        left_split = new (model_node_allocator().allocate(1))
-            model_node_type(cur_node->level_, allocator_);
-        right_split = new (model_node_allocator().allocate(1))
-            model_node_type(cur_node->level_, allocator_);
-      }
-
-      // Do the split
-      AlexNode<T, P>* next_left_split = nullptr;
-      AlexNode<T, P>* next_right_split = nullptr;
-      if (double_left_half) {
-        // double left half
-        assert(left_split != nullptr);
-        if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
-          *new_parent = left_split;
-        }
-        left_split->num_children_ = cur_node->num_children_;
-        left_split->children_ =
-            new (pointer_allocator().allocate(left_split->num_children_))
-                AlexNode<T, P>*[left_split->num_children_];
-        left_split->model_.a_ = cur_node->model_.a_ * 2;
-        left_split->model_.b_ = cur_node->model_.b_ * 2;
-        int cur = 0;
-        while (cur < cur_node->num_children_ / 2) {
-          AlexNode<T, P>* cur_child = cur_node->children_[cur];
-          int cur_child_repeats = 1 << cur_child->duplication_factor_;
-          for (int i = 2 * cur; i < 2 * (cur + cur_child_repeats); i++) {
-            left_split->children_[i] = cur_child;
-          }
-          cur_child->duplication_factor_++;
-          cur += cur_child_repeats;
-        }
-        assert(cur == cur_node->num_children_ / 2);
-
-        if (pull_up_right_child) {
-          next_right_split = cur_node->children_[cur_node->num_children_ / 2];
-          next_right_split->level_ = cur_node->level_;
-        } else {
-          right_split->num_children_ = cur_node->num_children_ / 2;
-          right_split->children_ =
-              new (pointer_allocator().allocate(right_split->num_children_))
-                  AlexNode<T, P>*[right_split->num_children_];
-          right_split->model_.a_ = cur_node->model_.a_;
-          right_split->model_.b_ =
-              cur_node->model_.b_ - cur_node->num_children_ / 2;
-          int j = 0;
-          for (int i = cur_node->num_children_ / 2; i < cur_node->num_children_;
-               i++) {
-            right_split->children_[j] = cur_node->children_[i];
-            j++;
-          }
-          next_right_split = right_split;
-        }
-
-        int new_bucketID = path_node.bucketID * 2;
-        int repeats = 1 << (prev_left_split->duplication_factor_ + 1);
-        int start_bucketID =
-            new_bucketID -
-            (new_bucketID % repeats);  // first bucket with same child
-        int mid_bucketID = start_bucketID + repeats / 2;
-        int end_bucketID =
-            start_bucketID + repeats;  // first bucket with next child
-        for (int i = start_bucketID; i < mid_bucketID; i++) {
-          left_split->children_[i] = prev_left_split;
-        }
-        for (int i = mid_bucketID; i < end_bucketID; i++) {
-          left_split->children_[i] = prev_right_split;
-        }
-        next_left_split = left_split;
-      } else {
-        // double right half
-        assert(right_split != nullptr);
-        if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
-          *new_parent = right_split;
-        }
-        if (pull_up_left_child) {
-          next_left_split = cur_node->children_[0];
-          next_left_split->level_ = cur_node->level_;
-        } else {
-          left_split->num_children_ = cur_node->num_children_ / 2;
-          left_split->children_ =
-              new (pointer_allocator().allocate(left_split->num_children_))
-                  AlexNode<T, P>*[left_split->num_children_];
-          left_split->model_.a_ = cur_node->model_.a_;
-          left_split->model_.b_ = cur_node->model_.b_;
-          int j = 0;
-          for (int i = 0; i < cur_node->num_children_ / 2; i++) {
-            left_split->children_[j] = cur_node->children_[i];
-            j++;
-          }
-          next_left_split = left_split;
-        }
-
-        right_split->num_children_ = cur_node->num_children_;
-        right_split->children_ =
-            new (pointer_allocator().allocate(right_split->num_children_))
-                AlexNode<T, P>*[right_split->num_children_];
-        right_split->model_.a_ = cur_node->model_.a_ * 2;
-        right_split->model_.b_ =
-            (cur_node->model_.b_ - cur_node->num_children_ / 2) * 2;
-        int cur = cur_node->num_children_ / 2;
-        while (cur < cur_node->num_children_) {
-          AlexNode<T, P>* cur_child = cur_node->children_[cur];
-          int cur_child_repeats = 1 << cur_child->duplication_factor_;
-          int right_child_idx = cur - cur_node->num_children_ / 2;
-          for (int i = 2 * right_child_idx;
-               i < 2 * (right_child_idx + cur_child_repeats); i++) {
-            right_split->children_[i] = cur_child;
-          }
-          cur_child->duplication_factor_++;
-          cur += cur_child_repeats;
-        }
-        assert(cur == cur_node->num_children_);
-
-        int new_bucketID =
-            (path_node.bucketID - cur_node->num_children_ / 2) * 2;
-        int repeats = 1 << (prev_left_split->duplication_factor_ + 1);
-        int start_bucketID =
-            new_bucketID -
-            (new_bucketID % repeats);  // first bucket with same child
-        int mid_bucketID = start_bucketID + repeats / 2;
-        int end_bucketID =
-            start_bucketID + repeats;  // first bucket with next child
-        for (int i = start_bucketID; i < mid_bucketID; i++) {
-          right_split->children_[i] = prev_left_split;
-        }
-        for (int i = mid_bucketID; i < end_bucketID; i++) {
-          right_split->children_[i] = prev_right_split;
-        }
-        next_right_split = right_split;
-      }
-      assert(next_left_split != nullptr && next_right_split != nullptr);
-      if (verbose) {
-        std::cout << "[Splitting upwards through-node] level "
-                  << cur_node->level_ << ", node addr: " << path_node.node
-                  << ", node children: " << path_node.node->num_children_
-                  << ", child index: " << path_node.bucketID
-                  << ", child repeats in node: "
-                  << (1 << prev_left_split->duplication_factor_)
-                  << ", node repeats in parent: "
-                  << (1 << path_node.node->duplication_factor_)
-                  << ", new nodes addr: " << left_split << "," << right_split
-                  << std::endl;
-      }
-      to_delete.push_back(cur_node);
-      if (!pull_up_left_child && !pull_up_right_child) {
-        stats_.num_model_nodes++;
-      }
-      // This is the expected duplication factor; it will be correct once we
-      // split/expand the parent
-      next_left_split->duplication_factor_ = cur_node->duplication_factor_;
-      next_right_split->duplication_factor_ = cur_node->duplication_factor_;
-      prev_left_split = next_left_split;
-      prev_right_split = next_right_split;
-      path_idx--;
-    }
-
-    // Insert into the top node
-    const TraversalNode& top_path_node = traversal_path[path_idx];
-    model_node_type* top_node = top_path_node.node;
-    assert(top_node->level_ == stop_propagation_level);
-    if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
-      *new_parent = top_node;
-    }
-    int top_bucketID = top_path_node.bucketID;
-    int repeats =
-        1 << prev_left_split->duplication_factor_;  // this was the duplication
-                                                    // factor of the child that
-                                                    // was deleted
-    if (verbose) {
-      std::cout << "[Splitting upwards top node] level "
-                << stop_propagation_level << ", node addr: " << top_node
-                << ", node children: " << top_node->num_children_
-                << ", child index: " << top_bucketID
-                << ", child repeats in node: " << repeats
-                << ", node repeats in parent: "
-                << (1 << top_node->duplication_factor_) << std::endl;
-    }
-
-    // Expand the top node if necessary
-    if (repeats == 1) {
-      stats_.num_model_node_expansions++;
-      stats_.num_model_node_expansion_pointers += top_node->num_children_;
-      top_node->expand(1);  // double size of top node
-      top_bucketID *= 2;
-      repeats *= 2;
-    } else {
-      prev_left_split->duplication_factor_--;
-      prev_right_split->duplication_factor_--;
-    }
-
-    int start_bucketID =
-        top_bucketID -
-        (top_bucketID % repeats);  // first bucket with same child
-    int mid_bucketID = start_bucketID + repeats / 2;
-    int end_bucketID =
-        start_bucketID + repeats;  // first bucket with next child
-    for (int i = start_bucketID; i < mid_bucketID; i++) {
-      top_node->children_[i] = prev_left_split;
-    }
-    for (int i = mid_bucketID; i < end_bucketID; i++) {
-      top_node->children_[i] = prev_right_split;
-    }
-
-    for (auto node : to_delete) {
-      delete_node(node);
-    }
-
-    return new_data_node;
-  }
-
-  /*** Delete ***/
-
- public:
-  // Erases the left-most key with the given key value
-  int erase_one(const T& key) {
-    data_node_type* leaf = get_leaf(key);
-    int num_erased = leaf->erase_one(key);
-    stats_.num_keys -= num_erased;
-    if (leaf->num_keys_ == 0) {
-      merge(leaf, key);
-    }
-    if (key > istats_.key_domain_max_) {
-      istats_.num_keys_above_key_domain -= num_erased;
-    } else if (key < istats_.key_domain_min_) {
-      istats_.num_keys_below_key_domain -= num_erased;
-    }
-    return num_erased;
-  }
-
-  // Erases all keys with a certain key value
-  int erase(const T& key) {
-    data_node_type* leaf = get_leaf(key);
-    int num_erased = leaf->erase(key);
-    stats_.num_keys -= num_erased;
-    if (leaf->num_keys_ == 0) {
-      merge(leaf, key);
-    }
-    if (key > istats_.key_domain_max_) {
-      istats_.num_keys_above_key_domain -= num_erased;
-    } else if (key < istats_.key_domain_min_) {
-      istats_.num_keys_below_key_domain -= num_erased;
-    }
-    return num_erased;
-  }
-
-  // Erases element pointed to by iterator
-  void erase(Iterator it) {
-    if (it.is_end()) {
-      return;
-    }
-    T key = it.key();
-    it.cur_leaf_->erase_one_at(it.cur_idx_);
-    stats_.num_keys--;
-    if (it.cur_leaf_->num_keys_ == 0) {
-      merge(it.cur_leaf_, key);
-    }
-    if (key > istats_.key_domain_max_) {
-      istats_.num_keys_above_key_domain--;
-    } else if (key < istats_.key_domain_min_) {
-      istats_.num_keys_below_key_domain--;
-    }
-  }
-
-  // Removes all elements
-  void clear() {
-    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-         node_it.next()) {
-      delete_node(node_it.current());
-    }
-    auto empty_data_node = new (data_node_allocator().allocate(1))
-        data_node_type(key_less_, allocator_);
-    empty_data_node->bulk_load(nullptr, 0);
-    root_node_ = empty_data_node;
-    create_superroot();
-    stats_.num_keys = 0;
-  }
-
- private:
-  // Try to merge empty leaf, which can be traversed to by looking up key
-  // This may cause the parent node to merge up into its own parent
-  void merge(data_node_type* leaf, T key) {
-    // first save the complete path down to data node
-    std::vector<TraversalNode> traversal_path;
-    auto leaf_dup = get_leaf(key, &traversal_path);
-    // We might need to correct the traversal path in edge cases
-    if (leaf_dup != leaf) {
-      if (leaf_dup->prev_leaf_ == leaf) {
-        correct_traversal_path(leaf, traversal_path, true);
-      } else if (leaf_dup->next_leaf_ == leaf) {
-        correct_traversal_path(leaf, traversal_path, false);
-      } else {
-        assert(false);
-        return;
-      }
-    }
-    if (traversal_path.size() == 1) {
-      return;
-    }
-    int path_pos = static_cast<int>(traversal_path.size()) - 1;
-    TraversalNode tn = traversal_path[path_pos];
-    model_node_type* parent = tn.node;
-    int bucketID = tn.bucketID;
-    int repeats = 1 << leaf->duplication_factor_;
-
-    while (path_pos >= 0) {
-      // repeatedly merge leaf with "sibling" leaf by redirecting pointers in
-      // the parent
-      while (leaf->num_keys_ == 0 && repeats < parent->num_children_) {
-        int start_bucketID = bucketID - (bucketID % repeats);
-        int end_bucketID = start_bucketID + repeats;
-        // determine if the potential sibling leaf is adjacent to the right or
-        // left
-        bool adjacent_to_right =
-            (bucketID % (repeats << 1) == bucketID % repeats);
-        data_node_type* adjacent_leaf = nullptr;
-
-        // check if adjacent node is a leaf
-        if (adjacent_to_right && parent->children_[end_bucketID]->is_leaf_) {
-          adjacent_leaf =
-              static_cast<data_node_type*>(parent->children_[end_bucketID]);
-        } else if (!adjacent_to_right &&
-                   parent->children_[start_bucketID - 1]->is_leaf_) {
-          adjacent_leaf = static_cast<data_node_type*>(
-              parent->children_[start_bucketID - 1]);
-        } else {
-          break;  // unable to merge with sibling leaf
-        }
-
-        // check if adjacent node is a sibling
-        if (leaf->duplication_factor_ != adjacent_leaf->duplication_factor_) {
-          break;  // unable to merge with sibling leaf
-        }
-
-        // merge with adjacent leaf
-        for (int i = start_bucketID; i < end_bucketID; i++) {
-          parent->children_[i] = adjacent_leaf;
-        }
-        if (adjacent_to_right) {
-          adjacent_leaf->prev_leaf_ = leaf->prev_leaf_;
-          if (leaf->prev_leaf_) {
-            leaf->prev_leaf_->next_leaf_ = adjacent_leaf;
-          }
-        } else {
-          adjacent_leaf->next_leaf_ = leaf->next_leaf_;
-          if (leaf->next_leaf_) {
-            leaf->next_leaf_->prev_leaf_ = adjacent_leaf;
-          }
-        }
-        adjacent_leaf->duplication_factor_++;
-        delete_node(leaf);
-        stats_.num_data_nodes--;
-        leaf = adjacent_leaf;
-        repeats = 1 << leaf->duplication_factor_;
-      }
-
-      // try to merge up by removing parent and replacing pointers to parent
-      // with pointers to leaf in grandparent
-      if (repeats == parent->num_children_) {
-        leaf->duplication_factor_ = parent->duplication_factor_;
-        repeats = 1 << leaf->duplication_factor_;
-        bool is_root_node = (parent == root_node_);
-        delete_node(parent);
-        stats_.num_model_nodes--;
-
-        if (is_root_node) {
-          root_node_ = leaf;
-          update_superroot_pointer();
-          break;
-        }
-
-        path_pos--;
-        tn = traversal_path[path_pos];
-        parent = tn.node;
-        bucketID = tn.bucketID;
-        int start_bucketID = bucketID - (bucketID % repeats);
-        int end_bucketID = start_bucketID + repeats;
-        for (int i = start_bucketID; i < end_bucketID; i++) {
-          parent->children_[i] = leaf;
-        }
-      } else {
-        break;  // unable to merge up
-      }
-    }
-  }
-
-  /*** Stats ***/
-
- public:
-  // Number of elements
-  size_t size() const { return static_cast<size_t>(stats_.num_keys); }
-
-  // True if there are no elements
-  bool empty() const { return (size() == 0); }
-
-  // This is just a function required by the STL standard. ALEX can hold more
-  // items.
-  size_t max_size() const { return size_t(-1); }
-
-  // Size in bytes of all the keys, payloads, and bitmaps stored in this index
-  long long data_size() const {
-    long long size = 0;
-    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-         node_it.next()) {
-      AlexNode<T, P>* cur = node_it.current();
-      if (cur->is_leaf_) {
-        size += static_cast<data_node_type*>(cur)->data_size();
-      }
-    }
-    return size;
-  }
-
-  // Size in bytes of all the model nodes (including pointers) and metadata in
-  // data nodes
-  long long model_size() const {
-    long long size = 0;
-    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
-         node_it.next()) {
-      size += node_it.current()->node_size();
-    }
-    return size;
-  }
-
-  // Total number of nodes in the RMI
-  int num_nodes() const {
-    return stats_.num_data_nodes + stats_.num_model_nodes;
-  };
-
-  // Number of data nodes in the RMI
-  int num_leaves() const { return stats_.num_data_nodes; };
-
-  // Return a const reference to the current statistics
-  const struct Stats& get_stats() const { return stats_; }
-
-  /*** Debugging ***/
-
- public:
-  // If short_circuit is true, then we stop validating after detecting the first
-  // invalid property
-  bool validate_structure(bool validate_data_nodes = false,
-                          bool short_circuit = false) const {
-    bool is_valid = true;
-    std::stack<AlexNode<T, P>*> node_stack;
-    AlexNode<T, P>* cur;
-    node_stack.push(root_node_);
-
-    while (!node_stack.empty()) {
-      cur = node_stack.top();
-      node_stack.pop();
-
-      if (!cur->is_leaf_) {
-        auto node = static_cast<model_node_type*>(cur);
-        if (!node->validate_structure(true)) {
-          std::cout << "[Model node invalid structure]"
-                    << " node addr: " << node
-                    << ", node level: " << node->level_ << std::endl;
-          if (short_circuit) {
-            return false;
-          } else {
-            is_valid = false;
-          }
-        }
-
-        node_stack.push(node->children_[node->num_children_ - 1]);
-        for (int i = node->num_children_ - 2; i >= 0; i--) {
-          if (node->children_[i] != node->children_[i + 1]) {
-            node_stack.push(node->children_[i]);
-          }
-        }
-      } else {
-        if (validate_data_nodes) {
-          auto node = static_cast<data_node_type*>(cur);
-          if (!node->validate_structure(true)) {
-            std::cout << "[Data node invalid structure]"
-                      << " node addr: " << node
-                      << ", node level: " << node->level_ << std::endl;
-            if (short_circuit) {
-              return false;
-            } else {
-              is_valid = false;
-            }
-          }
-          if (node->num_keys_ > 0) {
-            data_node_type* prev_nonempty_leaf = node->prev_leaf_;
-            while (prev_nonempty_leaf != nullptr &&
-                   prev_nonempty_leaf->num_keys_ == 0) {
-              prev_nonempty_leaf = prev_nonempty_leaf->prev_leaf_;
-            }
-            if (prev_nonempty_leaf) {
-              T last_in_prev_leaf = prev_nonempty_leaf->last_key();
-              T first_in_cur_leaf = node->first_key();
-              if (last_in_prev_leaf >= first_in_cur_leaf) {
-                std::cout
-                    << "[Data node keys not in sorted order with prev node]"
-                    << " node addr: " << node
-                    << ", node level: " << node->level_
-                    << ", last in prev leaf: " << last_in_prev_leaf
-                    << ", first in cur leaf: " << first_in_cur_leaf
-                    << std::endl;
-                if (short_circuit) {
-                  return false;
-                } else {
-                  is_valid = false;
-                }
-              }
-            }
-            data_node_type* next_nonempty_leaf = node->next_leaf_;
-            while (next_nonempty_leaf != nullptr &&
-                   next_nonempty_leaf->num_keys_ == 0) {
-              next_nonempty_leaf = next_nonempty_leaf->next_leaf_;
-            }
-            if (next_nonempty_leaf) {
-              T first_in_next_leaf = next_nonempty_leaf->first_key();
-              T last_in_cur_leaf = node->last_key();
-              if (last_in_cur_leaf >= first_in_next_leaf) {
-                std::cout
-                    << "[Data node keys not in sorted order with next node]"
-                    << " node addr: " << node
-                    << ", node level: " << node->level_
-                    << ", last in cur leaf: " << last_in_cur_leaf
-                    << ", first in next leaf: " << first_in_next_leaf
-                    << std::endl;
-                if (short_circuit) {
-                  return false;
-                } else {
-                  is_valid = false;
-                }
-              }
-            }
-          }
-        }
-      }
-    }
-    return is_valid;
-  }
-
-  /*** Iterators ***/
-
- public:
-  class Iterator {
-   public:
-    data_node_type* cur_leaf_ = nullptr;  // current data node
-    int cur_idx_ = 0;         // current position in key/data_slots of data node
-    int cur_bitmap_idx_ = 0;  // current position in bitmap
-    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
-                                    // bitmap position
-
-    Iterator() {}
-
-    Iterator(data_node_type* leaf, int idx) : cur_leaf_(leaf), cur_idx_(idx) {
-      initialize();
-    }
-
-    Iterator(const Iterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    Iterator(const ReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    Iterator& operator=(const Iterator& other) {
-      if (this != &other) {
-        cur_idx_ = other.cur_idx_;
-        cur_leaf_ = other.cur_leaf_;
-        cur_bitmap_idx_ = other.cur_bitmap_idx_;
-        cur_bitmap_data_ = other.cur_bitmap_data_;
-      }
-      return *this;
-    }
-
-    Iterator& operator++() {
-      advance();
-      return *this;
-    }
-
-    Iterator operator++(int) {
-      Iterator tmp = *this;
-      advance();
-      return tmp;
-    }
-
-#if ALEX_DATA_NODE_SEP_ARRAYS
-    // Does not return a reference because keys and payloads are stored
-    // separately.
-    // If possible, use key() and payload() instead.
-    V operator*() const {
-      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
-                            cur_leaf_->payload_slots_[cur_idx_]);
-    }
-#else
-    // If data node stores key-payload pairs contiguously, return reference to V
-    V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
-#endif
-
-    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
-
-    P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
-
-    bool is_end() const { return cur_leaf_ == nullptr; }
-
-    bool operator==(const Iterator& rhs) const {
-      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
-    }
-
-    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); };
-
-   private:
-    void initialize() {
-      if (!cur_leaf_) return;
-      assert(cur_idx_ >= 0);
-      if (cur_idx_ >= cur_leaf_->data_capacity_) {
-        cur_leaf_ = cur_leaf_->next_leaf_;
-        cur_idx_ = 0;
-        if (!cur_leaf_) return;
-      }
-
-      cur_bitmap_idx_ = cur_idx_ >> 6;
-      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-
-      // Zero out extra bits
-      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
-      cur_bitmap_data_ &= ~((1ULL << bit_pos) - 1);
-
-      (*this)++;
-    }
-
-    forceinline void advance() {
-      while (cur_bitmap_data_ == 0) {
-        cur_bitmap_idx_++;
-        if (cur_bitmap_idx_ >= cur_leaf_->bitmap_size_) {
-          cur_leaf_ = cur_leaf_->next_leaf_;
-          cur_idx_ = 0;
-          if (cur_leaf_ == nullptr) {
-            return;
-          }
-          cur_bitmap_idx_ = 0;
-        }
-        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-      }
-      uint64_t bit = extract_rightmost_one(cur_bitmap_data_);
-      cur_idx_ = get_offset(cur_bitmap_idx_, bit);
-      cur_bitmap_data_ = remove_rightmost_one(cur_bitmap_data_);
-    }
-  };
-
-  class ConstIterator {
-   public:
-    const data_node_type* cur_leaf_ = nullptr;  // current data node
-    int cur_idx_ = 0;         // current position in key/data_slots of data node
-    int cur_bitmap_idx_ = 0;  // current position in bitmap
-    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
-                                    // bitmap position
-
-    ConstIterator() {}
-
-    ConstIterator(const data_node_type* leaf, int idx)
-        : cur_leaf_(leaf), cur_idx_(idx) {
-      initialize();
-    }
-
-    ConstIterator(const Iterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    ConstIterator(const ConstIterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    ConstIterator(const ReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    ConstIterator(const ConstReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    ConstIterator& operator=(const ConstIterator& other) {
-      if (this != &other) {
-        cur_idx_ = other.cur_idx_;
-        cur_leaf_ = other.cur_leaf_;
-        cur_bitmap_idx_ = other.cur_bitmap_idx_;
-        cur_bitmap_data_ = other.cur_bitmap_data_;
-      }
-      return *this;
-    }
-
-    ConstIterator& operator++() {
-      advance();
-      return *this;
-    }
-
-    ConstIterator operator++(int) {
-      ConstIterator tmp = *this;
-      advance();
-      return tmp;
-    }
-
-#if ALEX_DATA_NODE_SEP_ARRAYS
-    // Does not return a reference because keys and payloads are stored
-    // separately.
-    // If possible, use key() and payload() instead.
-    V operator*() const {
-      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
-                            cur_leaf_->payload_slots_[cur_idx_]);
-    }
-#else
-    // If data node stores key-payload pairs contiguously, return reference to V
-    const V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
-#endif
-
-    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
-
-    const P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
-
-    bool is_end() const { return cur_leaf_ == nullptr; }
-
-    bool operator==(const ConstIterator& rhs) const {
-      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
-    }
-
-    bool operator!=(const ConstIterator& rhs) const { return !(*this == rhs); };
-
-   private:
-    void initialize() {
-      if (!cur_leaf_) return;
-      assert(cur_idx_ >= 0);
-      if (cur_idx_ >= cur_leaf_->data_capacity_) {
-        cur_leaf_ = cur_leaf_->next_leaf_;
-        cur_idx_ = 0;
-        if (!cur_leaf_) return;
-      }
-
-      cur_bitmap_idx_ = cur_idx_ >> 6;
-      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-
-      // Zero out extra bits
-      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
-      cur_bitmap_data_ &= ~((1ULL << bit_pos) - 1);
-
-      (*this)++;
-    }
-
-    forceinline void advance() {
-      while (cur_bitmap_data_ == 0) {
-        cur_bitmap_idx_++;
-        if (cur_bitmap_idx_ >= cur_leaf_->bitmap_size_) {
-          cur_leaf_ = cur_leaf_->next_leaf_;
-          cur_idx_ = 0;
-          if (cur_leaf_ == nullptr) {
-            return;
-          }
-          cur_bitmap_idx_ = 0;
-        }
-        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-      }
-      uint64_t bit = extract_rightmost_one(cur_bitmap_data_);
-      cur_idx_ = get_offset(cur_bitmap_idx_, bit);
-      cur_bitmap_data_ = remove_rightmost_one(cur_bitmap_data_);
-    }
-  };
-
-  class ReverseIterator {
-   public:
-    data_node_type* cur_leaf_ = nullptr;  // current data node
-    int cur_idx_ = 0;         // current position in key/data_slots of data node
-    int cur_bitmap_idx_ = 0;  // current position in bitmap
-    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
-                                    // bitmap position
-
-    ReverseIterator() {}
-
-    ReverseIterator(data_node_type* leaf, int idx)
-        : cur_leaf_(leaf), cur_idx_(idx) {
-      initialize();
-    }
-
-    ReverseIterator(const ReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    ReverseIterator(const Iterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    ReverseIterator& operator=(const ReverseIterator& other) {
-      if (this != &other) {
-        cur_idx_ = other.cur_idx_;
-        cur_leaf_ = other.cur_leaf_;
-        cur_bitmap_idx_ = other.cur_bitmap_idx_;
-        cur_bitmap_data_ = other.cur_bitmap_data_;
-      }
-      return *this;
-    }
-
-    ReverseIterator& operator++() {
-      advance();
-      return *this;
-    }
-
-    ReverseIterator operator++(int) {
-      ReverseIterator tmp = *this;
-      advance();
-      return tmp;
-    }
-
-#if ALEX_DATA_NODE_SEP_ARRAYS
-    // Does not return a reference because keys and payloads are stored
-    // separately.
-    // If possible, use key() and payload() instead.
-    V operator*() const {
-      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
-                            cur_leaf_->payload_slots_[cur_idx_]);
-    }
-#else
-    // If data node stores key-payload pairs contiguously, return reference to V
-    V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
-#endif
-
-    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
-
-    P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
-
-    bool is_end() const { return cur_leaf_ == nullptr; }
-
-    bool operator==(const ReverseIterator& rhs) const {
-      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
-    }
-
-    bool operator!=(const ReverseIterator& rhs) const {
-      return !(*this == rhs);
-    };
-
-   private:
-    void initialize() {
-      if (!cur_leaf_) return;
-      assert(cur_idx_ >= 0);
-      if (cur_idx_ >= cur_leaf_->data_capacity_) {
-        cur_leaf_ = cur_leaf_->next_leaf_;
-        cur_idx_ = 0;
-        if (!cur_leaf_) return;
-      }
-
-      cur_bitmap_idx_ = cur_idx_ >> 6;
-      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-
-      // Zero out extra bits
-      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
-      cur_bitmap_data_ &= (1ULL << bit_pos) | ((1ULL << bit_pos) - 1);
-
-      advance();
-    }
-
-    forceinline void advance() {
-      while (cur_bitmap_data_ == 0) {
-        cur_bitmap_idx_--;
-        if (cur_bitmap_idx_ < 0) {
-          cur_leaf_ = cur_leaf_->prev_leaf_;
-          if (cur_leaf_ == nullptr) {
-            cur_idx_ = 0;
-            return;
-          }
-          cur_idx_ = cur_leaf_->data_capacity_ - 1;
-          cur_bitmap_idx_ = cur_leaf_->bitmap_size_ - 1;
-        }
-        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-      }
-      assert(cpu_supports_bmi());
-      int bit_pos = static_cast<int>(63 - _lzcnt_u64(cur_bitmap_data_));
-      cur_idx_ = (cur_bitmap_idx_ << 6) + bit_pos;
-      cur_bitmap_data_ &= ~(1ULL << bit_pos);
-    }
-  };
-
-  class ConstReverseIterator {
-   public:
-    const data_node_type* cur_leaf_ = nullptr;  // current data node
-    int cur_idx_ = 0;         // current position in key/data_slots of data node
-    int cur_bitmap_idx_ = 0;  // current position in bitmap
-    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
-                                    // bitmap position
-
-    ConstReverseIterator() {}
-
-    ConstReverseIterator(const data_node_type* leaf, int idx)
-        : cur_leaf_(leaf), cur_idx_(idx) {
-      initialize();
-    }
-
-    ConstReverseIterator(const ConstReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    ConstReverseIterator(const ReverseIterator& other)
-        : cur_leaf_(other.cur_leaf_),
-          cur_idx_(other.cur_idx_),
-          cur_bitmap_idx_(other.cur_bitmap_idx_),
-          cur_bitmap_data_(other.cur_bitmap_data_) {}
-
-    ConstReverseIterator(const Iterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    ConstReverseIterator(const ConstIterator& other)
-        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
-      initialize();
-    }
-
-    ConstReverseIterator& operator=(const ConstReverseIterator& other) {
-      if (this != &other) {
-        cur_idx_ = other.cur_idx_;
-        cur_leaf_ = other.cur_leaf_;
-        cur_bitmap_idx_ = other.cur_bitmap_idx_;
-        cur_bitmap_data_ = other.cur_bitmap_data_;
-      }
-      return *this;
-    }
-
-    ConstReverseIterator& operator++() {
-      advance();
-      return *this;
-    }
-
-    ConstReverseIterator operator++(int) {
-      ConstReverseIterator tmp = *this;
-      advance();
-      return tmp;
-    }
-
-#if ALEX_DATA_NODE_SEP_ARRAYS
-    // Does not return a reference because keys and payloads are stored
-    // separately.
-    // If possible, use key() and payload() instead.
-    V operator*() const {
-      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
-                            cur_leaf_->payload_slots_[cur_idx_]);
-    }
-#else
-    // If data node stores key-payload pairs contiguously, return reference to V
-    const V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
-#endif
-
-    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
-
-    const P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
-
-    bool is_end() const { return cur_leaf_ == nullptr; }
-
-    bool operator==(const ConstReverseIterator& rhs) const {
-      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
-    }
-
-    bool operator!=(const ConstReverseIterator& rhs) const {
-      return !(*this == rhs);
-    };
-
-   private:
-    void initialize() {
-      if (!cur_leaf_) return;
-      assert(cur_idx_ >= 0);
-      if (cur_idx_ >= cur_leaf_->data_capacity_) {
-        cur_leaf_ = cur_leaf_->next_leaf_;
-        cur_idx_ = 0;
-        if (!cur_leaf_) return;
-      }
-
-      cur_bitmap_idx_ = cur_idx_ >> 6;
-      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-
-      // Zero out extra bits
-      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
-      cur_bitmap_data_ &= (1ULL << bit_pos) | ((1ULL << bit_pos) - 1);
-
-      advance();
-    }
-
-    forceinline void advance() {
-      while (cur_bitmap_data_ == 0) {
-        cur_bitmap_idx_--;
-        if (cur_bitmap_idx_ < 0) {
-          cur_leaf_ = cur_leaf_->prev_leaf_;
-          if (cur_leaf_ == nullptr) {
-            cur_idx_ = 0;
-            return;
-          }
-          cur_idx_ = cur_leaf_->data_capacity_ - 1;
-          cur_bitmap_idx_ = cur_leaf_->bitmap_size_ - 1;
-        }
-        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
-      }
-      assert(cpu_supports_bmi());
-      int bit_pos = static_cast<int>(63 - _lzcnt_u64(cur_bitmap_data_));
-      cur_idx_ = (cur_bitmap_idx_ << 6) + bit_pos;
-      cur_bitmap_data_ &= ~(1ULL << bit_pos);
-    }
-  };
-
-  // Iterates through all nodes with pre-order traversal
-  class NodeIterator {
-   public:
-    const self_type* index_;
-    AlexNode<T, P>* cur_node_;
-    std::stack<AlexNode<T, P>*> node_stack_;  // helps with traversal
-
-    // Start with root as cur and all children of root in stack
-    explicit NodeIterator(const self_type* index)
-        : index_(index), cur_node_(index->root_node_) {
-      if (cur_node_ && !cur_node_->is_leaf_) {
-        auto node = static_cast<model_node_type*>(cur_node_);
-        node_stack_.push(node->children_[node->num_children_ - 1]);
-        for (int i = node->num_children_ - 2; i >= 0; i--) {
-          if (node->children_[i] != node->children_[i + 1]) {
-            node_stack_.push(node->children_[i]);
-          }
-        }
-      }
-    }
-
-    AlexNode<T, P>* current() const { return cur_node_; }
-
-    AlexNode<T, P>* next() {
-      if (node_stack_.empty()) {
-        cur_node_ = nullptr;
-        return nullptr;
-      }
-
-      cur_node_ = node_stack_.top();
-      node_stack_.pop();
-
-      if (!cur_node_->is_leaf_) {
-        auto node = static_cast<model_node_type*>(cur_node_);
-        node_stack_.push(node->children_[node->num_children_ - 1]);
-        for (int i = node->num_children_ - 2; i >= 0; i--) {
-          if (node->children_[i] != node->children_[i + 1]) {
-            node_stack_.push(node->children_[i]);
-          }
-        }
-      }
-
-      return cur_node_;
-    }
-
-    bool is_end() const { return cur_node_ == nullptr; }
-  };
-};
-}  // namespace alex
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * ALEX with key type T and payload type P, combined type V=std::pair<T, P>.
+ * Iterating through keys is done using an "Iterator".
+ * Iterating through tree nodes is done using a "NodeIterator".
+ *
+ * Core user-facing API of Alex:
+ * - Alex()
+ * - void bulk_load(V values[], long long num_keys)
+ * - void insert(T key, P payload)
+ * - void upsert(T key, P payload, F combine)  // insert or update in place
+ * - int erase_one(T key)
+ * - int erase(T key)
+ * - long long erase_range(T low, T high)  // erases keys in [low, high)
+ * - Iterator find(T key)  // for exact match
+ * - Iterator begin()
+ * - Iterator end()
+ * - Iterator lower_bound(T key)
+ * - Iterator upper_bound(T key)
+ * - bool save(std::string path)
+ * - bool open_mmap(std::string path)  // uses the saved data nodes in place
+ * - void freeze()  // flat model nodes for lookups, until the tree changes
+ * - void set_defer_splits(bool)  // rebuilds large data nodes in the background
+ * - void set_track_latency(bool)  // see latency_snapshot()
+ * - void set_append_mode(bool)  // fast path for keys in increasing order
+ * - void set_lookup_cache_size(size_t)  // hot keys skip the traversal
+ * - void set_drift_threshold(double)  // rebuilds subtrees that degraded
+ * - void set_numa_replication(bool)  // frozen model nodes on every NUMA node
+ * - StructureSnapshot<T> export_structure()  // stats of all nodes
+ * - AlexSnapshot snapshot()  // read-only view for scans next to writes
+ * - size_t scan_range(T low, T high, F callback)  // called per run of keys
+ * - size_t lookup_sorted(T keys[], size_t n, P* out[])  // merge join
+ * - R aggregate_range(T low, T high, R init, Op op)
+ *
+ * User-facing API of Iterator:
+ * - void operator ++ ()  // post increment
+ * - V operator * ()  // does not return reference to V by default
+ * - const T& key ()
+ * - P& payload ()
+ * - bool is_end()
+ * - bool operator == (const Iterator & rhs)
+ * - bool operator != (const Iterator & rhs)
+ */
+
+#pragma once
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <stack>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ALEX_HAS_MMAP 1
+#else
+#define ALEX_HAS_MMAP 0
+#endif
+
+#include "alex_base.h"
+#include "alex_fanout_tree.h"
+#include "alex_latency.h"
+#include "alex_lookup_cache.h"
+#include "alex_nodes.h"
+#include "alex_numa.h"
+#include "alex_snapshot.h"
+#include "alex_structure.h"
+#include "alex_task_pool.h"
+
+// Whether we account for floating-point precision issues when traversing down
+// ALEX.
+// These issues rarely occur in practice but can cause incorrect behavior.
+// Turning this on will cause slight performance overhead due to extra
+// computation and possibly accessing two data nodes to perform a lookup.
+#define ALEX_SAFE_LOOKUP 1
+
+namespace alex {
+
+// Forward declaration
+template <class T, class P, class Compare, class Alloc, bool allow_duplicates>
+class ConcurrentAlex;
+
+template <class T, class P, class Compare = AlexCompare,
+          class Alloc = std::allocator<std::pair<T, P>>,
+          bool allow_duplicates = true, class Policy = AlexDefaultPolicy>
+class Alex {
+  static_assert(std::is_arithmetic<T>::value, "ALEX key type must be numeric.");
+  static_assert(std::is_same<Compare, AlexCompare>::value,
+                "Must use AlexCompare.");
+
+ public:
+  // Value type, returned by dereferencing an iterator
+  typedef std::pair<T, P> V;
+
+  // ALEX class aliases
+  typedef Alex<T, P, Compare, Alloc, allow_duplicates, Policy> self_type;
+  typedef AlexModelNode<T, P, Alloc> model_node_type;
+  typedef AlexDataNode<T, P, Compare, Alloc, allow_duplicates, Policy>
+      data_node_type;
+  // Read-only point-in-time view (see snapshot())
+  typedef AlexSnapshot<T, P, data_node_type> snapshot_type;
+
+  // Forward declaration for iterators
+  class Iterator;
+  class ConstIterator;
+  class ReverseIterator;
+  class ConstReverseIterator;
+  class NodeIterator;  // Iterates through all nodes with pre-order traversal
+
+  AlexNode<T, P>* root_node_ = nullptr;
+  model_node_type* superroot_ =
+      nullptr;  // phantom node that is the root's parent
+
+  /* User-changeable parameters */
+  struct Params {
+    // When bulk loading, Alex can use provided knowledge of the expected
+    // fraction of operations that will be inserts
+    // For simplicity, operations are either point lookups ("reads") or inserts
+    // ("writes)
+    // i.e., 0 means we expect a read-only workload, 1 means write-only
+    double expected_insert_frac = 1;
+    // Maximum node size, in bytes. By default, 16MB.
+    // Higher values result in better average throughput, but worse tail/max
+    // insert latency
+    long long max_node_size = 1 << 24;
+    // Approximate model computation: bulk load faster by using sampling to
+    // train models
+    bool approximate_model_computation = true;
+    // Approximate cost computation: bulk load faster by using sampling to
+    // compute cost
+    bool approximate_cost_computation = false;
+    // Number of threads used to bulk load. With more than one thread, subtrees
+    // are built in parallel, so the allocator must be thread-safe.
+    int num_bulk_load_threads = 1;
+    // Whether large data nodes that need to be expanded or split are rebuilt
+    // on a background thread instead of by the insert that found them full.
+    // Requires a thread-safe allocator. See set_defer_splits().
+    bool defer_splits = false;
+    // Bound on model_size() + data_size(), in bytes, or 0 for no bound. See
+    // set_memory_budget().
+    long long memory_budget = 0;
+    // Whether keys that are greater than all keys of the rightmost data node
+    // are appended without a traversal or shifts. See set_append_mode().
+    bool append_mode = false;
+    // Subtrees whose cost per key grows to more than this many times their
+    // cost when it was first measured are rebuilt, or 0 to never rebuild them.
+    // See set_drift_threshold().
+    double drift_threshold = 0;
+  };
+  Params params_;
+
+  /* Setting max node size automatically changes these parameters */
+  struct DerivedParams {
+    // The defaults here assume the default max node size of 16MB
+    int max_fanout = 1 << 21;  // assumes 8-byte pointers
+    int max_data_node_slots = (1 << 24) / sizeof(V);
+  };
+  DerivedParams derived_params_;
+
+  /* Counters, useful for benchmarking and profiling */
+  struct Stats {
+    long long num_keys = 0;
+    int num_model_nodes = 0;  // num model nodes
+    int num_data_nodes = 0;   // num data nodes
+    int num_expand_and_scales = 0;
+    int num_expand_and_retrains = 0;
+    int num_data_node_packs = 0;  // to fit the memory budget
+    int num_data_node_copies_on_write = 0;  // shared with snapshots
+    int num_downward_splits = 0;
+    int num_sideways_splits = 0;
+    int num_model_node_expansions = 0;
+    int num_model_node_splits = 0;
+    int num_subtree_rebuilds = 0;  // for distribution drift
+    long long num_downward_split_keys = 0;
+    long long num_sideways_split_keys = 0;
+    long long num_model_node_expansion_pointers = 0;
+    long long num_model_node_split_pointers = 0;
+    long long num_subtree_rebuild_keys = 0;
+    // Updated on the lookup path, so these are sharded by thread
+    mutable StatCounter num_node_lookups;
+    mutable StatCounter num_lookups;
+    // get_payload() lookups answered by the lookup cache, or not
+    mutable StatCounter num_lookup_cache_hits;
+    mutable StatCounter num_lookup_cache_misses;
+    long long num_inserts = 0;
+    double splitting_time = 0;
+    double cost_computation_time = 0;
+  };
+  Stats stats_;
+
+  /* These are for research purposes, a user should not change these */
+  struct ExperimentalParams {
+    // Fanout selection method used during bulk loading: 0 means use bottom-up
+    // fanout tree, 1 means top-down
+    int fanout_selection_method = 0;
+    // Policy when a data node experiences significant cost deviation.
+    // 0 means always split node in 2
+    // 1 means decide between no splitting or splitting in 2
+    // 2 means use a full fanout tree to decide the splitting strategy
+    int splitting_policy_method = 1;
+    // Splitting upwards means that a split can propagate all the way up to the
+    // root, like a B+ tree
+    // Splitting upwards can result in a better RMI, but has much more overhead
+    // than splitting sideways
+    bool allow_splitting_upwards = false;
+  };
+  ExperimentalParams experimental_params_;
+
+  /* Structs used internally */
+
+ private:
+  /* Statistics related to the key domain.
+   * The index can hold keys outside the domain, but lookups/inserts on those
+   * keys will be inefficient.
+   * If enough keys fall outside the key domain, then we expand the key domain.
+   */
+  struct InternalStats {
+    T key_domain_min_ = std::numeric_limits<T>::max();
+    T key_domain_max_ = std::numeric_limits<T>::lowest();
+    long long num_keys_above_key_domain = 0;
+    long long num_keys_below_key_domain = 0;
+    long long num_keys_at_last_right_domain_resize = 0;
+    long long num_keys_at_last_left_domain_resize = 0;
+  };
+  InternalStats istats_;
+
+  // ConcurrentAlex reads the key domain to decide whether an insert can bypass
+  // the structure modification path
+  template <class, class, class, class, bool>
+  friend class ConcurrentAlex;
+
+  /* Save the traversal path down the RMI by having a linked list of these
+   * structs. */
+  struct TraversalNode {
+    model_node_type* node = nullptr;
+    int bucketID = -1;
+  };
+
+  /* Used when finding the best way to propagate up the RMI when splitting
+   * upwards.
+   * Cost is in terms of additional model size created through splitting
+   * upwards, measured in units of pointers.
+   * One instance of this struct is created for each node on the traversal path.
+   * User should take into account the cost of metadata for new model nodes
+   * (base_cost). */
+  struct SplitDecisionCosts {
+    static constexpr double base_cost =
+        static_cast<double>(sizeof(model_node_type)) / sizeof(void*);
+    // Additional cost due to this node if propagation stops at this node.
+    // Equal to 0 if redundant slot exists, otherwise number of new pointers due
+    // to node expansion.
+    double stop_cost = 0;
+    // Additional cost due to this node if propagation continues past this node.
+    // Equal to number of new pointers due to node splitting, plus size of
+    // metadata of new model node.
+    double split_cost = 0;
+  };
+
+  // At least this many keys must be outside the domain before a domain
+  // expansion is triggered.
+  static const int kMinOutOfDomainKeys = 5;
+  // After this many keys are outside the domain, a domain expansion must be
+  // triggered.
+  static const int kMaxOutOfDomainKeys = 1000;
+  // When the number of max out-of-domain (OOD) keys is between the min and
+  // max, expand the domain if the number of OOD keys is greater than the
+  // expected number of OOD due to randomness by greater than the tolereance
+  // factor.
+  static const int kOutOfDomainToleranceFactor = 2;
+  // When inserting a sorted batch, a run of keys that falls into the same data
+  // node is merged into it with a single rebuild, unless the data node holds
+  // more than this many times as many keys as the run. In that case, the keys
+  // are inserted one at a time.
+  static const int kMaxBatchRebuildRatio = 16;
+  // Number of lookups that get_payloads() interleaves
+  static const int kLookupGroupSize = 16;
+  // lookup_sorted() traverses from the root for a key that is more than this
+  // many data nodes after the data node of the previous key
+  static const int kMaxSortedLookupHops = 2;
+
+  Compare key_less_ = Compare();
+  Alloc allocator_ = Alloc();
+
+  // File mapped by open_mmap(), which holds the slots of some data nodes
+  char* mapped_file_ = nullptr;
+  size_t mapped_file_size_ = 0;
+
+  // Read-optimized copy of the model nodes built by freeze(). Two entries share
+  // a cache line, or one with the larger fixed-point models of integral keys.
+  struct alignas(sizeof(LinearModel<T>) <= 24 ? 32 : 64) FrozenModelNode {
+    LinearModel<T> model;
+    int num_children;
+    // Index of the first child in frozen_children_
+    int first_child;
+  };
+  // Model nodes in breadth-first order, starting with the root
+  std::vector<FrozenModelNode> frozen_model_nodes_;
+  // Children of all model nodes. A non-negative entry is the index of a model
+  // node, a negative entry i refers to the data node frozen_leaves_[~i].
+  std::vector<int> frozen_children_;
+  std::vector<data_node_type*> frozen_leaves_;
+  // Copies of the flat arrays in the memory of each NUMA node, indexed by
+  // node, or none if the index is not replicated (see set_numa_replication())
+  struct FrozenReplica {
+    NumaBuffer buffer;
+    const FrozenModelNode* model_nodes = nullptr;
+    const int* children = nullptr;
+    data_node_type* const* leaves = nullptr;
+  };
+  std::vector<FrozenReplica> frozen_replicas_;
+  bool numa_replication_ = false;
+  // stats_.num_inserts when the index was last thawed
+  long long num_inserts_at_thaw_ = 0;
+
+  // Data nodes and subtrees that are being rebuilt in the background, and keys
+  // that were inserted into them in the meantime (see set_defer_splits() and
+  // set_drift_threshold())
+  struct DeferredSplit;
+  std::vector<std::unique_ptr<DeferredSplit>> deferred_splits_;
+  // Set while flush_deferred_splits() runs, so that no new rebuilds start
+  bool flushing_deferred_splits_ = false;
+
+  // stats_.num_inserts at the last density rebalance (see set_memory_budget())
+  long long num_inserts_at_rebalance_ = 0;
+  // stats_.num_inserts at the last drift check (see set_drift_threshold())
+  long long num_inserts_at_drift_check_ = 0;
+
+  // Where inserts go in append mode (see set_append_mode()). The parent is on
+  // the right edge of the tree and min_key goes into the parent, so every
+  // larger key goes into the parent as well.
+  struct AppendFinger {
+    data_node_type* leaf = nullptr;
+    model_node_type* parent = nullptr;
+    T min_key = T();
+    int position = -1;  // right after the last append to leaf
+  };
+  AppendFinger append_finger_;
+
+  // Latency histograms, or null if latency is not tracked
+  std::unique_ptr<LatencyStats> latency_stats_;
+
+  // Cache of hot keys for get_payload(), or null if there is none (see
+  // set_lookup_cache_size())
+  mutable std::unique_ptr<LookupCache<T, data_node_type>> lookup_cache_;
+  // Bumped whenever a data node is freed, which invalidates all entries of
+  // the lookup cache
+  uint32_t structure_epoch_ = 0;
+
+  // Live snapshots, or null if snapshot() was never called (see
+  // alex_snapshot.h)
+  std::shared_ptr<SnapshotRegistry> snapshot_registry_;
+  uint64_t next_snapshot_version_ = 1;
+  // Data nodes that the index no longer uses but snapshots may still read.
+  // Each is freed once no live snapshot is older than its version.
+  struct RetiredLeaf {
+    data_node_type* leaf;
+    uint64_t version;
+  };
+  std::deque<RetiredLeaf> retired_leaves_;
+
+  /*** Constructors and setters ***/
+
+ public:
+  Alex() {
+    // Set up root as empty data node
+    auto empty_data_node = new (data_node_allocator().allocate(1))
+        data_node_type(key_less_, allocator_);
+    empty_data_node->bulk_load(nullptr, 0);
+    root_node_ = empty_data_node;
+    stats_.num_data_nodes++;
+    create_superroot();
+  }
+
+  Alex(const Compare& comp, const Alloc& alloc = Alloc())
+      : key_less_(comp), allocator_(alloc) {
+    // Set up root as empty data node
+    auto empty_data_node = new (data_node_allocator().allocate(1))
+        data_node_type(key_less_, allocator_);
+    empty_data_node->bulk_load(nullptr, 0);
+    root_node_ = empty_data_node;
+    stats_.num_data_nodes++;
+    create_superroot();
+  }
+
+  Alex(const Alloc& alloc) : allocator_(alloc) {
+    // Set up root as empty data node
+    auto empty_data_node = new (data_node_allocator().allocate(1))
+        data_node_type(key_less_, allocator_);
+    empty_data_node->bulk_load(nullptr, 0);
+    root_node_ = empty_data_node;
+    stats_.num_data_nodes++;
+    create_superroot();
+  }
+
+  ~Alex() {
+    discard_deferred_splits();
+    // Snapshots must not be read after the index is destroyed, so no data
+    // node is kept for them
+    snapshot_registry_.reset();
+    if (!release_allocator(allocator_, 0)) {
+      for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+           node_it.next()) {
+        delete_node(node_it.current());
+      }
+      delete_node(superroot_);
+      reclaim_retired_leaves();
+    }
+    unmap_file();
+  }
+
+  // Initializes with range [first, last). The range does not need to be
+  // sorted. This creates a temporary copy of the data. If possible, we
+  // recommend directly using bulk_load() instead.
+  template <class InputIterator>
+  explicit Alex(InputIterator first, InputIterator last, const Compare& comp,
+                const Alloc& alloc = Alloc())
+      : key_less_(comp), allocator_(alloc) {
+    std::vector<V> values;
+    for (auto it = first; it != last; ++it) {
+      values.push_back(*it);
+    }
+    std::sort(values.begin(), values.end(),
+              [this](auto const& a, auto const& b) {
+                return key_less_(a.first, b.first);
+              });
+    bulk_load(values.data(), static_cast<long long>(values.size()));
+  }
+
+  // Initializes with range [first, last). The range does not need to be
+  // sorted. This creates a temporary copy of the data. If possible, we
+  // recommend directly using bulk_load() instead.
+  template <class InputIterator>
+  explicit Alex(InputIterator first, InputIterator last,
+                const Alloc& alloc = Alloc())
+      : allocator_(alloc) {
+    std::vector<V> values;
+    for (auto it = first; it != last; ++it) {
+      values.push_back(*it);
+    }
+    std::sort(values.begin(), values.end(),
+              [this](auto const& a, auto const& b) {
+                return key_less_(a.first, b.first);
+              });
+    bulk_load(values.data(), static_cast<long long>(values.size()));
+  }
+
+  explicit Alex(const self_type& other)
+      : params_(other.params_),
+        derived_params_(other.derived_params_),
+        stats_(other.stats_),
+        experimental_params_(other.experimental_params_),
+        istats_(other.istats_),
+        key_less_(other.key_less_),
+        allocator_(other.allocator_),
+        num_inserts_at_rebalance_(other.num_inserts_at_rebalance_),
+        num_inserts_at_drift_check_(other.num_inserts_at_drift_check_) {
+    // Keys of deferred splits are not in the tree yet. Moving them into the
+    // tree does not change the contents of other.
+    const_cast<self_type&>(other).flush_deferred_splits();
+    superroot_ =
+        static_cast<model_node_type*>(copy_tree_recursive(other.superroot_));
+    root_node_ = superroot_->children_[0];
+  }
+
+  Alex& operator=(const self_type& other) {
+    if (this != &other) {
+      const_cast<self_type&>(other).flush_deferred_splits();
+      discard_deferred_splits();
+      for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+           node_it.next()) {
+        delete_node(node_it.current());
+      }
+      delete_node(superroot_);
+      unmap_file();
+      thaw();
+      params_ = other.params_;
+      derived_params_ = other.derived_params_;
+      experimental_params_ = other.experimental_params_;
+      istats_ = other.istats_;
+      stats_ = other.stats_;
+      key_less_ = other.key_less_;
+      allocator_ = other.allocator_;
+      num_inserts_at_rebalance_ = other.num_inserts_at_rebalance_;
+      num_inserts_at_drift_check_ = other.num_inserts_at_drift_check_;
+      superroot_ =
+          static_cast<model_node_type*>(copy_tree_recursive(other.superroot_));
+      root_node_ = superroot_->children_[0];
+    }
+    return *this;
+  }
+
+  void swap(self_type& other) {
+    // Background rebuilds refer to the index that started them
+    flush_deferred_splits();
+    other.flush_deferred_splits();
+    std::swap(params_, other.params_);
+    std::swap(derived_params_, other.derived_params_);
+    std::swap(experimental_params_, other.experimental_params_);
+    std::swap(istats_, other.istats_);
+    std::swap(stats_, other.stats_);
+    std::swap(key_less_, other.key_less_);
+    std::swap(allocator_, other.allocator_);
+    std::swap(superroot_, other.superroot_);
+    std::swap(root_node_, other.root_node_);
+    std::swap(mapped_file_, other.mapped_file_);
+    std::swap(mapped_file_size_, other.mapped_file_size_);
+    std::swap(frozen_model_nodes_, other.frozen_model_nodes_);
+    std::swap(frozen_children_, other.frozen_children_);
+    std::swap(frozen_leaves_, other.frozen_leaves_);
+    std::swap(frozen_replicas_, other.frozen_replicas_);
+    std::swap(numa_replication_, other.numa_replication_);
+    std::swap(num_inserts_at_thaw_, other.num_inserts_at_thaw_);
+    std::swap(latency_stats_, other.latency_stats_);
+    std::swap(lookup_cache_, other.lookup_cache_);
+    std::swap(structure_epoch_, other.structure_epoch_);
+    std::swap(num_inserts_at_rebalance_, other.num_inserts_at_rebalance_);
+    std::swap(num_inserts_at_drift_check_, other.num_inserts_at_drift_check_);
+    std::swap(append_finger_, other.append_finger_);
+    std::swap(snapshot_registry_, other.snapshot_registry_);
+    std::swap(next_snapshot_version_, other.next_snapshot_version_);
+    std::swap(retired_leaves_, other.retired_leaves_);
+  }
+
+ private:
+  // Deep copy of tree starting at given node. The copied data nodes are
+  // linked to each other instead of to the data nodes of the original tree.
+  AlexNode<T, P>* copy_tree_recursive(const AlexNode<T, P>* node) {
+    data_node_type* prev_leaf = nullptr;
+    return copy_tree_recursive(node, prev_leaf);
+  }
+
+  // prev_leaf is the last data node copied so far, and is updated to the last
+  // data node of the copy
+  AlexNode<T, P>* copy_tree_recursive(const AlexNode<T, P>* node,
+                                      data_node_type*& prev_leaf) {
+    if (!node) return nullptr;
+    if (node->is_leaf_) {
+      auto leaf_copy = new (data_node_allocator().allocate(1))
+          data_node_type(*static_cast<const data_node_type*>(node));
+      leaf_copy->prev_leaf_ = prev_leaf;
+      leaf_copy->next_leaf_ = nullptr;
+      if (prev_leaf != nullptr) {
+        prev_leaf->next_leaf_ = leaf_copy;
+      }
+      prev_leaf = leaf_copy;
+      return leaf_copy;
+    } else {
+      auto node_copy = new (model_node_allocator().allocate(1))
+          model_node_type(*static_cast<const model_node_type*>(node));
+      int cur = 0;
+      while (cur < node_copy->num_children_) {
+        AlexNode<T, P>* child_node = node_copy->children_[cur];
+        AlexNode<T, P>* child_node_copy =
+            copy_tree_recursive(child_node, prev_leaf);
+        int repeats = 1 << child_node_copy->duplication_factor_;
+        for (int i = cur; i < cur + repeats; i++) {
+          node_copy->children_[i] = child_node_copy;
+        }
+        cur += repeats;
+      }
+      return node_copy;
+    }
+  }
+
+ public:
+  // When bulk loading, Alex can use provided knowledge of the expected fraction
+  // of operations that will be inserts
+  // For simplicity, operations are either point lookups ("reads") or inserts
+  // ("writes)
+  // i.e., 0 means we expect a read-only workload, 1 means write-only
+  // This is only useful if you set it before bulk loading
+  void set_expected_insert_frac(double expected_insert_frac) {
+    assert(expected_insert_frac >= 0 && expected_insert_frac <= 1);
+    params_.expected_insert_frac = expected_insert_frac;
+  }
+
+  // Maximum node size, in bytes.
+  // Higher values result in better average throughput, but worse tail/max
+  // insert latency.
+  // Positions within a node are ints, so nodes have at most 2^30 slots or
+  // children even if the max node size allows more. The index as a whole can
+  // hold more keys than an int counts.
+  void set_max_node_size(long long max_node_size) {
+    assert(max_node_size >= static_cast<long long>(sizeof(V)));
+    params_.max_node_size = max_node_size;
+    derived_params_.max_fanout = static_cast<int>(
+        std::min<long long>(params_.max_node_size / sizeof(void*),
+                            data_node_type::kMaxSlots_));
+    derived_params_.max_data_node_slots = static_cast<int>(
+        std::min<long long>(params_.max_node_size / sizeof(V),
+                            data_node_type::kMaxSlots_));
+  }
+
+  // Bulk load faster by using sampling to train models.
+  // This is only useful if you set it before bulk loading.
+  void set_approximate_model_computation(bool approximate_model_computation) {
+    params_.approximate_model_computation = approximate_model_computation;
+  }
+
+  // Bulk load faster by using sampling to compute cost.
+  // This is only useful if you set it before bulk loading.
+  void set_approximate_cost_computation(bool approximate_cost_computation) {
+    params_.approximate_cost_computation = approximate_cost_computation;
+  }
+
+  // Bulk load with multiple threads. The resulting index is the same as with
+  // one thread. Requires a thread-safe allocator, such as std::allocator or
+  // ArenaAllocator.
+  // This is only useful if you set it before bulk loading.
+  void set_num_bulk_load_threads(int num_bulk_load_threads) {
+    assert(num_bulk_load_threads >= 1);
+    params_.num_bulk_load_threads = num_bulk_load_threads;
+  }
+
+  // Bounds the latency of inserts into large data nodes. When an insert finds
+  // a data node of at least kMinDeferredSplitKeys keys that must be expanded
+  // or split, the data node is copied into a new subtree on a background
+  // thread, as bulk loading would build it. Until the subtree replaces the
+  // data node, inserts into it go to a sorted side buffer, which get_payload()
+  // also searches. Subtrees are swapped in by later inserts, which then move a
+  // few buffered keys per insert into the tree.
+  // Buffered keys are not visible to find(), iterators and range scans until
+  // they are moved into the tree. Inserts that find a full buffer, or too many
+  // pending rebuilds, wait for a rebuild to finish. Requires a thread-safe
+  // allocator, such as std::allocator or ArenaAllocator.
+  void set_defer_splits(bool defer_splits) {
+    if (!defer_splits) {
+      flush_deferred_splits();
+    }
+    params_.defer_splits = defer_splits;
+  }
+
+  // Records the latency of every lookup, insert, erase and range scan, and of
+  // the phases of inserts, into histograms (see latency_snapshot()). Each
+  // operation reads the clock twice, and each insert phase once more.
+  // Turning tracking off drops the histograms. Copies of the index do not
+  // track latency.
+  void set_track_latency(bool track_latency) {
+    if (!track_latency) {
+      latency_stats_.reset();
+    } else if (!latency_stats_) {
+      latency_stats_.reset(new LatencyStats());
+    }
+  }
+
+  // Bounds model_size() + data_size() to memory_budget bytes, or removes the
+  // bound if memory_budget is 0. Data nodes normally keep 20-40% of their
+  // slots free for inserts. To fit the budget, data nodes that received few
+  // inserts since the last check are packed to a density of
+  // data_node_type::kPackedDensity_, coldest first (see rebalance_density()).
+  // Data nodes that receive many inserts keep their gaps, and packed data nodes
+  // that fill up expand as usual, so density follows where inserts go.
+  // Lookups do not count, since gaps only speed up inserts. The budget is
+  // checked once every kMinRebalanceInterval inserts or one insert per data
+  // node, whichever is more, so it can be exceeded in between, or if too few
+  // data nodes are cold.
+  void set_memory_budget(long long memory_budget) {
+    params_.memory_budget = memory_budget;
+    if (memory_budget > 0) {
+      rebalance_density();
+    }
+  }
+
+  // Rebuilds subtrees whose keys became more expensive to reach and search
+  // than when the subtree was first measured, or stops doing so if
+  // drift_threshold is 0. Inserts whose distribution drifts away from the
+  // bulk loaded keys grow subtrees by local splits, which can make them much
+  // deeper and less accurate than bulk loading the same keys would. The cost
+  // of a subtree is its expected number of node lookups and search iterations
+  // per key, using the empirical cost of data nodes that had operations (see
+  // rebuild_drifted_subtrees()). A subtree whose cost grows to more than
+  // drift_threshold times its first measured cost is rebuilt from its keys on
+  // a background thread, as set_defer_splits() rebuilds data nodes, and the
+  // rebuilt subtree is measured anew. The subtrees are checked once every
+  // kMinDriftCheckInterval inserts or one insert per data node, whichever is
+  // more, so checks take amortized constant time. Requires a thread-safe
+  // allocator for subtrees of at least kMinDeferredSplitKeys keys.
+  void set_drift_threshold(double drift_threshold) {
+    params_.drift_threshold = drift_threshold;
+    if (drift_threshold > 0) {
+      rebuild_drifted_subtrees();
+    }
+  }
+
+  // Speeds up inserts of keys in increasing order, such as timestamps or
+  // sequence numbers. The index keeps a finger on the data node at the right
+  // edge of the tree, and a key that is greater than all keys of that data
+  // node is written right after its last key, without a traversal, shifts or
+  // resizes. When the last slot of the data node is filled, it is sealed: its
+  // model is fit to its keys, without moving them. The child pointers of its
+  // parent that the next keys go to are split off into new data nodes that
+  // cover 1, 2, 4, ... pointers, up to the pointers that the data node kept.
+  // The new data node that the next key goes to is allocated up front with
+  // twice as many slots as the sealed data node has keys, so data nodes grow
+  // geometrically and no keys are copied. Keys outside the key domain, and
+  // data nodes that cannot be split this way, take the usual insert path,
+  // which also moves the finger to where keys are appended.
+  void set_append_mode(bool append_mode) {
+    params_.append_mode = append_mode;
+    append_finger_ = AppendFinger();
+  }
+
+  // Puts a cache of at least num_entries hot keys in front of get_payload(),
+  // or removes the cache if num_entries is 0. The cache is set-associative
+  // with one cache line per set, and remembers the data node and position of
+  // recently found keys, so a hit skips the traversal and the search. Entries
+  // are checked against epochs that change when keys of their data node move
+  // or data nodes are freed, so inserts and erases never make the cache
+  // return a wrong payload (see alex_lookup_cache.h). Hits and misses are
+  // counted in get_stats(). Lookups fill the cache, so with a cache, lookups
+  // must not run concurrently with each other. Copies of the index do not
+  // have a cache.
+  void set_lookup_cache_size(size_t num_entries) {
+    if (num_entries == 0) {
+      lookup_cache_.reset();
+    } else {
+      lookup_cache_.reset(new LookupCache<T, data_node_type>(num_entries));
+    }
+  }
+
+  // Keeps the index frozen (see freeze()) with one copy of the flat model
+  // node arrays in the memory of each NUMA node, so that lookups on every
+  // node traverse local memory instead of the memory of the node that built
+  // the tree. Lookups read the copy of the node they run on (see
+  // current_numa_node() in alex_numa.h), which takes no system call in
+  // threads pinned with pin_thread_to_numa_node(). Changes to the structure
+  // of the tree thaw the index and drop the copies, so they never disagree
+  // with the model nodes. Lookups then traverse the model nodes until the
+  // index is frozen again, which inserts do once every kMinRefreezeInterval
+  // inserts or one insert per data node after the thaw, whichever is more.
+  // Call freeze() to freeze it earlier. Only the model nodes are copied, so
+  // data nodes should be placed with ArenaOptions::numa_node. Has no effect
+  // on machines with one NUMA node. Copies of the index are not replicated.
+  void set_numa_replication(bool numa_replication) {
+    numa_replication_ = numa_replication;
+    if (numa_replication) {
+      freeze();
+    } else {
+      frozen_replicas_ = std::vector<FrozenReplica>();
+    }
+  }
+
+  /*** General helpers ***/
+
+ public:
+// Return the data node that contains the key (if it exists).
+// Also optionally return the traversal path to the data node.
+// traversal_path should be empty when calling this function.
+// The returned traversal path begins with superroot and ends with the data
+// node's parent.
+#if ALEX_SAFE_LOOKUP
+  forceinline data_node_type* get_leaf(
+      T key, std::vector<TraversalNode>* traversal_path = nullptr) const {
+    if (traversal_path) {
+      traversal_path->push_back({superroot_, 0});
+    } else if (is_frozen()) {
+      return get_leaf_frozen(key);
+    }
+    AlexNode<T, P>* cur = root_node_;
+    if (cur->is_leaf_) {
+      return static_cast<data_node_type*>(cur);
+    }
+
+    while (true) {
+      auto node = static_cast<model_node_type*>(cur);
+      double bucketID_prediction = node->model_.predict_double(key);
+      int bucketID = static_cast<int>(bucketID_prediction);
+      bucketID =
+          std::min<int>(std::max<int>(bucketID, 0), node->num_children_ - 1);
+      if (traversal_path) {
+        traversal_path->push_back({node, bucketID});
+      }
+      cur = node->children_[bucketID];
+      if (cur->is_leaf_) {
+        stats_.num_node_lookups += cur->level_;
+        return correct_leaf(static_cast<data_node_type*>(cur), key,
+                            bucketID_prediction, traversal_path);
+      }
+    }
+  }
+#else
+  data_node_type* get_leaf(
+      T key, std::vector<TraversalNode>* traversal_path = nullptr) const {
+    if (traversal_path) {
+      traversal_path->push_back({superroot_, 0});
+    } else if (is_frozen()) {
+      return get_leaf_frozen(key);
+    }
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      auto node = static_cast<model_node_type*>(cur);
+      int bucketID = node->model_.predict(key);
+      bucketID =
+          std::min<int>(std::max<int>(bucketID, 0), node->num_children_ - 1);
+      if (traversal_path) {
+        traversal_path->push_back({node, bucketID});
+      }
+      cur = node->children_[bucketID];
+    }
+
+    stats_.num_node_lookups += cur->level_;
+    return static_cast<data_node_type*>(cur);
+  }
+#endif
+
+ private:
+#if ALEX_SAFE_LOOKUP
+  // If the bucket prediction in the parent model node that led to leaf is
+  // close to a bucket boundary, floating-point precision issues may have sent
+  // the key to the wrong neighbor. Returns the data node that actually
+  // contains the key, and corrects the traversal path if one is given.
+  forceinline data_node_type* correct_leaf(
+      data_node_type* leaf, T key, double bucketID_prediction,
+      std::vector<TraversalNode>* traversal_path = nullptr) const {
+    // Doesn't really matter if rounding is incorrect, we just want it to be
+    // fast.
+    // So we don't need to use std::round or std::lround.
+    int bucketID_prediction_rounded =
+        static_cast<int>(bucketID_prediction + 0.5);
+    double tolerance =
+        10 * std::numeric_limits<double>::epsilon() * bucketID_prediction +
+        LinearModel<T>::kPredictionError;
+    // https://stackoverflow.com/questions/17333/what-is-the-most-effective-way-for-float-and-double-comparison
+    if (std::abs(bucketID_prediction - bucketID_prediction_rounded) <=
+        tolerance) {
+      if (bucketID_prediction_rounded <= bucketID_prediction) {
+        if (leaf->prev_leaf_ && leaf->prev_leaf_->last_key() >= key) {
+          if (traversal_path) {
+            // Correct the traversal path
+            correct_traversal_path(leaf, *traversal_path, true);
+          }
+          return leaf->prev_leaf_;
+        }
+      } else {
+        if (leaf->next_leaf_ && leaf->next_leaf_->first_key() <= key) {
+          if (traversal_path) {
+            // Correct the traversal path
+            correct_traversal_path(leaf, *traversal_path, false);
+          }
+          return leaf->next_leaf_;
+        }
+      }
+    }
+    return leaf;
+  }
+#endif
+
+  // Make a correction to the traversal path to instead point to the leaf node
+  // that is to the left or right of the current leaf node.
+  inline void correct_traversal_path(data_node_type* leaf,
+                                     std::vector<TraversalNode>& traversal_path,
+                                     bool left) const {
+    if (left) {
+      int repeats = 1 << leaf->duplication_factor_;
+      TraversalNode& tn = traversal_path.back();
+      model_node_type* parent = tn.node;
+      // First bucket whose pointer is to leaf
+      int start_bucketID = tn.bucketID - (tn.bucketID % repeats);
+      if (start_bucketID == 0) {
+        // Traverse back up the traversal path to make correction
+        while (start_bucketID == 0) {
+          traversal_path.pop_back();
+          repeats = 1 << parent->duplication_factor_;
+          tn = traversal_path.back();
+          parent = tn.node;
+          start_bucketID = tn.bucketID - (tn.bucketID % repeats);
+        }
+        int correct_bucketID = start_bucketID - 1;
+        tn.bucketID = correct_bucketID;
+        AlexNode<T, P>* cur = parent->children_[correct_bucketID];
+        while (!cur->is_leaf_) {
+          auto node = static_cast<model_node_type*>(cur);
+          traversal_path.push_back({node, node->num_children_ - 1});
+          cur = node->children_[node->num_children_ - 1];
+        }
+        assert(cur == leaf->prev_leaf_);
+      } else {
+        tn.bucketID = start_bucketID - 1;
+      }
+    } else {
+      int repeats = 1 << leaf->duplication_factor_;
+      TraversalNode& tn = traversal_path.back();
+      model_node_type* parent = tn.node;
+      // First bucket whose pointer is not to leaf
+      int end_bucketID = tn.bucketID - (tn.bucketID % repeats) + repeats;
+      if (end_bucketID == parent->num_children_) {
+        // Traverse back up the traversal path to make correction
+        while (end_bucketID == parent->num_children_) {
+          traversal_path.pop_back();
+          repeats = 1 << parent->duplication_factor_;
+          tn = traversal_path.back();
+          parent = tn.node;
+          end_bucketID = tn.bucketID - (tn.bucketID % repeats) + repeats;
+        }
+        int correct_bucketID = end_bucketID;
+        tn.bucketID = correct_bucketID;
+        AlexNode<T, P>* cur = parent->children_[correct_bucketID];
+        while (!cur->is_leaf_) {
+          auto node = static_cast<model_node_type*>(cur);
+          traversal_path.push_back({node, 0});
+          cur = node->children_[0];
+        }
+        assert(cur == leaf->next_leaf_);
+      } else {
+        tn.bucketID = end_bucketID;
+      }
+    }
+  }
+
+  // Return left-most data node
+  data_node_type* first_data_node() const {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      cur = static_cast<model_node_type*>(cur)->children_[0];
+    }
+    return static_cast<data_node_type*>(cur);
+  }
+
+  // Return right-most data node
+  data_node_type* last_data_node() const {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      auto node = static_cast<model_node_type*>(cur);
+      cur = node->children_[node->num_children_ - 1];
+    }
+    return static_cast<data_node_type*>(cur);
+  }
+
+  // Returns minimum key in the index
+  T get_min_key() const { return first_data_node()->first_key(); }
+
+  // Returns maximum key in the index
+  T get_max_key() const { return last_data_node()->last_key(); }
+
+  // Link all data nodes together. Used after bulk loading.
+  void link_all_data_nodes() {
+    data_node_type* prev_leaf = nullptr;
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      AlexNode<T, P>* cur = node_it.current();
+      if (cur->is_leaf_) {
+        auto node = static_cast<data_node_type*>(cur);
+        if (prev_leaf != nullptr) {
+          prev_leaf->next_leaf_ = node;
+          node->prev_leaf_ = prev_leaf;
+        }
+        prev_leaf = node;
+      }
+    }
+  }
+
+  // Link the new data nodes together when old data node is replaced by two new
+  // data nodes.
+  void link_data_nodes(const data_node_type* old_leaf,
+                       data_node_type* left_leaf, data_node_type* right_leaf) {
+    if (old_leaf->prev_leaf_ != nullptr) {
+      old_leaf->prev_leaf_->next_leaf_ = left_leaf;
+    }
+    left_leaf->prev_leaf_ = old_leaf->prev_leaf_;
+    left_leaf->next_leaf_ = right_leaf;
+    right_leaf->prev_leaf_ = left_leaf;
+    right_leaf->next_leaf_ = old_leaf->next_leaf_;
+    if (old_leaf->next_leaf_ != nullptr) {
+      old_leaf->next_leaf_->prev_leaf_ = right_leaf;
+    }
+  }
+
+  /*** Allocators and comparators ***/
+
+ public:
+  Alloc get_allocator() const { return allocator_; }
+
+  Compare key_comp() const { return key_less_; }
+
+ private:
+  typename model_node_type::alloc_type model_node_allocator() {
+    return typename model_node_type::alloc_type(allocator_);
+  }
+
+  typename data_node_type::alloc_type data_node_allocator() {
+    return typename data_node_type::alloc_type(allocator_);
+  }
+
+  typename model_node_type::pointer_alloc_type pointer_allocator() {
+    return typename model_node_type::pointer_alloc_type(allocator_);
+  }
+
+  void delete_node(AlexNode<T, P>* node) {
+    if (node == append_finger_.leaf || node == append_finger_.parent) {
+      append_finger_ = AppendFinger();
+    }
+    if (node == nullptr) {
+      return;
+    } else if (node->is_leaf_) {
+      structure_epoch_++;
+      auto leaf = static_cast<data_node_type*>(node);
+      if (is_shared(leaf)) {
+        retire_leaf(leaf);
+      } else {
+        data_node_allocator().destroy(leaf);
+        data_node_allocator().deallocate(leaf, 1);
+      }
+    } else {
+      delete_unlinked_model_node(node);
+    }
+  }
+
+  // Frees a model node that was never part of the tree, such as the node that
+  // bulk_load_node() replaces. Unlike delete_node(), this touches no state of
+  // the index, so bulk load tasks and deferred split workers can call it.
+  void delete_unlinked_model_node(AlexNode<T, P>* node) {
+    model_node_allocator().destroy(static_cast<model_node_type*>(node));
+    model_node_allocator().deallocate(static_cast<model_node_type*>(node), 1);
+  }
+
+  // Frees the memory of all nodes at once, if the allocator supports it (see
+  // ArenaAllocator::release_all()). Returns false if the nodes must be deleted
+  // one by one.
+  template <class A>
+  static auto release_allocator(A& alloc, int)
+      -> decltype(alloc.release_all()) {
+    return alloc.release_all();
+  }
+
+  template <class A>
+  static bool release_allocator(A&, long) {
+    return false;
+  }
+
+  // True if a == b
+  template <class K>
+  forceinline bool key_equal(const T& a, const K& b) const {
+    return !key_less_(a, b) && !key_less_(b, a);
+  }
+
+  /*** Bulk loading ***/
+
+ public:
+  // values should be the sorted array of key-payload pairs.
+  // The number of elements should be num_keys.
+  // The index must be empty when calling this method.
+  void bulk_load(const V values[], long long num_keys) {
+    if (stats_.num_keys > 0 || num_keys <= 0) {
+      return;
+    }
+    thaw();
+    delete_node(root_node_);  // delete the empty root node from constructor
+
+    stats_.num_keys = num_keys;
+
+    // Build temporary root model, which outputs a CDF in the range [0, 1]
+    root_node_ =
+        new (model_node_allocator().allocate(1)) model_node_type(0, allocator_);
+    T min_key = values[0].first;
+    T max_key = values[num_keys - 1].first;
+    root_node_->model_.set_anchored(1.0 / (max_key - min_key), min_key, 0);
+
+    // Compute cost of root node
+    LinearModel<T> root_data_node_model;
+    data_node_type::build_model(values, num_keys, &root_data_node_model,
+                                params_.approximate_model_computation);
+    DataNodeStats stats;
+    root_node_->cost_ = data_node_type::compute_expected_cost(
+        values, num_keys, data_node_type::kInitDensity_,
+        params_.expected_insert_frac, &root_data_node_model,
+        params_.approximate_cost_computation, &stats);
+
+    // Recursively bulk load
+    std::unique_ptr<TaskPool> pool;
+    if (params_.num_bulk_load_threads > 1) {
+      pool.reset(new TaskPool(params_.num_bulk_load_threads));
+    }
+    BulkLoadCounts counts;
+    bulk_load_node(values, num_keys, root_node_, num_keys, counts,
+                   &root_data_node_model, pool.get());
+    stats_.num_model_nodes += counts.num_model_nodes;
+    stats_.num_data_nodes += counts.num_data_nodes;
+
+    if (root_node_->is_leaf_) {
+      static_cast<data_node_type*>(root_node_)
+          ->expected_avg_exp_search_iterations_ = stats.num_search_iterations;
+      static_cast<data_node_type*>(root_node_)->expected_avg_shifts_ =
+          stats.num_shifts;
+    }
+
+    create_superroot();
+    update_superroot_key_domain();
+    link_all_data_nodes();
+  }
+
+ private:
+  // Only call this after creating a root node
+  void create_superroot() {
+    if (!root_node_) return;
+    delete_node(superroot_);
+    superroot_ = new (model_node_allocator().allocate(1))
+        model_node_type(static_cast<short>(root_node_->level_ - 1), allocator_);
+    superroot_->num_children_ = 1;
+    superroot_->children_ =
+        new (pointer_allocator().allocate(1)) AlexNode<T, P>*[1];
+    update_superroot_pointer();
+  }
+
+  // Updates the key domain based on the min/max keys and retrains the model.
+  // Should only be called immediately after bulk loading or when the root node
+  // is a data node.
+  void update_superroot_key_domain() {
+    assert(stats_.num_inserts == 0 || root_node_->is_leaf_);
+    istats_.key_domain_min_ = get_min_key();
+    istats_.key_domain_max_ = get_max_key();
+    istats_.num_keys_at_last_right_domain_resize = stats_.num_keys;
+    istats_.num_keys_at_last_left_domain_resize = stats_.num_keys;
+    istats_.num_keys_above_key_domain = 0;
+    istats_.num_keys_below_key_domain = 0;
+    superroot_->model_.set_anchored(
+        1.0 / (istats_.key_domain_max_ - istats_.key_domain_min_),
+        istats_.key_domain_min_, 0);
+  }
+
+  void update_superroot_pointer() {
+    superroot_->children_[0] = root_node_;
+    superroot_->level_ = static_cast<short>(root_node_->level_ - 1);
+  }
+
+  // Children with at least this many keys are bulk loaded as separate tasks
+  static const int kMinParallelBulkLoadKeys = 1 << 16;
+
+  // Nodes created by bulk_load_node(), which are added to stats_ once all
+  // subtrees are built, so that parallel tasks do not write to stats_
+  struct BulkLoadCounts {
+    int num_model_nodes = 0;
+    int num_data_nodes = 0;
+  };
+
+  // Recursively bulk load a single node.
+  // Assumes node has already been trained to output [0, 1), has cost.
+  // Figures out the optimal partitioning of children.
+  // node is trained as if it's a model node. It must not be part of the tree
+  // yet, and is freed and replaced by the new node.
+  // data_node_model is what the node's model would be if it were a data node of
+  // dense keys.
+  // If pool is given, large children are bulk loaded in parallel.
+  void bulk_load_node(const V values[], long long num_keys,
+                      AlexNode<T, P>*& node, long long total_keys,
+                      BulkLoadCounts& counts,
+                      const LinearModel<T>* data_node_model = nullptr,
+                      TaskPool* pool = nullptr) {
+    // Automatically convert to data node when it is impossible to be better
+    // than current cost
+    if (num_keys <= derived_params_.max_data_node_slots *
+                        data_node_type::kInitDensity_ &&
+        (node->cost_ < kNodeLookupsWeight || node->model_.a() == 0)) {
+      counts.num_data_nodes++;
+      auto data_node = new (data_node_allocator().allocate(1))
+          data_node_type(node->level_, derived_params_.max_data_node_slots,
+                         key_less_, allocator_);
+      data_node->bulk_load(values, static_cast<int>(num_keys), data_node_model,
+                           params_.approximate_model_computation);
+      data_node->cost_ = node->cost_;
+      delete_unlinked_model_node(node);
+      node = data_node;
+      return;
+    }
+
+    // Use a fanout tree to determine the best way to divide the key space into
+    // child nodes
+    std::vector<fanout_tree::FTNode> used_fanout_tree_nodes;
+    std::pair<int, double> best_fanout_stats;
+    if (experimental_params_.fanout_selection_method == 0) {
+      int max_data_node_keys = static_cast<int>(
+          derived_params_.max_data_node_slots * data_node_type::kInitDensity_);
+      best_fanout_stats = fanout_tree::find_best_fanout_bottom_up<
+          T, P, Compare, data_node_type>(
+          values, num_keys, node, total_keys, used_fanout_tree_nodes,
+          derived_params_.max_fanout, max_data_node_keys,
+          params_.expected_insert_frac, params_.approximate_model_computation,
+          params_.approximate_cost_computation, key_less_, pool);
+    } else if (experimental_params_.fanout_selection_method == 1) {
+      best_fanout_stats = fanout_tree::find_best_fanout_top_down<
+          T, P, Compare, data_node_type>(
+          values, num_keys, node, total_keys, used_fanout_tree_nodes,
+          derived_params_.max_fanout, params_.expected_insert_frac,
+          params_.approximate_model_computation,
+          params_.approximate_cost_computation, key_less_);
+    }
+    int best_fanout_tree_depth = best_fanout_stats.first;
+    double best_fanout_tree_cost = best_fanout_stats.second;
+
+    // Decide whether this node should be a model node or data node
+    if (best_fanout_tree_cost < node->cost_ ||
+        num_keys > derived_params_.max_data_node_slots *
+                       data_node_type::kInitDensity_) {
+      // Convert to model node based on the output of the fanout tree
+      counts.num_model_nodes++;
+      auto model_node = new (model_node_allocator().allocate(1))
+          model_node_type(node->level_, allocator_);
+      if (best_fanout_tree_depth == 0) {
+        // slightly hacky: we assume this means that the node is relatively
+        // uniform but we need to split in
+        // order to satisfy the max node size, so we compute the fanout that
+        // would satisfy that condition
+        // in expectation
+        best_fanout_tree_depth =
+            static_cast<int>(std::log2(static_cast<double>(num_keys) /
+                                       derived_params_.max_data_node_slots)) +
+            1;
+        used_fanout_tree_nodes.clear();
+        int max_data_node_keys = static_cast<int>(
+            derived_params_.max_data_node_slots * data_node_type::kInitDensity_);
+        fanout_tree::compute_level<T, P, std::less<T>, data_node_type>(
+            values, num_keys, node, total_keys, used_fanout_tree_nodes,
+            best_fanout_tree_depth, max_data_node_keys,
+            params_.expected_insert_frac, params_.approximate_model_computation,
+            params_.approximate_cost_computation, std::less<T>(), pool);
+      }
+      int fanout = 1 << best_fanout_tree_depth;
+      // Same model that compute_level() partitioned the keys with
+      model_node->model_ = node->model_;
+      model_node->model_.expand(fanout);
+      model_node->num_children_ = fanout;
+      model_node->children_ =
+          new (pointer_allocator().allocate(fanout)) AlexNode<T, P>*[fanout];
+
+      // Instantiate all the child nodes and recurse
+      TaskPool::TaskGroup children_group;
+      std::vector<BulkLoadCounts> children_counts;
+      if (pool != nullptr) {
+        children_counts.resize(used_fanout_tree_nodes.size());
+      }
+      int cur = 0;
+      for (size_t child_idx = 0; child_idx < used_fanout_tree_nodes.size();
+           child_idx++) {
+        const fanout_tree::FTNode& tree_node =
+            used_fanout_tree_nodes[child_idx];
+        auto child_node = new (model_node_allocator().allocate(1))
+            model_node_type(static_cast<short>(node->level_ + 1), allocator_);
+        child_node->cost_ = tree_node.cost;
+        child_node->duplication_factor_ =
+            static_cast<uint8_t>(best_fanout_tree_depth - tree_node.level);
+        int repeats = 1 << child_node->duplication_factor_;
+        double left_value = static_cast<double>(cur) / fanout;
+        double right_value = static_cast<double>(cur + repeats) / fanout;
+        long double left_boundary = node->model_.inverse(left_value);
+        long double right_boundary = node->model_.inverse(right_value);
+        child_node->model_.set_anchored(
+            static_cast<double>(1 / (right_boundary - left_boundary)),
+            left_boundary, 0);
+        model_node->children_[cur] = child_node;
+        // The child is built by a separate task if it is large enough, which
+        // fills in all of its duplicate pointers
+        auto build_child = [this, values, total_keys, model_node, cur, repeats,
+                            best_fanout_tree_depth, tree_node,
+                            pool](BulkLoadCounts& child_counts) {
+          LinearModel<T> child_data_node_model(tree_node.a, tree_node.anchor,
+                                               tree_node.b);
+          bulk_load_node(values + tree_node.left_boundary,
+                         tree_node.right_boundary - tree_node.left_boundary,
+                         model_node->children_[cur], total_keys, child_counts,
+                         &child_data_node_model, pool);
+          model_node->children_[cur]->duplication_factor_ =
+              static_cast<uint8_t>(best_fanout_tree_depth - tree_node.level);
+          if (model_node->children_[cur]->is_leaf_) {
+            static_cast<data_node_type*>(model_node->children_[cur])
+                ->expected_avg_exp_search_iterations_ =
+                tree_node.expected_avg_search_iterations;
+            static_cast<data_node_type*>(model_node->children_[cur])
+                ->expected_avg_shifts_ = tree_node.expected_avg_shifts;
+          }
+          for (int i = cur + 1; i < cur + repeats; i++) {
+            model_node->children_[i] = model_node->children_[cur];
+          }
+        };
+        if (pool != nullptr && tree_node.num_keys >= kMinParallelBulkLoadKeys) {
+          BulkLoadCounts* child_counts = &children_counts[child_idx];
+          pool->spawn(children_group, [build_child, child_counts] {
+            build_child(*child_counts);
+          });
+        } else {
+          build_child(counts);
+        }
+        cur += repeats;
+      }
+      if (pool != nullptr) {
+        pool->wait(children_group);
+        for (const BulkLoadCounts& child_counts : children_counts) {
+          counts.num_model_nodes += child_counts.num_model_nodes;
+          counts.num_data_nodes += child_counts.num_data_nodes;
+        }
+      }
+
+      delete_unlinked_model_node(node);
+      node = model_node;
+    } else {
+      // Convert to data node
+      counts.num_data_nodes++;
+      auto data_node = new (data_node_allocator().allocate(1))
+          data_node_type(node->level_, derived_params_.max_data_node_slots,
+                         key_less_, allocator_);
+      data_node->bulk_load(values, static_cast<int>(num_keys), data_node_model,
+                           params_.approximate_model_computation);
+      data_node->cost_ = node->cost_;
+      delete_unlinked_model_node(node);
+      node = data_node;
+    }
+  }
+
+  // Caller needs to set the level, duplication factor, and neighbor pointers of
+  // the returned data node
+  data_node_type* bulk_load_leaf_node_from_existing(
+      const data_node_type* existing_node, int left, int right,
+      bool compute_cost = true, const fanout_tree::FTNode* tree_node = nullptr,
+      bool reuse_model = false, bool keep_left = false,
+      bool keep_right = false) {
+    auto node = new (data_node_allocator().allocate(1))
+        data_node_type(key_less_, allocator_);
+    stats_.num_data_nodes++;
+    if (tree_node) {
+      // Use the model and num_keys saved in the tree node so we don't have to
+      // recompute it
+      LinearModel<T> precomputed_model(tree_node->a, tree_node->anchor,
+                                       tree_node->b);
+      node->bulk_load_from_existing(existing_node, left, right, keep_left,
+                                    keep_right, &precomputed_model,
+                                    static_cast<int>(tree_node->num_keys));
+    } else if (reuse_model) {
+      // Use the model from the existing node
+      // Assumes the model is accurate
+      int num_actual_keys = existing_node->num_keys_in_range(left, right);
+      LinearModel<T> precomputed_model(existing_node->model_);
+      precomputed_model.shift(-left);
+      precomputed_model.expand(static_cast<double>(num_actual_keys) /
+                               (right - left));
+      node->bulk_load_from_existing(existing_node, left, right, keep_left,
+                                    keep_right, &precomputed_model,
+                                    num_actual_keys);
+    } else {
+      node->bulk_load_from_existing(existing_node, left, right, keep_left,
+                                    keep_right);
+    }
+    node->max_slots_ = derived_params_.max_data_node_slots;
+    if (compute_cost) {
+      node->cost_ = node->compute_expected_cost(existing_node->frac_inserts());
+    }
+    return node;
+  }
+
+  /*** Lookup ***/
+
+ public:
+  // Looks for an exact match of the key
+  // If the key does not exist, returns an end iterator
+  // If there are multiple keys with the same value, returns an iterator to the
+  // right-most key
+  // If you instead want an iterator to the left-most key with the input value,
+  // use lower_bound()
+  typename self_type::Iterator find(const T& key) {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_key(key);
+    if (idx < 0) {
+      return end();
+    } else {
+      return Iterator(leaf, idx);
+    }
+  }
+
+  typename self_type::ConstIterator find(const T& key) const {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_key(key);
+    if (idx < 0) {
+      return cend();
+    } else {
+      return ConstIterator(leaf, idx);
+    }
+  }
+
+  size_t count(const T& key) {
+    ConstIterator it = lower_bound(key);
+    size_t num_equal = 0;
+    while (!it.is_end() && key_equal(it.key(), key)) {
+      num_equal++;
+      ++it;
+    }
+    return num_equal;
+  }
+
+  // Returns an iterator to the first key no less than the input value
+  typename self_type::Iterator lower_bound(const T& key) {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_lower(key);
+    return Iterator(leaf, idx);  // automatically handles the case where idx ==
+                                 // leaf->data_capacity
+  }
+
+  typename self_type::ConstIterator lower_bound(const T& key) const {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_lower(key);
+    return ConstIterator(leaf, idx);  // automatically handles the case where
+                                      // idx == leaf->data_capacity
+  }
+
+  // Returns an iterator to the first key greater than the input value
+  typename self_type::Iterator upper_bound(const T& key) {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_upper(key);
+    return Iterator(leaf, idx);  // automatically handles the case where idx ==
+                                 // leaf->data_capacity
+  }
+
+  typename self_type::ConstIterator upper_bound(const T& key) const {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    int idx = leaf->find_upper(key);
+    return ConstIterator(leaf, idx);  // automatically handles the case where
+                                      // idx == leaf->data_capacity
+  }
+
+  std::pair<Iterator, Iterator> equal_range(const T& key) {
+    return std::pair<Iterator, Iterator>(lower_bound(key), upper_bound(key));
+  }
+
+  std::pair<ConstIterator, ConstIterator> equal_range(const T& key) const {
+    return std::pair<ConstIterator, ConstIterator>(lower_bound(key),
+                                                   upper_bound(key));
+  }
+
+  // Directly returns a pointer to the payload found through find(key)
+  // This avoids the overhead of creating an iterator
+  // Returns null pointer if there is no exact match of the key
+  // The payload of a key in the buffer of a deferred split is only valid until
+  // the next insert.
+  P* get_payload(const T& key) const {
+    LatencyTimer timer(latency_stats_.get(), kLookupOp);
+    stats_.num_lookups++;
+    data_node_type* leaf;
+    int idx;
+    if (lookup_cache_) {
+      if (lookup_cache_->find(key, structure_epoch_, &leaf, &idx)) {
+        stats_.num_lookup_cache_hits++;
+        return &(leaf->get_payload(idx));
+      }
+      stats_.num_lookup_cache_misses++;
+    }
+    leaf = get_leaf(key);
+    idx = leaf->find_key(key);
+    if (idx < 0) {
+      return deferred_splits_.empty() ? nullptr : find_deferred_payload(key);
+    }
+    if (lookup_cache_) {
+      lookup_cache_->insert(key, leaf, idx, structure_epoch_);
+    }
+    return &(leaf->get_payload(idx));
+  }
+
+  // Looks up a batch of n keys, and sets out[i] to the payload pointer that
+  // get_payload(keys[i]) returns.
+  // Lookups are interleaved in groups of kLookupGroupSize: each step of a
+  // lookup prefetches what its next step reads (the child pointer of the
+  // model node, the next node, or the predicted key slot of the data node)
+  // and then moves on to the next lookup in the group, so that the cache
+  // misses of the lookups in a group overlap.
+  void get_payloads(const T* keys, size_t n, P** out) const {
+    // Step that a lookup does when it is next visited
+    enum LookupStage { kVisitNode, kLoadChild, kSearchLeaf };
+    struct Lookup {
+      size_t idx = 0;
+      LookupStage stage = kVisitNode;
+      AlexNode<T, P>* node = nullptr;
+      AlexNode<T, P>* const* child = nullptr;
+      // Bucket prediction in the parent of the data node, or negative if the
+      // data node is the root
+      double bucketID_prediction = -1;
+    };
+    uint64_t start_ns = latency_stats_ ? LatencyStats::now_ns() : 0;
+    Lookup group[kLookupGroupSize];
+    size_t next_idx = 0;
+    int num_active = 0;
+    for (; num_active < kLookupGroupSize && next_idx < n; num_active++) {
+      group[num_active].idx = next_idx++;
+      group[num_active].node = root_node_;
+    }
+    stats_.num_lookups += static_cast<long long>(n);
+
+    while (num_active > 0) {
+      for (int g = 0; g < num_active; g++) {
+        Lookup& lookup = group[g];
+        const T& key = keys[lookup.idx];
+        if (lookup.stage == kVisitNode) {
+          if (lookup.node->is_leaf_) {
+            auto leaf = static_cast<data_node_type*>(lookup.node);
+            _mm_prefetch(reinterpret_cast<const char*>(
+                             &leaf->get_key(leaf->predict_position(key))),
+                         _MM_HINT_T0);
+            lookup.stage = kSearchLeaf;
+          } else {
+            auto node = static_cast<model_node_type*>(lookup.node);
+            lookup.bucketID_prediction = node->model_.predict_double(key);
+            int bucketID = static_cast<int>(lookup.bucketID_prediction);
+            bucketID = std::min<int>(std::max<int>(bucketID, 0),
+                                     node->num_children_ - 1);
+            lookup.child = node->children_ + bucketID;
+            _mm_prefetch(reinterpret_cast<const char*>(lookup.child),
+                         _MM_HINT_T0);
+            lookup.stage = kLoadChild;
+          }
+        } else if (lookup.stage == kLoadChild) {
+          lookup.node = *lookup.child;
+          _mm_prefetch(reinterpret_cast<const char*>(lookup.node),
+                       _MM_HINT_T0);
+          lookup.stage = kVisitNode;
+        } else {
+          auto leaf = static_cast<data_node_type*>(lookup.node);
+          stats_.num_node_lookups += leaf->level_;
+#if ALEX_SAFE_LOOKUP
+          if (lookup.bucketID_prediction >= 0) {
+            leaf = correct_leaf(leaf, key, lookup.bucketID_prediction);
+          }
+#endif
+          int pos = leaf->find_key(key);
+          out[lookup.idx] = pos < 0 ? nullptr : &(leaf->get_payload(pos));
+
+          // Start the next lookup in place of the finished one
+          if (next_idx < n) {
+            lookup = Lookup();
+            lookup.idx = next_idx++;
+            lookup.node = root_node_;
+          } else {
+            group[g] = group[--num_active];
+            g--;
+          }
+        }
+      }
+    }
+    if (!deferred_splits_.empty()) {
+      for (size_t i = 0; i < n; i++) {
+        if (out[i] == nullptr) {
+          out[i] = find_deferred_payload(keys[i]);
+        }
+      }
+    }
+    if (latency_stats_ && n > 0) {
+      // Lookups of a batch overlap, so each is counted with the average
+      // latency of the batch
+      latency_stats_->op(kLookupOp).record(
+          (LatencyStats::now_ns() - start_ns) / n, n);
+    }
+  }
+
+  // Looks up n keys that are sorted in increasing order, and sets out[i] to
+  // the payload pointer that get_payload(keys[i]) returns. Returns the number
+  // of keys that were found.
+  // Instead of traversing from the root for every key, the keys are merged
+  // with the linked data nodes: a key that is at least the first key of the
+  // next data node moves the lookup on to that data node, and each data node
+  // is searched forward from the position of the previous key. So a batch
+  // costs about as much as the data nodes it touches and the distances
+  // between its keys in the data nodes, instead of one traversal per key.
+  // Only keys that are more than kMaxSortedLookupHops data nodes away from
+  // the previous key traverse from the root.
+  size_t lookup_sorted(const T* keys, size_t n, P** out) const {
+    uint64_t start_ns = latency_stats_ ? LatencyStats::now_ns() : 0;
+    stats_.num_lookups += static_cast<long long>(n);
+    size_t num_found = 0;
+    data_node_type* leaf = nullptr;
+    int pos = 0;  // upper bound of the previous key in leaf
+    // First data node with keys after leaf, and its first key
+    data_node_type* next = nullptr;
+    T next_first_key = T();
+    auto move_to = [&](data_node_type* node) {
+      leaf = node;
+      pos = 0;
+      next = leaf->next_leaf_;
+      while (next != nullptr && next->num_keys_ == 0) {
+        next = next->next_leaf_;
+      }
+      if (next != nullptr) {
+        next_first_key = next->first_key();
+      }
+    };
+    for (size_t i = 0; i < n; i++) {
+      const T& key = keys[i];
+      int num_hops = 0;
+      while (leaf != nullptr && next != nullptr &&
+             !key_less_(key, next_first_key)) {
+        if (++num_hops > kMaxSortedLookupHops) {
+          leaf = nullptr;
+          break;
+        }
+        move_to(next);
+      }
+      if (leaf == nullptr) {
+        move_to(get_leaf(key));
+      }
+      // The upper bound of key is not before the upper bound of the previous
+      // key, and the model is usually closer for keys that are far apart
+      pos = leaf->upper_bound_from(
+          std::max(pos, leaf->predict_position(key)), key);
+      if (pos > 0 && key_equal(leaf->get_key(pos - 1), key)) {
+        out[i] = &(leaf->get_payload(pos - 1));
+        num_found++;
+      } else {
+        out[i] = nullptr;
+      }
+    }
+    if (!deferred_splits_.empty()) {
+      for (size_t i = 0; i < n; i++) {
+        if (out[i] == nullptr) {
+          out[i] = find_deferred_payload(keys[i]);
+          num_found += out[i] != nullptr;
+        }
+      }
+    }
+    if (latency_stats_ && n > 0) {
+      latency_stats_->op(kLookupOp).record(
+          (LatencyStats::now_ns() - start_ns) / n, n);
+    }
+    return num_found;
+  }
+
+  // Looks for the last key no greater than the input value
+  // Conceptually, this is equal to the last key before upper_bound()
+  typename self_type::Iterator find_last_no_greater_than(const T& key) {
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    const int idx = leaf->upper_bound(key) - 1;
+    if (idx >= 0) {
+      return Iterator(leaf, idx);
+    }
+
+    // Edge case: need to check previous data node(s)
+    while (true) {
+      if (leaf->prev_leaf_ == nullptr) {
+        return Iterator(leaf, 0);
+      }
+      leaf = leaf->prev_leaf_;
+      if (leaf->num_keys_ > 0) {
+        return Iterator(leaf, leaf->last_pos());
+      }
+    }
+  }
+
+  // Directly returns a pointer to the payload found through
+  // find_last_no_greater_than(key)
+  // This avoids the overhead of creating an iterator
+  P* get_payload_last_no_greater_than(const T& key) {
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(key);
+    const int idx = leaf->upper_bound(key) - 1;
+    if (idx >= 0) {
+      return &(leaf->get_payload(idx));
+    }
+
+    // Edge case: Need to check previous data node(s)
+    while (true) {
+      if (leaf->prev_leaf_ == nullptr) {
+        return &(leaf->get_payload(leaf->first_pos()));
+      }
+      leaf = leaf->prev_leaf_;
+      if (leaf->num_keys_ > 0) {
+        return &(leaf->get_payload(leaf->last_pos()));
+      }
+    }
+  }
+
+  typename self_type::Iterator begin() {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      cur = static_cast<model_node_type*>(cur)->children_[0];
+    }
+    return Iterator(static_cast<data_node_type*>(cur), 0);
+  }
+
+  typename self_type::Iterator end() {
+    Iterator it = Iterator();
+    it.cur_leaf_ = nullptr;
+    it.cur_idx_ = 0;
+    return it;
+  }
+
+  typename self_type::ConstIterator cbegin() const {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      cur = static_cast<model_node_type*>(cur)->children_[0];
+    }
+    return ConstIterator(static_cast<data_node_type*>(cur), 0);
+  }
+
+  typename self_type::ConstIterator cend() const {
+    ConstIterator it = ConstIterator();
+    it.cur_leaf_ = nullptr;
+    it.cur_idx_ = 0;
+    return it;
+  }
+
+  typename self_type::ReverseIterator rbegin() {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      auto model_node = static_cast<model_node_type*>(cur);
+      cur = model_node->children_[model_node->num_children_ - 1];
+    }
+    auto data_node = static_cast<data_node_type*>(cur);
+    return ReverseIterator(data_node, data_node->data_capacity_ - 1);
+  }
+
+  typename self_type::ReverseIterator rend() {
+    ReverseIterator it = ReverseIterator();
+    it.cur_leaf_ = nullptr;
+    it.cur_idx_ = 0;
+    return it;
+  }
+
+  typename self_type::ConstReverseIterator crbegin() const {
+    AlexNode<T, P>* cur = root_node_;
+
+    while (!cur->is_leaf_) {
+      auto model_node = static_cast<model_node_type*>(cur);
+      cur = model_node->children_[model_node->num_children_ - 1];
+    }
+    auto data_node = static_cast<data_node_type*>(cur);
+    return ConstReverseIterator(data_node, data_node->data_capacity_ - 1);
+  }
+
+  typename self_type::ConstReverseIterator crend() const {
+    ConstReverseIterator it = ConstReverseIterator();
+    it.cur_leaf_ = nullptr;
+    it.cur_idx_ = 0;
+    return it;
+  }
+
+  /*** Range scans ***/
+
+ public:
+  // Number of keys in [low, high).
+  // Data nodes that lie inside the range entirely are counted without reading
+  // their keys or bitmaps.
+  size_t count_range(const T& low, const T& high) const {
+    size_t num_keys = 0;
+    auto count = [&num_keys](const data_node_type* leaf, int left, int right) {
+      num_keys += (left == 0 && right == leaf->data_capacity_)
+                      ? leaf->num_keys_
+                      : leaf->num_keys_in_range(left, right);
+    };
+    for_each_leaf_in_range(low, high, count);
+    return num_keys;
+  }
+
+#if ALEX_DATA_NODE_SEP_ARRAYS
+  // Calls callback(const T* keys, const P* payloads, int n) for every run of n
+  // adjacent keys in [low, high), in key order, which is faster than iterating
+  // over the keys one at a time. Only keys at the ends of the range are
+  // compared with low and high.
+  // Returns the number of keys in the range.
+  template <class F>
+  size_t scan_range(const T& low, const T& high, F callback) const {
+    size_t num_keys = 0;
+    auto on_run = [&](const T* keys, const P* payloads, int n) {
+      num_keys += n;
+      callback(keys, payloads, n);
+    };
+    auto scan = [&on_run](const data_node_type* leaf, int left, int right) {
+      leaf->for_each_run(left, right, on_run);
+    };
+    for_each_leaf_in_range(low, high, scan);
+    return num_keys;
+  }
+
+  // Folds the payloads of all keys in [low, high) in key order, with
+  // result = op(result, payload) starting from init.
+  template <class R, class Op>
+  R aggregate_range(const T& low, const T& high, R init, Op op) const {
+    scan_range(low, high, [&init, &op](const T*, const P* payloads, int n) {
+      for (int i = 0; i < n; i++) {
+        init = op(init, payloads[i]);
+      }
+    });
+    return init;
+  }
+
+  // Sum of the payloads of all keys in [low, high). Payloads of 64-bit types
+  // are summed with SIMD loads masked by the bitmap words of the data nodes.
+  P sum_range(const T& low, const T& high) const {
+    P sum = P();
+    auto add = [&sum](const data_node_type* leaf, int left, int right) {
+      sum += SimdSum<P>::masked_sum(leaf->payload_slots_, leaf->bitmap_, left,
+                                    right);
+    };
+    for_each_leaf_in_range(low, high, add);
+    return sum;
+  }
+#endif
+
+ private:
+  // Calls f(leaf, left, right) for every data node with keys in [low, high),
+  // in key order, where [left, right) are the positions of those keys. right is
+  // the data capacity for data nodes whose keys are all less than high.
+  template <class F>
+  void for_each_leaf_in_range(const T& low, const T& high, F& f) const {
+    if (!key_less_(low, high)) {
+      return;
+    }
+    LatencyTimer timer(latency_stats_.get(), kRangeOp);
+    stats_.num_lookups++;
+    data_node_type* leaf = get_leaf(low);
+    int left = leaf->find_lower(low);
+    while (leaf != nullptr) {
+      bool is_last = !key_less_(leaf->last_key(), high);
+      int right = is_last ? leaf->lower_bound(high) : leaf->data_capacity_;
+      if (left < right) {
+        f(leaf, left, right);
+      }
+      if (is_last) {
+        return;
+      }
+      leaf = leaf->next_leaf_;
+      left = 0;
+    }
+  }
+
+  /*** Insert ***/
+
+ public:
+  std::pair<Iterator, bool> insert(const V& value) {
+    return insert(value.first, value.second);
+  }
+
+  // Inserts the range [first, last). The range does not need to be sorted.
+  // This creates a temporary sorted copy of the data, which is then inserted
+  // using insert_sorted().
+  template <class InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    std::vector<V> values;
+    for (auto it = first; it != last; ++it) {
+      values.push_back(*it);
+    }
+    auto value_less = [this](auto const& a, auto const& b) {
+      return key_less_(a.first, b.first);
+    };
+    if (!std::is_sorted(values.begin(), values.end(), value_less)) {
+      // Stable sort so that the first of several equal keys is kept when
+      // duplicates are not allowed
+      std::stable_sort(values.begin(), values.end(), value_less);
+    }
+    insert_sorted(values.data(), static_cast<long long>(values.size()));
+  }
+
+  // values should be the sorted array of key-payload pairs.
+  // The number of elements should be num_keys.
+  // Instead of inserting one key at a time, each run of keys that falls into
+  // the same data node is merged into that data node with a single rebuild,
+  // and the decision to expand or split the data node is made once per run.
+  // This will NOT do an update of an existing key.
+  // Like insert(), this records the insert latency, and does the maintenance
+  // that is due before each run of keys. Keys that go into a data node that is
+  // being rebuilt in the background are inserted one at a time like with
+  // insert(), and so are all keys while buffered keys are pending if
+  // duplicates are not allowed. Full data nodes are rebuilt in the background
+  // if splits are deferred (see set_defer_splits()).
+  // Returns the number of keys that were inserted.
+  long long insert_sorted(const V values[], long long num_keys) {
+    if (num_keys <= 0) {
+      return 0;
+    }
+    uint64_t start_ns = latency_stats_ ? LatencyStats::now_ns() : 0;
+    flush_deferred_splits();
+    if (stats_.num_keys == 0 && root_node_->is_leaf_) {
+      long long num_loaded = bulk_load_sorted_batch(values, num_keys);
+      record_batch_insert_latency(start_ns, num_keys);
+      return num_loaded;
+    }
+
+    // If enough keys fall outside the key domain, expand the root to expand the
+    // key domain. The keys are sorted, so this only needs to be checked once
+    // per side.
+    auto value_key_less = [this](const V& a, const T& b) {
+      return key_less_(a.first, b);
+    };
+    auto key_value_less = [this](const T& a, const V& b) {
+      return key_less_(a, b.first);
+    };
+    long long num_keys_above_key_domain =
+        values + num_keys - std::upper_bound(values, values + num_keys,
+                                             istats_.key_domain_max_,
+                                             key_value_less);
+    if (num_keys_above_key_domain > 0) {
+      istats_.num_keys_above_key_domain += num_keys_above_key_domain;
+      if (should_expand_right()) {
+        expand_root(values[num_keys - 1].first, false);  // expand to the right
+      }
+    }
+    long long num_keys_below_key_domain =
+        std::lower_bound(values, values + num_keys, istats_.key_domain_min_,
+                         value_key_less) -
+        values;
+    if (num_keys_below_key_domain > 0) {
+      istats_.num_keys_below_key_domain += num_keys_below_key_domain;
+      if (should_expand_left()) {
+        expand_root(values[0].first, true);  // expand to the left
+      }
+    }
+
+    long long num_inserted = 0;
+    long long i = 0;
+    while (i < num_keys) {
+      maintain_before_insert();
+      const T& key = values[i].first;
+      data_node_type* leaf = get_leaf(key);
+
+      // Data nodes that are being rebuilt must not be modified, and buffered
+      // keys must not be inserted a second time
+      if (!deferred_splits_.empty() &&
+          (!allow_duplicates || find_deferred_split(leaf) != nullptr)) {
+        num_inserted += insert_one_of_batch(values[i]);
+        i++;
+        continue;
+      }
+
+      // Do not merge more keys than the data node can hold
+      int max_run_size =
+          static_cast<int>(leaf->max_slots_ * data_node_type::kMinDensity_) -
+          leaf->num_keys_;
+      if (max_run_size <= 0 && leaf->num_keys_ > 0) {
+        // Data node is at max capacity, so split it before merging
+        split_leaf_of_batch(leaf, key, 3);
+        continue;
+      }
+      long long run_end = leaf_run_end(
+          leaf, values, i, std::min(num_keys, i + std::max(max_run_size, 1)));
+      leaf = own_leaf(leaf, key);
+
+      if (leaf->num_keys_ > (run_end - i) * kMaxBatchRebuildRatio) {
+        // The run is small relative to the data node, so inserting the keys one
+        // at a time is cheaper than rebuilding the data node
+        for (; i < run_end; i++) {
+          std::pair<int, int> ret =
+              leaf->insert(values[i].first, values[i].second);
+          if (ret.first > 0) {
+            // Retry this key after the data node is expanded or split
+            split_leaf_of_batch(leaf, values[i].first, ret.first);
+            break;
+          }
+          if (ret.first == 0) {
+            num_inserted++;
+            stats_.num_inserts++;
+            stats_.num_keys++;
+          }
+        }
+        continue;
+      }
+
+      double prev_cost = leaf->cost_;
+      int num_run_inserted =
+          leaf->insert_sorted(values + i, static_cast<int>(run_end - i));
+      num_inserted += num_run_inserted;
+      stats_.num_inserts += num_run_inserted;
+      stats_.num_keys += num_run_inserted;
+      if (num_run_inserted > 0) {
+        // The data node was retrained on the merged keys, so its expected cost
+        // stands in for the empirical cost when deciding whether to split
+        leaf->cost_ = leaf->compute_expected_cost(leaf->frac_inserts());
+        int fail = 0;
+        if (leaf->catastrophic_cost()) {
+          fail = 2;
+        } else if (leaf->cost_ > kNodeLookupsWeight &&
+                   leaf->cost_ > 1.5 * prev_cost) {
+          fail = 1;
+        }
+        if (fail) {
+          split_leaf_of_batch(leaf, key, fail);
+        } else {
+          leaf->reset_stats();
+        }
+      }
+      i = run_end;
+    }
+    record_batch_insert_latency(start_ns, num_keys);
+    return num_inserted;
+  }
+
+  // This will NOT do an update of an existing key.
+  // To perform an update or read-modify-write, do a lookup and modify the
+  // payload's value.
+  // Returns iterator to inserted element, and whether the insert happened or
+  // not.
+  // Insert does not happen if duplicates are not allowed and duplicate is
+  // found.
+  // If the key goes into the buffer of a deferred split (see
+  // set_defer_splits()), the returned iterator is an end iterator.
+  std::pair<Iterator, bool> insert(const T& key, const P& payload) {
+    LatencyTimer timer(latency_stats_.get(), kInsertOp);
+    maintain_before_insert();
+    return insert_after_maintenance(key, payload);
+  }
+
+  // Inserts key if it does not exist yet. Otherwise calls
+  // combine(P& existing_payload, const P& payload) to update the payload of
+  // the existing key in place, e.g. to add to a counter. With duplicates, the
+  // right-most key with this value is updated.
+  // Unlike a lookup followed by an insert, this traverses the tree and
+  // searches the data node only once, and a new key is inserted at the
+  // position where the search for it ended.
+  // Returns iterator to the inserted or updated element, and whether the key
+  // was inserted. If the key is in the buffer of a deferred split, the
+  // returned iterator is an end iterator.
+  template <class Combine>
+  std::pair<Iterator, bool> upsert(const T& key, const P& payload,
+                                   Combine combine) {
+    LatencyTimer timer(latency_stats_.get(), kInsertOp);
+    maintain_before_insert();
+    return upsert_after_maintenance(key, payload, combine);
+  }
+
+  // Upserts the range [first, last) of key-payload pairs, which does not need
+  // to be sorted. Pairs with equal keys are combined in their order in the
+  // range. The pairs are sorted, and the keys that fall into the same data
+  // node are upserted after a single traversal.
+  // Returns the number of keys that were inserted.
+  template <class InputIterator, class Combine>
+  long long upsert_range(InputIterator first, InputIterator last,
+                         Combine combine) {
+    std::vector<V> values;
+    for (auto it = first; it != last; ++it) {
+      values.push_back(*it);
+    }
+    auto value_less = [this](auto const& a, auto const& b) {
+      return key_less_(a.first, b.first);
+    };
+    if (!std::is_sorted(values.begin(), values.end(), value_less)) {
+      std::stable_sort(values.begin(), values.end(), value_less);
+    }
+
+    uint64_t start_ns = latency_stats_ ? LatencyStats::now_ns() : 0;
+    auto num_values = static_cast<long long>(values.size());
+    long long num_inserted = 0;
+    long long i = 0;
+    while (i < num_values) {
+      maintain_before_insert();
+      const T& key = values[i].first;
+      if (!can_upsert_in_leaf(key)) {
+        num_inserted +=
+            upsert_after_maintenance(key, values[i].second, combine).second;
+        i++;
+        continue;
+      }
+      data_node_type* leaf = own_leaf(get_leaf(key), key);
+      // Keys up to the last key of the data node also fall into the data
+      // node, because keys that follow each other fall into data nodes that
+      // follow each other
+      T last_key = leaf->last_key();
+      do {
+        std::pair<int, int> ret =
+            leaf->upsert(values[i].first, values[i].second, combine);
+        if (ret.first > 0) {
+          // The data node must be expanded or split, which may free it
+          num_inserted += insert_one(values[i].first, values[i].second).second;
+          i++;
+          break;
+        }
+        if (ret.first == 0) {
+          num_inserted++;
+          stats_.num_inserts++;
+          stats_.num_keys++;
+        }
+        i++;
+      } while (i < num_values && !key_less_(last_key, values[i].first) &&
+               can_upsert_in_leaf(values[i].first));
+    }
+    if (num_values > 0) {
+      record_batch_insert_latency(start_ns, num_values);
+    }
+    return num_inserted;
+  }
+
+ private:
+  // Records num_values inserts of a batch that started at start_ns, each with
+  // the average latency of the batch
+  void record_batch_insert_latency(uint64_t start_ns,
+                                   long long num_values) const {
+    if (latency_stats_) {
+      latency_stats_->op(kInsertOp).record(
+          (LatencyStats::now_ns() - start_ns) / num_values, num_values);
+    }
+  }
+
+  // Work that is due before an insert: servicing deferred splits,
+  // rebalancing the density of data nodes for the memory budget, rebuilding
+  // subtrees that drifted and refreezing the NUMA replicas
+  void maintain_before_insert() {
+    if (!deferred_splits_.empty()) {
+      service_deferred_splits();
+    }
+    if (params_.memory_budget > 0 &&
+        stats_.num_inserts - num_inserts_at_rebalance_ >=
+            std::max(kMinRebalanceInterval, stats_.num_data_nodes)) {
+      rebalance_density();
+    }
+    if (params_.drift_threshold > 0 && deferred_splits_.empty() &&
+        stats_.num_inserts - num_inserts_at_drift_check_ >=
+            std::max(kMinDriftCheckInterval, stats_.num_data_nodes)) {
+      rebuild_drifted_subtrees();
+    }
+    if (numa_replication_ && !is_frozen() &&
+        stats_.num_inserts - num_inserts_at_thaw_ >=
+            std::max<long long>(kMinRefreezeInterval, stats_.num_data_nodes)) {
+      freeze();
+    }
+  }
+
+  std::pair<Iterator, bool> insert_after_maintenance(const T& key,
+                                                     const P& payload) {
+    if (!params_.append_mode) {
+      return insert_one(key, payload);
+    }
+    int pos = try_append(key, payload);
+    if (pos >= 0) {
+      return {Iterator(append_finger_.leaf, pos), true};
+    }
+    std::pair<Iterator, bool> ret = insert_one(key, payload);
+    if (ret.second) {
+      update_append_finger(ret.first.cur_leaf_, key);
+    }
+    return ret;
+  }
+
+  // Whether key can be upserted by searching its data node directly. Keys
+  // outside the key domain may expand the root, deferred splits buffer keys
+  // outside of data nodes, and append mode tracks the right-most data node.
+  bool can_upsert_in_leaf(const T& key) const {
+    return deferred_splits_.empty() && !params_.append_mode &&
+           !(key > istats_.key_domain_max_) &&
+           !(key < istats_.key_domain_min_);
+  }
+
+  template <class Combine>
+  std::pair<Iterator, bool> upsert_after_maintenance(const T& key,
+                                                     const P& payload,
+                                                     Combine& combine) {
+    if (!can_upsert_in_leaf(key)) {
+      data_node_type* leaf = get_leaf(key);
+      if (DeferredSplit* split = find_deferred_split(leaf)) {
+        // Data nodes that are being rebuilt must not be modified
+        install_deferred_split(*split);
+        leaf = get_leaf(key);
+      }
+      int idx = leaf->find_key(key);
+      if (idx >= 0) {
+        leaf = own_leaf(leaf, key);
+        combine(leaf->get_payload(idx), payload);
+        return {Iterator(leaf, idx), false};
+      }
+      if (P* buffered_payload = find_deferred_payload(key)) {
+        combine(*buffered_payload, payload);
+        return {end(), false};
+      }
+      return insert_after_maintenance(key, payload);
+    }
+
+    uint64_t start_ns = insert_phase_start();
+    data_node_type* leaf = own_leaf(get_leaf(key), key);
+    start_ns = record_insert_phase(kTraversalPhase, start_ns);
+    int num_resizes = leaf->num_resizes_;
+    std::pair<int, int> ret = leaf->upsert(key, payload, combine);
+    record_insert_phase(
+        leaf->num_resizes_ != num_resizes ? kExpandPhase : kShiftPhase,
+        start_ns);
+    if (ret.first == -1) {
+      return {Iterator(leaf, ret.second), false};
+    }
+    if (ret.first > 0) {
+      // The key does not exist, and the data node must be expanded or split
+      return insert_one(key, payload);
+    }
+    stats_.num_inserts++;
+    stats_.num_keys++;
+    return {Iterator(leaf, ret.second), true};
+  }
+
+  std::pair<Iterator, bool> insert_one(const T& key, const P& payload) {
+    // If enough keys fall outside the key domain, expand the root to expand the
+    // key domain
+    if (key > istats_.key_domain_max_) {
+      istats_.num_keys_above_key_domain++;
+      if (should_expand_right()) {
+        uint64_t start_ns = insert_phase_start();
+        install_deferred_splits();
+        expand_root(key, false);  // expand to the right
+        record_insert_phase(kRootExpansionPhase, start_ns);
+      }
+    } else if (key < istats_.key_domain_min_) {
+      istats_.num_keys_below_key_domain++;
+      if (should_expand_left()) {
+        uint64_t start_ns = insert_phase_start();
+        install_deferred_splits();
+        expand_root(key, true);  // expand to the left
+        record_insert_phase(kRootExpansionPhase, start_ns);
+      }
+    }
+
+    if (!allow_duplicates && !deferred_splits_.empty() &&
+        find_deferred_payload(key) != nullptr) {
+      return {end(), false};
+    }
+
+    uint64_t start_ns = insert_phase_start();
+    data_node_type* leaf = get_leaf(key);
+    start_ns = record_insert_phase(kTraversalPhase, start_ns);
+
+    // Data nodes that are being rebuilt must not be modified, and full data
+    // nodes are rebuilt in the background if they are large enough
+    if (!deferred_splits_.empty() || params_.defer_splits) {
+      DeferredSplit* split = find_deferred_split(leaf);
+      if (split == nullptr && leaf->num_keys_ >= leaf->expansion_threshold_) {
+        split = start_deferred_split(leaf, key);
+      }
+      if (split != nullptr) {
+        if (split->buffer.size() < kMaxDeferredKeys) {
+          return insert_into_deferred_split(*split, leaf, key, payload);
+        }
+        install_deferred_split(*split);
+        leaf = get_leaf(key);
+        start_ns = insert_phase_start();
+      }
+    }
+
+    // Nonzero fail flag means that the insert did not happen
+    leaf = own_leaf(leaf, key);
+    std::pair<int, int> ret = insert_into_leaf(leaf, key, payload, start_ns);
+    int fail = ret.first;
+    int insert_pos = ret.second;
+    if (fail == -1) {
+      // Duplicate found and duplicates not allowed
+      return {Iterator(leaf, insert_pos), false};
+    }
+
+    // If no insert, figure out what to do with the data node to decrease the
+    // cost
+    if (fail) {
+      if (DeferredSplit* split = start_deferred_split(leaf, key)) {
+        return insert_into_deferred_split(*split, leaf, key, payload);
+      }
+      std::vector<TraversalNode> traversal_path;
+      get_leaf(key, &traversal_path);
+      model_node_type* parent = traversal_path.back().node;
+      if (!deferred_splits_.empty()) {
+        // Splitting may expand the parent, which moves the child pointers of
+        // data nodes that are being rebuilt
+        install_deferred_splits(
+            experimental_params_.allow_splitting_upwards ? nullptr : parent);
+      }
+
+      while (fail) {
+        leaf = split_or_expand_leaf(leaf, key, fail, parent, traversal_path);
+
+        // Try again to insert the key
+        ret = insert_into_leaf(leaf, key, payload, insert_phase_start());
+        fail = ret.first;
+        insert_pos = ret.second;
+        if (fail == -1) {
+          // Duplicate found and duplicates not allowed
+          return {Iterator(leaf, insert_pos), false};
+        }
+      }
+    }
+    stats_.num_inserts++;
+    stats_.num_keys++;
+    return {Iterator(leaf, insert_pos), true};
+  }
+
+  // Inserts into the data node, and records the insert as the shift phase, or
+  // as the expand phase if the data node was resized
+  std::pair<int, int> insert_into_leaf(data_node_type* leaf, const T& key,
+                                       const P& payload, uint64_t start_ns) {
+    int num_resizes = leaf->num_resizes_;
+    std::pair<int, int> ret = leaf->insert(key, payload);
+    record_insert_phase(
+        leaf->num_resizes_ != num_resizes ? kExpandPhase : kShiftPhase,
+        start_ns);
+    return ret;
+  }
+
+  // Start time of an insert phase, or zero if latency is not tracked
+  uint64_t insert_phase_start() const {
+    return latency_stats_ ? LatencyStats::now_ns() : 0;
+  }
+
+  // Records an insert phase that started at start_ns, and returns the current
+  // time as the start of the next phase
+  uint64_t record_insert_phase(InsertPhase phase, uint64_t start_ns) const {
+    if (!latency_stats_) {
+      return 0;
+    }
+    uint64_t now_ns = LatencyStats::now_ns();
+    latency_stats_->insert_phase(phase).record(now_ns - start_ns);
+    return now_ns;
+  }
+
+  /*** Append mode ***/
+
+  // Data nodes that appends seal get at least this many slots for the
+  // appends after them
+  static constexpr int kMinAppendCapacity = 1 << 10;
+
+  // Appends the key to the data node of the append finger if the key goes
+  // there and is greater than all keys there (see set_append_mode()). Keys
+  // above the key domain go to the last data node, and are counted towards the
+  // next root expansion like in insert_one(). Returns the position of the key,
+  // or -1 if the key takes the usual insert path.
+  int try_append(const T& key, const P& payload) {
+    AppendFinger& finger = append_finger_;
+    if (finger.leaf == nullptr || !deferred_splits_.empty() ||
+        key_less_(key, finger.min_key)) {
+      return -1;
+    }
+    bool above_key_domain = key_less_(istats_.key_domain_max_, key);
+    if (above_key_domain) {
+      // The usual insert path expands the root once this key is counted
+      istats_.num_keys_above_key_domain++;
+      bool expand = should_expand_right();
+      istats_.num_keys_above_key_domain--;
+      if (expand) {
+        return -1;
+      }
+    }
+    model_node_type* parent = finger.parent;
+    int bucketID = parent->model_.predict(key);
+    bucketID =
+        std::min<int>(std::max<int>(bucketID, 0), parent->num_children_ - 1);
+    AlexNode<T, P>* child = parent->children_[bucketID];
+    if (child != finger.leaf) {
+      // Keys moved on to a data node that an earlier seal split off
+      if (!child->is_leaf_) {
+        return -1;
+      }
+      finger.leaf = static_cast<data_node_type*>(child);
+      finger.position = -1;
+    }
+    data_node_type* leaf = finger.leaf;
+    if (!key_less_(leaf->max_key_, key) ||
+        (leaf->next_leaf_ != nullptr &&
+         !key_less_(key, leaf->next_leaf_->min_key_))) {
+      return -1;
+    }
+    leaf = own_leaf(leaf, key);
+    int pos = leaf->append_position(key, finger.position);
+    if (pos == leaf->data_capacity_) {
+      if (seal_append_leaf(key, bucketID)) {
+        leaf = finger.leaf;
+        pos = 0;
+      } else if (leaf->data_capacity_ < derived_params_.max_data_node_slots) {
+        // The key goes into the same child pointer as the last key, so the
+        // data node doubles like a vector instead
+        leaf->extend_appends(std::min(derived_params_.max_data_node_slots,
+                                      2 * leaf->data_capacity_));
+      } else {
+        return -1;
+      }
+    }
+    leaf->append(key, payload, pos);
+    finger.position = pos + 1;
+    if (above_key_domain) {
+      istats_.num_keys_above_key_domain++;
+    }
+    stats_.num_inserts++;
+    stats_.num_keys++;
+    return pos;
+  }
+
+  // Seals the full data node of the append finger, and splits the child
+  // pointers of the data node that bucketID and later buckets of the parent
+  // point to off into new data nodes. The finger moves to the new data node of
+  // bucketID, where key goes. Returns false if the last key of the data node
+  // goes into the same half of the pointers as key, all the way down.
+  bool seal_append_leaf(const T& key, int bucketID) {
+    AppendFinger& finger = append_finger_;
+    data_node_type* leaf = finger.leaf;
+    model_node_type* parent = finger.parent;
+    int repeats = 1 << leaf->duplication_factor_;
+    int start_bucketID = bucketID - (bucketID % repeats);
+    int last_bucketID = parent->model_.predict(leaf->max_key_);
+    int num_kept = 1;  // pointers that the sealed data node keeps
+    while (start_bucketID + num_kept <= last_bucketID) {
+      num_kept *= 2;
+    }
+    if (start_bucketID + num_kept > bucketID) {
+      return false;
+    }
+
+    thaw();
+    double key_range = static_cast<double>(leaf->max_key_) -
+                       static_cast<double>(leaf->min_key_);
+    double slope = key_range > 0 ? (leaf->num_keys_ - 1) / key_range : 0;
+    int capacity = std::min(derived_params_.max_data_node_slots,
+                            std::max(2 * leaf->num_keys_, kMinAppendCapacity));
+    leaf->seal();
+    leaf->duplication_factor_ =
+        static_cast<uint8_t>(log_2_round_down(num_kept));
+    data_node_type* next = leaf->next_leaf_;
+    data_node_type* prev = leaf;
+    for (int n = num_kept; n < repeats; n *= 2) {
+      auto node = new (data_node_allocator().allocate(1))
+          data_node_type(leaf->level_, derived_params_.max_data_node_slots,
+                         key_less_, allocator_);
+      node->bulk_load(nullptr, 0);
+      node->duplication_factor_ = static_cast<uint8_t>(log_2_round_down(n));
+      int first_bucketID = start_bucketID + n;
+      if (bucketID >= first_bucketID && bucketID < first_bucketID + n) {
+        node->initialize_appends(capacity, key, slope);
+        finger.leaf = node;
+      }
+      for (int i = first_bucketID; i < first_bucketID + n; i++) {
+        parent->children_[i] = node;
+      }
+      prev->next_leaf_ = node;
+      node->prev_leaf_ = prev;
+      prev = node;
+      stats_.num_data_nodes++;
+    }
+    prev->next_leaf_ = next;
+    if (next != nullptr) {
+      next->prev_leaf_ = prev;
+    }
+    return true;
+  }
+
+  // Moves the append finger to leaf, which key was just inserted into, if the
+  // parent of leaf is on the right edge of the tree
+  void update_append_finger(data_node_type* leaf, const T& key) {
+    if (leaf == nullptr || leaf == append_finger_.leaf) {
+      return;
+    }
+    append_finger_ = AppendFinger();
+    AlexNode<T, P>* cur = root_node_;
+    model_node_type* parent = nullptr;
+    while (!cur->is_leaf_) {
+      parent = static_cast<model_node_type*>(cur);
+      int bucketID = parent->model_.predict(key);
+      bucketID =
+          std::min<int>(std::max<int>(bucketID, 0), parent->num_children_ - 1);
+      cur = parent->children_[bucketID];
+    }
+    if (cur != leaf || parent == nullptr) {
+      return;
+    }
+    AlexNode<T, P>* last_child = parent->children_[parent->num_children_ - 1];
+    if (!last_child->is_leaf_ ||
+        static_cast<data_node_type*>(last_child)->next_leaf_ != nullptr) {
+      return;
+    }
+    append_finger_.leaf = leaf;
+    append_finger_.parent = parent;
+    append_finger_.min_key = key;
+  }
+
+  /*** Deferred splits ***/
+
+ public:
+  // Waits for all background rebuilds and moves all buffered keys into the
+  // tree. After this, find(), iterators and range scans see every key.
+  void flush_deferred_splits() {
+    if (deferred_splits_.empty() || flushing_deferred_splits_) {
+      return;
+    }
+    flushing_deferred_splits_ = true;
+    while (!deferred_splits_.empty()) {
+      DeferredSplit& split = *deferred_splits_.front();
+      if (split.node != nullptr) {
+        install_deferred_split(split);
+      }
+      move_deferred_keys(split, split.buffer.size());
+      deferred_splits_.erase(deferred_splits_.begin());
+    }
+    flushing_deferred_splits_ = false;
+  }
+
+  // Number of keys that are in the buffers of deferred splits
+  size_t num_deferred_keys() const {
+    size_t num_keys = 0;
+    for (const auto& split : deferred_splits_) {
+      num_keys += split->buffer.size();
+    }
+    return num_keys;
+  }
+
+ private:
+  // Only data nodes and subtrees with at least this many keys are rebuilt in
+  // the background. Smaller ones are rebuilt faster than a thread is started.
+  static const int kMinDeferredSplitKeys = 1 << 12;
+  // Maximum number of data nodes and subtrees that are rebuilt at the same time
+  static const int kMaxDeferredSplits = 8;
+  // Maximum number of keys in the buffer of a deferred split
+  static const size_t kMaxDeferredKeys = 1 << 12;
+  // Number of buffered keys that every insert moves into the tree. This is
+  // more than one, so buffers drain faster than inserts fill them.
+  static const size_t kDeferredKeysPerInsert = 4;
+
+  // A data node or subtree that was taken out of service and is being rebuilt
+  // by a background thread. Once the new subtree is installed, node and parent
+  // are null and the buffered keys are moved into the tree.
+  struct DeferredSplit {
+    // A data node, or the root of a subtree that drifted
+    AlexNode<T, P>* node = nullptr;
+    model_node_type* parent = nullptr;
+    // Child pointers of parent that point to node
+    int start_bucketID = 0;
+    int end_bucketID = 0;
+    // Data nodes of node in key order, and sorted by address for lookups
+    std::vector<data_node_type*> leaves;
+    std::vector<data_node_type*> sorted_leaves;
+    int num_model_nodes = 0;  // of node
+    long long num_keys = 0;   // of node
+    // Key space of node, which the rebuilt subtree maps to [0, 1)
+    long double left_boundary = 0;
+    long double right_boundary = 0;
+    long long total_keys = 0;
+    // Sorted keys inserted into node since the rebuild started
+    std::vector<V> buffer;
+    std::thread worker;
+    std::atomic<bool> done{false};
+    // Written by the worker
+    AlexNode<T, P>* subtree = nullptr;
+    data_node_type* first_leaf = nullptr;
+    data_node_type* last_leaf = nullptr;
+    BulkLoadCounts counts;
+  };
+
+  // Returns the rebuild that leaf is part of, or null
+  DeferredSplit* find_deferred_split(const data_node_type* leaf) const {
+    std::less<const data_node_type*> less;
+    for (const auto& split : deferred_splits_) {
+      if (split->node == nullptr) {
+        continue;
+      }
+      auto it = std::lower_bound(split->sorted_leaves.begin(),
+                                 split->sorted_leaves.end(), leaf, less);
+      if (it != split->sorted_leaves.end() && *it == leaf) {
+        return split.get();
+      }
+    }
+    return nullptr;
+  }
+
+  // Returns the payload of the right-most buffered key equal to key, or null
+  P* find_deferred_payload(const T& key) const {
+    for (const auto& split : deferred_splits_) {
+      auto it = std::upper_bound(
+          split->buffer.begin(), split->buffer.end(), key,
+          [this](const T& k, const V& v) { return key_less_(k, v.first); });
+      if (it != split->buffer.begin() && key_equal((it - 1)->first, key)) {
+        return &(it - 1)->second;
+      }
+    }
+    return nullptr;
+  }
+
+  // Takes leaf out of service and starts rebuilding it in the background.
+  // Returns null if leaf should be split by the caller instead.
+  DeferredSplit* start_deferred_split(data_node_type* leaf, const T& key) {
+    if (!params_.defer_splits || flushing_deferred_splits_ ||
+        leaf->num_keys_ < kMinDeferredSplitKeys ||
+        static_cast<int>(deferred_splits_.size()) >= kMaxDeferredSplits) {
+      return nullptr;
+    }
+    std::vector<TraversalNode> traversal_path;
+    get_leaf(key, &traversal_path);
+    model_node_type* parent = traversal_path.back().node;
+    int bucketID = traversal_path.back().bucketID;
+    if (parent->children_[bucketID] != leaf) {
+      return nullptr;
+    }
+    return start_worker(make_deferred_split(leaf, parent, bucketID));
+  }
+
+  // Describes the rebuild of node, which is the child of parent at bucketID
+  std::unique_ptr<DeferredSplit> make_deferred_split(AlexNode<T, P>* node,
+                                                     model_node_type* parent,
+                                                     int bucketID) {
+    if (parent == superroot_) {
+      update_superroot_key_domain();
+    }
+    std::unique_ptr<DeferredSplit> split(new DeferredSplit());
+    int repeats = 1 << node->duplication_factor_;
+    split->node = node;
+    split->parent = parent;
+    split->start_bucketID = bucketID - (bucketID % repeats);
+    split->end_bucketID = split->start_bucketID + repeats;
+    collect_data_nodes(node, split->leaves);
+    split->sorted_leaves = split->leaves;
+    std::sort(split->sorted_leaves.begin(), split->sorted_leaves.end(),
+              std::less<const data_node_type*>());
+    split->num_model_nodes = num_model_nodes_of(node);
+    for (const data_node_type* leaf : split->leaves) {
+      split->num_keys += leaf->num_keys_;
+    }
+    split->left_boundary = parent->model_.inverse(split->start_bucketID);
+    split->right_boundary = parent->model_.inverse(split->end_bucketID);
+    split->total_keys = stats_.num_keys;
+    return split;
+  }
+
+  // Starts the rebuild of split on a background thread
+  DeferredSplit* start_worker(std::unique_ptr<DeferredSplit> split) {
+    split->buffer.reserve(kMaxDeferredKeys);
+    DeferredSplit* split_ptr = split.get();
+    split->worker = std::thread([this, split_ptr] {
+      build_deferred_split(*split_ptr);
+      split_ptr->done.store(true, std::memory_order_release);
+    });
+    deferred_splits_.push_back(std::move(split));
+    return split_ptr;
+  }
+
+  // Runs on the worker thread. Only reads the keys and payloads of the data
+  // nodes, which nothing writes to while they are being rebuilt.
+  void build_deferred_split(DeferredSplit& split) {
+    std::vector<V> values;
+    values.reserve(split.num_keys);
+    for (const data_node_type* leaf : split.leaves) {
+      for (int i = 0; i < leaf->data_capacity_; i++) {
+        if (leaf->check_exists(i)) {
+          values.push_back({leaf->get_key(i), leaf->get_payload(i)});
+        }
+      }
+    }
+    int num_keys = static_cast<int>(values.size());
+
+    AlexNode<T, P>* node = new (model_node_allocator().allocate(1))
+        model_node_type(split.node->level_, allocator_);
+    node->model_.set_anchored(
+        static_cast<double>(1 / (split.right_boundary - split.left_boundary)),
+        split.left_boundary, 0);
+    LinearModel<T> data_node_model;
+    data_node_type::build_model(values.data(), num_keys, &data_node_model,
+                                params_.approximate_model_computation);
+    DataNodeStats stats;
+    node->cost_ = data_node_type::compute_expected_cost(
+        values.data(), num_keys, data_node_type::kInitDensity_,
+        params_.expected_insert_frac, &data_node_model,
+        params_.approximate_cost_computation, &stats);
+    bulk_load_node(values.data(), num_keys, node, split.total_keys,
+                   split.counts, &data_node_model);
+    node->duplication_factor_ = split.node->duplication_factor_;
+    if (node->is_leaf_) {
+      static_cast<data_node_type*>(node)->expected_avg_exp_search_iterations_ =
+          stats.num_search_iterations;
+      static_cast<data_node_type*>(node)->expected_avg_shifts_ =
+          stats.num_shifts;
+    }
+
+    // Link the new data nodes to each other
+    std::vector<data_node_type*> new_leaves;
+    collect_data_nodes(node, new_leaves);
+    for (size_t i = 1; i < new_leaves.size(); i++) {
+      new_leaves[i - 1]->next_leaf_ = new_leaves[i];
+      new_leaves[i]->prev_leaf_ = new_leaves[i - 1];
+    }
+    split.subtree = node;
+    split.first_leaf = new_leaves.front();
+    split.last_leaf = new_leaves.back();
+  }
+
+  // Appends the data nodes of the subtree in key order
+  static void collect_data_nodes(AlexNode<T, P>* node,
+                                 std::vector<data_node_type*>& leaves) {
+    if (node->is_leaf_) {
+      leaves.push_back(static_cast<data_node_type*>(node));
+      return;
+    }
+    auto model_node = static_cast<model_node_type*>(node);
+    for (int i = 0; i < model_node->num_children_; i++) {
+      if (i == 0 || model_node->children_[i] != model_node->children_[i - 1]) {
+        collect_data_nodes(model_node->children_[i], leaves);
+      }
+    }
+  }
+
+  static int num_model_nodes_of(const AlexNode<T, P>* node) {
+    if (node->is_leaf_) {
+      return 0;
+    }
+    auto model_node = static_cast<const model_node_type*>(node);
+    int num_model_nodes = 1;
+    for (int i = 0; i < model_node->num_children_; i++) {
+      if (i == 0 || model_node->children_[i] != model_node->children_[i - 1]) {
+        num_model_nodes += num_model_nodes_of(model_node->children_[i]);
+      }
+    }
+    return num_model_nodes;
+  }
+
+  // Waits for the rebuild, if it runs in the background, and replaces the
+  // data node or subtree with the new subtree. The buffered keys stay in the
+  // buffer.
+  void install_deferred_split(DeferredSplit& split) {
+    uint64_t start_ns = insert_phase_start();
+    if (split.worker.joinable()) {
+      split.worker.join();
+    }
+    model_node_type* parent = split.parent;
+    for (int i = split.start_bucketID; i < split.end_bucketID; i++) {
+      parent->children_[i] = split.subtree;
+    }
+    if (parent == superroot_) {
+      root_node_ = split.subtree;
+      update_superroot_pointer();
+    }
+    data_node_type* first_old_leaf = split.leaves.front();
+    data_node_type* last_old_leaf = split.leaves.back();
+    split.first_leaf->prev_leaf_ = first_old_leaf->prev_leaf_;
+    if (first_old_leaf->prev_leaf_ != nullptr) {
+      first_old_leaf->prev_leaf_->next_leaf_ = split.first_leaf;
+    }
+    split.last_leaf->next_leaf_ = last_old_leaf->next_leaf_;
+    if (last_old_leaf->next_leaf_ != nullptr) {
+      last_old_leaf->next_leaf_->prev_leaf_ = split.last_leaf;
+    }
+
+    // Payloads may have been changed through iterators while the rebuild
+    // copied them
+    Iterator it(split.first_leaf, 0);
+    for (const data_node_type* leaf : split.leaves) {
+      for (int i = 0; i < leaf->data_capacity_; i++) {
+        if (leaf->check_exists(i)) {
+          it.payload() = leaf->get_payload(i);
+          it++;
+        }
+      }
+      stats_.num_expand_and_scales += leaf->num_resizes_;
+    }
+
+    if (!split.node->is_leaf_) {
+      stats_.num_subtree_rebuilds++;
+      stats_.num_subtree_rebuild_keys += split.num_keys;
+    } else if (split.subtree->is_leaf_) {
+      stats_.num_expand_and_retrains++;
+    } else {
+      stats_.num_downward_splits++;
+      stats_.num_downward_split_keys += split.num_keys;
+    }
+    stats_.num_model_nodes += split.counts.num_model_nodes -
+                              split.num_model_nodes;
+    stats_.num_data_nodes += split.counts.num_data_nodes -
+                             static_cast<int>(split.leaves.size());
+    delete_subtree(split.node);
+    split.node = nullptr;
+    split.parent = nullptr;
+    split.leaves = std::vector<data_node_type*>();
+    split.sorted_leaves = std::vector<data_node_type*>();
+    thaw();
+    record_insert_phase(kSplitPhase, start_ns);
+  }
+
+  // Installs the finished rebuilds of the children of parent, or of all data
+  // nodes and subtrees if parent is null, waiting for them if necessary
+  void install_deferred_splits(const model_node_type* parent = nullptr) {
+    for (auto& split : deferred_splits_) {
+      if (split->node != nullptr &&
+          (parent == nullptr || split->parent == parent)) {
+        install_deferred_split(*split);
+      }
+    }
+  }
+
+  // Called before every insert. Installs the rebuilds that have finished, and
+  // moves a few buffered keys of an installed rebuild into the tree.
+  void service_deferred_splits() {
+    for (auto& split : deferred_splits_) {
+      if (split->node != nullptr &&
+          split->done.load(std::memory_order_acquire)) {
+        install_deferred_split(*split);
+      }
+    }
+    for (size_t i = 0; i < deferred_splits_.size(); i++) {
+      DeferredSplit& split = *deferred_splits_[i];
+      if (split.node == nullptr) {
+        move_deferred_keys(split, kDeferredKeysPerInsert);
+        // Moving keys may have started new rebuilds, but never removes one
+        if (split.buffer.empty()) {
+          deferred_splits_.erase(deferred_splits_.begin() + i);
+        }
+        return;
+      }
+    }
+  }
+
+  // Moves up to num_keys buffered keys of an installed rebuild into the tree
+  void move_deferred_keys(DeferredSplit& split, size_t num_keys) {
+    for (size_t i = 0; i < num_keys && !split.buffer.empty(); i++) {
+      V value = split.buffer.back();
+      split.buffer.pop_back();
+      // The key was counted when it was buffered
+      stats_.num_inserts--;
+      stats_.num_keys--;
+      if (value.first > istats_.key_domain_max_) {
+        istats_.num_keys_above_key_domain--;
+      } else if (value.first < istats_.key_domain_min_) {
+        istats_.num_keys_below_key_domain--;
+      }
+      insert_one(value.first, value.second);
+    }
+  }
+
+  // Buffers key, whose data node leaf is part of the rebuild of split
+  std::pair<Iterator, bool> insert_into_deferred_split(DeferredSplit& split,
+                                                       data_node_type* leaf,
+                                                       const T& key,
+                                                       const P& payload) {
+    if (!allow_duplicates) {
+      int idx = leaf->find_key(key);
+      if (idx >= 0) {
+        return {Iterator(leaf, idx), false};
+      }
+    }
+    // Equal keys stay in insertion order
+    auto it = std::upper_bound(
+        split.buffer.begin(), split.buffer.end(), key,
+        [this](const T& k, const V& v) { return key_less_(k, v.first); });
+    split.buffer.insert(it, V(key, payload));
+    stats_.num_inserts++;
+    stats_.num_keys++;
+    return {end(), true};
+  }
+
+  // Stops all rebuilds and drops the buffered keys. Used when the tree is
+  // about to be deleted.
+  void discard_deferred_splits() {
+    for (auto& split : deferred_splits_) {
+      if (split->node != nullptr) {
+        if (split->worker.joinable()) {
+          split->worker.join();
+        }
+        delete_subtree(split->subtree);
+      }
+    }
+    deferred_splits_.clear();
+  }
+
+  void delete_subtree(AlexNode<T, P>* node) {
+    if (!node->is_leaf_) {
+      auto model_node = static_cast<model_node_type*>(node);
+      for (int i = 0; i < model_node->num_children_; i++) {
+        if (i == 0 ||
+            model_node->children_[i] != model_node->children_[i - 1]) {
+          delete_subtree(model_node->children_[i]);
+        }
+      }
+    }
+    delete_node(node);
+  }
+
+ private:
+  // Decide what to do with a data node that failed an insert of key, using the
+  // fail flag returned by the data node: either expand and retrain the data
+  // node, or split it sideways/downwards/upwards.
+  // parent is the parent of the data node and is updated if the data node is
+  // split downwards.
+  // Returns the data node that key falls into after the expansion or split.
+  data_node_type* split_or_expand_leaf(
+      data_node_type* leaf, const T& key, int fail, model_node_type*& parent,
+      std::vector<TraversalNode>& traversal_path) {
+    thaw();
+    append_finger_ = AppendFinger();
+    uint64_t start_ns = insert_phase_start();
+    auto start_time = std::chrono::high_resolution_clock::now();
+    stats_.num_expand_and_scales += leaf->num_resizes_;
+
+    if (parent == superroot_) {
+      update_superroot_key_domain();
+    }
+    int bucketID = parent->model_.predict(key);
+    bucketID = std::min<int>(std::max<int>(bucketID, 0),
+                             parent->num_children_ - 1);
+    std::vector<fanout_tree::FTNode> used_fanout_tree_nodes;
+
+    int fanout_tree_depth = 1;
+    if (experimental_params_.splitting_policy_method == 0 || fail >= 2) {
+      // always split in 2. No extra work required here
+    } else if (experimental_params_.splitting_policy_method == 1) {
+      // decide between no split (i.e., expand and retrain) or splitting in 2
+      fanout_tree_depth = fanout_tree::find_best_fanout_existing_node<
+          T, P, Compare, Alloc, allow_duplicates, Policy>(
+          parent, bucketID, stats_.num_keys, used_fanout_tree_nodes, 2);
+    } else if (experimental_params_.splitting_policy_method == 2) {
+      // use full fanout tree to decide fanout
+      fanout_tree_depth = fanout_tree::find_best_fanout_existing_node<
+          T, P, Compare, Alloc, allow_duplicates, Policy>(
+          parent, bucketID, stats_.num_keys, used_fanout_tree_nodes,
+          derived_params_.max_fanout);
+    }
+    int best_fanout = 1 << fanout_tree_depth;
+    stats_.cost_computation_time +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::high_resolution_clock::now() - start_time)
+            .count();
+
+    if (fanout_tree_depth == 0) {
+      // expand existing data node and retrain model
+      leaf = own_leaf(leaf, key);
+      leaf->resize(data_node_type::kMinDensity_, true,
+                   leaf->is_append_mostly_right(),
+                   leaf->is_append_mostly_left());
+      fanout_tree::FTNode& tree_node = used_fanout_tree_nodes[0];
+      leaf->cost_ = tree_node.cost;
+      leaf->expected_avg_exp_search_iterations_ =
+          tree_node.expected_avg_search_iterations;
+      leaf->expected_avg_shifts_ = tree_node.expected_avg_shifts;
+      leaf->reset_stats();
+      stats_.num_expand_and_retrains++;
+    } else {
+      // split data node: always try to split sideways/upwards, only split
+      // downwards if necessary
+      bool reuse_model = (fail == 3);
+      if (experimental_params_.allow_splitting_upwards) {
+        // allow splitting upwards
+        assert(experimental_params_.splitting_policy_method != 2);
+        int stop_propagation_level = best_split_propagation(traversal_path);
+        if (stop_propagation_level <= superroot_->level_) {
+          parent = split_downwards(parent, bucketID, fanout_tree_depth,
+                                   used_fanout_tree_nodes, reuse_model);
+        } else {
+          split_upwards(key, stop_propagation_level, traversal_path,
+                        reuse_model, &parent);
+        }
+      } else {
+        // either split sideways or downwards
+        bool should_split_downwards =
+            (parent->num_children_ * best_fanout /
+                     (1 << leaf->duplication_factor_) >
+                 derived_params_.max_fanout ||
+             parent->level_ == superroot_->level_);
+        if (should_split_downwards) {
+          parent = split_downwards(parent, bucketID, fanout_tree_depth,
+                                   used_fanout_tree_nodes, reuse_model);
+        } else {
+          split_sideways(parent, bucketID, fanout_tree_depth,
+                         used_fanout_tree_nodes, reuse_model);
+        }
+      }
+      leaf = static_cast<data_node_type*>(parent->get_child_node(key));
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = end_time - start_time;
+    stats_.splitting_time +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+            .count();
+    record_insert_phase(fanout_tree_depth == 0 ? kExpandPhase : kSplitPhase,
+                        start_ns);
+
+    return leaf;
+  }
+
+  // Bulk load a sorted batch into the empty index, dropping duplicate keys if
+  // they are not allowed.
+  // Returns the number of keys that were loaded.
+  long long bulk_load_sorted_batch(const V values[], long long num_keys) {
+    if (allow_duplicates) {
+      bulk_load(values, num_keys);
+      return num_keys;
+    }
+    std::vector<V> unique_values;
+    unique_values.reserve(num_keys);
+    for (long long i = 0; i < num_keys; i++) {
+      if (unique_values.empty() ||
+          !key_equal(unique_values.back().first, values[i].first)) {
+        unique_values.push_back(values[i]);
+      }
+    }
+    bulk_load(unique_values.data(),
+              static_cast<long long>(unique_values.size()));
+    return static_cast<long long>(unique_values.size());
+  }
+
+  // Inserts value of insert_sorted() on its own, like insert() does. Its key
+  // was already counted if it is outside the key domain.
+  // Returns whether the key was inserted.
+  bool insert_one_of_batch(const V& value) {
+    if (value.first > istats_.key_domain_max_) {
+      istats_.num_keys_above_key_domain--;
+    } else if (value.first < istats_.key_domain_min_) {
+      istats_.num_keys_below_key_domain--;
+    }
+    return insert_one(value.first, value.second).second;
+  }
+
+  // Splits or expands leaf, which key of insert_sorted() falls into, or
+  // rebuilds it in the background if splits are deferred and it is large
+  // enough. fail is as for split_or_expand_leaf().
+  void split_leaf_of_batch(data_node_type* leaf, const T& key, int fail) {
+    if (start_deferred_split(leaf, key) != nullptr) {
+      return;
+    }
+    std::vector<TraversalNode> traversal_path;
+    get_leaf(key, &traversal_path);
+    model_node_type* parent = traversal_path.back().node;
+    if (!deferred_splits_.empty()) {
+      // Splitting may expand the parent, which moves the child pointers of
+      // data nodes that are being rebuilt
+      install_deferred_splits(
+          experimental_params_.allow_splitting_upwards ? nullptr : parent);
+    }
+    split_or_expand_leaf(leaf, key, fail, parent, traversal_path);
+  }
+
+  // Returns the end (exclusive) of the run of sorted keys starting at
+  // values[begin] that fall into leaf, looking no further than values[end - 1].
+  // values[begin] must fall into leaf.
+  // Uses exponential search followed by binary search, so the number of
+  // traversals is logarithmic in the length of the run.
+  long long leaf_run_end(const data_node_type* leaf, const V values[],
+                         long long begin, long long end) const {
+    long long bound = 1;
+    while (begin + bound < end &&
+           get_leaf(values[begin + bound].first) == leaf) {
+      bound *= 2;
+    }
+    long long l = begin + bound / 2 + 1;
+    long long r = std::min(begin + bound, end);
+    while (l < r) {
+      long long mid = l + (r - l) / 2;
+      if (get_leaf(values[mid].first) == leaf) {
+        l = mid + 1;
+      } else {
+        r = mid;
+      }
+    }
+    return l;
+  }
+
+  // Our criteria for when to expand the root, thereby expanding the key domain.
+  // We want to strike a balance between expanding too aggressively and too
+  // slowly.
+  // Specifically, the number of inserted keys falling to the right of the key
+  // domain must have one of two properties: (1) above some maximum threshold,
+  // or
+  // (2) above some minimum threshold and the number is much more than we would
+  // expect from randomness alone.
+  bool should_expand_right() const {
+    return (!root_node_->is_leaf_ &&
+            ((istats_.num_keys_above_key_domain >= kMinOutOfDomainKeys &&
+              istats_.num_keys_above_key_domain >=
+                  kOutOfDomainToleranceFactor *
+                      (stats_.num_keys /
+                           istats_.num_keys_at_last_right_domain_resize -
+                       1)) ||
+             istats_.num_keys_above_key_domain >= kMaxOutOfDomainKeys));
+  }
+
+  // Similar to should_expand_right, but for insertions to the left of the key
+  // domain.
+  bool should_expand_left() const {
+    return (!root_node_->is_leaf_ &&
+            ((istats_.num_keys_below_key_domain >= kMinOutOfDomainKeys &&
+              istats_.num_keys_below_key_domain >=
+                  kOutOfDomainToleranceFactor *
+                      (stats_.num_keys /
+                           istats_.num_keys_at_last_left_domain_resize -
+                       1)) ||
+             istats_.num_keys_below_key_domain >= kMaxOutOfDomainKeys));
+  }
+
+  // When splitting upwards, find best internal node to propagate upwards to.
+  // Returns the level of that node. Returns superroot's level if splitting
+  // sideways not possible.
+  int best_split_propagation(const std::vector<TraversalNode>& traversal_path,
+                             bool verbose = false) const {
+    if (root_node_->is_leaf_) {
+      return superroot_->level_;
+    }
+
+    // Find costs on the path down to data node
+    std::vector<SplitDecisionCosts> traversal_costs;
+    for (const TraversalNode& tn : traversal_path) {
+      double stop_cost;
+      AlexNode<T, P>* next = tn.node->children_[tn.bucketID];
+      if (next->duplication_factor_ > 0) {
+        stop_cost = 0;
+      } else {
+        stop_cost =
+            tn.node->num_children_ >= derived_params_.max_fanout
+                ? std::numeric_limits<double>::max()
+                : tn.node->num_children_ + SplitDecisionCosts::base_cost;
+      }
+      traversal_costs.push_back(
+          {stop_cost,
+           tn.node->num_children_ <= 2
+               ? 0
+               : tn.node->num_children_ / 2 + SplitDecisionCosts::base_cost});
+    }
+
+    // Compute back upwards to find the optimal node to stop propagation.
+    // Ignore the superroot (the first node in the traversal path).
+    double cumulative_cost = 0;
+    double best_cost = std::numeric_limits<double>::max();
+    int best_path_level = superroot_->level_;
+    for (int i = traversal_costs.size() - 1; i >= 0; i--) {
+      SplitDecisionCosts& c = traversal_costs[i];
+      if (c.stop_cost != std::numeric_limits<double>::max() &&
+          cumulative_cost + c.stop_cost < best_cost) {
+        best_cost = cumulative_cost + c.stop_cost;
+        best_path_level = traversal_path[i].node->level_;
+      }
+      cumulative_cost += c.split_cost;
+    }
+
+    if (verbose) {
+      std::cout << "[Best split propagation] best level: " << best_path_level
+                << ", parent level: " << traversal_path.back().node->level_
+                << ", best cost: " << best_cost
+                << ", traversal path (level/addr/n_children): ";
+      for (const TraversalNode& tn : traversal_path) {
+        std::cout << tn.node->level_ << "/" << tn.node << "/"
+                  << tn.node->num_children_ << " ";
+      }
+      std::cout << std::endl;
+    }
+    return best_path_level;
+  }
+
+  // Expand the key value space that is covered by the index.
+  // Expands the root node (which is a model node).
+  // If the root node is at the max node size, then we split the root and create
+  // a new root node.
+  void expand_root(T key, bool expand_left) {
+    thaw();
+    append_finger_ = AppendFinger();
+    auto root = static_cast<model_node_type*>(root_node_);
+
+    // Find the new bounds of the key domain.
+    // Need to be careful to avoid overflows in the key type.
+    T domain_size = istats_.key_domain_max_ - istats_.key_domain_min_;
+    int expansion_factor;
+    T new_domain_min = istats_.key_domain_min_;
+    T new_domain_max = istats_.key_domain_max_;
+    data_node_type* outermost_node;
+    if (expand_left) {
+      auto key_difference = static_cast<double>(istats_.key_domain_min_ -
+                                                std::min(key, get_min_key()));
+      expansion_factor = pow_2_round_up(static_cast<int>(
+          std::ceil((key_difference + domain_size) / domain_size)));
+      // Check for overflow. To avoid overflow on signed types while doing
+      // this check, we do comparisons using half of the relevant quantities.
+      T half_expandable_domain =
+          istats_.key_domain_max_ / 2 - std::numeric_limits<T>::lowest() / 2;
+      T half_expanded_domain_size = expansion_factor / 2 * domain_size;
+      if (half_expandable_domain < half_expanded_domain_size) {
+        new_domain_min = std::numeric_limits<T>::lowest();
+      } else {
+        new_domain_min = istats_.key_domain_max_;
+        new_domain_min -= half_expanded_domain_size;
+        new_domain_min -= half_expanded_domain_size;
+      }
+      istats_.num_keys_at_last_left_domain_resize = stats_.num_keys;
+      istats_.num_keys_below_key_domain = 0;
+      outermost_node =
+          own_leaf(first_data_node(), std::numeric_limits<T>::lowest());
+    } else {
+      auto key_difference = static_cast<double>(std::max(key, get_max_key()) -
+                                                istats_.key_domain_max_);
+      expansion_factor = pow_2_round_up(static_cast<int>(
+          std::ceil((key_difference + domain_size) / domain_size)));
+      // Check for overflow. To avoid overflow on signed types while doing
+      // this check, we do comparisons using half of the relevant quantities.
+      T half_expandable_domain =
+          std::numeric_limits<T>::max() / 2 - istats_.key_domain_min_ / 2;
+      T half_expanded_domain_size = expansion_factor / 2 * domain_size;
+      if (half_expandable_domain < half_expanded_domain_size) {
+        new_domain_max = std::numeric_limits<T>::max();
+      } else {
+        new_domain_max = istats_.key_domain_min_;
+        new_domain_max += half_expanded_domain_size;
+        new_domain_max += half_expanded_domain_size;
+      }
+      istats_.num_keys_at_last_right_domain_resize = stats_.num_keys;
+      istats_.num_keys_above_key_domain = 0;
+      outermost_node =
+          own_leaf(last_data_node(), std::numeric_limits<T>::max());
+    }
+    assert(expansion_factor > 1);
+
+    // Modify the root node appropriately
+    int new_nodes_start;  // index of first pointer to a new node
+    int new_nodes_end;    // exclusive
+    if (static_cast<size_t>(root->num_children_) * expansion_factor <=
+        static_cast<size_t>(derived_params_.max_fanout)) {
+      // Expand root node
+      stats_.num_model_node_expansions++;
+      stats_.num_model_node_expansion_pointers += root->num_children_;
+
+      int new_num_children = root->num_children_ * expansion_factor;
+      auto new_children = new (pointer_allocator().allocate(new_num_children))
+          AlexNode<T, P>*[new_num_children];
+      int copy_start;
+      if (expand_left) {
+        copy_start = new_num_children - root->num_children_;
+        new_nodes_start = 0;
+        new_nodes_end = copy_start;
+        root->model_.shift(new_num_children - root->num_children_);
+      } else {
+        copy_start = 0;
+        new_nodes_start = root->num_children_;
+        new_nodes_end = new_num_children;
+      }
+      for (int i = 0; i < root->num_children_; i++) {
+        new_children[copy_start + i] = root->children_[i];
+      }
+      pointer_allocator().deallocate(root->children_, root->num_children_);
+      root->children_ = new_children;
+      root->num_children_ = new_num_children;
+    } else {
+      // Create new root node
+      auto new_root = new (model_node_allocator().allocate(1))
+          model_node_type(static_cast<short>(root->level_ - 1), allocator_);
+      new_root->model_ = root->model_;
+      new_root->model_.expand(1.0 / root->num_children_);
+      if (expand_left) {
+        new_root->model_.shift(expansion_factor - 1);
+      }
+      new_root->num_children_ = expansion_factor;
+      new_root->children_ = new (pointer_allocator().allocate(expansion_factor))
+          AlexNode<T, P>*[expansion_factor];
+      if (expand_left) {
+        new_root->children_[expansion_factor - 1] = root;
+        new_nodes_start = 0;
+      } else {
+        new_root->children_[0] = root;
+        new_nodes_start = 1;
+      }
+      new_nodes_end = new_nodes_start + expansion_factor - 1;
+      root_node_ = new_root;
+      update_superroot_pointer();
+      root = new_root;
+    }
+    // Determine if new nodes represent a range outside the key type's domain.
+    // This happens when we're preventing overflows.
+    int in_bounds_new_nodes_start = new_nodes_start;
+    int in_bounds_new_nodes_end = new_nodes_end;
+    if (expand_left) {
+      in_bounds_new_nodes_start =
+          std::max(new_nodes_start, root->model_.predict(new_domain_min));
+    } else {
+      in_bounds_new_nodes_end =
+          std::min(new_nodes_end, root->model_.predict(new_domain_max) + 1);
+    }
+
+    // Fill newly created child pointers of the root node with new data nodes.
+    // To minimize empty new data nodes, we create a new data node per n child
+    // pointers, where n is the number of pointers to existing nodes.
+    // Requires reassigning some keys from the outermost pre-existing data node
+    // to the new data nodes.
+    int n = root->num_children_ - (new_nodes_end - new_nodes_start);
+    assert(root->num_children_ % n == 0);
+    auto new_node_duplication_factor =
+        static_cast<uint8_t>(log_2_round_down(n));
+    if (expand_left) {
+      T left_boundary_value = istats_.key_domain_min_;
+      int left_boundary = outermost_node->lower_bound(left_boundary_value);
+      data_node_type* next = outermost_node;
+      for (int i = new_nodes_end; i > new_nodes_start; i -= n) {
+        if (i <= in_bounds_new_nodes_start) {
+          // Do not initialize nodes that fall outside the key type's domain
+          break;
+        }
+        int right_boundary = left_boundary;
+        if (i - n <= in_bounds_new_nodes_start) {
+          left_boundary = 0;
+        } else {
+          left_boundary_value -= domain_size;
+          left_boundary = outermost_node->lower_bound(left_boundary_value);
+        }
+        data_node_type* new_node = bulk_load_leaf_node_from_existing(
+            outermost_node, left_boundary, right_boundary, true);
+        new_node->level_ = static_cast<short>(root->level_ + 1);
+        new_node->duplication_factor_ = new_node_duplication_factor;
+        if (next) {
+          next->prev_leaf_ = new_node;
+        }
+        new_node->next_leaf_ = next;
+        next = new_node;
+        for (int j = i - 1; j >= i - n; j--) {
+          root->children_[j] = new_node;
+        }
+      }
+    } else {
+      T right_boundary_value = istats_.key_domain_max_;
+      int right_boundary = outermost_node->lower_bound(right_boundary_value);
+      data_node_type* prev = nullptr;
+      for (int i = new_nodes_start; i < new_nodes_end; i += n) {
+        if (i >= in_bounds_new_nodes_end) {
+          // Do not initialize nodes that fall outside the key type's domain
+          break;
+        }
+        int left_boundary = right_boundary;
+        if (i + n >= in_bounds_new_nodes_end) {
+          right_boundary = outermost_node->data_capacity_;
+        } else {
+          right_boundary_value += domain_size;
+          right_boundary = outermost_node->lower_bound(right_boundary_value);
+        }
+        data_node_type* new_node = bulk_load_leaf_node_from_existing(
+            outermost_node, left_boundary, right_boundary, true);
+        new_node->level_ = static_cast<short>(root->level_ + 1);
+        new_node->duplication_factor_ = new_node_duplication_factor;
+        if (prev) {
+          prev->next_leaf_ = new_node;
+        }
+        new_node->prev_leaf_ = prev;
+        prev = new_node;
+        for (int j = i; j < i + n; j++) {
+          root->children_[j] = new_node;
+        }
+      }
+    }
+
+    // Connect leaf nodes and remove reassigned keys from outermost pre-existing
+    // node.
+    if (expand_left) {
+      outermost_node->erase_range(new_domain_min, istats_.key_domain_min_);
+      auto last_new_leaf =
+          static_cast<data_node_type*>(root->children_[new_nodes_end - 1]);
+      outermost_node->prev_leaf_ = last_new_leaf;
+      last_new_leaf->next_leaf_ = outermost_node;
+    } else {
+      outermost_node->erase_range(istats_.key_domain_max_, new_domain_max,
+                                  true);
+      auto first_new_leaf =
+          static_cast<data_node_type*>(root->children_[new_nodes_start]);
+      outermost_node->next_leaf_ = first_new_leaf;
+      first_new_leaf->prev_leaf_ = outermost_node;
+    }
+
+    istats_.key_domain_min_ = new_domain_min;
+    istats_.key_domain_max_ = new_domain_max;
+  }
+
+  // Splits downwards in the manner determined by the fanout tree and updates
+  // the pointers of the parent.
+  // If no fanout tree is provided, then splits downward in two. Returns the
+  // newly created model node.
+  model_node_type* split_downwards(
+      model_node_type* parent, int bucketID, int fanout_tree_depth,
+      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
+      bool reuse_model) {
+    auto leaf = static_cast<data_node_type*>(parent->children_[bucketID]);
+    stats_.num_downward_splits++;
+    stats_.num_downward_split_keys += leaf->num_keys_;
+
+    // Create the new model node that will replace the current data node
+    int fanout = 1 << fanout_tree_depth;
+    auto new_node = new (model_node_allocator().allocate(1))
+        model_node_type(leaf->level_, allocator_);
+    new_node->duplication_factor_ = leaf->duplication_factor_;
+    new_node->num_children_ = fanout;
+    new_node->children_ =
+        new (pointer_allocator().allocate(fanout)) AlexNode<T, P>*[fanout];
+
+    int repeats = 1 << leaf->duplication_factor_;
+    int start_bucketID =
+        bucketID - (bucketID % repeats);  // first bucket with same child
+    int end_bucketID =
+        start_bucketID + repeats;  // first bucket with different child
+    long double left_boundary_value = parent->model_.inverse(start_bucketID);
+    long double right_boundary_value = parent->model_.inverse(end_bucketID);
+    new_node->model_.set_anchored(
+        static_cast<double>(1 / (right_boundary_value - left_boundary_value)),
+        left_boundary_value, 0);
+    new_node->model_.expand(fanout);
+
+    // Create new data nodes
+    if (used_fanout_tree_nodes.empty()) {
+      assert(fanout_tree_depth == 1);
+      create_two_new_data_nodes(leaf, new_node, fanout_tree_depth, reuse_model);
+    } else {
+      create_new_data_nodes(leaf, new_node, fanout_tree_depth,
+                            used_fanout_tree_nodes);
+    }
+
+    delete_node(leaf);
+    stats_.num_data_nodes--;
+    stats_.num_model_nodes++;
+    for (int i = start_bucketID; i < end_bucketID; i++) {
+      parent->children_[i] = new_node;
+    }
+    if (parent == superroot_) {
+      root_node_ = new_node;
+      update_superroot_pointer();
+    }
+
+    return new_node;
+  }
+
+  // Splits data node sideways in the manner determined by the fanout tree.
+  // If no fanout tree is provided, then splits sideways in two.
+  void split_sideways(model_node_type* parent, int bucketID,
+                      int fanout_tree_depth,
+                      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
+                      bool reuse_model) {
+    auto leaf = static_cast<data_node_type*>(parent->children_[bucketID]);
+    stats_.num_sideways_splits++;
+    stats_.num_sideways_split_keys += leaf->num_keys_;
+
+    int fanout = 1 << fanout_tree_depth;
+    int repeats = 1 << leaf->duplication_factor_;
+    if (fanout > repeats) {
+      // Expand the pointer array in the parent model node if there are not
+      // enough redundant pointers
+      stats_.num_model_node_expansions++;
+      stats_.num_model_node_expansion_pointers += parent->num_children_;
+      int expansion_factor =
+          parent->expand(fanout_tree_depth - leaf->duplication_factor_);
+      repeats *= expansion_factor;
+      bucketID *= expansion_factor;
+    }
+    int start_bucketID =
+        bucketID - (bucketID % repeats);  // first bucket with same child
+
+    if (used_fanout_tree_nodes.empty()) {
+      assert(fanout_tree_depth == 1);
+      create_two_new_data_nodes(
+          leaf, parent,
+          std::max(fanout_tree_depth,
+                   static_cast<int>(leaf->duplication_factor_)),
+          reuse_model, start_bucketID);
+    } else {
+      // Extra duplication factor is required when there are more redundant
+      // pointers than necessary
+      int extra_duplication_factor =
+          std::max(0, leaf->duplication_factor_ - fanout_tree_depth);
+      create_new_data_nodes(leaf, parent, fanout_tree_depth,
+                            used_fanout_tree_nodes, start_bucketID,
+                            extra_duplication_factor);
+    }
+
+    delete_node(leaf);
+    stats_.num_data_nodes--;
+  }
+
+  // Create two new data nodes by equally dividing the key space of the old data
+  // node, insert the new
+  // nodes as children of the parent model node starting from a given position,
+  // and link the new data nodes together.
+  // duplication_factor denotes how many child pointer slots were assigned to
+  // the old data node.
+  void create_two_new_data_nodes(data_node_type* old_node,
+                                 model_node_type* parent,
+                                 int duplication_factor, bool reuse_model,
+                                 int start_bucketID = 0) {
+    assert(duplication_factor >= 1);
+    int num_buckets = 1 << duplication_factor;
+    int end_bucketID = start_bucketID + num_buckets;
+    int mid_bucketID = start_bucketID + num_buckets / 2;
+
+    bool append_mostly_right = old_node->is_append_mostly_right();
+    int appending_right_bucketID = std::min<int>(
+        std::max<int>(parent->model_.predict(old_node->max_key_), 0),
+        parent->num_children_ - 1);
+    bool append_mostly_left = old_node->is_append_mostly_left();
+    int appending_left_bucketID = std::min<int>(
+        std::max<int>(parent->model_.predict(old_node->min_key_), 0),
+        parent->num_children_ - 1);
+
+    int right_boundary =
+        old_node->lower_bound_prediction(parent->model_, mid_bucketID);
+    data_node_type* left_leaf = bulk_load_leaf_node_from_existing(
+        old_node, 0, right_boundary, true, nullptr, reuse_model,
+        append_mostly_right && start_bucketID <= appending_right_bucketID &&
+            appending_right_bucketID < mid_bucketID,
+        append_mostly_left && start_bucketID <= appending_left_bucketID &&
+            appending_left_bucketID < mid_bucketID);
+    data_node_type* right_leaf = bulk_load_leaf_node_from_existing(
+        old_node, right_boundary, old_node->data_capacity_, true, nullptr,
+        reuse_model,
+        append_mostly_right && mid_bucketID <= appending_right_bucketID &&
+            appending_right_bucketID < end_bucketID,
+        append_mostly_left && mid_bucketID <= appending_left_bucketID &&
+            appending_left_bucketID < end_bucketID);
+    left_leaf->level_ = static_cast<short>(parent->level_ + 1);
+    right_leaf->level_ = static_cast<short>(parent->level_ + 1);
+    left_leaf->duplication_factor_ =
+        static_cast<uint8_t>(duplication_factor - 1);
+    right_leaf->duplication_factor_ =
+        static_cast<uint8_t>(duplication_factor - 1);
+
+    for (int i = start_bucketID; i < mid_bucketID; i++) {
+      parent->children_[i] = left_leaf;
+    }
+    for (int i = mid_bucketID; i < end_bucketID; i++) {
+      parent->children_[i] = right_leaf;
+    }
+    link_data_nodes(old_node, left_leaf, right_leaf);
+  }
+
+  // Create new data nodes from the keys in the old data node according to the
+  // fanout tree, insert the new
+  // nodes as children of the parent model node starting from a given position,
+  // and link the new data nodes together.
+  // Helper for splitting when using a fanout tree.
+  void create_new_data_nodes(
+      const data_node_type* old_node, model_node_type* parent,
+      int fanout_tree_depth,
+      std::vector<fanout_tree::FTNode>& used_fanout_tree_nodes,
+      int start_bucketID = 0, int extra_duplication_factor = 0) {
+    bool append_mostly_right = old_node->is_append_mostly_right();
+    int appending_right_bucketID = std::min<int>(
+        std::max<int>(parent->model_.predict(old_node->max_key_), 0),
+        parent->num_children_ - 1);
+    bool append_mostly_left = old_node->is_append_mostly_left();
+    int appending_left_bucketID = std::min<int>(
+        std::max<int>(parent->model_.predict(old_node->min_key_), 0),
+        parent->num_children_ - 1);
+
+    // Create the new data nodes
+    int cur = start_bucketID;  // first bucket with same child
+    data_node_type* prev_leaf =
+        old_node->prev_leaf_;  // used for linking the new data nodes
+    int left_boundary = 0;
+    int right_boundary = 0;
+    // Keys may be re-assigned to an adjacent fanout tree node due to off-by-one
+    // errors
+    int num_reassigned_keys = 0;
+    for (fanout_tree::FTNode& tree_node : used_fanout_tree_nodes) {
+      left_boundary = right_boundary;
+      auto duplication_factor = static_cast<uint8_t>(
+          fanout_tree_depth - tree_node.level + extra_duplication_factor);
+      int child_node_repeats = 1 << duplication_factor;
+      bool keep_left = append_mostly_right && cur <= appending_right_bucketID &&
+                       appending_right_bucketID < cur + child_node_repeats;
+      bool keep_right = append_mostly_left && cur <= appending_left_bucketID &&
+                        appending_left_bucketID < cur + child_node_repeats;
+      right_boundary = static_cast<int>(tree_node.right_boundary);
+      // Account for off-by-one errors due to floating-point precision issues.
+      tree_node.num_keys -= num_reassigned_keys;
+      num_reassigned_keys = 0;
+      while (right_boundary < old_node->data_capacity_ &&
+             old_node->get_key(right_boundary) !=
+                 data_node_type::kEndSentinel_ &&
+             parent->model_.predict(old_node->get_key(right_boundary)) <
+                 cur + child_node_repeats) {
+        num_reassigned_keys++;
+        right_boundary = std::min(
+            old_node->get_next_filled_position(right_boundary, false) + 1,
+            old_node->data_capacity_);
+      }
+      tree_node.num_keys += num_reassigned_keys;
+      data_node_type* child_node = bulk_load_leaf_node_from_existing(
+          old_node, left_boundary, right_boundary, false, &tree_node, false,
+          keep_left, keep_right);
+      child_node->level_ = static_cast<short>(parent->level_ + 1);
+      child_node->cost_ = tree_node.cost;
+      child_node->duplication_factor_ = duplication_factor;
+      child_node->expected_avg_exp_search_iterations_ =
+          tree_node.expected_avg_search_iterations;
+      child_node->expected_avg_shifts_ = tree_node.expected_avg_shifts;
+      child_node->prev_leaf_ = prev_leaf;
+      if (prev_leaf != nullptr) {
+        prev_leaf->next_leaf_ = child_node;
+      }
+      for (int i = cur; i < cur + child_node_repeats; i++) {
+        parent->children_[i] = child_node;
+      }
+      cur += child_node_repeats;
+      prev_leaf = child_node;
+    }
+    prev_leaf->next_leaf_ = old_node->next_leaf_;
+    if (old_node->next_leaf_ != nullptr) {
+      old_node->next_leaf_->prev_leaf_ = prev_leaf;
+    }
+  }
+
+  // Splits the data node in two and propagates the split upwards along the
+  // traversal path.
+  // Of the two newly created data nodes, returns the one that key falls into.
+  // Returns the parent model node of the new data nodes through new_parent.
+  data_node_type* split_upwards(
+      T key, int stop_propagation_level,
+      const std::vector<TraversalNode>& traversal_path, bool reuse_model,
+      model_node_type** new_parent, bool verbose = false) {
+    assert(stop_propagation_level >= root_node_->level_);
+    std::vector<AlexNode<T, P>*> to_delete;  // nodes that need to be deleted
+
+    // Split the data node into two new data nodes
+    const TraversalNode& parent_path_node = traversal_path.back();
+    model_node_type* parent = parent_path_node.node;
+    auto leaf = static_cast<data_node_type*>(
+        parent->children_[parent_path_node.bucketID]);
+    int leaf_repeats = 1 << (leaf->duplication_factor_);
+    int leaf_start_bucketID =
+        parent_path_node.bucketID - (parent_path_node.bucketID % leaf_repeats);
+    double leaf_mid_bucketID = leaf_start_bucketID + leaf_repeats / 2.0;
+    int leaf_end_bucketID =
+        leaf_start_bucketID + leaf_repeats;  // first bucket with next child
+    stats_.num_sideways_splits++;
+    stats_.num_sideways_split_keys += leaf->num_keys_;
+
+    // Determine if either of the two new data nodes will need to adapt to
+    // append-mostly behavior
+    bool append_mostly_right = leaf->is_append_mostly_right();
+    bool left_half_appending_right = false, right_half_appending_right = false;
+    if (append_mostly_right) {
+      double appending_right_bucketID =
+          parent->model_.predict_double(leaf->max_key_);
+      if (appending_right_bucketID >= leaf_start_bucketID &&
+          appending_right_bucketID < leaf_mid_bucketID) {
+        left_half_appending_right = true;
+      } else if (appending_right_bucketID >= leaf_mid_bucketID &&
+                 appending_right_bucketID < leaf_end_bucketID) {
+        right_half_appending_right = true;
+      }
+    }
+    bool append_mostly_left = leaf->is_append_mostly_left();
+    bool left_half_appending_left = false, right_half_appending_left = false;
+    if (append_mostly_left) {
+      double appending_left_bucketID =
+          parent->model_.predict_double(leaf->min_key_);
+      if (appending_left_bucketID >= leaf_start_bucketID &&
+          appending_left_bucketID < leaf_mid_bucketID) {
+        left_half_appending_left = true;
+      } else if (appending_left_bucketID >= leaf_mid_bucketID &&
+                 appending_left_bucketID < leaf_end_bucketID) {
+        right_half_appending_left = true;
+      }
+    }
+
+    int mid_boundary =
+        leaf->lower_bound_prediction(parent->model_, leaf_mid_bucketID);
+    data_node_type* left_leaf = bulk_load_leaf_node_from_existing(
+        leaf, 0, mid_boundary, true, nullptr, reuse_model,
+        append_mostly_right && left_half_appending_right,
+        append_mostly_left && left_half_appending_left);
+    data_node_type* right_leaf = bulk_load_leaf_node_from_existing(
+        leaf, mid_boundary, leaf->data_capacity_, true, nullptr, reuse_model,
+        append_mostly_right && right_half_appending_right,
+        append_mostly_left && right_half_appending_left);
+    // This is the expected duplication factor; it will be correct once we
+    // split/expand the parent
+    left_leaf->duplication_factor_ = leaf->duplication_factor_;
+    right_leaf->duplication_factor_ = leaf->duplication_factor_;
+    left_leaf->level_ = leaf->level_;
+    right_leaf->level_ = leaf->level_;
+    link_data_nodes(leaf, left_leaf, right_leaf);
+    to_delete.push_back(leaf);
+    stats_.num_data_nodes--;
+
+    if (verbose) {
+      std::cout << "[Splitting upwards data node] level " << leaf->level_
+                << ", node addr: " << leaf
+                << ", node repeats in parent: " << leaf_repeats
+                << ", node indexes in parent: [" << leaf_start_bucketID << ", "
+                << leaf_end_bucketID << ")"
+                << ", left leaf indexes: [0, " << mid_boundary << ")"
+                << ", right leaf indexes: [" << mid_boundary << ", "
+                << leaf->data_capacity_ << ")"
+                << ", new nodes addr: " << left_leaf << "," << right_leaf
+                << std::endl;
+    }
+
+    // The new data node that the key falls into is the one we return
+    data_node_type* new_data_node;
+    if (parent->model_.predict_double(key) < leaf_mid_bucketID) {
+      new_data_node = left_leaf;
+    } else {
+      new_data_node = right_leaf;
+    }
+
+    // Split all internal nodes from the parent up to the highest node along the
+    // traversal path.
+    // As this happens, the entries of the traversal path will go stale, which
+    // is fine because we no longer use them.
+    // Splitting an internal node involves dividing the child pointers into two
+    // halves, and doubling the relevant half.
+    AlexNode<T, P>* prev_left_split = left_leaf;
+    AlexNode<T, P>* prev_right_split = right_leaf;
+    int path_idx = static_cast<int>(traversal_path.size()) - 1;
+    while (traversal_path[path_idx].node->level_ > stop_propagation_level) {
+      // Decide which half to double
+      const TraversalNode& path_node = traversal_path[path_idx];
+      model_node_type* cur_node = path_node.node;
+      stats_.num_model_node_splits++;
+      stats_.num_model_node_split_pointers += cur_node->num_children_;
+      bool double_left_half = path_node.bucketID < cur_node->num_children_ / 2;
+      model_node_type* left_split = nullptr;
+      model_node_type* right_split = nullptr;
+
+      // If one of the resulting halves will only have one child pointer, we
+      // should "pull up" that child
+      bool pull_up_left_child = false, pull_up_right_child = false;
+      AlexNode<T, P>* left_half_first_child = cur_node->children_[0];
+      AlexNode<T, P>* right_half_first_child =
+          cur_node->children_[cur_node->num_children_ / 2];
+      if (double_left_half &&
+          (1 << right_half_first_child->duplication_factor_) ==
+              cur_node->num_children_ / 2) {
+        // pull up right child if all children in the right half are the same
+        pull_up_right_child = true;
+        left_split = new (model_node_allocator().allocate(1))
+            model_node_type(cur_node->level_, allocator_);
+      } else if (!double_left_half &&
+                 (1 << left_half_first_child->duplication_factor_) ==
+                     cur_node->num_children_ / 2) {
+        // pull up left child if all children in the left half are the same
+        pull_up_left_child = true;
+        right_split = new (model_node_allocator().allocate(1))
+            model_node_type(cur_node->level_, allocator_);
+      } else {
+        left_split = new (model_node_allocator().allocate(1))
+            model_node_type(cur_node->level_, allocator_);
+        right_split = new (model_node_allocator().allocate(1))
+            model_node_type(cur_node->level_, allocator_);
+      }
+
+      // Do the split
+      AlexNode<T, P>* next_left_split = nullptr;
+      AlexNode<T, P>* next_right_split = nullptr;
+      if (double_left_half) {
+        // double left half
+        assert(left_split != nullptr);
+        if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
+          *new_parent = left_split;
+        }
+        left_split->num_children_ = cur_node->num_children_;
+        left_split->children_ =
+            new (pointer_allocator().allocate(left_split->num_children_))
+                AlexNode<T, P>*[left_split->num_children_];
+        left_split->model_ = cur_node->model_;
+        left_split->model_.expand(2);
+        int cur = 0;
+        while (cur < cur_node->num_children_ / 2) {
+          AlexNode<T, P>* cur_child = cur_node->children_[cur];
+          int cur_child_repeats = 1 << cur_child->duplication_factor_;
+          for (int i = 2 * cur; i < 2 * (cur + cur_child_repeats); i++) {
+            left_split->children_[i] = cur_child;
+          }
+          cur_child->duplication_factor_++;
+          cur += cur_child_repeats;
+        }
+        assert(cur == cur_node->num_children_ / 2);
+
+        if (pull_up_right_child) {
+          next_right_split = cur_node->children_[cur_node->num_children_ / 2];
+          next_right_split->level_ = cur_node->level_;
+        } else {
+          right_split->num_children_ = cur_node->num_children_ / 2;
+          right_split->children_ =
+              new (pointer_allocator().allocate(right_split->num_children_))
+                  AlexNode<T, P>*[right_split->num_children_];
+          right_split->model_ = cur_node->model_;
+          right_split->model_.shift(-(cur_node->num_children_ / 2));
+          int j = 0;
+          for (int i = cur_node->num_children_ / 2; i < cur_node->num_children_;
+               i++) {
+            right_split->children_[j] = cur_node->children_[i];
+            j++;
+          }
+          next_right_split = right_split;
+        }
+
+        int new_bucketID = path_node.bucketID * 2;
+        int repeats = 1 << (prev_left_split->duplication_factor_ + 1);
+        int start_bucketID =
+            new_bucketID -
+            (new_bucketID % repeats);  // first bucket with same child
+        int mid_bucketID = start_bucketID + repeats / 2;
+        int end_bucketID =
+            start_bucketID + repeats;  // first bucket with next child
+        for (int i = start_bucketID; i < mid_bucketID; i++) {
+          left_split->children_[i] = prev_left_split;
+        }
+        for (int i = mid_bucketID; i < end_bucketID; i++) {
+          left_split->children_[i] = prev_right_split;
+        }
+        next_left_split = left_split;
+      } else {
+        // double right half
+        assert(right_split != nullptr);
+        if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
+          *new_parent = right_split;
+        }
+        if (pull_up_left_child) {
+          next_left_split = cur_node->children_[0];
+          next_left_split->level_ = cur_node->level_;
+        } else {
+          left_split->num_children_ = cur_node->num_children_ / 2;
+          left_split->children_ =
+              new (pointer_allocator().allocate(left_split->num_children_))
+                  AlexNode<T, P>*[left_split->num_children_];
+          left_split->model_ = cur_node->model_;
+          int j = 0;
+          for (int i = 0; i < cur_node->num_children_ / 2; i++) {
+            left_split->children_[j] = cur_node->children_[i];
+            j++;
+          }
+          next_left_split = left_split;
+        }
+
+        right_split->num_children_ = cur_node->num_children_;
+        right_split->children_ =
+            new (pointer_allocator().allocate(right_split->num_children_))
+                AlexNode<T, P>*[right_split->num_children_];
+        right_split->model_ = cur_node->model_;
+        right_split->model_.shift(-(cur_node->num_children_ / 2));
+        right_split->model_.expand(2);
+        int cur = cur_node->num_children_ / 2;
+        while (cur < cur_node->num_children_) {
+          AlexNode<T, P>* cur_child = cur_node->children_[cur];
+          int cur_child_repeats = 1 << cur_child->duplication_factor_;
+          int right_child_idx = cur - cur_node->num_children_ / 2;
+          for (int i = 2 * right_child_idx;
+               i < 2 * (right_child_idx + cur_child_repeats); i++) {
+            right_split->children_[i] = cur_child;
+          }
+          cur_child->duplication_factor_++;
+          cur += cur_child_repeats;
+        }
+        assert(cur == cur_node->num_children_);
+
+        int new_bucketID =
+            (path_node.bucketID - cur_node->num_children_ / 2) * 2;
+        int repeats = 1 << (prev_left_split->duplication_factor_ + 1);
+        int start_bucketID =
+            new_bucketID -
+            (new_bucketID % repeats);  // first bucket with same child
+        int mid_bucketID = start_bucketID + repeats / 2;
+        int end_bucketID =
+            start_bucketID + repeats;  // first bucket with next child
+        for (int i = start_bucketID; i < mid_bucketID; i++) {
+          right_split->children_[i] = prev_left_split;
+        }
+        for (int i = mid_bucketID; i < end_bucketID; i++) {
+          right_split->children_[i] = prev_right_split;
+        }
+        next_right_split = right_split;
+      }
+      assert(next_left_split != nullptr && next_right_split != nullptr);
+      if (verbose) {
+        std::cout << "[Splitting upwards through-node] level "
+                  << cur_node->level_ << ", node addr: " << path_node.node
+                  << ", node children: " << path_node.node->num_children_
+                  << ", child index: " << path_node.bucketID
+                  << ", child repeats in node: "
+                  << (1 << prev_left_split->duplication_factor_)
+                  << ", node repeats in parent: "
+                  << (1 << path_node.node->duplication_factor_)
+                  << ", new nodes addr: " << left_split << "," << right_split
+                  << std::endl;
+      }
+      to_delete.push_back(cur_node);
+      if (!pull_up_left_child && !pull_up_right_child) {
+        stats_.num_model_nodes++;
+      }
+      // This is the expected duplication factor; it will be correct once we
+      // split/expand the parent
+      next_left_split->duplication_factor_ = cur_node->duplication_factor_;
+      next_right_split->duplication_factor_ = cur_node->duplication_factor_;
+      prev_left_split = next_left_split;
+      prev_right_split = next_right_split;
+      path_idx--;
+    }
+
+    // Insert into the top node
+    const TraversalNode& top_path_node = traversal_path[path_idx];
+    model_node_type* top_node = top_path_node.node;
+    assert(top_node->level_ == stop_propagation_level);
+    if (path_idx == static_cast<int>(traversal_path.size()) - 1) {
+      *new_parent = top_node;
+    }
+    int top_bucketID = top_path_node.bucketID;
+    int repeats =
+        1 << prev_left_split->duplication_factor_;  // this was the duplication
+                                                    // factor of the child that
+                                                    // was deleted
+    if (verbose) {
+      std::cout << "[Splitting upwards top node] level "
+                << stop_propagation_level << ", node addr: " << top_node
+                << ", node children: " << top_node->num_children_
+                << ", child index: " << top_bucketID
+                << ", child repeats in node: " << repeats
+                << ", node repeats in parent: "
+                << (1 << top_node->duplication_factor_) << std::endl;
+    }
+
+    // Expand the top node if necessary
+    if (repeats == 1) {
+      stats_.num_model_node_expansions++;
+      stats_.num_model_node_expansion_pointers += top_node->num_children_;
+      top_node->expand(1);  // double size of top node
+      top_bucketID *= 2;
+      repeats *= 2;
+    } else {
+      prev_left_split->duplication_factor_--;
+      prev_right_split->duplication_factor_--;
+    }
+
+    int start_bucketID =
+        top_bucketID -
+        (top_bucketID % repeats);  // first bucket with same child
+    int mid_bucketID = start_bucketID + repeats / 2;
+    int end_bucketID =
+        start_bucketID + repeats;  // first bucket with next child
+    for (int i = start_bucketID; i < mid_bucketID; i++) {
+      top_node->children_[i] = prev_left_split;
+    }
+    for (int i = mid_bucketID; i < end_bucketID; i++) {
+      top_node->children_[i] = prev_right_split;
+    }
+
+    for (auto node : to_delete) {
+      delete_node(node);
+    }
+
+    return new_data_node;
+  }
+
+  /*** Memory budget ***/
+
+ public:
+  // Packs the coldest data nodes until model_size() + data_size() fits the
+  // memory budget (see set_memory_budget()), and starts a new period for
+  // counting inserts per data node. Data nodes that received more inserts
+  // since the last rebalance than a packed data node could take are not
+  // packed. Returns the size in bytes after packing.
+  long long rebalance_density() {
+    num_inserts_at_rebalance_ = stats_.num_inserts;
+    struct ColdNode {
+      double inserts_per_key;
+      data_node_type* node;
+    };
+    std::vector<ColdNode> cold_nodes;
+    long long size = 0;
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      AlexNode<T, P>* cur = node_it.current();
+      size += cur->node_size();
+      if (!cur->is_leaf_) {
+        continue;
+      }
+      auto node = static_cast<data_node_type*>(cur);
+      size += node->data_size();
+      int num_inserts = node->num_inserts_ - node->num_inserts_at_rebalance_;
+      node->num_inserts_at_rebalance_ = node->num_inserts_;
+      // Data nodes that are being rebuilt must not be modified, and packing
+      // data nodes of a mapped file or of a snapshot would copy them
+      double max_packed_inserts =
+          node->num_keys_ * (data_node_type::kPackedMaxDensity_ /
+                                 data_node_type::kPackedDensity_ -
+                             1);
+      if (node->num_keys_ == 0 || node->slots_in_file_ || is_shared(node) ||
+          node->packed_data_size() >= node->data_size() ||
+          num_inserts >= max_packed_inserts ||
+          find_deferred_split(node) != nullptr) {
+        continue;
+      }
+      cold_nodes.push_back(
+          {static_cast<double>(num_inserts) / node->num_keys_, node});
+    }
+    if (params_.memory_budget <= 0 || size <= params_.memory_budget) {
+      return size;
+    }
+
+    std::sort(cold_nodes.begin(), cold_nodes.end(),
+              [](const ColdNode& a, const ColdNode& b) {
+                return a.inserts_per_key < b.inserts_per_key;
+              });
+    for (const ColdNode& cold_node : cold_nodes) {
+      if (size <= params_.memory_budget) {
+        break;
+      }
+      data_node_type* node = cold_node.node;
+      size -= node->data_size();
+      node->pack();
+      size += node->data_size();
+      stats_.num_data_node_packs++;
+    }
+    return size;
+  }
+
+ private:
+  // Minimum number of inserts between two rebalances. Rebalances are also at
+  // least one insert per data node apart, so they take amortized constant time.
+  static constexpr int kMinRebalanceInterval = 1 << 12;
+
+  /*** Distribution drift ***/
+
+ public:
+  // Measures the cost of every subtree below the root, and rebuilds the
+  // top-most subtrees whose cost per key grew to more than drift_threshold
+  // times the cost they had when they were first measured (see
+  // set_drift_threshold()). The cost of a data node is its empirical cost if
+  // it had operations since it was last resized, and its expected cost
+  // otherwise. The cost of a subtree sums the costs of its data nodes and one
+  // node lookup per model node on the way to them, weighted by the number of
+  // keys of each data node. Subtrees that this finds for the first time are
+  // only measured. Pending rebuilds are installed first. Returns the number of
+  // subtrees whose rebuild started.
+  int rebuild_drifted_subtrees() {
+    flush_deferred_splits();
+    num_inserts_at_drift_check_ = stats_.num_inserts;
+    if (params_.drift_threshold <= 0 || root_node_->is_leaf_) {
+      return 0;
+    }
+    std::vector<DriftedSubtree> drifted;
+    auto root = static_cast<model_node_type*>(root_node_);
+    for (int i = 0; i < root->num_children_; i++) {
+      if (i == 0 || root->children_[i] != root->children_[i - 1]) {
+        long long num_keys;
+        measure_drift(root->children_[i], root, i, num_keys, drifted);
+      }
+    }
+
+    int num_rebuilds = 0;
+    for (const DriftedSubtree& subtree : drifted) {
+      if (static_cast<int>(deferred_splits_.size()) >= kMaxDeferredSplits) {
+        break;
+      }
+      std::unique_ptr<DeferredSplit> split =
+          make_deferred_split(subtree.node, subtree.parent, subtree.bucketID);
+      if (split->num_keys < kMinDeferredSplitKeys) {
+        build_deferred_split(*split);
+        install_deferred_split(*split);
+      } else {
+        start_worker(std::move(split));
+      }
+      num_rebuilds++;
+    }
+    return num_rebuilds;
+  }
+
+ private:
+  // Minimum number of inserts between two drift checks. Checks are also at
+  // least one insert per data node apart, so they take amortized constant time.
+  static constexpr int kMinDriftCheckInterval = 1 << 12;
+
+  struct DriftedSubtree {
+    model_node_type* node;
+    model_node_type* parent;
+    int bucketID;
+  };
+
+  // Returns the cost of node summed over its keys, and sets num_keys to the
+  // number of keys of node. The cost per key of a model node when it is first
+  // measured is kept in its cost_, which model nodes do not use otherwise.
+  // Model nodes that drifted are added to drifted, replacing the model nodes
+  // below them.
+  double measure_drift(AlexNode<T, P>* node, model_node_type* parent,
+                       int bucketID, long long& num_keys,
+                       std::vector<DriftedSubtree>& drifted) {
+    if (node->is_leaf_) {
+      auto leaf = static_cast<data_node_type*>(node);
+      num_keys = leaf->num_keys_;
+      double cost = leaf->num_inserts_ + leaf->num_lookups_ > 0
+                        ? leaf->empirical_cost()
+                        : leaf->cost_;
+      return cost * num_keys;
+    }
+    auto model_node = static_cast<model_node_type*>(node);
+    size_t num_drifted_before = drifted.size();
+    double total_cost = 0;
+    num_keys = 0;
+    for (int i = 0; i < model_node->num_children_; i++) {
+      if (i == 0 || model_node->children_[i] != model_node->children_[i - 1]) {
+        long long child_keys;
+        total_cost += measure_drift(model_node->children_[i], model_node, i,
+                                    child_keys, drifted) +
+                      kNodeLookupsWeight * child_keys;
+        num_keys += child_keys;
+      }
+    }
+    if (num_keys == 0) {
+      return 0;
+    }
+    double cost = total_cost / num_keys;
+    if (model_node->cost_ <= 0) {
+      model_node->cost_ = cost;
+    } else if (cost > params_.drift_threshold * model_node->cost_) {
+      // Rebuilding the model node also rebuilds the subtrees below it
+      drifted.resize(num_drifted_before);
+      drifted.push_back({model_node, parent, bucketID});
+    }
+    return total_cost;
+  }
+
+  /*** Delete ***/
+
+ public:
+  // Erases the left-most key with the given key value
+  int erase_one(const T& key) {
+    LatencyTimer timer(latency_stats_.get(), kEraseOp);
+    flush_deferred_splits();
+    data_node_type* leaf = own_leaf(get_leaf(key), key);
+    int num_erased = leaf->erase_one(key);
+    stats_.num_keys -= num_erased;
+    if (leaf->num_keys_ == 0) {
+      merge(leaf, key);
+    }
+    if (key > istats_.key_domain_max_) {
+      istats_.num_keys_above_key_domain -= num_erased;
+    } else if (key < istats_.key_domain_min_) {
+      istats_.num_keys_below_key_domain -= num_erased;
+    }
+    return num_erased;
+  }
+
+  // Erases all keys with a certain key value
+  int erase(const T& key) {
+    LatencyTimer timer(latency_stats_.get(), kEraseOp);
+    flush_deferred_splits();
+    data_node_type* leaf = own_leaf(get_leaf(key), key);
+    int num_erased = leaf->erase(key);
+    stats_.num_keys -= num_erased;
+    if (leaf->num_keys_ == 0) {
+      merge(leaf, key);
+    }
+    if (key > istats_.key_domain_max_) {
+      istats_.num_keys_above_key_domain -= num_erased;
+    } else if (key < istats_.key_domain_min_) {
+      istats_.num_keys_below_key_domain -= num_erased;
+    }
+    return num_erased;
+  }
+
+  // Erases element pointed to by iterator
+  void erase(Iterator it) {
+    if (it.is_end()) {
+      return;
+    }
+    LatencyTimer timer(latency_stats_.get(), kEraseOp);
+    T key = it.key();
+    if (!deferred_splits_.empty()) {
+      // Keys in buffers are not in the tree, so only rebuilds that are in
+      // progress have to finish. If the data node of it is being rebuilt, it
+      // is found again by its rank among equal keys, which the rebuilt subtree
+      // keeps in order.
+      int rank = -1;
+      if (find_deferred_split(it.cur_leaf_) != nullptr) {
+        rank = 0;
+        for (Iterator first = lower_bound(key); !first.is_end() && first != it;
+             ++first) {
+          rank++;
+        }
+      }
+      install_deferred_splits();
+      if (rank >= 0) {
+        it = lower_bound(key);
+        for (; rank > 0; rank--) {
+          ++it;
+        }
+      }
+    }
+    data_node_type* leaf = own_leaf(it.cur_leaf_, key);
+    leaf->erase_one_at(it.cur_idx_);
+    stats_.num_keys--;
+    if (leaf->num_keys_ == 0) {
+      merge(leaf, key);
+    }
+    if (key > istats_.key_domain_max_) {
+      istats_.num_keys_above_key_domain--;
+    } else if (key < istats_.key_domain_min_) {
+      istats_.num_keys_below_key_domain--;
+    }
+  }
+
+  // Erases all keys in [low, high).
+  // Data nodes whose keys all lie in the range are freed without touching
+  // their slots, and so are subtrees that only hold such data nodes. Only the
+  // data nodes at the ends of the range, which also hold keys outside of it,
+  // have keys erased from their slots. Each model node that loses children is
+  // fixed up once, after all of its children in the range were visited.
+  // Returns the number of keys erased.
+  long long erase_range(const T& low, const T& high) {
+    if (!key_less_(low, high)) {
+      return 0;
+    }
+    LatencyTimer timer(latency_stats_.get(), kEraseOp);
+    flush_deferred_splits();
+    EraseRangeState state;
+    std::vector<TraversalNode> traversal_path;
+    for (data_node_type* leaf = get_leaf(low, &traversal_path);
+         leaf != nullptr; leaf = leaf->next_leaf_) {
+      state.leaves.push_back(leaf);
+      if (leaf->num_keys_ > 0 && !key_less_(leaf->last_key(), high)) {
+        break;
+      }
+    }
+    data_node_type* prev_leaf = state.leaves.front()->prev_leaf_;
+    data_node_type* next_leaf = state.leaves.back()->next_leaf_;
+
+    long long num_erased = 0;
+    state.num_outside.push_back(0);
+    for (int i = 0; i < static_cast<int>(state.leaves.size()); i++) {
+      data_node_type*& leaf = state.leaves[i];
+      bool inside = leaf->num_keys_ == 0 ||
+                    (!key_less_(leaf->first_key(), low) &&
+                     key_less_(leaf->last_key(), high));
+      if (!inside || root_node_->is_leaf_) {
+        leaf = own_leaf(leaf, leaf->last_key());
+        update_key_domain_counts_for_erase(leaf, low, high);
+        num_erased += leaf->erase_range(low, high);
+        inside = leaf->num_keys_ == 0;
+      } else {
+        update_key_domain_counts_for_erase(leaf, low, high);
+        num_erased += leaf->num_keys_;
+      }
+      state.ranks[leaf] = i;
+      state.num_outside.push_back(state.num_outside.back() + (inside ? 0 : 1));
+    }
+    stats_.num_keys -= num_erased;
+    if (root_node_->is_leaf_ ||
+        state.num_outside.back() == static_cast<int>(state.leaves.size())) {
+      return num_erased;
+    }
+
+    if (!leads_to(traversal_path, state.leaves.front())) {
+      // An edge case of the correction in get_leaf() may leave the path
+      // pointing elsewhere
+      traversal_path.resize(1);
+      find_traversal_path(root_node_, state.leaves.front(), traversal_path);
+    }
+    thaw();
+    append_finger_ = AppendFinger();
+    erase_range_children(static_cast<model_node_type*>(root_node_),
+                         traversal_path, 1, state);
+    data_node_type* root_leaf =
+        collapse_model_node(static_cast<model_node_type*>(root_node_));
+    if (root_leaf != nullptr) {
+      root_node_ = root_leaf;
+      update_superroot_pointer();
+    }
+
+    // Link the remaining data nodes of the range to each other and to their
+    // neighbors outside of the range
+    for (data_node_type* leaf : state.new_leaves) {
+      if (state.merged_leaves.count(leaf) > 0) {
+        continue;
+      }
+      leaf->prev_leaf_ = prev_leaf;
+      if (prev_leaf != nullptr) {
+        prev_leaf->next_leaf_ = leaf;
+      }
+      prev_leaf = leaf;
+    }
+    if (prev_leaf != nullptr) {
+      prev_leaf->next_leaf_ = next_leaf;
+    }
+    if (next_leaf != nullptr) {
+      next_leaf->prev_leaf_ = prev_leaf;
+    }
+    for (data_node_type* leaf : state.merged_leaves) {
+      delete_node(leaf);
+      stats_.num_data_nodes--;
+    }
+    return num_erased;
+  }
+
+  // Removes all elements
+  void clear() {
+    discard_deferred_splits();
+    reclaim_retired_leaves();
+    if (retired_leaves_.empty() && !has_live_snapshots() &&
+        release_allocator(allocator_, 0)) {
+      superroot_ = nullptr;
+      append_finger_ = AppendFinger();
+      structure_epoch_++;
+    } else {
+      for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+           node_it.next()) {
+        delete_node(node_it.current());
+      }
+    }
+    unmap_file();
+    thaw();
+    auto empty_data_node = new (data_node_allocator().allocate(1))
+        data_node_type(key_less_, allocator_);
+    empty_data_node->bulk_load(nullptr, 0);
+    root_node_ = empty_data_node;
+    create_superroot();
+    stats_.num_keys = 0;
+  }
+
+ private:
+  // Updates the counts of keys outside the key domain for erasing the keys of
+  // leaf in [low, high)
+  void update_key_domain_counts_for_erase(const data_node_type* leaf,
+                                          const T& low, const T& high) {
+    if (leaf->num_keys_ == 0 ||
+        (!key_less_(istats_.key_domain_max_, leaf->last_key()) &&
+         !key_less_(leaf->first_key(), istats_.key_domain_min_))) {
+      return;
+    }
+    for (int pos = 0; pos < leaf->data_capacity_; pos++) {
+      if (!leaf->check_exists(pos)) {
+        continue;
+      }
+      const T& key = leaf->get_key(pos);
+      if (key_less_(key, low) || !key_less_(key, high)) {
+        continue;
+      }
+      if (key > istats_.key_domain_max_) {
+        istats_.num_keys_above_key_domain--;
+      } else if (key < istats_.key_domain_min_) {
+        istats_.num_keys_below_key_domain--;
+      }
+    }
+  }
+
+  // Data nodes of a range that erase_range() erases
+  struct EraseRangeState {
+    // From the data node that low falls into to the one that ends the range,
+    // in key order, and the rank of each in this order
+    std::vector<data_node_type*> leaves;
+    std::unordered_map<const data_node_type*, int> ranks;
+    // num_outside[i] is the number of leaves before rank i that still hold
+    // keys after the erase
+    std::vector<int> num_outside;
+    // Data nodes in the range after the erase, in key order
+    std::vector<data_node_type*> new_leaves;
+    // Empty data nodes that replaced freed children
+    std::unordered_set<const data_node_type*> empty_leaves;
+    // Empty data nodes that were merged into a sibling, to be freed
+    std::unordered_set<data_node_type*> merged_leaves;
+
+    // Rank of leaf, or -1 if it is not in the range
+    int rank(const data_node_type* leaf) const {
+      auto it = ranks.find(leaf);
+      return it == ranks.end() ? -1 : it->second;
+    }
+  };
+
+  // Frees the children of node that only hold data nodes without keys left,
+  // and recurses into the children that also hold other data nodes. Each
+  // freed child is replaced by an empty data node, and these are merged with
+  // their siblings once all children were visited. path is the traversal path
+  // to the first data node of the range. If node is on the path, it is
+  // path[depth].node, and only the children from the one on the path onwards
+  // are visited.
+  void erase_range_children(model_node_type* node,
+                            const std::vector<TraversalNode>& path,
+                            size_t depth, EraseRangeState& state) {
+    bool on_path = depth < path.size() && path[depth].node == node;
+    int bucketID = 0;
+    if (on_path) {
+      int path_bucketID = path[depth].bucketID;
+      bucketID = path_bucketID -
+                 path_bucketID %
+                     (1 << node->children_[path_bucketID]->duplication_factor_);
+    }
+    int start_bucketID = node->num_children_;  // of the changed children
+    int end_bucketID = 0;
+    bool child_on_path = on_path;
+    while (bucketID < node->num_children_) {
+      AlexNode<T, P>* child = node->children_[bucketID];
+      int repeats = 1 << child->duplication_factor_;
+      int first_rank = state.rank(leftmost_leaf(child));
+      int last_rank = state.rank(rightmost_leaf(child));
+      if (first_rank < 0 && !child_on_path) {
+        break;  // past the end of the range
+      }
+      AlexNode<T, P>* new_child = nullptr;
+      if (first_rank >= 0 && last_rank >= 0 &&
+          state.num_outside[last_rank + 1] == state.num_outside[first_rank]) {
+        if (!child->is_leaf_) {
+          stats_.num_model_nodes -= num_model_nodes_of(child);
+        }
+        stats_.num_data_nodes -= last_rank - first_rank + 1;
+        auto leaf = new (data_node_allocator().allocate(1))
+            data_node_type(static_cast<short>(node->level_ + 1),
+                           derived_params_.max_data_node_slots, key_less_,
+                           allocator_);
+        leaf->bulk_load(nullptr, 0);
+        leaf->duplication_factor_ = child->duplication_factor_;
+        delete_subtree(child);
+        stats_.num_data_nodes++;
+        state.new_leaves.push_back(leaf);
+        state.empty_leaves.insert(leaf);
+        new_child = leaf;
+      } else if (child->is_leaf_) {
+        state.new_leaves.push_back(static_cast<data_node_type*>(child));
+      } else {
+        auto model_child = static_cast<model_node_type*>(child);
+        erase_range_children(model_child, path,
+                             child_on_path ? depth + 1 : path.size(), state);
+        new_child = collapse_model_node(model_child);
+      }
+      if (new_child != nullptr) {
+        for (int i = bucketID; i < bucketID + repeats; i++) {
+          node->children_[i] = new_child;
+        }
+        start_bucketID = std::min(start_bucketID, bucketID);
+        end_bucketID = bucketID + repeats;
+      }
+      child_on_path = false;
+      bucketID += repeats;
+    }
+    if (start_bucketID < end_bucketID) {
+      merge_empty_children(node, start_bucketID, end_bucketID, state);
+    }
+  }
+
+  // Merges the empty data nodes that erase_range() put into the children
+  // [start_bucketID, end_bucketID) of node into their siblings, from the
+  // smallest children upwards, like merge() does for a single empty data
+  // node
+  void merge_empty_children(model_node_type* node, int start_bucketID,
+                            int end_bucketID, EraseRangeState& state) {
+    for (int repeats = 1; repeats < node->num_children_; repeats <<= 1) {
+      for (int i = start_bucketID - start_bucketID % (repeats << 1);
+           i < end_bucketID; i += repeats << 1) {
+        AlexNode<T, P>* left = node->children_[i];
+        AlexNode<T, P>* right = node->children_[i + repeats];
+        if (left == right || !left->is_leaf_ || !right->is_leaf_ ||
+            (1 << left->duplication_factor_) != repeats ||
+            (1 << right->duplication_factor_) != repeats) {
+          continue;
+        }
+        auto left_leaf = static_cast<data_node_type*>(left);
+        auto right_leaf = static_cast<data_node_type*>(right);
+        data_node_type* empty_leaf = nullptr;
+        if (state.empty_leaves.count(right_leaf) > 0) {
+          empty_leaf = right_leaf;
+        } else if (state.empty_leaves.count(left_leaf) > 0) {
+          empty_leaf = left_leaf;
+        } else {
+          continue;
+        }
+        data_node_type* kept_leaf =
+            empty_leaf == right_leaf ? left_leaf : right_leaf;
+        kept_leaf->duplication_factor_++;
+        for (int j = i; j < i + (repeats << 1); j++) {
+          node->children_[j] = kept_leaf;
+        }
+        state.empty_leaves.erase(empty_leaf);
+        state.merged_leaves.insert(empty_leaf);
+      }
+    }
+  }
+
+  // If all children of node are the same data node, frees node and returns
+  // the data node, which the caller puts in place of node. Otherwise returns
+  // null.
+  data_node_type* collapse_model_node(model_node_type* node) {
+    AlexNode<T, P>* child = node->children_[0];
+    if (!child->is_leaf_ ||
+        (1 << child->duplication_factor_) != node->num_children_) {
+      return nullptr;
+    }
+    child->duplication_factor_ = node->duplication_factor_;
+    delete_node(node);
+    stats_.num_model_nodes--;
+    return static_cast<data_node_type*>(child);
+  }
+
+  // Whether the traversal path leads to leaf
+  static bool leads_to(const std::vector<TraversalNode>& traversal_path,
+                       const data_node_type* leaf) {
+    for (size_t i = 1; i < traversal_path.size(); i++) {
+      const TraversalNode& tn = traversal_path[i];
+      const AlexNode<T, P>* child = tn.node->children_[tn.bucketID];
+      if (i + 1 < traversal_path.size()
+              ? child != traversal_path[i + 1].node
+              : child != leaf) {
+        return false;
+      }
+    }
+    return traversal_path.size() > 1;
+  }
+
+  // Appends the path from node to leaf, which is in the subtree of node, to
+  // traversal_path. Returns false if leaf is not in the subtree.
+  static bool find_traversal_path(AlexNode<T, P>* node,
+                                  const data_node_type* leaf,
+                                  std::vector<TraversalNode>& traversal_path) {
+    if (node->is_leaf_) {
+      return node == leaf;
+    }
+    auto model_node = static_cast<model_node_type*>(node);
+    for (int i = 0; i < model_node->num_children_;
+         i += 1 << model_node->children_[i]->duplication_factor_) {
+      traversal_path.push_back({model_node, i});
+      if (find_traversal_path(model_node->children_[i], leaf,
+                              traversal_path)) {
+        return true;
+      }
+      traversal_path.pop_back();
+    }
+    return false;
+  }
+
+  static data_node_type* leftmost_leaf(AlexNode<T, P>* node) {
+    while (!node->is_leaf_) {
+      node = static_cast<model_node_type*>(node)->children_[0];
+    }
+    return static_cast<data_node_type*>(node);
+  }
+
+  static data_node_type* rightmost_leaf(AlexNode<T, P>* node) {
+    while (!node->is_leaf_) {
+      auto model_node = static_cast<model_node_type*>(node);
+      node = model_node->children_[model_node->num_children_ - 1];
+    }
+    return static_cast<data_node_type*>(node);
+  }
+
+  // Try to merge empty leaf, which can be traversed to by looking up key
+  // This may cause the parent node to merge up into its own parent
+  void merge(data_node_type* leaf, T key) {
+    thaw();
+    // first save the complete path down to data node
+    std::vector<TraversalNode> traversal_path;
+    auto leaf_dup = get_leaf(key, &traversal_path);
+    // We might need to correct the traversal path in edge cases
+    if (leaf_dup != leaf) {
+      if (leaf_dup->prev_leaf_ == leaf) {
+        correct_traversal_path(leaf, traversal_path, true);
+      } else if (leaf_dup->next_leaf_ == leaf) {
+        correct_traversal_path(leaf, traversal_path, false);
+      } else {
+        assert(false);
+        return;
+      }
+    }
+    if (traversal_path.size() == 1) {
+      return;
+    }
+    int path_pos = static_cast<int>(traversal_path.size()) - 1;
+    TraversalNode tn = traversal_path[path_pos];
+    model_node_type* parent = tn.node;
+    int bucketID = tn.bucketID;
+    int repeats = 1 << leaf->duplication_factor_;
+
+    while (path_pos >= 0) {
+      // repeatedly merge leaf with "sibling" leaf by redirecting pointers in
+      // the parent
+      while (leaf->num_keys_ == 0 && repeats < parent->num_children_) {
+        int start_bucketID = bucketID - (bucketID % repeats);
+        int end_bucketID = start_bucketID + repeats;
+        // determine if the potential sibling leaf is adjacent to the right or
+        // left
+        bool adjacent_to_right =
+            (bucketID % (repeats << 1) == bucketID % repeats);
+        data_node_type* adjacent_leaf = nullptr;
+
+        // check if adjacent node is a leaf
+        if (adjacent_to_right && parent->children_[end_bucketID]->is_leaf_) {
+          adjacent_leaf =
+              static_cast<data_node_type*>(parent->children_[end_bucketID]);
+        } else if (!adjacent_to_right &&
+                   parent->children_[start_bucketID - 1]->is_leaf_) {
+          adjacent_leaf = static_cast<data_node_type*>(
+              parent->children_[start_bucketID - 1]);
+        } else {
+          break;  // unable to merge with sibling leaf
+        }
+
+        // check if adjacent node is a sibling
+        if (leaf->duplication_factor_ != adjacent_leaf->duplication_factor_) {
+          break;  // unable to merge with sibling leaf
+        }
+
+        // merge with adjacent leaf
+        for (int i = start_bucketID; i < end_bucketID; i++) {
+          parent->children_[i] = adjacent_leaf;
+        }
+        if (adjacent_to_right) {
+          adjacent_leaf->prev_leaf_ = leaf->prev_leaf_;
+          if (leaf->prev_leaf_) {
+            leaf->prev_leaf_->next_leaf_ = adjacent_leaf;
+          }
+        } else {
+          adjacent_leaf->next_leaf_ = leaf->next_leaf_;
+          if (leaf->next_leaf_) {
+            leaf->next_leaf_->prev_leaf_ = adjacent_leaf;
+          }
+        }
+        adjacent_leaf->duplication_factor_++;
+        delete_node(leaf);
+        stats_.num_data_nodes--;
+        leaf = adjacent_leaf;
+        repeats = 1 << leaf->duplication_factor_;
+      }
+
+      // try to merge up by removing parent and replacing pointers to parent
+      // with pointers to leaf in grandparent
+      if (repeats == parent->num_children_) {
+        leaf->duplication_factor_ = parent->duplication_factor_;
+        repeats = 1 << leaf->duplication_factor_;
+        bool is_root_node = (parent == root_node_);
+        delete_node(parent);
+        stats_.num_model_nodes--;
+
+        if (is_root_node) {
+          root_node_ = leaf;
+          update_superroot_pointer();
+          break;
+        }
+
+        path_pos--;
+        tn = traversal_path[path_pos];
+        parent = tn.node;
+        bucketID = tn.bucketID;
+        int start_bucketID = bucketID - (bucketID % repeats);
+        int end_bucketID = start_bucketID + repeats;
+        for (int i = start_bucketID; i < end_bucketID; i++) {
+          parent->children_[i] = leaf;
+        }
+      } else {
+        break;  // unable to merge up
+      }
+    }
+  }
+
+  /*** Frozen layout ***/
+
+ public:
+  // Copies the model nodes into flat arrays in breadth-first order, which
+  // lookups traverse instead of the model nodes. Children are referred to by
+  // 32-bit indexes, so that a child slot takes 4 bytes instead of a pointer.
+  // Inserts keep the index frozen, until an insert or erase changes the
+  // structure of the tree, which thaws the index. Call freeze() again after a
+  // write-heavy phase. With NUMA replication, the arrays are also copied to
+  // every NUMA node (see set_numa_replication()).
+  void freeze() {
+    thaw();
+    if (root_node_->is_leaf_) {
+      return;
+    }
+    std::unordered_map<const AlexNode<T, P>*, int> node_indexes;
+    std::vector<const model_node_type*> queue;
+    queue.push_back(static_cast<const model_node_type*>(root_node_));
+    for (size_t i = 0; i < queue.size(); i++) {
+      const model_node_type* node = queue[i];
+      FrozenModelNode frozen_node;
+      frozen_node.model = node->model_;
+      frozen_node.num_children = node->num_children_;
+      frozen_node.first_child = static_cast<int>(frozen_children_.size());
+      frozen_model_nodes_.push_back(frozen_node);
+      for (int j = 0; j < node->num_children_; j++) {
+        const AlexNode<T, P>* child = node->children_[j];
+        auto it = node_indexes.find(child);
+        if (it == node_indexes.end()) {
+          int index;
+          if (child->is_leaf_) {
+            index = ~static_cast<int>(frozen_leaves_.size());
+            frozen_leaves_.push_back(static_cast<data_node_type*>(
+                const_cast<AlexNode<T, P>*>(child)));
+          } else {
+            index = static_cast<int>(queue.size());
+            queue.push_back(static_cast<const model_node_type*>(child));
+          }
+          it = node_indexes.emplace(child, index).first;
+        }
+        frozen_children_.push_back(it->second);
+      }
+    }
+    if (numa_replication_) {
+      replicate_frozen_arrays();
+    }
+  }
+
+  // Switches lookups back to traversing the model nodes
+  void thaw() {
+    if (is_frozen()) {
+      num_inserts_at_thaw_ = stats_.num_inserts;
+    }
+    frozen_model_nodes_ = std::vector<FrozenModelNode>();
+    frozen_children_ = std::vector<int>();
+    frozen_leaves_ = std::vector<data_node_type*>();
+    frozen_replicas_ = std::vector<FrozenReplica>();
+  }
+
+  bool is_frozen() const { return !frozen_model_nodes_.empty(); }
+
+  // Size in bytes of the flat arrays built by freeze(), and of their NUMA
+  // replicas
+  long long frozen_size() const {
+    long long size = static_cast<long long>(
+        frozen_model_nodes_.size() * sizeof(FrozenModelNode) +
+        frozen_children_.size() * sizeof(int) +
+        frozen_leaves_.size() * sizeof(data_node_type*));
+    for (const FrozenReplica& replica : frozen_replicas_) {
+      size += static_cast<long long>(replica.buffer.size());
+    }
+    return size;
+  }
+
+ private:
+  // Minimum number of inserts between a thaw and the next freeze with NUMA
+  // replication. Freezing is also at least one insert per data node after the
+  // thaw, so it takes amortized constant time.
+  static constexpr int kMinRefreezeInterval = 1 << 12;
+
+  // Copies the flat arrays into the memory of each NUMA node. The pages of
+  // each copy are bound to their node before the copy writes them.
+  void replicate_frozen_arrays() {
+    int num_nodes = NumaTopology::get().num_nodes();
+    if (num_nodes <= 1) {
+      return;
+    }
+    size_t model_nodes_size =
+        frozen_model_nodes_.size() * sizeof(FrozenModelNode);
+    size_t children_size = frozen_children_.size() * sizeof(int);
+    size_t leaves_offset = model_nodes_size + children_size;
+    leaves_offset = (leaves_offset + alignof(data_node_type*) - 1) /
+                    alignof(data_node_type*) * alignof(data_node_type*);
+    size_t num_bytes =
+        leaves_offset + frozen_leaves_.size() * sizeof(data_node_type*);
+    frozen_replicas_.resize(num_nodes);
+    for (int node = 0; node < num_nodes; node++) {
+      FrozenReplica& replica = frozen_replicas_[node];
+      replica.buffer = NumaBuffer(num_bytes, node);
+      char* data = replica.buffer.data();
+      std::memcpy(data, frozen_model_nodes_.data(), model_nodes_size);
+      std::memcpy(data + model_nodes_size, frozen_children_.data(),
+                  children_size);
+      std::memcpy(data + leaves_offset, frozen_leaves_.data(),
+                  frozen_leaves_.size() * sizeof(data_node_type*));
+      replica.model_nodes = reinterpret_cast<const FrozenModelNode*>(data);
+      replica.children = reinterpret_cast<const int*>(data + model_nodes_size);
+      replica.leaves =
+          reinterpret_cast<data_node_type* const*>(data + leaves_offset);
+    }
+  }
+
+  // Same as get_leaf() without a traversal path, but reads the flat arrays
+  forceinline data_node_type* get_leaf_frozen(T key) const {
+    const FrozenModelNode* nodes = frozen_model_nodes_.data();
+    const int* children = frozen_children_.data();
+    data_node_type* const* leaves = frozen_leaves_.data();
+    if (!frozen_replicas_.empty()) {
+      const FrozenReplica& replica = frozen_replicas_[std::min<int>(
+          current_numa_node(), static_cast<int>(frozen_replicas_.size()) - 1)];
+      nodes = replica.model_nodes;
+      children = replica.children;
+      leaves = replica.leaves;
+    }
+    int cur = 0;
+    while (true) {
+      const FrozenModelNode& node = nodes[cur];
+      double bucketID_prediction = node.model.predict_double(key);
+      int bucketID = static_cast<int>(bucketID_prediction);
+      bucketID =
+          std::min<int>(std::max<int>(bucketID, 0), node.num_children - 1);
+      cur = children[node.first_child + bucketID];
+      if (cur < 0) {
+        data_node_type* leaf = leaves[~cur];
+        stats_.num_node_lookups += leaf->level_;
+#if ALEX_SAFE_LOOKUP
+        return correct_leaf(leaf, key, bucketID_prediction);
+#else
+        return leaf;
+#endif
+      }
+    }
+  }
+
+  /*** Snapshots ***/
+
+ public:
+  // Returns a read-only view of the keys and payloads as they are now, which
+  // does not change when the index changes afterwards. Taking a snapshot
+  // takes time linear in the number of data nodes and copies no keys:
+  // the snapshot shares the data nodes with the index, and the index copies a
+  // shared data node the first time it changes it (see alex_snapshot.h).
+  // Snapshots can be read and destroyed in any thread while the index keeps
+  // changing, but snapshot() must not run at the same time as changes to the
+  // index. A snapshot must not be read after the index is destroyed or
+  // cleared, or after the file of open_mmap() is unmapped.
+  // Payloads changed through pointers or iterators, instead of through
+  // insert() or upsert(), also change in snapshots that share the data node.
+  snapshot_type snapshot() {
+    // Keys in buffers must be in data nodes to be in the snapshot
+    flush_deferred_splits();
+    if (!snapshot_registry_) {
+      snapshot_registry_ = std::make_shared<SnapshotRegistry>();
+    }
+    reclaim_retired_leaves();
+    uint64_t version = next_snapshot_version_++;
+    std::vector<const data_node_type*> leaves;
+    for (data_node_type* leaf = first_data_node(); leaf != nullptr;
+         leaf = leaf->next_leaf_) {
+      if (leaf->num_keys_ > 0) {
+        leaf->snapshot_version_ = version;
+        leaves.push_back(leaf);
+      }
+    }
+    snapshot_registry_->add(version);
+    return snapshot_type(snapshot_registry_, version, std::move(leaves),
+                         static_cast<size_t>(stats_.num_keys));
+  }
+
+  // Number of data nodes that the index no longer uses but keeps for live
+  // snapshots
+  size_t num_retired_data_nodes() const { return retired_leaves_.size(); }
+
+ private:
+  bool has_live_snapshots() const {
+    return snapshot_registry_ &&
+           snapshot_registry_->oldest() != SnapshotRegistry::kNoSnapshot;
+  }
+
+  // Whether a live snapshot may read leaf
+  bool is_shared(const data_node_type* leaf) const {
+    return leaf->snapshot_version_ != 0 && snapshot_registry_ &&
+           snapshot_registry_->oldest() <= leaf->snapshot_version_;
+  }
+
+  // Returns leaf if no live snapshot shares it. Otherwise replaces leaf in the
+  // tree by a copy, which the caller changes instead, and retires leaf. key
+  // must fall into leaf.
+  data_node_type* own_leaf(data_node_type* leaf, const T& key) {
+    if (!is_shared(leaf)) {
+      if (!retired_leaves_.empty()) {
+        reclaim_retired_leaves();
+      }
+      return leaf;
+    }
+    // Data nodes that are being rebuilt are not modified, so never copied
+    assert(find_deferred_split(leaf) == nullptr);
+    thaw();
+    std::vector<TraversalNode> traversal_path;
+    get_leaf(key, &traversal_path);
+    model_node_type* parent = traversal_path.back().node;
+    int bucketID = traversal_path.back().bucketID;
+    assert(parent->children_[bucketID] == leaf);
+    auto copy = new (data_node_allocator().allocate(1)) data_node_type(*leaf);
+    int start_bucketID = bucketID;
+    while (start_bucketID > 0 &&
+           parent->children_[start_bucketID - 1] == leaf) {
+      start_bucketID--;
+    }
+    for (int i = start_bucketID;
+         i < parent->num_children_ && parent->children_[i] == leaf; i++) {
+      parent->children_[i] = copy;
+    }
+    if (root_node_ == leaf) {
+      root_node_ = copy;
+    }
+    if (leaf->prev_leaf_ != nullptr) {
+      leaf->prev_leaf_->next_leaf_ = copy;
+    }
+    if (leaf->next_leaf_ != nullptr) {
+      leaf->next_leaf_->prev_leaf_ = copy;
+    }
+    if (append_finger_.leaf == leaf) {
+      append_finger_.leaf = copy;
+    }
+    structure_epoch_++;
+    retire_leaf(leaf);
+    stats_.num_data_node_copies_on_write++;
+    return copy;
+  }
+
+  void retire_leaf(data_node_type* leaf) {
+    reclaim_retired_leaves();
+    retired_leaves_.push_back({leaf, next_snapshot_version_});
+  }
+
+  // Frees the retired data nodes that no live snapshot can read anymore
+  void reclaim_retired_leaves() {
+    uint64_t oldest = snapshot_registry_ ? snapshot_registry_->oldest()
+                                         : SnapshotRegistry::kNoSnapshot;
+    while (!retired_leaves_.empty() &&
+           retired_leaves_.front().version <= oldest) {
+      data_node_type* leaf = retired_leaves_.front().leaf;
+      data_node_allocator().destroy(leaf);
+      data_node_allocator().deallocate(leaf, 1);
+      retired_leaves_.pop_front();
+    }
+  }
+
+  /*** Stats ***/
+
+ public:
+  // Number of elements
+  size_t size() const { return static_cast<size_t>(stats_.num_keys); }
+
+  // True if there are no elements
+  bool empty() const { return (size() == 0); }
+
+  // This is just a function required by the STL standard. ALEX can hold more
+  // items.
+  size_t max_size() const { return size_t(-1); }
+
+  // Size in bytes of all the keys, payloads, and bitmaps stored in this index
+  long long data_size() const {
+    long long size = 0;
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      AlexNode<T, P>* cur = node_it.current();
+      if (cur->is_leaf_) {
+        size += static_cast<data_node_type*>(cur)->data_size();
+      }
+    }
+    return size;
+  }
+
+  // Size in bytes of all the model nodes (including pointers) and metadata in
+  // data nodes
+  long long model_size() const {
+    long long size = 0;
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      size += node_it.current()->node_size();
+    }
+    return size;
+  }
+
+  // Total number of nodes in the RMI
+  int num_nodes() const {
+    return stats_.num_data_nodes + stats_.num_model_nodes;
+  };
+
+  // Number of data nodes in the RMI
+  int num_leaves() const { return stats_.num_data_nodes; };
+
+  // Return a const reference to the current statistics
+  const struct Stats& get_stats() const { return stats_; }
+
+  // Copies the latency histograms (see set_track_latency()). All histograms
+  // are empty if latency is not tracked. Only reads atomic counters, so it can
+  // be called from another thread while the index is in use.
+  LatencyStats::Snapshot latency_snapshot() const {
+    return latency_stats_ ? latency_stats_->snapshot()
+                          : LatencyStats::Snapshot();
+  }
+
+  void reset_latency_stats() {
+    if (latency_stats_) {
+      latency_stats_->reset();
+    }
+  }
+
+  // Stats of all nodes and summary histograms, taken in one pass over the
+  // nodes without reading keys (see alex_structure.h). Keys in deferred splits
+  // are only counted in num_deferred_keys.
+  StructureSnapshot<T> export_structure() const {
+    StructureSnapshot<T> snapshot;
+    snapshot.num_keys = stats_.num_keys;
+    snapshot.num_deferred_keys = static_cast<int64_t>(num_deferred_keys());
+    if (root_node_ == nullptr) {
+      return snapshot;
+    }
+    short root_level = root_node_->level_;
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      AlexNode<T, P>* cur = node_it.current();
+      auto depth = static_cast<int16_t>(cur->level_ - root_level);
+      snapshot.max_depth = std::max<int>(snapshot.max_depth, depth);
+      snapshot.model_size_bytes += cur->node_size();
+      if (cur->is_leaf_) {
+        auto node = static_cast<const data_node_type*>(cur);
+        auto& c = snapshot.data_nodes;
+        c.depth.push_back(depth);
+        c.duplication_factor.push_back(node->duplication_factor_);
+        c.data_capacity.push_back(node->data_capacity_);
+        c.num_keys.push_back(node->num_keys_);
+        c.num_shifts.push_back(node->num_shifts_);
+        c.num_exp_search_iterations.push_back(node->num_exp_search_iterations_);
+        c.num_lookups.push_back(node->num_lookups_);
+        c.num_inserts.push_back(node->num_inserts_);
+        c.num_resizes.push_back(node->num_resizes_);
+        c.expected_avg_shifts.push_back(node->expected_avg_shifts_);
+        c.expected_avg_exp_search_iterations.push_back(
+            node->expected_avg_exp_search_iterations_);
+        c.model_a.push_back(node->model_.a());
+        c.model_b.push_back(node->model_.b());
+        c.num_model_segments.push_back(
+            static_cast<int16_t>(node->segments_.num_segments()));
+        c.min_key.push_back(node->min_key_);
+        c.max_key.push_back(node->max_key_);
+        long long data_size = node->data_size();
+        c.size_bytes.push_back(node->node_size() + data_size);
+        snapshot.data_size_bytes += data_size;
+
+        snapshot.depth_histogram.add(depth);
+        snapshot.density_histogram.add(
+            node->data_capacity_ == 0
+                ? 0
+                : node->num_keys_ / static_cast<double>(node->data_capacity_));
+        snapshot.model_error_histogram.add(
+            node->num_lookups_ + node->num_inserts_ > 0
+                ? node->exp_search_iterations_per_operation()
+                : node->expected_avg_exp_search_iterations_);
+      } else {
+        auto node = static_cast<const model_node_type*>(cur);
+        int fanout = 0;
+        for (int i = 0; i < node->num_children_; i++) {
+          if (i == 0 || node->children_[i] != node->children_[i - 1]) {
+            fanout++;
+          }
+        }
+        auto& c = snapshot.model_nodes;
+        c.depth.push_back(depth);
+        c.duplication_factor.push_back(node->duplication_factor_);
+        c.num_children.push_back(node->num_children_);
+        c.fanout.push_back(fanout);
+        c.model_a.push_back(node->model_.a());
+        c.model_b.push_back(node->model_.b());
+        c.size_bytes.push_back(node->node_size());
+        snapshot.fanout_histogram.add(fanout);
+      }
+    }
+    return snapshot;
+  }
+
+  // Writes export_structure() to a file in the format of
+  // StructureSnapshot::write(). Returns whether the file was written
+  // successfully.
+  bool export_structure(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    return out && export_structure().write(out);
+  }
+
+  /*** Persistence ***/
+
+  // Layout of a file written by save(). Nodes refer to each other by node
+  // number, and everything else is located by its offset from the start of
+  // the file, so the file can be mapped at any address:
+  // - FileHeader
+  // - One record per node, in pre-order starting at the superroot. A model
+  //   node record is followed by the node numbers of all of its children. A
+  //   data node record is followed by the slot block of the data node, in the
+  //   same layout as in memory.
+  // - The offset of each node record, indexed by node number
+ private:
+  static const uint32_t kFileVersion = 5;
+  static const size_t kFileRecordAlignment = alignof(std::max_align_t);
+  static const size_t kFileSlotBlockAlignment = 64;
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t payload_size;
+    uint32_t allows_duplicates;
+    uint32_t sep_arrays;
+    uint32_t max_model_segments;  // of the policy, which sizes data records
+    uint64_t num_nodes;
+    uint64_t node_table_offset;
+    Params params;
+    DerivedParams derived_params;
+    ExperimentalParams experimental_params;
+    InternalStats istats;
+    long long num_keys;
+    int num_model_nodes;
+    int num_data_nodes;
+    long long num_inserts;
+  };
+
+  struct NodeRecord {
+    uint8_t is_leaf;
+    uint8_t duplication_factor;
+    short level;
+    double model_a;
+    long double model_anchor;
+    double model_anchor_position;
+    double cost;
+  };
+
+  struct ModelNodeRecord {
+    NodeRecord node;
+    int num_children;
+  };
+
+  struct DataNodeRecord {
+    NodeRecord node;
+    int64_t next_leaf;  // node number, or -1 if there is none
+    int64_t prev_leaf;
+    uint64_t slot_block_offset;
+    int data_capacity;
+    int num_keys;
+    int bitmap_size;
+    int max_slots;
+    double expansion_threshold;
+    double contraction_threshold;
+    long long num_shifts;
+    long long num_exp_search_iterations;
+    int num_lookups;
+    int num_inserts;
+    int num_resizes;
+    int num_right_out_of_bounds_inserts;
+    int num_left_out_of_bounds_inserts;
+    T max_key;
+    T min_key;
+    double expected_avg_exp_search_iterations;
+    double expected_avg_shifts;
+    typename data_node_type::segment_model_type segments;
+  };
+
+ public:
+  // Writes the index to a file, which can be opened with open_mmap().
+  // Returns whether the file was written successfully.
+  bool save(const std::string& path) const {
+    static_assert(std::is_trivially_copyable<P>::value,
+                  "ALEX can only save trivially copyable payloads.");
+    // Keys of deferred splits are not in the tree yet
+    const_cast<self_type*>(this)->flush_deferred_splits();
+    // Number the nodes in pre-order. A child that is duplicated in its parent
+    // is only numbered once.
+    std::vector<const AlexNode<T, P>*> nodes;
+    std::unordered_map<const AlexNode<T, P>*, int64_t> node_numbers;
+    std::stack<const AlexNode<T, P>*> node_stack;
+    node_stack.push(superroot_);
+    while (!node_stack.empty()) {
+      const AlexNode<T, P>* node = node_stack.top();
+      node_stack.pop();
+      node_numbers[node] = static_cast<int64_t>(nodes.size());
+      nodes.push_back(node);
+      if (!node->is_leaf_) {
+        auto model_node = static_cast<const model_node_type*>(node);
+        // Walk the children from the right, so that the left-most child is
+        // numbered first
+        int cur = model_node->num_children_ - 1;
+        while (cur >= 0) {
+          const AlexNode<T, P>* child = model_node->children_[cur];
+          node_stack.push(child);
+          cur -= 1 << child->duplication_factor_;
+        }
+      }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return false;
+    }
+    uint64_t offset = 0;
+    auto write = [&](const void* data, size_t num_bytes) {
+      out.write(static_cast<const char*>(data), num_bytes);
+      offset += num_bytes;
+    };
+    auto pad = [&](size_t alignment) {
+      static const char zeros[kFileSlotBlockAlignment] = {};
+      write(zeros, (alignment - offset % alignment) % alignment);
+    };
+
+    FileHeader header = FileHeader();
+    std::memcpy(header.magic, "ALEXIDX", sizeof(header.magic));
+    header.version = kFileVersion;
+    header.key_size = sizeof(T);
+    header.payload_size = sizeof(P);
+    header.allows_duplicates = allow_duplicates;
+    header.sep_arrays = ALEX_DATA_NODE_SEP_ARRAYS;
+    header.max_model_segments = Policy::kMaxModelSegments;
+    header.num_nodes = nodes.size();
+    header.params = params_;
+    header.derived_params = derived_params_;
+    header.experimental_params = experimental_params_;
+    header.istats = istats_;
+    header.num_keys = stats_.num_keys;
+    header.num_model_nodes = stats_.num_model_nodes;
+    header.num_data_nodes = stats_.num_data_nodes;
+    header.num_inserts = stats_.num_inserts;
+    write(&header, sizeof(header));
+
+    std::vector<uint64_t> node_offsets;
+    node_offsets.reserve(nodes.size());
+    for (const AlexNode<T, P>* node : nodes) {
+      pad(kFileRecordAlignment);
+      node_offsets.push_back(offset);
+      NodeRecord node_record = NodeRecord();
+      node_record.is_leaf = node->is_leaf_;
+      node_record.duplication_factor = node->duplication_factor_;
+      node_record.level = node->level_;
+      node_record.model_a = node->model_.a();
+      node_record.model_anchor = node->model_.anchor();
+      node_record.model_anchor_position = node->model_.anchor_position();
+      node_record.cost = node->cost_;
+      if (!node->is_leaf_) {
+        auto model_node = static_cast<const model_node_type*>(node);
+        ModelNodeRecord record = ModelNodeRecord();
+        record.node = node_record;
+        record.num_children = model_node->num_children_;
+        write(&record, sizeof(record));
+        for (int i = 0; i < model_node->num_children_; i++) {
+          int64_t child_number = node_numbers[model_node->children_[i]];
+          write(&child_number, sizeof(child_number));
+        }
+        continue;
+      }
+      auto data_node = static_cast<const data_node_type*>(node);
+      DataNodeRecord record = DataNodeRecord();
+      record.node = node_record;
+      record.next_leaf = data_node->next_leaf_
+                             ? node_numbers[data_node->next_leaf_]
+                             : -1;
+      record.prev_leaf = data_node->prev_leaf_
+                             ? node_numbers[data_node->prev_leaf_]
+                             : -1;
+      record.slot_block_offset = offset + sizeof(record);
+      record.slot_block_offset +=
+          (kFileSlotBlockAlignment -
+           record.slot_block_offset % kFileSlotBlockAlignment) %
+          kFileSlotBlockAlignment;
+      record.data_capacity = data_node->data_capacity_;
+      record.num_keys = data_node->num_keys_;
+      record.bitmap_size = data_node->bitmap_size_;
+      record.max_slots = data_node->max_slots_;
+      record.expansion_threshold = data_node->expansion_threshold_;
+      record.contraction_threshold = data_node->contraction_threshold_;
+      record.num_shifts = data_node->num_shifts_;
+      record.num_exp_search_iterations = data_node->num_exp_search_iterations_;
+      record.num_lookups = data_node->num_lookups_;
+      record.num_inserts = data_node->num_inserts_;
+      record.num_resizes = data_node->num_resizes_;
+      record.num_right_out_of_bounds_inserts =
+          data_node->num_right_out_of_bounds_inserts_;
+      record.num_left_out_of_bounds_inserts =
+          data_node->num_left_out_of_bounds_inserts_;
+      record.max_key = data_node->max_key_;
+      record.min_key = data_node->min_key_;
+      record.expected_avg_exp_search_iterations =
+          data_node->expected_avg_exp_search_iterations_;
+      record.expected_avg_shifts = data_node->expected_avg_shifts_;
+      record.segments = data_node->segments_;
+      write(&record, sizeof(record));
+      pad(kFileSlotBlockAlignment);
+      write(data_node->slot_block(),
+            data_node_type::slot_block_size(data_node->data_capacity_,
+                                            data_node->bitmap_size_) *
+                sizeof(std::max_align_t));
+    }
+
+    pad(kFileRecordAlignment);
+    header.node_table_offset = offset;
+    write(node_offsets.data(), node_offsets.size() * sizeof(uint64_t));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    return !out.fail();
+  }
+
+  // Replaces the contents of the index with an index written by save(). The
+  // keys, payloads, and bitmaps are used directly from the mapped file instead
+  // of being read into memory, and only the node objects are rebuilt, so
+  // opening takes time proportional to the number of nodes instead of keys.
+  // The file is mapped privately and is never modified. Writing to a data node
+  // that is backed by the file copies the pages it touches, and resizing the
+  // data node moves its slots into memory from the allocator. If read_only is
+  // true, the file is mapped without write access, and the index must not be
+  // modified.
+  // Returns false if the file cannot be mapped or was not written by an index
+  // of the same type, in which case the index is unchanged.
+  bool open_mmap(const std::string& path, bool read_only = false) {
+#if ALEX_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        static_cast<size_t>(file_stat.st_size) < sizeof(FileHeader)) {
+      ::close(fd);
+      return false;
+    }
+    auto file_size = static_cast<size_t>(file_stat.st_size);
+    void* mapping =
+        mmap(nullptr, file_size, read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+             MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+    char* file = static_cast<char*>(mapping);
+    if (!is_valid_file(file, file_size)) {
+      munmap(mapping, file_size);
+      return false;
+    }
+
+    discard_deferred_splits();
+    for (NodeIterator node_it = NodeIterator(this); !node_it.is_end();
+         node_it.next()) {
+      delete_node(node_it.current());
+    }
+    delete_node(superroot_);
+    unmap_file();
+    thaw();
+
+    const auto& header = *reinterpret_cast<const FileHeader*>(file);
+    auto node_offsets =
+        reinterpret_cast<const uint64_t*>(file + header.node_table_offset);
+    std::vector<AlexNode<T, P>*> nodes(header.num_nodes);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const auto& node_record =
+          *reinterpret_cast<const NodeRecord*>(file + node_offsets[i]);
+      if (node_record.is_leaf) {
+        const auto& record =
+            *reinterpret_cast<const DataNodeRecord*>(file + node_offsets[i]);
+        auto node = new (data_node_allocator().allocate(1)) data_node_type(
+            node_record.level, derived_params_.max_data_node_slots, key_less_,
+            allocator_);
+        node->data_capacity_ = record.data_capacity;
+        node->num_keys_ = record.num_keys;
+        node->bitmap_size_ = record.bitmap_size;
+        node->attach_slot_block(file + record.slot_block_offset);
+        node->max_slots_ = record.max_slots;
+        node->expansion_threshold_ = record.expansion_threshold;
+        node->contraction_threshold_ = record.contraction_threshold;
+        node->num_shifts_ = record.num_shifts;
+        node->num_exp_search_iterations_ = record.num_exp_search_iterations;
+        node->num_lookups_ = record.num_lookups;
+        node->num_inserts_ = record.num_inserts;
+        node->num_resizes_ = record.num_resizes;
+        node->num_right_out_of_bounds_inserts_ =
+            record.num_right_out_of_bounds_inserts;
+        node->num_left_out_of_bounds_inserts_ =
+            record.num_left_out_of_bounds_inserts;
+        node->max_key_ = record.max_key;
+        node->min_key_ = record.min_key;
+        node->expected_avg_exp_search_iterations_ =
+            record.expected_avg_exp_search_iterations;
+        node->expected_avg_shifts_ = record.expected_avg_shifts;
+        node->segments_ = record.segments;
+        nodes[i] = node;
+      } else {
+        const auto& record =
+            *reinterpret_cast<const ModelNodeRecord*>(file + node_offsets[i]);
+        auto node = new (model_node_allocator().allocate(1))
+            model_node_type(node_record.level, allocator_);
+        node->num_children_ = record.num_children;
+        node->children_ =
+            new (pointer_allocator().allocate(node->num_children_))
+                AlexNode<T, P>*[node->num_children_];
+        nodes[i] = node;
+      }
+      nodes[i]->duplication_factor_ = node_record.duplication_factor;
+      nodes[i]->model_.set_anchored(node_record.model_a,
+                                    node_record.model_anchor,
+                                    node_record.model_anchor_position);
+      nodes[i]->cost_ = node_record.cost;
+    }
+
+    // Link the nodes once they all exist
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const char* record = file + node_offsets[i];
+      if (nodes[i]->is_leaf_) {
+        const auto& data_record =
+            *reinterpret_cast<const DataNodeRecord*>(record);
+        auto node = static_cast<data_node_type*>(nodes[i]);
+        if (data_record.next_leaf >= 0) {
+          node->next_leaf_ =
+              static_cast<data_node_type*>(nodes[data_record.next_leaf]);
+        }
+        if (data_record.prev_leaf >= 0) {
+          node->prev_leaf_ =
+              static_cast<data_node_type*>(nodes[data_record.prev_leaf]);
+        }
+      } else {
+        auto node = static_cast<model_node_type*>(nodes[i]);
+        auto child_numbers =
+            reinterpret_cast<const int64_t*>(record + sizeof(ModelNodeRecord));
+        for (int j = 0; j < node->num_children_; j++) {
+          node->children_[j] = nodes[child_numbers[j]];
+        }
+      }
+    }
+
+    superroot_ = static_cast<model_node_type*>(nodes[0]);
+    root_node_ = superroot_->children_[0];
+    params_ = header.params;
+    derived_params_ = header.derived_params;
+    experimental_params_ = header.experimental_params;
+    istats_ = header.istats;
+    stats_ = Stats();
+    stats_.num_keys = header.num_keys;
+    stats_.num_model_nodes = header.num_model_nodes;
+    stats_.num_data_nodes = header.num_data_nodes;
+    stats_.num_inserts = header.num_inserts;
+    mapped_file_ = file;
+    mapped_file_size_ = file_size;
+    return true;
+#else
+    (void)path;
+    (void)read_only;
+    return false;
+#endif
+  }
+
+ private:
+  // Checks that everything open_mmap() reads lies inside the file, and that
+  // the file was written by an index with the same key and payload types
+  static bool is_valid_file(const char* file, size_t file_size) {
+    const auto& header = *reinterpret_cast<const FileHeader*>(file);
+    if (std::memcmp(header.magic, "ALEXIDX", sizeof(header.magic)) != 0 ||
+        header.version != kFileVersion || header.key_size != sizeof(T) ||
+        header.payload_size != sizeof(P) ||
+        header.allows_duplicates != allow_duplicates ||
+        header.sep_arrays != ALEX_DATA_NODE_SEP_ARRAYS ||
+        header.max_model_segments != Policy::kMaxModelSegments ||
+        header.num_nodes < 2 || header.node_table_offset > file_size ||
+        header.node_table_offset % kFileRecordAlignment != 0 ||
+        (file_size - header.node_table_offset) / sizeof(uint64_t) <
+            header.num_nodes) {
+      return false;
+    }
+    auto node_offsets =
+        reinterpret_cast<const uint64_t*>(file + header.node_table_offset);
+    for (uint64_t i = 0; i < header.num_nodes; i++) {
+      uint64_t offset = node_offsets[i];
+      if (offset % kFileRecordAlignment != 0 ||
+          offset > file_size - sizeof(ModelNodeRecord)) {
+        return false;
+      }
+      const auto& node_record =
+          *reinterpret_cast<const NodeRecord*>(file + offset);
+      // The superroot is a model node with a single child
+      if (i == 0 && node_record.is_leaf) {
+        return false;
+      }
+      if (node_record.is_leaf) {
+        if (offset > file_size - sizeof(DataNodeRecord)) {
+          return false;
+        }
+        const auto& record =
+            *reinterpret_cast<const DataNodeRecord*>(file + offset);
+        if (record.data_capacity <= 0 || record.bitmap_size <= 0 ||
+            record.segments.num_segments() < 0 ||
+            record.segments.num_segments() > Policy::kMaxModelSegments ||
+            record.next_leaf >= static_cast<int64_t>(header.num_nodes) ||
+            record.prev_leaf >= static_cast<int64_t>(header.num_nodes) ||
+            record.slot_block_offset % kFileSlotBlockAlignment != 0 ||
+            record.slot_block_offset > file_size ||
+            (file_size - record.slot_block_offset) /
+                    sizeof(std::max_align_t) <
+                data_node_type::slot_block_size(record.data_capacity,
+                                                record.bitmap_size)) {
+          return false;
+        }
+        continue;
+      }
+      const auto& record =
+          *reinterpret_cast<const ModelNodeRecord*>(file + offset);
+      if (record.num_children <= 0 || (i == 0 && record.num_children != 1) ||
+          (file_size - offset - sizeof(record)) / sizeof(int64_t) <
+              static_cast<uint64_t>(record.num_children)) {
+        return false;
+      }
+      auto child_numbers =
+          reinterpret_cast<const int64_t*>(file + offset + sizeof(record));
+      for (int j = 0; j < record.num_children; j++) {
+        if (child_numbers[j] <= 0 ||
+            child_numbers[j] >= static_cast<int64_t>(header.num_nodes)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Unmaps the file opened by open_mmap(), once no data node uses it
+  void unmap_file() {
+#if ALEX_HAS_MMAP
+    if (mapped_file_ != nullptr) {
+      munmap(mapped_file_, mapped_file_size_);
+    }
+#endif
+    mapped_file_ = nullptr;
+    mapped_file_size_ = 0;
+  }
+
+  /*** Debugging ***/
+
+ public:
+  // If short_circuit is true, then we stop validating after detecting the first
+  // invalid property
+  bool validate_structure(bool validate_data_nodes = false,
+                          bool short_circuit = false) const {
+    bool is_valid = true;
+    std::stack<AlexNode<T, P>*> node_stack;
+    AlexNode<T, P>* cur;
+    node_stack.push(root_node_);
+
+    while (!node_stack.empty()) {
+      cur = node_stack.top();
+      node_stack.pop();
+
+      if (!cur->is_leaf_) {
+        auto node = static_cast<model_node_type*>(cur);
+        if (!node->validate_structure(true)) {
+          std::cout << "[Model node invalid structure]"
+                    << " node addr: " << node
+                    << ", node level: " << node->level_ << std::endl;
+          if (short_circuit) {
+            return false;
+          } else {
+            is_valid = false;
+          }
+        }
+
+        node_stack.push(node->children_[node->num_children_ - 1]);
+        for (int i = node->num_children_ - 2; i >= 0; i--) {
+          if (node->children_[i] != node->children_[i + 1]) {
+            node_stack.push(node->children_[i]);
+          }
+        }
+      } else {
+        if (validate_data_nodes) {
+          auto node = static_cast<data_node_type*>(cur);
+          if (!node->validate_structure(true)) {
+            std::cout << "[Data node invalid structure]"
+                      << " node addr: " << node
+                      << ", node level: " << node->level_ << std::endl;
+            if (short_circuit) {
+              return false;
+            } else {
+              is_valid = false;
+            }
+          }
+          if (node->num_keys_ > 0) {
+            data_node_type* prev_nonempty_leaf = node->prev_leaf_;
+            while (prev_nonempty_leaf != nullptr &&
+                   prev_nonempty_leaf->num_keys_ == 0) {
+              prev_nonempty_leaf = prev_nonempty_leaf->prev_leaf_;
+            }
+            if (prev_nonempty_leaf) {
+              T last_in_prev_leaf = prev_nonempty_leaf->last_key();
+              T first_in_cur_leaf = node->first_key();
+              if (last_in_prev_leaf >= first_in_cur_leaf) {
+                std::cout
+                    << "[Data node keys not in sorted order with prev node]"
+                    << " node addr: " << node
+                    << ", node level: " << node->level_
+                    << ", last in prev leaf: " << last_in_prev_leaf
+                    << ", first in cur leaf: " << first_in_cur_leaf
+                    << std::endl;
+                if (short_circuit) {
+                  return false;
+                } else {
+                  is_valid = false;
+                }
+              }
+            }
+            data_node_type* next_nonempty_leaf = node->next_leaf_;
+            while (next_nonempty_leaf != nullptr &&
+                   next_nonempty_leaf->num_keys_ == 0) {
+              next_nonempty_leaf = next_nonempty_leaf->next_leaf_;
+            }
+            if (next_nonempty_leaf) {
+              T first_in_next_leaf = next_nonempty_leaf->first_key();
+              T last_in_cur_leaf = node->last_key();
+              if (last_in_cur_leaf >= first_in_next_leaf) {
+                std::cout
+                    << "[Data node keys not in sorted order with next node]"
+                    << " node addr: " << node
+                    << ", node level: " << node->level_
+                    << ", last in cur leaf: " << last_in_cur_leaf
+                    << ", first in next leaf: " << first_in_next_leaf
+                    << std::endl;
+                if (short_circuit) {
+                  return false;
+                } else {
+                  is_valid = false;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    return is_valid;
+  }
+
+  /*** Iterators ***/
+
+ public:
+  class Iterator {
+   public:
+    data_node_type* cur_leaf_ = nullptr;  // current data node
+    int cur_idx_ = 0;         // current position in key/data_slots of data node
+    int cur_bitmap_idx_ = 0;  // current position in bitmap
+    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
+                                    // bitmap position
+
+    Iterator() {}
+
+    Iterator(data_node_type* leaf, int idx) : cur_leaf_(leaf), cur_idx_(idx) {
+      initialize();
+    }
+
+    Iterator(const Iterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    Iterator(const ReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    Iterator& operator=(const Iterator& other) {
+      if (this != &other) {
+        cur_idx_ = other.cur_idx_;
+        cur_leaf_ = other.cur_leaf_;
+        cur_bitmap_idx_ = other.cur_bitmap_idx_;
+        cur_bitmap_data_ = other.cur_bitmap_data_;
+      }
+      return *this;
+    }
+
+    Iterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+#if ALEX_DATA_NODE_SEP_ARRAYS
+    // Does not return a reference because keys and payloads are stored
+    // separately.
+    // If possible, use key() and payload() instead.
+    V operator*() const {
+      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
+                            cur_leaf_->payload_slots_[cur_idx_]);
+    }
+#else
+    // If data node stores key-payload pairs contiguously, return reference to V
+    V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
+#endif
+
+    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
+
+    P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
+
+    bool is_end() const { return cur_leaf_ == nullptr; }
+
+    bool operator==(const Iterator& rhs) const {
+      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
+    }
+
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); };
+
+   private:
+    void initialize() {
+      if (!cur_leaf_) return;
+      assert(cur_idx_ >= 0);
+      if (cur_idx_ >= cur_leaf_->data_capacity_) {
+        cur_leaf_ = cur_leaf_->next_leaf_;
+        cur_idx_ = 0;
+        if (!cur_leaf_) return;
+      }
+
+      cur_bitmap_idx_ = cur_idx_ >> 6;
+      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+
+      // Zero out extra bits
+      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
+      cur_bitmap_data_ &= ~((1ULL << bit_pos) - 1);
+
+      (*this)++;
+    }
+
+    forceinline void advance() {
+      while (cur_bitmap_data_ == 0) {
+        cur_bitmap_idx_++;
+        if (cur_bitmap_idx_ >= cur_leaf_->bitmap_size_) {
+          cur_leaf_ = cur_leaf_->next_leaf_;
+          cur_idx_ = 0;
+          if (cur_leaf_ == nullptr) {
+            return;
+          }
+          cur_bitmap_idx_ = 0;
+        }
+        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+      }
+      uint64_t bit = extract_rightmost_one(cur_bitmap_data_);
+      cur_idx_ = get_offset(cur_bitmap_idx_, bit);
+      cur_bitmap_data_ = remove_rightmost_one(cur_bitmap_data_);
+    }
+  };
+
+  class ConstIterator {
+   public:
+    const data_node_type* cur_leaf_ = nullptr;  // current data node
+    int cur_idx_ = 0;         // current position in key/data_slots of data node
+    int cur_bitmap_idx_ = 0;  // current position in bitmap
+    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
+                                    // bitmap position
+
+    ConstIterator() {}
+
+    ConstIterator(const data_node_type* leaf, int idx)
+        : cur_leaf_(leaf), cur_idx_(idx) {
+      initialize();
+    }
+
+    ConstIterator(const Iterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    ConstIterator(const ConstIterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    ConstIterator(const ReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    ConstIterator(const ConstReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    ConstIterator& operator=(const ConstIterator& other) {
+      if (this != &other) {
+        cur_idx_ = other.cur_idx_;
+        cur_leaf_ = other.cur_leaf_;
+        cur_bitmap_idx_ = other.cur_bitmap_idx_;
+        cur_bitmap_data_ = other.cur_bitmap_data_;
+      }
+      return *this;
+    }
+
+    ConstIterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    ConstIterator operator++(int) {
+      ConstIterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+#if ALEX_DATA_NODE_SEP_ARRAYS
+    // Does not return a reference because keys and payloads are stored
+    // separately.
+    // If possible, use key() and payload() instead.
+    V operator*() const {
+      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
+                            cur_leaf_->payload_slots_[cur_idx_]);
+    }
+#else
+    // If data node stores key-payload pairs contiguously, return reference to V
+    const V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
+#endif
+
+    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
+
+    const P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
+
+    bool is_end() const { return cur_leaf_ == nullptr; }
+
+    bool operator==(const ConstIterator& rhs) const {
+      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
+    }
+
+    bool operator!=(const ConstIterator& rhs) const { return !(*this == rhs); };
+
+   private:
+    void initialize() {
+      if (!cur_leaf_) return;
+      assert(cur_idx_ >= 0);
+      if (cur_idx_ >= cur_leaf_->data_capacity_) {
+        cur_leaf_ = cur_leaf_->next_leaf_;
+        cur_idx_ = 0;
+        if (!cur_leaf_) return;
+      }
+
+      cur_bitmap_idx_ = cur_idx_ >> 6;
+      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+
+      // Zero out extra bits
+      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
+      cur_bitmap_data_ &= ~((1ULL << bit_pos) - 1);
+
+      (*this)++;
+    }
+
+    forceinline void advance() {
+      while (cur_bitmap_data_ == 0) {
+        cur_bitmap_idx_++;
+        if (cur_bitmap_idx_ >= cur_leaf_->bitmap_size_) {
+          cur_leaf_ = cur_leaf_->next_leaf_;
+          cur_idx_ = 0;
+          if (cur_leaf_ == nullptr) {
+            return;
+          }
+          cur_bitmap_idx_ = 0;
+        }
+        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+      }
+      uint64_t bit = extract_rightmost_one(cur_bitmap_data_);
+      cur_idx_ = get_offset(cur_bitmap_idx_, bit);
+      cur_bitmap_data_ = remove_rightmost_one(cur_bitmap_data_);
+    }
+  };
+
+  class ReverseIterator {
+   public:
+    data_node_type* cur_leaf_ = nullptr;  // current data node
+    int cur_idx_ = 0;         // current position in key/data_slots of data node
+    int cur_bitmap_idx_ = 0;  // current position in bitmap
+    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
+                                    // bitmap position
+
+    ReverseIterator() {}
+
+    ReverseIterator(data_node_type* leaf, int idx)
+        : cur_leaf_(leaf), cur_idx_(idx) {
+      initialize();
+    }
+
+    ReverseIterator(const ReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    ReverseIterator(const Iterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    ReverseIterator& operator=(const ReverseIterator& other) {
+      if (this != &other) {
+        cur_idx_ = other.cur_idx_;
+        cur_leaf_ = other.cur_leaf_;
+        cur_bitmap_idx_ = other.cur_bitmap_idx_;
+        cur_bitmap_data_ = other.cur_bitmap_data_;
+      }
+      return *this;
+    }
+
+    ReverseIterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    ReverseIterator operator++(int) {
+      ReverseIterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+#if ALEX_DATA_NODE_SEP_ARRAYS
+    // Does not return a reference because keys and payloads are stored
+    // separately.
+    // If possible, use key() and payload() instead.
+    V operator*() const {
+      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
+                            cur_leaf_->payload_slots_[cur_idx_]);
+    }
+#else
+    // If data node stores key-payload pairs contiguously, return reference to V
+    V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
+#endif
+
+    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
+
+    P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
+
+    bool is_end() const { return cur_leaf_ == nullptr; }
+
+    bool operator==(const ReverseIterator& rhs) const {
+      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
+    }
+
+    bool operator!=(const ReverseIterator& rhs) const {
+      return !(*this == rhs);
+    };
+
+   private:
+    void initialize() {
+      if (!cur_leaf_) return;
+      assert(cur_idx_ >= 0);
+      if (cur_idx_ >= cur_leaf_->data_capacity_) {
+        cur_leaf_ = cur_leaf_->next_leaf_;
+        cur_idx_ = 0;
+        if (!cur_leaf_) return;
+      }
+
+      cur_bitmap_idx_ = cur_idx_ >> 6;
+      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+
+      // Zero out extra bits
+      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
+      cur_bitmap_data_ &= (1ULL << bit_pos) | ((1ULL << bit_pos) - 1);
+
+      advance();
+    }
+
+    forceinline void advance() {
+      while (cur_bitmap_data_ == 0) {
+        cur_bitmap_idx_--;
+        if (cur_bitmap_idx_ < 0) {
+          cur_leaf_ = cur_leaf_->prev_leaf_;
+          if (cur_leaf_ == nullptr) {
+            cur_idx_ = 0;
+            return;
+          }
+          cur_idx_ = cur_leaf_->data_capacity_ - 1;
+          cur_bitmap_idx_ = cur_leaf_->bitmap_size_ - 1;
+        }
+        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+      }
+      assert(cpu_supports_bmi());
+      int bit_pos = static_cast<int>(63 - _lzcnt_u64(cur_bitmap_data_));
+      cur_idx_ = (cur_bitmap_idx_ << 6) + bit_pos;
+      cur_bitmap_data_ &= ~(1ULL << bit_pos);
+    }
+  };
+
+  class ConstReverseIterator {
+   public:
+    const data_node_type* cur_leaf_ = nullptr;  // current data node
+    int cur_idx_ = 0;         // current position in key/data_slots of data node
+    int cur_bitmap_idx_ = 0;  // current position in bitmap
+    uint64_t cur_bitmap_data_ = 0;  // caches the relevant data in the current
+                                    // bitmap position
+
+    ConstReverseIterator() {}
+
+    ConstReverseIterator(const data_node_type* leaf, int idx)
+        : cur_leaf_(leaf), cur_idx_(idx) {
+      initialize();
+    }
+
+    ConstReverseIterator(const ConstReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    ConstReverseIterator(const ReverseIterator& other)
+        : cur_leaf_(other.cur_leaf_),
+          cur_idx_(other.cur_idx_),
+          cur_bitmap_idx_(other.cur_bitmap_idx_),
+          cur_bitmap_data_(other.cur_bitmap_data_) {}
+
+    ConstReverseIterator(const Iterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    ConstReverseIterator(const ConstIterator& other)
+        : cur_leaf_(other.cur_leaf_), cur_idx_(other.cur_idx_) {
+      initialize();
+    }
+
+    ConstReverseIterator& operator=(const ConstReverseIterator& other) {
+      if (this != &other) {
+        cur_idx_ = other.cur_idx_;
+        cur_leaf_ = other.cur_leaf_;
+        cur_bitmap_idx_ = other.cur_bitmap_idx_;
+        cur_bitmap_data_ = other.cur_bitmap_data_;
+      }
+      return *this;
+    }
+
+    ConstReverseIterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    ConstReverseIterator operator++(int) {
+      ConstReverseIterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+#if ALEX_DATA_NODE_SEP_ARRAYS
+    // Does not return a reference because keys and payloads are stored
+    // separately.
+    // If possible, use key() and payload() instead.
+    V operator*() const {
+      return std::make_pair(cur_leaf_->key_slots_[cur_idx_],
+                            cur_leaf_->payload_slots_[cur_idx_]);
+    }
+#else
+    // If data node stores key-payload pairs contiguously, return reference to V
+    const V& operator*() const { return cur_leaf_->data_slots_[cur_idx_]; }
+#endif
+
+    const T& key() const { return cur_leaf_->get_key(cur_idx_); }
+
+    const P& payload() const { return cur_leaf_->get_payload(cur_idx_); }
+
+    bool is_end() const { return cur_leaf_ == nullptr; }
+
+    bool operator==(const ConstReverseIterator& rhs) const {
+      return cur_idx_ == rhs.cur_idx_ && cur_leaf_ == rhs.cur_leaf_;
+    }
+
+    bool operator!=(const ConstReverseIterator& rhs) const {
+      return !(*this == rhs);
+    };
+
+   private:
+    void initialize() {
+      if (!cur_leaf_) return;
+      assert(cur_idx_ >= 0);
+      if (cur_idx_ >= cur_leaf_->data_capacity_) {
+        cur_leaf_ = cur_leaf_->next_leaf_;
+        cur_idx_ = 0;
+        if (!cur_leaf_) return;
+      }
+
+      cur_bitmap_idx_ = cur_idx_ >> 6;
+      cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+
+      // Zero out extra bits
+      int bit_pos = cur_idx_ - (cur_bitmap_idx_ << 6);
+      cur_bitmap_data_ &= (1ULL << bit_pos) | ((1ULL << bit_pos) - 1);
+
+      advance();
+    }
+
+    forceinline void advance() {
+      while (cur_bitmap_data_ == 0) {
+        cur_bitmap_idx_--;
+        if (cur_bitmap_idx_ < 0) {
+          cur_leaf_ = cur_leaf_->prev_leaf_;
+          if (cur_leaf_ == nullptr) {
+            cur_idx_ = 0;
+            return;
+          }
+          cur_idx_ = cur_leaf_->data_capacity_ - 1;
+          cur_bitmap_idx_ = cur_leaf_->bitmap_size_ - 1;
+        }
+        cur_bitmap_data_ = cur_leaf_->bitmap_[cur_bitmap_idx_];
+      }
+      assert(cpu_supports_bmi());
+      int bit_pos = static_cast<int>(63 - _lzcnt_u64(cur_bitmap_data_));
+      cur_idx_ = (cur_bitmap_idx_ << 6) + bit_pos;
+      cur_bitmap_data_ &= ~(1ULL << bit_pos);
+    }
+  };
+
+  // Iterates through all nodes with pre-order traversal
+  class NodeIterator {
+   public:
+    const self_type* index_;
+    AlexNode<T, P>* cur_node_;
+    std::stack<AlexNode<T, P>*> node_stack_;  // helps with traversal
+
+    // Start with root as cur and all children of root in stack
+    explicit NodeIterator(const self_type* index)
+        : index_(index), cur_node_(index->root_node_) {
+      if (cur_node_ && !cur_node_->is_leaf_) {
+        auto node = static_cast<model_node_type*>(cur_node_);
+        node_stack_.push(node->children_[node->num_children_ - 1]);
+        for (int i = node->num_children_ - 2; i >= 0; i--) {
+          if (node->children_[i] != node->children_[i + 1]) {
+            node_stack_.push(node->children_[i]);
+          }
+        }
+      }
+    }
+
+    AlexNode<T, P>* current() const { return cur_node_; }
+
+    AlexNode<T, P>* next() {
+      if (node_stack_.empty()) {
+        cur_node_ = nullptr;
+        return nullptr;
+      }
+
+      cur_node_ = node_stack_.top();
+      node_stack_.pop();
+
+      if (!cur_node_->is_leaf_) {
+        auto node = static_cast<model_node_type*>(cur_node_);
+        node_stack_.push(node->children_[node->num_children_ - 1]);
+        for (int i = node->num_children_ - 2; i >= 0; i--) {
+          if (node->children_[i] != node->children_[i + 1]) {
+            node_stack_.push(node->children_[i]);
+          }
+        }
+      }
+
+      return cur_node_;
+    }
+
+    bool is_end() const { return cur_node_ == nullptr; }
+  };
+};
+}  // namespace alex
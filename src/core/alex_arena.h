@@ -0,0 +1,344 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * An allocator for ALEX that serves node objects and data node slot blocks
+ * from large arenas instead of the general-purpose heap.
+ *
+ * Allocations are rounded up to size classes, and freed blocks are kept on a
+ * free list per size class for reuse by later allocations of the same class.
+ * Small blocks (model and data node objects, child pointer arrays) are carved
+ * out of slabs that hold many blocks of one size class. Larger blocks (the
+ * key/payload/bitmap block of a data node) are cut directly from the arena.
+ * Arenas are backed by transparent huge pages on Linux, and can be placed on
+ * one NUMA node (see ArenaOptions::numa_node). Memory is only returned to the
+ * OS when the arenas are released, which happens when the last allocator that
+ * shares them is destroyed.
+ *
+ * Usage:
+ *   typedef alex::ArenaAllocator<std::pair<uint64_t, uint64_t>> Alloc;
+ *   alex::Alex<uint64_t, uint64_t, alex::AlexCompare, Alloc> index;
+ *
+ * Copies and rebinds of an ArenaAllocator share the same arenas. A default
+ * constructed ArenaAllocator creates new arenas, so every index gets its own
+ * arenas unless an allocator is passed to its constructor.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "alex_base.h"
+#include "alex_numa.h"
+
+namespace alex {
+
+struct ArenaOptions {
+  // Size in bytes of each arena
+  size_t arena_size = size_t(1) << 21;
+  // Whether arenas are backed by huge pages, if the OS supports it
+  bool use_huge_pages = true;
+  // Whether Alex::clear() and the destructor of Alex free all arenas at once,
+  // instead of returning every node to the free lists one at a time. This only
+  // happens when no other allocator shares the arenas.
+  bool release_on_clear = false;
+  // NUMA node whose memory backs the arenas, or -1 for the node of the thread
+  // that first touches each page (see alex_numa.h)
+  int numa_node = -1;
+};
+
+// The arenas and free lists shared by all copies of an ArenaAllocator.
+// Thread-safe.
+class ArenaResource {
+ public:
+  // Blocks up to this size are served from size classes spaced 16 bytes apart.
+  // Larger blocks use four size classes per power of two.
+  static const size_t kMaxSmallBlockSize = 256;
+  // Blocks up to this size are carved in bulk out of slabs
+  static const size_t kMaxSlabBlockSize = 1024;
+  static const size_t kSlabSize = size_t(1) << 16;
+  static const size_t kHugePageSize = size_t(1) << 21;
+  static const int kNumSizeClasses = 16 + 4 * (64 - 8);
+
+  explicit ArenaResource(const ArenaOptions& options = ArenaOptions())
+      : options_(options) {
+    options_.arena_size = std::max(options_.arena_size, 4 * kSlabSize);
+    std::fill(free_lists_, free_lists_ + kNumSizeClasses, nullptr);
+  }
+
+  ArenaResource(const ArenaResource& other) = delete;
+  ArenaResource& operator=(const ArenaResource& other) = delete;
+
+  ~ArenaResource() { release(); }
+
+  void* allocate(size_t num_bytes) {
+    num_bytes = std::max<size_t>(num_bytes, 1);
+    // Blocks that would waste a large part of an arena get their own pages
+    if (num_bytes > options_.arena_size / 4) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      void* block = map_pages(num_bytes);
+      large_blocks_[block] = num_bytes;
+      bytes_reserved_ += num_bytes;
+      return block;
+    }
+    int size_class = get_size_class(num_bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_lists_[size_class] == nullptr) {
+      refill(size_class);
+    }
+    FreeBlock* block = free_lists_[size_class];
+    free_lists_[size_class] = block->next;
+    return block;
+  }
+
+  // num_bytes must be the size that was passed to allocate()
+  void deallocate(void* p, size_t num_bytes) {
+    if (p == nullptr) {
+      return;
+    }
+    num_bytes = std::max<size_t>(num_bytes, 1);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (num_bytes > options_.arena_size / 4) {
+      large_blocks_.erase(p);
+      bytes_reserved_ -= num_bytes;
+      unmap_pages(p, num_bytes);
+      return;
+    }
+    int size_class = get_size_class(num_bytes);
+    auto block = static_cast<FreeBlock*>(p);
+    block->next = free_lists_[size_class];
+    free_lists_[size_class] = block;
+  }
+
+  // Returns all arenas to the OS. All blocks allocated from this resource
+  // become invalid.
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (void* arena : arenas_) {
+      unmap_pages(arena, options_.arena_size);
+    }
+    for (const auto& large_block : large_blocks_) {
+      unmap_pages(large_block.first, large_block.second);
+    }
+    arenas_.clear();
+    large_blocks_.clear();
+    std::fill(free_lists_, free_lists_ + kNumSizeClasses, nullptr);
+    arena_cur_ = nullptr;
+    arena_end_ = nullptr;
+    bytes_reserved_ = 0;
+  }
+
+  const ArenaOptions& options() const { return options_; }
+
+  // Total bytes obtained from the OS, including free blocks and the unused
+  // parts of arenas
+  size_t bytes_reserved() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_reserved_;
+  }
+
+  /*** Size classes ***/
+
+  static int get_size_class(size_t num_bytes) {
+    if (num_bytes <= kMaxSmallBlockSize) {
+      return static_cast<int>((num_bytes + 15) / 16) - 1;
+    }
+    // 2^log < num_bytes <= 2^(log+1)
+    int log = 8;
+    while (num_bytes > (size_t(1) << (log + 1))) {
+      log++;
+    }
+    size_t step = size_t(1) << (log - 2);
+    int sub_class =
+        static_cast<int>((num_bytes - 1 - (size_t(1) << log)) / step);
+    return 16 + 4 * (log - 8) + sub_class;
+  }
+
+  static size_t get_size_class_bytes(int size_class) {
+    if (size_class < 16) {
+      return 16 * static_cast<size_t>(size_class + 1);
+    }
+    int log = (size_class - 16) / 4 + 8;
+    int sub_class = (size_class - 16) % 4;
+    return (size_t(1) << log) + (sub_class + 1) * (size_t(1) << (log - 2));
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Puts at least one block on the free list of the size class
+  void refill(int size_class) {
+    size_t block_size = get_size_class_bytes(size_class);
+    size_t carve_size = block_size <= kMaxSlabBlockSize
+                            ? kSlabSize / block_size * block_size
+                            : block_size;
+    char* blocks = carve_from_arena(carve_size);
+    for (size_t offset = carve_size; offset >= block_size;) {
+      offset -= block_size;
+      auto block = reinterpret_cast<FreeBlock*>(blocks + offset);
+      block->next = free_lists_[size_class];
+      free_lists_[size_class] = block;
+    }
+  }
+
+  char* carve_from_arena(size_t num_bytes) {
+    // Keeps blocks of 64 bytes and more aligned to cache lines
+    size_t alignment = num_bytes >= 64 ? 64 : 16;
+    auto cur = reinterpret_cast<uintptr_t>(arena_cur_);
+    cur = (cur + alignment - 1) & ~(alignment - 1);
+    if (arena_cur_ == nullptr ||
+        cur + num_bytes > reinterpret_cast<uintptr_t>(arena_end_)) {
+      arena_cur_ = static_cast<char*>(map_pages(options_.arena_size, true));
+      arena_end_ = arena_cur_ + options_.arena_size;
+      arenas_.push_back(arena_cur_);
+      bytes_reserved_ += options_.arena_size;
+      cur = reinterpret_cast<uintptr_t>(arena_cur_);
+    }
+    arena_cur_ = reinterpret_cast<char*>(cur + num_bytes);
+    return reinterpret_cast<char*>(cur);
+  }
+
+  /*** OS memory ***/
+
+  void* map_pages(size_t num_bytes, bool is_arena = false) {
+#ifdef __linux__
+    bool huge = options_.use_huge_pages && is_arena &&
+                num_bytes % kHugePageSize == 0;
+    // Huge pages are only used for ranges aligned to the huge page size, so
+    // arenas map an extra huge page and trim the unaligned ends
+    size_t map_bytes = huge ? num_bytes + kHugePageSize : num_bytes;
+    void* p = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (!huge) {
+      bind_pages(p, num_bytes);
+      return p;
+    }
+    auto begin = reinterpret_cast<uintptr_t>(p);
+    uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    if (aligned > begin) {
+      munmap(p, aligned - begin);
+    }
+    size_t tail = begin + map_bytes - (aligned + num_bytes);
+    if (tail > 0) {
+      munmap(reinterpret_cast<void*>(aligned + num_bytes), tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), num_bytes, MADV_HUGEPAGE);
+#endif
+    bind_pages(reinterpret_cast<void*>(aligned), num_bytes);
+    return reinterpret_cast<void*>(aligned);
+#else
+    (void)is_arena;
+    return ::operator new(num_bytes);
+#endif
+  }
+
+  // Pages are bound before they are first touched, so they are allocated on
+  // the node right away instead of being migrated
+  void bind_pages(void* p, size_t num_bytes) {
+    if (options_.numa_node >= 0) {
+      bind_to_numa_node(p, num_bytes, options_.numa_node);
+    }
+  }
+
+  static void unmap_pages(void* p, size_t num_bytes) {
+#ifdef __linux__
+    munmap(p, num_bytes);
+#else
+    (void)num_bytes;
+    ::operator delete(p);
+#endif
+  }
+
+  ArenaOptions options_;
+  mutable std::mutex mutex_;
+  FreeBlock* free_lists_[kNumSizeClasses];
+  std::vector<void*> arenas_;
+  std::unordered_map<void*, size_t> large_blocks_;
+  char* arena_cur_ = nullptr;
+  char* arena_end_ = nullptr;
+  size_t bytes_reserved_ = 0;
+};
+
+template <class T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() : resource_(std::make_shared<ArenaResource>()) {}
+
+  explicit ArenaAllocator(const ArenaOptions& options)
+      : resource_(std::make_shared<ArenaResource>(options)) {}
+
+  explicit ArenaAllocator(std::shared_ptr<ArenaResource> resource)
+      : resource_(std::move(resource)) {}
+
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : resource_(other.resource_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(resource_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) { resource_->deallocate(p, n * sizeof(T)); }
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <class U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  // Frees all arenas at once if release_on_clear is set and no other
+  // allocator shares them. Returns whether the arenas were freed. Called by
+  // Alex when all of its nodes are about to be deleted.
+  bool release_all() {
+    if (!resource_->options().release_on_clear || resource_.use_count() > 1) {
+      return false;
+    }
+    resource_->release();
+    return true;
+  }
+
+  const std::shared_ptr<ArenaResource>& resource() const { return resource_; }
+
+  template <class U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return resource_ == other.resource_;
+  }
+
+  template <class U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return resource_ != other.resource_;
+  }
+
+ private:
+  template <class U>
+  friend class ArenaAllocator;
+
+  std::shared_ptr<ArenaResource> resource_;
+};
+}
@@ -1,391 +1,1071 @@
-// Copyright (c) Microsoft Corporation.
-// Licensed under the MIT license.
-
-/* This file contains the classes for linear models and model builders, helpers
- * for the bitmap,
- * cost model weights, statistic accumulators for collecting cost model
- * statistics,
- * and other miscellaneous functions
- */
-
-#pragma once
-
-#include <algorithm>
-#include <array>
-#include <chrono>
-#include <cstring>
-#include <iostream>
-#include <limits>
-#include <memory>
-#include <random>
-#include <set>
-#include <string>
-#include <utility>
-#include <vector>
-#ifdef _MSC_VER
-#include <intrin.h>
-#else
-#include <x86intrin.h>
-#endif
-#include <bitset>
-#include <cassert>
-#ifdef _WIN32
-#include <intrin.h>
-#include <limits.h>
-typedef unsigned __int32 uint32_t;
-#else
-#include <stdint.h>
-#endif
-
-#ifdef _MSC_VER
-#define forceinline __forceinline
-#elif defined(__GNUC__)
-#define forceinline inline __attribute__((__always_inline__))
-#elif defined(__CLANG__)
-#if __has_attribute(__always_inline__)
-#define forceinline inline __attribute__((__always_inline__))
-#else
-#define forceinline inline
-#endif
-#else
-#define forceinline inline
-#endif
-
-namespace alex {
-
-/*** Linear model and model builder ***/
-
-// Forward declaration
-template <class T>
-class LinearModelBuilder;
-
-// Linear regression model
-template <class T>
-class LinearModel {
- public:
-  double a_ = 0;  // slope
-  double b_ = 0;  // intercept
-
-  LinearModel() = default;
-  LinearModel(double a, double b) : a_(a), b_(b) {}
-  explicit LinearModel(const LinearModel& other) : a_(other.a_), b_(other.b_) {}
-
-  void expand(double expansion_factor) {
-    a_ *= expansion_factor;
-    b_ *= expansion_factor;
-  }
-
-  inline int predict(T key) const {
-    return static_cast<int>(a_ * static_cast<double>(key) + b_);
-  }
-
-  inline double predict_double(T key) const {
-    return a_ * static_cast<double>(key) + b_;
-  }
-};
-
-template <class T>
-class LinearModelBuilder {
- public:
-  LinearModel<T>* model_;
-
-  explicit LinearModelBuilder<T>(LinearModel<T>* model) : model_(model) {}
-
-  inline void add(T x, int y) {
-    count_++;
-    x_sum_ += static_cast<long double>(x);
-    y_sum_ += static_cast<long double>(y);
-    xx_sum_ += static_cast<long double>(x) * x;
-    xy_sum_ += static_cast<long double>(x) * y;
-    x_min_ = std::min<T>(x, x_min_);
-    x_max_ = std::max<T>(x, x_max_);
-    y_min_ = std::min<double>(y, y_min_);
-    y_max_ = std::max<double>(y, y_max_);
-  }
-
-  void build() {
-    if (count_ <= 1) {
-      model_->a_ = 0;
-      model_->b_ = static_cast<double>(y_sum_);
-      return;
-    }
-
-    if (static_cast<long double>(count_) * xx_sum_ - x_sum_ * x_sum_ == 0) {
-      // all values in a bucket have the same key.
-      model_->a_ = 0;
-      model_->b_ = static_cast<double>(y_sum_) / count_;
-      return;
-    }
-
-    auto slope = static_cast<double>(
-        (static_cast<long double>(count_) * xy_sum_ - x_sum_ * y_sum_) /
-        (static_cast<long double>(count_) * xx_sum_ - x_sum_ * x_sum_));
-    auto intercept = static_cast<double>(
-        (y_sum_ - static_cast<long double>(slope) * x_sum_) / count_);
-    model_->a_ = slope;
-    model_->b_ = intercept;
-
-    // If floating point precision errors, fit spline
-    if (model_->a_ <= 0) {
-      model_->a_ = (y_max_ - y_min_) / (x_max_ - x_min_);
-      model_->b_ = -static_cast<double>(x_min_) * model_->a_;
-    }
-  }
-
- private:
-  int count_ = 0;
-  long double x_sum_ = 0;
-  long double y_sum_ = 0;
-  long double xx_sum_ = 0;
-  long double xy_sum_ = 0;
-  T x_min_ = std::numeric_limits<T>::max();
-  T x_max_ = std::numeric_limits<T>::lowest();
-  double y_min_ = std::numeric_limits<double>::max();
-  double y_max_ = std::numeric_limits<double>::lowest();
-};
-
-/*** Comparison ***/
-
-struct AlexCompare {
-  template <class T1, class T2>
-  bool operator()(const T1& x, const T2& y) const {
-    static_assert(
-        std::is_arithmetic<T1>::value && std::is_arithmetic<T2>::value,
-        "Comparison types must be numeric.");
-    return x < y;
-  }
-};
-
-/*** Helper methods for bitmap ***/
-
-// Extract the rightmost 1 in the binary representation.
-// e.g. extract_rightmost_one(010100100) = 000000100
-inline uint64_t extract_rightmost_one(uint64_t value) {
-  return value & -static_cast<int64_t>(value);
-}
-
-// Remove the rightmost 1 in the binary representation.
-// e.g. remove_rightmost_one(010100100) = 010100000
-inline uint64_t remove_rightmost_one(uint64_t value) {
-  return value & (value - 1);
-}
-
-// Count the number of 1s in the binary representation.
-// e.g. count_ones(010100100) = 3
-inline int count_ones(uint64_t value) {
-  return static_cast<int>(_mm_popcnt_u64(value));
-}
-
-// Get the offset of a bit in a bitmap.
-// word_id is the word id of the bit in a bitmap
-// bit is the word that contains the bit
-inline int get_offset(int word_id, uint64_t bit) {
-  return (word_id << 6) + count_ones(bit - 1);
-}
-
-/*** Cost model weights ***/
-
-// Intra-node cost weights
-constexpr double kExpSearchIterationsWeight = 20;
-constexpr double kShiftsWeight = 0.5;
-
-// TraverseToLeaf cost weights
-constexpr double kNodeLookupsWeight = 20;
-constexpr double kModelSizeWeight = 5e-7;
-
-/*** Stat Accumulators ***/
-
-struct DataNodeStats {
-  double num_search_iterations = 0;
-  double num_shifts = 0;
-};
-
-// Used when stats are computed using a sample
-struct SampleDataNodeStats {
-  double log2_sample_size = 0;
-  double num_search_iterations = 0;
-  double log2_num_shifts = 0;
-};
-
-// Accumulates stats that are used in the cost model, based on the actual vs
-// predicted position of a key
-class StatAccumulator {
- public:
-  virtual ~StatAccumulator() = default;
-  virtual void accumulate(int actual_position, int predicted_position) = 0;
-  virtual double get_stat() = 0;
-  virtual void reset() = 0;
-};
-
-// Mean log error represents the expected number of exponential search
-// iterations when doing a lookup
-class ExpectedSearchIterationsAccumulator : public StatAccumulator {
- public:
-  void accumulate(int actual_position, int predicted_position) override {
-    cumulative_log_error_ +=
-        std::log2(std::abs(predicted_position - actual_position) + 1);
-    count_++;
-  }
-
-  double get_stat() override {
-    if (count_ == 0) return 0;
-    return cumulative_log_error_ / count_;
-  }
-
-  void reset() override {
-    cumulative_log_error_ = 0;
-    count_ = 0;
-  }
-
- public:
-  double cumulative_log_error_ = 0;
-  int count_ = 0;
-};
-
-// Mean shifts represents the expected number of shifts when doing an insert
-class ExpectedShiftsAccumulator : public StatAccumulator {
- public:
-  explicit ExpectedShiftsAccumulator(int data_capacity)
-      : data_capacity_(data_capacity) {}
-
-  // A dense region of n keys will contribute a total number of expected shifts
-  // of approximately
-  // ((n-1)/2)((n-1)/2 + 1) = n^2/4 - 1/4
-  // This is exact for odd n and off by 0.25 for even n.
-  // Therefore, we track n^2/4.
-  void accumulate(int actual_position, int) override {
-    if (actual_position > last_position_ + 1) {
-      long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
-      num_expected_shifts_ += (dense_region_length * dense_region_length) / 4;
-      dense_region_start_idx_ = actual_position;
-    }
-    last_position_ = actual_position;
-    count_++;
-  }
-
-  double get_stat() override {
-    if (count_ == 0) return 0;
-    // first need to accumulate statistics for current packed region
-    long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
-    long long cur_num_expected_shifts =
-        num_expected_shifts_ + (dense_region_length * dense_region_length) / 4;
-    return cur_num_expected_shifts / static_cast<double>(count_);
-  }
-
-  void reset() override {
-    last_position_ = -1;
-    dense_region_start_idx_ = 0;
-    num_expected_shifts_ = 0;
-    count_ = 0;
-  }
-
- public:
-  int last_position_ = -1;
-  int dense_region_start_idx_ = 0;
-  long long num_expected_shifts_ = 0;
-  int count_ = 0;
-  int data_capacity_ = -1;  // capacity of node
-};
-
-// Combines ExpectedSearchIterationsAccumulator and ExpectedShiftsAccumulator
-class ExpectedIterationsAndShiftsAccumulator : public StatAccumulator {
- public:
-  ExpectedIterationsAndShiftsAccumulator() = default;
-  explicit ExpectedIterationsAndShiftsAccumulator(int data_capacity)
-      : data_capacity_(data_capacity) {}
-
-  void accumulate(int actual_position, int predicted_position) override {
-    cumulative_log_error_ +=
-        std::log2(std::abs(predicted_position - actual_position) + 1);
-
-    if (actual_position > last_position_ + 1) {
-      long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
-      num_expected_shifts_ += (dense_region_length * dense_region_length) / 4;
-      dense_region_start_idx_ = actual_position;
-    }
-    last_position_ = actual_position;
-
-    count_++;
-  }
-
-  double get_stat() override {
-    assert(false);  // this should not be used
-    return 0;
-  }
-
-  double get_expected_num_search_iterations() {
-    if (count_ == 0) return 0;
-    return cumulative_log_error_ / count_;
-  }
-
-  double get_expected_num_shifts() {
-    if (count_ == 0) return 0;
-    long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
-    long long cur_num_expected_shifts =
-        num_expected_shifts_ + (dense_region_length * dense_region_length) / 4;
-    return cur_num_expected_shifts / static_cast<double>(count_);
-  }
-
-  void reset() override {
-    cumulative_log_error_ = 0;
-    last_position_ = -1;
-    dense_region_start_idx_ = 0;
-    num_expected_shifts_ = 0;
-    count_ = 0;
-  }
-
- public:
-  double cumulative_log_error_ = 0;
-  int last_position_ = -1;
-  int dense_region_start_idx_ = 0;
-  long long num_expected_shifts_ = 0;
-  int count_ = 0;
-  int data_capacity_ = -1;  // capacity of node
-};
-
-/*** Miscellaneous helpers ***/
-
-// https://stackoverflow.com/questions/364985/algorithm-for-finding-the-smallest-power-of-two-thats-greater-or-equal-to-a-giv
-inline int pow_2_round_up(int x) {
-  --x;
-  x |= x >> 1;
-  x |= x >> 2;
-  x |= x >> 4;
-  x |= x >> 8;
-  x |= x >> 16;
-  return x + 1;
-}
-
-// https://stackoverflow.com/questions/994593/how-to-do-an-integer-log2-in-c
-inline int log_2_round_down(int x) {
-  int res = 0;
-  while (x >>= 1) ++res;
-  return res;
-}
-
-// https://stackoverflow.com/questions/1666093/cpuid-implementations-in-c
-class CPUID {
-  uint32_t regs[4];
-
- public:
-  explicit CPUID(unsigned i, unsigned j) {
-#ifdef _WIN32
-    __cpuidex((int*)regs, (int)i, (int)j);
-#else
-    asm volatile("cpuid"
-                 : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
-                 : "a"(i), "c"(j));
-#endif
-  }
-
-  const uint32_t& EAX() const { return regs[0]; }
-  const uint32_t& EBX() const { return regs[1]; }
-  const uint32_t& ECX() const { return regs[2]; }
-  const uint32_t& EDX() const { return regs[3]; }
-};
-
-// https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features
-inline bool cpu_supports_bmi() {
-  return static_cast<bool>(CPUID(7, 0).EBX() & (1 << 3));
-}
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/* This file contains the classes for linear models and model builders, helpers
+ * for the bitmap,
+ * cost model weights, statistic accumulators for collecting cost model
+ * statistics,
+ * and other miscellaneous functions
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include <bitset>
+#include <cassert>
+#ifdef _WIN32
+#include <intrin.h>
+#include <limits.h>
+typedef unsigned __int32 uint32_t;
+#else
+#include <stdint.h>
+#endif
+
+#ifdef _MSC_VER
+#define forceinline __forceinline
+#elif defined(__GNUC__)
+#define forceinline inline __attribute__((__always_inline__))
+#elif defined(__CLANG__)
+#if __has_attribute(__always_inline__)
+#define forceinline inline __attribute__((__always_inline__))
+#else
+#define forceinline inline
+#endif
+#else
+#define forceinline inline
+#endif
+
+// Functions that use instruction sets beyond the compiler's target. They must
+// only be called after checking for CPU support at runtime.
+#ifdef _MSC_VER
+#define ALEX_TARGET_AVX2
+#define ALEX_TARGET_AVX512
+#else
+#define ALEX_TARGET_AVX2 __attribute__((__target__("avx2,popcnt")))
+#define ALEX_TARGET_AVX512 __attribute__((__target__("avx512f,popcnt")))
+#endif
+
+// Whether we skip collecting statistics on lookups.
+// If this is turned on, lookups do not write to the index: the lookup counters
+// in Alex::Stats stay at zero, and data nodes do not count lookups, so their
+// empirical cost (which decides when to split or expand them) is based on
+// inserts only.
+#ifndef ALEX_DISABLE_STATS
+#define ALEX_DISABLE_STATS 0
+#endif
+
+// Whether linear models for integral keys predict in fixed point, which needs
+// 128-bit integers
+#ifdef __SIZEOF_INT128__
+#define ALEX_FIXED_POINT_MODELS 1
+#else
+#define ALEX_FIXED_POINT_MODELS 0
+#endif
+
+namespace alex {
+
+/*** Linear model and model builder ***/
+
+// Forward declaration
+template <class T>
+class LinearModelBuilder;
+
+// Linear regression model: predicts the position of a key as a * key + b.
+// Models can also be set by a point (anchor, position) on the line instead of
+// by the intercept, which keeps the precision of the intercept for keys far
+// from zero when the model stores it that way (see the specialization for
+// integral keys below).
+template <class T, bool kFixedPoint =
+                       ALEX_FIXED_POINT_MODELS && std::is_integral<T>::value>
+class LinearModel {
+ public:
+  // Bound on the error of predict_double() on top of floating-point rounding
+  static constexpr double kPredictionError = 0;
+
+  LinearModel() = default;
+  LinearModel(double a, double b) : a_(a), b_(b) {}
+  LinearModel(double a, long double anchor, double position) {
+    set_anchored(a, anchor, position);
+  }
+  explicit LinearModel(const LinearModel& other) = default;
+  LinearModel& operator=(const LinearModel& other) = default;
+
+  double a() const { return a_; }  // slope
+  double b() const { return b_; }  // intercept
+  long double anchor() const { return 0; }
+  double anchor_position() const { return b_; }  // prediction at the anchor
+
+  void set(double a, double b) {
+    a_ = a;
+    b_ = b;
+  }
+
+  // Anchors are long double, which holds 64-bit keys exactly on x86
+  void set_anchored(double a, long double anchor, double position) {
+    set(a, static_cast<double>(position - a * anchor));
+  }
+
+  void expand(double expansion_factor) {
+    a_ *= expansion_factor;
+    b_ *= expansion_factor;
+  }
+
+  // Adds offset to all predictions
+  void shift(double offset) { b_ += offset; }
+
+  // Key for which the model predicts position
+  long double inverse(double position) const { return (position - b_) / a_; }
+
+  inline int predict(T key) const {
+    return static_cast<int>(a_ * static_cast<double>(key) + b_);
+  }
+
+  inline double predict_double(T key) const {
+    return a_ * static_cast<double>(key) + b_;
+  }
+
+ private:
+  double a_ = 0;  // slope
+  double b_ = 0;  // intercept
+};
+
+// Linear model for integral keys, which predicts in fixed point instead of
+// converting keys to double.
+//
+// The model is stored as the position c at an anchor key x0 near the keys,
+// so that keys near 2^64 do not lose the low bits of the intercept. The slope
+// is scaled by 2^shift_ to a 59-bit integer, and a prediction is
+//   ((key - x0) * slope_fp_ >> (shift_ - kFractionBits)) + intercept_fp_
+// in units of 2^-kFractionBits positions: one 64x64-bit multiply, a shift and
+// an add.
+//
+// Scaling by a power of two only changes shift_, and predictions are rounded
+// down, so a model expanded by 2^m predicts exactly 2^m times as many
+// positions as the original model, rounded down. Bulk loading relies on this
+// to partition keys with a model before it is expanded to the fanout of a
+// model node.
+//
+// Models that do not fit this form (negative or non-finite slopes, or
+// positions beyond 2^38) predict in double.
+template <class T>
+class LinearModel<T, true> {
+ private:
+  static constexpr int kFractionBits = 24;
+
+ public:
+  // Predictions are rounded down to multiples of 2^-kFractionBits, the
+  // intercept is rounded to one, and slopes below 2^(kSlopeBits - kMaxShift)
+  // keep fewer than kSlopeBits bits
+  static constexpr double kPredictionError = 4.0 / (1 << kFractionBits);
+
+  LinearModel() { update(); }
+  LinearModel(double a, double b) { set(a, b); }
+  LinearModel(double a, long double anchor, double position) {
+    set_anchored(a, anchor, position);
+  }
+  explicit LinearModel(const LinearModel& other) = default;
+  LinearModel& operator=(const LinearModel& other) = default;
+
+  double a() const { return a_; }  // slope
+  double b() const {               // intercept
+    return static_cast<double>(c_ - static_cast<long double>(a_) * x0_);
+  }
+  long double anchor() const { return x0_; }
+  double anchor_position() const { return c_; }  // prediction at the anchor
+
+  // Anchors the model at the key it maps to position 0
+  void set(double a, double b) {
+    long double anchor = 0;
+    if (a != 0 && std::isfinite(b / a)) {
+      anchor = -static_cast<long double>(b) / a;
+    }
+    set_anchored(a, anchor, static_cast<double>(b + a * anchor));
+  }
+
+  void set_anchored(double a, long double anchor, double position) {
+    // The anchor must be a key; move it to the closest key
+    long double x0 = std::isfinite(anchor) ? std::round(anchor) : 0;
+    x0 = std::min<long double>(
+        std::max<long double>(x0, std::numeric_limits<T>::lowest()),
+        std::numeric_limits<T>::max());
+    a_ = a;
+    x0_ = static_cast<T>(x0);
+    c_ = static_cast<double>(position + static_cast<long double>(a) *
+                                            (x0_ - anchor));
+    update();
+  }
+
+  void expand(double expansion_factor) {
+    a_ *= expansion_factor;
+    c_ *= expansion_factor;
+    update();
+  }
+
+  // Adds offset to all predictions
+  void shift(double offset) {
+    c_ += offset;
+    update();
+  }
+
+  // Key for which the model predicts position
+  long double inverse(double position) const {
+    return x0_ + (position - c_) / static_cast<long double>(a_);
+  }
+
+  // Rounds down
+  forceinline int predict(T key) const {
+    if (!fixed_point_) {
+      return static_cast<int>(predict_double(key));
+    }
+    return static_cast<int>(predict_fixed_point(key) >> kFractionBits);
+  }
+
+  forceinline double predict_double(T key) const {
+    if (!fixed_point_) {
+      return a_ * static_cast<double>(static_cast<long double>(key) -
+                                      static_cast<long double>(x0_)) +
+             c_;
+    }
+    return static_cast<double>(predict_fixed_point(key)) *
+           (1.0 / (1LL << kFractionBits));
+  }
+
+ private:
+  static constexpr int kSlopeBits = 59;
+  // Keeps the shift of the product below 64 bits
+  static constexpr int kMaxShift = 63 + kFractionBits;
+  // Bound on the fixed-point offset from the anchor and intercept, so that
+  // predictions fit in an int
+  static constexpr int64_t kMaxFixedPoint = 1LL << (30 + kFractionBits);
+
+  double a_ = 0;
+  double c_ = 0;
+  T x0_ = 0;
+  int64_t slope_fp_ = 0;      // a_ * 2^(shift_ + kFractionBits)
+  int64_t intercept_fp_ = 0;  // c_ * 2^kFractionBits
+  int shift_ = 0;             // of the product of key distance and slope
+  bool fixed_point_ = false;
+
+  // Prediction times 2^kFractionBits, rounded down
+  forceinline int64_t predict_fixed_point(T key) const {
+    // Keys below the anchor are rare: data nodes anchor at their first key,
+    // and model nodes at the key that maps to position 0
+    if (key >= x0_) {
+      // One 64 x 64 bit multiply, since the distance fits in 64 bits
+      auto distance = static_cast<uint64_t>(key) - static_cast<uint64_t>(x0_);
+      auto product = static_cast<unsigned __int128>(distance) *
+                     static_cast<uint64_t>(slope_fp_);
+      auto low = static_cast<uint64_t>(product);
+      auto high = static_cast<uint64_t>(product >> 64);
+      // Shifts by less than 64, without the cases of a 128-bit shift
+      uint64_t offset = (low >> shift_) | ((high << 1) << (63 - shift_));
+      if ((high >> shift_) != 0 ||
+          offset > static_cast<uint64_t>(kMaxFixedPoint)) {
+        offset = kMaxFixedPoint;
+      }
+      return static_cast<int64_t>(offset) + intercept_fp_;
+    }
+    __int128 distance =
+        static_cast<__int128>(key) - static_cast<__int128>(x0_);
+    __int128 offset = (distance * slope_fp_) >> shift_;
+    return static_cast<int64_t>(std::max<__int128>(offset, -kMaxFixedPoint)) +
+           intercept_fp_;
+  }
+
+  // Recomputes the fixed-point parameters from a_ and c_
+  void update() {
+    fixed_point_ = false;
+    if (!std::isfinite(a_) || a_ < 0 || !std::isfinite(c_) ||
+        std::abs(c_) >= std::ldexp(1.0, 30)) {
+      return;
+    }
+    int a_exponent = 0;
+    std::frexp(a_, &a_exponent);
+    int slope_shift = a_ == 0 ? kMaxShift
+                              : std::min(kSlopeBits - a_exponent, kMaxShift);
+    if (slope_shift < kFractionBits) {
+      return;
+    }
+    shift_ = slope_shift - kFractionBits;
+    slope_fp_ = static_cast<int64_t>(std::ldexp(a_, slope_shift));
+    // Keeps c_ in sync with the fixed-point intercept
+    intercept_fp_ = std::llround(std::ldexp(c_, kFractionBits));
+    c_ = std::ldexp(static_cast<double>(intercept_fp_), -kFractionBits);
+    fixed_point_ = true;
+  }
+};
+
+template <class T>
+class LinearModelBuilder {
+ public:
+  LinearModel<T>* model_;
+
+  explicit LinearModelBuilder<T>(LinearModel<T>* model) : model_(model) {}
+
+  // Sums are taken relative to the first key, so that they keep their
+  // precision for keys far from zero
+  inline void add(T x, long long y) {
+    if (count_ == 0) {
+      x0_ = x;
+    }
+    count_++;
+    long double dx =
+        static_cast<long double>(x) - static_cast<long double>(x0_);
+    x_sum_ += dx;
+    y_sum_ += static_cast<long double>(y);
+    xx_sum_ += dx * dx;
+    xy_sum_ += dx * static_cast<long double>(y);
+    x_min_ = std::min<T>(x, x_min_);
+    x_max_ = std::max<T>(x, x_max_);
+    y_min_ = std::min<double>(static_cast<double>(y), y_min_);
+    y_max_ = std::max<double>(static_cast<double>(y), y_max_);
+  }
+
+  void build() {
+    if (count_ <= 1) {
+      model_->set(0, static_cast<double>(y_sum_));
+      return;
+    }
+
+    if (static_cast<long double>(count_) * xx_sum_ - x_sum_ * x_sum_ == 0) {
+      // all values in a bucket have the same key.
+      model_->set(0, static_cast<double>(y_sum_) / count_);
+      return;
+    }
+
+    auto slope = static_cast<double>(
+        (static_cast<long double>(count_) * xy_sum_ - x_sum_ * y_sum_) /
+        (static_cast<long double>(count_) * xx_sum_ - x_sum_ * x_sum_));
+    auto position = static_cast<double>(
+        (y_sum_ - static_cast<long double>(slope) * x_sum_) / count_);
+    model_->set_anchored(slope, x0_, position);
+
+    // If floating point precision errors, fit spline
+    if (slope <= 0) {
+      model_->set_anchored(
+          static_cast<double>((y_max_ - y_min_) /
+                              (static_cast<long double>(x_max_) - x_min_)),
+          x_min_, 0);
+    }
+  }
+
+ private:
+  long long count_ = 0;
+  T x0_ = 0;
+  long double x_sum_ = 0;
+  long double y_sum_ = 0;
+  long double xx_sum_ = 0;
+  long double xy_sum_ = 0;
+  T x_min_ = std::numeric_limits<T>::max();
+  T x_max_ = std::numeric_limits<T>::lowest();
+  double y_min_ = std::numeric_limits<double>::max();
+  double y_max_ = std::numeric_limits<double>::lowest();
+};
+
+// Piecewise linear model of the keys of a data node, with up to kMaxSegments
+// segments. Each segment is a linear model that predicts the keys from its
+// first key up to the first key of the next segment.
+//
+// Segments are fit to the ranks of the keys with the shrinking cone algorithm
+// of FITing-tree and the PGM-index: a segment is anchored at the rank of its
+// first key, and grows as long as some slope predicts the rank of each of its
+// keys within the max error. fit() doubles the max error until the keys fit
+// in kMaxSegments segments, and keeps no segments if they fit in one, in
+// which case the data node uses its linear model.
+template <class T, int kMaxSegments>
+class PiecewiseLinearModel {
+ public:
+  int num_segments() const { return num_segments_; }
+
+  void clear() { num_segments_ = 0; }
+
+  void expand(double expansion_factor) {
+    for (int i = 0; i < num_segments_; i++) {
+      models_[i].expand(expansion_factor);
+    }
+  }
+
+  // Adds offset to all predictions
+  void shift(double offset) {
+    for (int i = 0; i < num_segments_; i++) {
+      models_[i].shift(offset);
+    }
+  }
+
+  // Keys before the first segment are predicted by the first segment. Needs
+  // at least one segment.
+  forceinline int predict(T key) const {
+    int i = 1;
+    while (i < num_segments_ && !(key < first_keys_[i])) {
+      i++;
+    }
+    return models_[i - 1].predict(key);
+  }
+
+  // Fits the segments to num_keys keys, which for_each_key passes in sorted
+  // order as add(key, rank) until add returns false. Ranks may skip keys,
+  // e.g. for a sample. The first max error that is tried is min_error.
+  template <class ForEachKey>
+  void fit(ForEachKey for_each_key, long long num_keys, double min_error) {
+    for (double max_error = min_error; max_error < num_keys; max_error *= 2) {
+      if (fit_with_error(for_each_key, max_error)) {
+        if (num_segments_ == 1) {
+          num_segments_ = 0;
+        }
+        return;
+      }
+    }
+    num_segments_ = 0;
+  }
+
+ private:
+  // Returns false if the keys need more than kMaxSegments segments
+  template <class ForEachKey>
+  bool fit_with_error(ForEachKey& for_each_key, double max_error) {
+    num_segments_ = 0;
+    bool fits = true;
+    long double first_key = 0;  // of the current segment
+    long long first_rank = 0;
+    double min_slope = 0;
+    double max_slope = std::numeric_limits<double>::infinity();
+    auto finish_segment = [&]() {
+      double slope = max_slope == std::numeric_limits<double>::infinity()
+                         ? min_slope
+                         : (min_slope + max_slope) / 2;
+      models_[num_segments_ - 1].set_anchored(
+          slope, first_key, static_cast<double>(first_rank));
+    };
+    for_each_key([&](T key, long long rank) {
+      if (num_segments_ > 0) {
+        long double distance = static_cast<long double>(key) - first_key;
+        // Equal keys are found at the rank of the first one
+        if (distance == 0) {
+          return true;
+        }
+        auto low = static_cast<double>(
+            (static_cast<long double>(rank - first_rank) - max_error) /
+            distance);
+        auto high = static_cast<double>(
+            (static_cast<long double>(rank - first_rank) + max_error) /
+            distance);
+        if (std::max(low, min_slope) <= std::min(high, max_slope)) {
+          min_slope = std::max(low, min_slope);
+          max_slope = std::min(high, max_slope);
+          return true;
+        }
+        if (num_segments_ == kMaxSegments) {
+          fits = false;
+          return false;
+        }
+        finish_segment();
+      }
+      first_keys_[num_segments_++] = key;
+      first_key = static_cast<long double>(key);
+      first_rank = rank;
+      min_slope = 0;
+      max_slope = std::numeric_limits<double>::infinity();
+      return true;
+    });
+    if (fits && num_segments_ > 0) {
+      finish_segment();
+    }
+    return fits;
+  }
+
+  T first_keys_[kMaxSegments];
+  LinearModel<T> models_[kMaxSegments];
+  int num_segments_ = 0;
+};
+
+// Data nodes that only use their linear model keep no segments
+template <class T>
+class PiecewiseLinearModel<T, 1> {
+ public:
+  static constexpr int num_segments() { return 0; }
+  void clear() {}
+  void expand(double) {}
+  void shift(double) {}
+  int predict(T) const { return 0; }
+  template <class ForEachKey>
+  void fit(ForEachKey, long long, double) {}
+};
+
+/*** Policies ***/
+
+// Compile-time options of data nodes. To change an option, derive a struct
+// from AlexDefaultPolicy that overrides it and pass it as the Policy of Alex.
+struct AlexDefaultPolicy {
+  // Whether we use lzcnt and tzcnt when manipulating a bitmap (e.g., when
+  // finding the closest gap). If your hardware does not support lzcnt/tzcnt
+  // (e.g., your Intel CPU is pre-Haswell), set this to false.
+  static constexpr bool kUseLzcnt = true;
+
+  // Data nodes predict the positions of keys with a piecewise linear model of
+  // up to this many segments when one linear model does not fit their keys
+  // (see PiecewiseLinearModel), which makes data nodes larger, since the cost
+  // of a data node goes down when its model fits better. With 1, data nodes
+  // only use their linear model, which costs no space.
+  static constexpr int kMaxModelSegments = 1;
+  // Smallest max error of the segments, in positions of a dense array
+  static constexpr int kMinModelSegmentError = 8;
+};
+
+/*** Comparison ***/
+
+struct AlexCompare {
+  template <class T1, class T2>
+  bool operator()(const T1& x, const T2& y) const {
+    static_assert(
+        std::is_arithmetic<T1>::value && std::is_arithmetic<T2>::value,
+        "Comparison types must be numeric.");
+    return x < y;
+  }
+};
+
+/*** Helper methods for bitmap ***/
+
+// Extract the rightmost 1 in the binary representation.
+// e.g. extract_rightmost_one(010100100) = 000000100
+inline uint64_t extract_rightmost_one(uint64_t value) {
+  return value & -static_cast<int64_t>(value);
+}
+
+// Remove the rightmost 1 in the binary representation.
+// e.g. remove_rightmost_one(010100100) = 010100000
+inline uint64_t remove_rightmost_one(uint64_t value) {
+  return value & (value - 1);
+}
+
+// Count the number of 1s in the binary representation.
+// e.g. count_ones(010100100) = 3
+inline int count_ones(uint64_t value) {
+  return static_cast<int>(_mm_popcnt_u64(value));
+}
+
+// Get the offset of a bit in a bitmap.
+// word_id is the word id of the bit in a bitmap
+// bit is the word that contains the bit
+inline int get_offset(int word_id, uint64_t bit) {
+  return (word_id << 6) + count_ones(bit - 1);
+}
+
+/*** Cost model weights ***/
+
+// Intra-node cost weights
+constexpr double kExpSearchIterationsWeight = 20;
+constexpr double kShiftsWeight = 0.5;
+
+// TraverseToLeaf cost weights
+constexpr double kNodeLookupsWeight = 20;
+constexpr double kModelSizeWeight = 5e-7;
+
+/*** Stat Accumulators ***/
+
+struct DataNodeStats {
+  double num_search_iterations = 0;
+  double num_shifts = 0;
+};
+
+// Used when stats are computed using a sample
+struct SampleDataNodeStats {
+  double log2_sample_size = 0;
+  double num_search_iterations = 0;
+  double log2_num_shifts = 0;
+};
+
+// Accumulates stats that are used in the cost model, based on the actual vs
+// predicted position of a key
+class StatAccumulator {
+ public:
+  virtual ~StatAccumulator() = default;
+  virtual void accumulate(int actual_position, int predicted_position) = 0;
+  virtual double get_stat() = 0;
+  virtual void reset() = 0;
+};
+
+// Mean log error represents the expected number of exponential search
+// iterations when doing a lookup
+class ExpectedSearchIterationsAccumulator : public StatAccumulator {
+ public:
+  void accumulate(int actual_position, int predicted_position) override {
+    cumulative_log_error_ +=
+        std::log2(std::abs(predicted_position - actual_position) + 1);
+    count_++;
+  }
+
+  double get_stat() override {
+    if (count_ == 0) return 0;
+    return cumulative_log_error_ / count_;
+  }
+
+  void reset() override {
+    cumulative_log_error_ = 0;
+    count_ = 0;
+  }
+
+ public:
+  double cumulative_log_error_ = 0;
+  int count_ = 0;
+};
+
+// Mean shifts represents the expected number of shifts when doing an insert
+class ExpectedShiftsAccumulator : public StatAccumulator {
+ public:
+  explicit ExpectedShiftsAccumulator(int data_capacity)
+      : data_capacity_(data_capacity) {}
+
+  // A dense region of n keys will contribute a total number of expected shifts
+  // of approximately
+  // ((n-1)/2)((n-1)/2 + 1) = n^2/4 - 1/4
+  // This is exact for odd n and off by 0.25 for even n.
+  // Therefore, we track n^2/4.
+  void accumulate(int actual_position, int) override {
+    if (actual_position > last_position_ + 1) {
+      long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
+      num_expected_shifts_ += (dense_region_length * dense_region_length) / 4;
+      dense_region_start_idx_ = actual_position;
+    }
+    last_position_ = actual_position;
+    count_++;
+  }
+
+  double get_stat() override {
+    if (count_ == 0) return 0;
+    // first need to accumulate statistics for current packed region
+    long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
+    long long cur_num_expected_shifts =
+        num_expected_shifts_ + (dense_region_length * dense_region_length) / 4;
+    return cur_num_expected_shifts / static_cast<double>(count_);
+  }
+
+  void reset() override {
+    last_position_ = -1;
+    dense_region_start_idx_ = 0;
+    num_expected_shifts_ = 0;
+    count_ = 0;
+  }
+
+ public:
+  int last_position_ = -1;
+  int dense_region_start_idx_ = 0;
+  long long num_expected_shifts_ = 0;
+  int count_ = 0;
+  int data_capacity_ = -1;  // capacity of node
+};
+
+// Combines ExpectedSearchIterationsAccumulator and ExpectedShiftsAccumulator
+class ExpectedIterationsAndShiftsAccumulator : public StatAccumulator {
+ public:
+  ExpectedIterationsAndShiftsAccumulator() = default;
+  explicit ExpectedIterationsAndShiftsAccumulator(int data_capacity)
+      : data_capacity_(data_capacity) {}
+
+  void accumulate(int actual_position, int predicted_position) override {
+    cumulative_log_error_ +=
+        std::log2(std::abs(predicted_position - actual_position) + 1);
+
+    if (actual_position > last_position_ + 1) {
+      long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
+      num_expected_shifts_ += (dense_region_length * dense_region_length) / 4;
+      dense_region_start_idx_ = actual_position;
+    }
+    last_position_ = actual_position;
+
+    count_++;
+  }
+
+  double get_stat() override {
+    assert(false);  // this should not be used
+    return 0;
+  }
+
+  double get_expected_num_search_iterations() {
+    if (count_ == 0) return 0;
+    return cumulative_log_error_ / count_;
+  }
+
+  double get_expected_num_shifts() {
+    if (count_ == 0) return 0;
+    long long dense_region_length = last_position_ - dense_region_start_idx_ + 1;
+    long long cur_num_expected_shifts =
+        num_expected_shifts_ + (dense_region_length * dense_region_length) / 4;
+    return cur_num_expected_shifts / static_cast<double>(count_);
+  }
+
+  void reset() override {
+    cumulative_log_error_ = 0;
+    last_position_ = -1;
+    dense_region_start_idx_ = 0;
+    num_expected_shifts_ = 0;
+    count_ = 0;
+  }
+
+ public:
+  double cumulative_log_error_ = 0;
+  int last_position_ = -1;
+  int dense_region_start_idx_ = 0;
+  long long num_expected_shifts_ = 0;
+  int count_ = 0;
+  int data_capacity_ = -1;  // capacity of node
+};
+
+/*** Sharded statistics ***/
+
+// Returns a small id of the calling thread. Ids are assigned in the order in
+// which threads first call this function.
+inline int thread_shard_id() {
+  static std::atomic<int> next_id{0};
+  // Constant-initialized, so that reading it does not need an initialization
+  // check
+  thread_local int id = -1;
+  if (id < 0) {
+    id = next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+  return id;
+}
+
+// Counter for a statistic that is updated on the lookup path.
+// Each thread adds to its own shard, so that threads do not write to a shared
+// cache line, and the shards are summed on read. Threads beyond the number of
+// shards share shards, in which case concurrent updates may be lost.
+// If ALEX_DISABLE_STATS is turned on, updates do nothing and the value is zero.
+class StatCounter {
+ public:
+  static const int kNumShards = 16;
+
+  StatCounter() = default;
+  StatCounter(const StatCounter& other) { add(other.value()); }
+
+  StatCounter& operator=(const StatCounter& other) {
+    if (this != &other) {
+      long long other_value = other.value();
+      add(other_value - value());
+    }
+    return *this;
+  }
+
+  void operator++(int) { add(1); }
+
+  StatCounter& operator+=(long long n) {
+    add(n);
+    return *this;
+  }
+
+  operator long long() const { return value(); }
+
+  long long value() const {
+    long long sum = 0;
+#if !ALEX_DISABLE_STATS
+    for (const Shard& shard : shards_) {
+      sum += shard.count.load(std::memory_order_relaxed);
+    }
+#endif
+    return sum;
+  }
+
+ private:
+#if !ALEX_DISABLE_STATS
+  struct alignas(64) Shard {
+    std::atomic<long long> count{0};
+  };
+  Shard shards_[kNumShards];
+#endif
+
+  void add(long long n) {
+#if ALEX_DISABLE_STATS
+    (void)n;
+#else
+    // A load and a store instead of an atomic add, because the shard is
+    // normally only written by one thread
+    std::atomic<long long>& count =
+        shards_[thread_shard_id() % kNumShards].count;
+    count.store(count.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+#endif
+  }
+};
+
+/*** Miscellaneous helpers ***/
+
+// https://stackoverflow.com/questions/364985/algorithm-for-finding-the-smallest-power-of-two-thats-greater-or-equal-to-a-giv
+inline int pow_2_round_up(int x) {
+  --x;
+  x |= x >> 1;
+  x |= x >> 2;
+  x |= x >> 4;
+  x |= x >> 8;
+  x |= x >> 16;
+  return x + 1;
+}
+
+// https://stackoverflow.com/questions/994593/how-to-do-an-integer-log2-in-c
+inline int log_2_round_down(int x) {
+  int res = 0;
+  while (x >>= 1) ++res;
+  return res;
+}
+
+// https://stackoverflow.com/questions/1666093/cpuid-implementations-in-c
+class CPUID {
+  uint32_t regs[4];
+
+ public:
+  explicit CPUID(unsigned i, unsigned j) {
+#ifdef _WIN32
+    __cpuidex((int*)regs, (int)i, (int)j);
+#else
+    asm volatile("cpuid"
+                 : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                 : "a"(i), "c"(j));
+#endif
+  }
+
+  const uint32_t& EAX() const { return regs[0]; }
+  const uint32_t& EBX() const { return regs[1]; }
+  const uint32_t& ECX() const { return regs[2]; }
+  const uint32_t& EDX() const { return regs[3]; }
+};
+
+// https://en.wikipedia.org/wiki/CPUID#EAX=7,_ECX=0:_Extended_Features
+inline bool cpu_supports_bmi() {
+  return static_cast<bool>(CPUID(7, 0).EBX() & (1 << 3));
+}
+
+// Whether the OS saves the AVX registers (and the AVX-512 registers if avx512
+// is true) on context switches
+// https://en.wikipedia.org/wiki/Control_register#XCR0_and_XSS
+inline bool os_supports_avx(bool avx512) {
+  if (!(CPUID(1, 0).ECX() & (1 << 27))) {
+    return false;  // no OSXSAVE, so XGETBV is not available
+  }
+#ifdef _WIN32
+  uint64_t xcr0 = _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  asm volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  uint64_t xcr0 = (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+  uint64_t required_state = avx512 ? 0xE6 : 0x6;
+  return (xcr0 & required_state) == required_state;
+}
+
+inline bool cpu_supports_avx2() {
+  return (CPUID(7, 0).EBX() & (1 << 5)) && os_supports_avx(false);
+}
+
+inline bool cpu_supports_avx512() {
+  return (CPUID(7, 0).EBX() & (1 << 16)) && os_supports_avx(true);
+}
+
+/*** SIMD dispatch ***/
+
+// Instruction sets that the SIMD kernels can use
+enum SimdLevel { kSimdNone = 0, kSimdAvx2 = 1, kSimdAvx512 = 2 };
+
+inline SimdLevel detect_simd_level() {
+  return cpu_supports_avx512() ? kSimdAvx512
+                               : (cpu_supports_avx2() ? kSimdAvx2 : kSimdNone);
+}
+
+// Best instruction set supported by the CPU, detected during static
+// initialization. This avoids the initialization check of a function-local
+// static on every call. Calls that run before it is detected see kSimdNone
+// and do not use SIMD.
+template <class Dummy = void>
+struct SimdLevelHolder {
+  static const SimdLevel level;
+};
+
+template <class Dummy>
+const SimdLevel SimdLevelHolder<Dummy>::level = detect_simd_level();
+
+inline SimdLevel simd_level() { return SimdLevelHolder<>::level; }
+
+/*** SIMD reductions ***/
+
+// The kernels sum values[i] for the positions i in [left, right) whose bit is
+// set in bitmap, like the bitmap of a data node. Each bitmap word is used as
+// the mask of masked loads, so gaps do not cause branches, and masked loads do
+// not read past the end of values. The AVX2 kernels add 4 values per
+// instruction, and the AVX-512 kernels add 8. Doubles are therefore added in a
+// different order than by a sequential loop, which can change the rounding of
+// the sum. Integer sums wrap around.
+
+// Bits of the positions in [left, right) in the given bitmap word
+inline uint64_t bitmap_word_mask(int word_idx, int left, int right) {
+  uint64_t mask = ~0ULL;
+  if (word_idx == left >> 6) {
+    mask &= ~0ULL << (left & 63);
+  }
+  if (word_idx == (right - 1) >> 6) {
+    mask &= ~0ULL >> (63 - ((right - 1) & 63));
+  }
+  return mask;
+}
+
+ALEX_TARGET_AVX2 inline double avx2_masked_sum(const double* values,
+                                               const uint64_t* bitmap,
+                                               int left, int right) {
+  const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  __m256d sum = _mm256_setzero_pd();
+  for (int i = left >> 6; i <= (right - 1) >> 6; i++) {
+    uint64_t bits = bitmap[i] & bitmap_word_mask(i, left, right);
+    const double* word_values = values + (static_cast<size_t>(i) << 6);
+    for (int j = 0; j < 64 && (bits >> j) != 0; j += 4) {
+      __m256i lanes = _mm256_and_si256(
+          _mm256_set1_epi64x(static_cast<int64_t>(bits >> j)), lane_bits);
+      __m256i load_mask = _mm256_cmpeq_epi64(lanes, lane_bits);
+      sum = _mm256_add_pd(sum, _mm256_maskload_pd(word_values + j, load_mask));
+    }
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sum);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+ALEX_TARGET_AVX2 inline uint64_t avx2_masked_sum_int64(const int64_t* values,
+                                                       const uint64_t* bitmap,
+                                                       int left, int right) {
+  const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = left >> 6; i <= (right - 1) >> 6; i++) {
+    uint64_t bits = bitmap[i] & bitmap_word_mask(i, left, right);
+    auto word_values = reinterpret_cast<const long long*>(
+        values + (static_cast<size_t>(i) << 6));
+    for (int j = 0; j < 64 && (bits >> j) != 0; j += 4) {
+      __m256i lanes = _mm256_and_si256(
+          _mm256_set1_epi64x(static_cast<int64_t>(bits >> j)), lane_bits);
+      __m256i load_mask = _mm256_cmpeq_epi64(lanes, lane_bits);
+      sum = _mm256_add_epi64(sum,
+                             _mm256_maskload_epi64(word_values + j, load_mask));
+    }
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+ALEX_TARGET_AVX512 inline double avx512_masked_sum(const double* values,
+                                                   const uint64_t* bitmap,
+                                                   int left, int right) {
+  __m512d sum = _mm512_setzero_pd();
+  for (int i = left >> 6; i <= (right - 1) >> 6; i++) {
+    uint64_t bits = bitmap[i] & bitmap_word_mask(i, left, right);
+    const double* word_values = values + (static_cast<size_t>(i) << 6);
+    for (int j = 0; j < 64 && (bits >> j) != 0; j += 8) {
+      auto load_mask = static_cast<__mmask8>(bits >> j);
+      sum = _mm512_add_pd(sum,
+                          _mm512_maskz_loadu_pd(load_mask, word_values + j));
+    }
+  }
+  return _mm512_reduce_add_pd(sum);
+}
+
+ALEX_TARGET_AVX512 inline uint64_t avx512_masked_sum_int64(
+    const int64_t* values, const uint64_t* bitmap, int left, int right) {
+  __m512i sum = _mm512_setzero_si512();
+  for (int i = left >> 6; i <= (right - 1) >> 6; i++) {
+    uint64_t bits = bitmap[i] & bitmap_word_mask(i, left, right);
+    const int64_t* word_values = values + (static_cast<size_t>(i) << 6);
+    for (int j = 0; j < 64 && (bits >> j) != 0; j += 8) {
+      auto load_mask = static_cast<__mmask8>(bits >> j);
+      sum = _mm512_add_epi64(
+          sum, _mm512_maskz_loadu_epi64(load_mask, word_values + j));
+    }
+  }
+  // Added as unsigned, since overflows of signed sums are undefined
+  uint64_t lanes[8];
+  _mm512_storeu_si512(lanes, sum);
+  uint64_t total = 0;
+  for (uint64_t lane : lanes) {
+    total += lane;
+  }
+  return total;
+}
+
+template <class P>
+inline P scalar_masked_sum(const P* values, const uint64_t* bitmap, int left,
+                           int right) {
+  P sum = P();
+  for (int i = left >> 6; i <= (right - 1) >> 6; i++) {
+    uint64_t bits = bitmap[i] & bitmap_word_mask(i, left, right);
+    while (bits) {
+      uint64_t bit = extract_rightmost_one(bits);
+      sum += values[get_offset(i, bit)];
+      bits ^= bit;
+    }
+  }
+  return sum;
+}
+
+// Sums the values of type P at the set positions of a bitmap, with SIMD kernels
+// for 64-bit integer and floating-point types
+template <class P, class Enable = void>
+struct SimdSum {
+  static P masked_sum(const P* values, const uint64_t* bitmap, int left,
+                      int right) {
+    return scalar_masked_sum(values, bitmap, left, right);
+  }
+};
+
+template <class P>
+struct SimdSum<P, typename std::enable_if<std::is_arithmetic<P>::value &&
+                                          sizeof(P) == 8>::type> {
+  static P masked_sum(const P* values, const uint64_t* bitmap, int left,
+                      int right) {
+    return masked_sum(values, bitmap, left, right,
+                      std::is_floating_point<P>());
+  }
+
+ private:
+  static P masked_sum(const P* values, const uint64_t* bitmap, int left,
+                      int right, std::true_type) {
+    auto double_values = reinterpret_cast<const double*>(values);
+    switch (simd_level()) {
+      case kSimdAvx512:
+        return static_cast<P>(
+            avx512_masked_sum(double_values, bitmap, left, right));
+      case kSimdAvx2:
+        return static_cast<P>(
+            avx2_masked_sum(double_values, bitmap, left, right));
+      default:
+        return scalar_masked_sum(values, bitmap, left, right);
+    }
+  }
+
+  static P masked_sum(const P* values, const uint64_t* bitmap, int left,
+                      int right, std::false_type) {
+    auto int_values = reinterpret_cast<const int64_t*>(values);
+    switch (simd_level()) {
+      case kSimdAvx512:
+        return static_cast<P>(
+            avx512_masked_sum_int64(int_values, bitmap, left, right));
+      case kSimdAvx2:
+        return static_cast<P>(
+            avx2_masked_sum_int64(int_values, bitmap, left, right));
+      default:
+        return scalar_masked_sum(values, bitmap, left, right);
+    }
+  }
+};
 }
\ No newline at end of file
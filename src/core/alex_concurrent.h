@@ -0,0 +1,336 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * A thread-safe variant of ALEX that allows concurrent lookups and inserts.
+ *
+ * Lookups are optimistic: they read the version of the data node they land
+ * in, search it without writing to it, and retry if the version changed in the
+ * meantime. Lookups never take a latch.
+ * Inserts that fit into their data node without resizing it only latch that
+ * data node. Inserts that need a structure modification (expanding or
+ * splitting a data node, or expanding the root) escalate to an exclusive
+ * structure latch, which waits for in-flight operations to drain before the
+ * modification runs. Structure modifications free and reallocate nodes and
+ * child pointer arrays in place, so this is what keeps in-flight lookups from
+ * reading freed memory. Erases and bulk loads also take the structure latch.
+ *
+ * Lookups do not update the cost model counters of data nodes, so the cost
+ * model of a ConcurrentAlex is driven by inserts only.
+ *
+ * User-facing API of ConcurrentAlex:
+ * - ConcurrentAlex()
+ * - void bulk_load(V values[], long long num_keys)
+ * - bool insert(T key, P payload)
+ * - bool get_payload(T key, P* payload)  // copies the payload if found
+ * - int erase(T key)
+ * - size_t size()
+ */
+
+#pragma once
+
+#include <mutex>
+
+#include "alex.h"
+
+namespace alex {
+
+template <class T, class P, class Compare = AlexCompare,
+          class Alloc = std::allocator<std::pair<T, P>>,
+          bool allow_duplicates = true>
+class ConcurrentAlex {
+  static_assert(std::is_arithmetic<T>::value, "ALEX key type must be numeric.");
+  static_assert(std::is_same<Compare, AlexCompare>::value,
+                "Must use AlexCompare.");
+
+ public:
+  // Value type
+  typedef std::pair<T, P> V;
+
+  // ALEX class aliases
+  typedef ConcurrentAlex<T, P, Compare, Alloc, allow_duplicates> self_type;
+  typedef Alex<T, P, Compare, Alloc, allow_duplicates> alex_impl;
+  typedef typename alex_impl::model_node_type model_node_type;
+  typedef typename alex_impl::data_node_type data_node_type;
+
+  // Threads announce in-flight operations in one of this many slots. Threads
+  // beyond this number share slots, which is still correct.
+  static const int kNumThreadSlots = 64;
+
+ private:
+  // Each slot is on its own cache line, so that threads do not write to cache
+  // lines shared with other threads
+  struct alignas(64) ThreadSlot {
+    std::atomic<int> num_active_operations{0};
+    // Inserts that bypassed alex_, which are added to the stats of alex_ during
+    // the next structure modification
+    std::atomic<long long> num_pending_inserts{0};
+  };
+
+  alex_impl alex_;
+  mutable ThreadSlot thread_slots_[kNumThreadSlots];
+  // Set while a structure modification is running or waiting to run
+  std::atomic<bool> structure_latched_{false};
+  std::mutex structure_mutex_;
+
+  /*** Constructors ***/
+
+ public:
+  ConcurrentAlex() : alex_() {}
+
+  ConcurrentAlex(const Compare& comp, const Alloc& alloc = Alloc())
+      : alex_(comp, alloc) {}
+
+  ConcurrentAlex(const Alloc& alloc) : alex_(alloc) {}
+
+  ConcurrentAlex(const self_type& other) = delete;
+  ConcurrentAlex& operator=(const self_type& other) = delete;
+
+  /*** Bulk loading ***/
+
+ public:
+  // values should be the sorted array of key-payload pairs.
+  // The number of elements should be num_keys.
+  // The index must be empty when calling this method.
+  void bulk_load(const V values[], long long num_keys) {
+    std::lock_guard<std::mutex> lock(structure_mutex_);
+    latch_structure();
+    alex_.bulk_load(values, num_keys);
+    unlatch_structure();
+  }
+
+  /*** Lookup ***/
+
+ public:
+  // Copies the payload of an exact match of the key into payload.
+  // Returns whether the key was found.
+  // If there are multiple keys with the same value, returns the payload of the
+  // right-most key.
+  bool get_payload(const T& key, P* payload) const {
+    ThreadSlot& slot = enter_operation();
+    bool found;
+    while (true) {
+      const data_node_type* leaf = get_leaf(key);
+      uint64_t version = read_version(leaf);
+      int idx = leaf->find_key_without_stats(key);
+      found = idx >= 0;
+      P found_payload = found ? leaf->get_payload(idx) : P();
+      if (validate_version(leaf, version)) {
+        if (found) {
+          *payload = found_payload;
+        }
+        break;
+      }
+    }
+    exit_operation(slot);
+    return found;
+  }
+
+  /*** Insert ***/
+
+ public:
+  // This will NOT do an update of an existing key.
+  // Returns whether the insert happened. Insert does not happen if duplicates
+  // are not allowed and duplicate is found.
+  bool insert(const T& key, const P& payload) {
+    ThreadSlot& slot = enter_operation();
+    // Nonzero fail flag means that the insert needs a structure modification
+    int fail = 1;
+    // Keys outside the key domain are counted towards expanding the root
+    if (!key_less(key, alex_.istats_.key_domain_min_) &&
+        !key_less(alex_.istats_.key_domain_max_, key)) {
+      data_node_type* leaf = get_leaf(key);
+      latch_leaf(leaf);
+      // Inserting into a full data node would resize it, which frees the
+      // arrays that concurrent lookups may be reading
+      if (leaf->num_keys_ < leaf->expansion_threshold_) {
+        fail = leaf->insert(key, payload).first;
+      }
+      unlatch_leaf(leaf);
+      if (fail == 0) {
+        slot.num_pending_inserts.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    exit_operation(slot);
+    if (fail <= 0) {
+      return fail == 0;
+    }
+
+    std::lock_guard<std::mutex> lock(structure_mutex_);
+    latch_structure();
+    bool inserted = alex_.insert(key, payload).second;
+    unlatch_structure();
+    return inserted;
+  }
+
+  /*** Delete ***/
+
+ public:
+  // Erases all keys with a certain key value.
+  // Returns the number of keys erased.
+  int erase(const T& key) {
+    std::lock_guard<std::mutex> lock(structure_mutex_);
+    latch_structure();
+    int num_erased = alex_.erase(key);
+    unlatch_structure();
+    return num_erased;
+  }
+
+  /*** Stats ***/
+
+ public:
+  // Number of elements
+  size_t size() const {
+    ThreadSlot& slot = enter_operation();
+    long long num_keys = alex_.stats_.num_keys;
+    for (const ThreadSlot& s : thread_slots_) {
+      num_keys += s.num_pending_inserts.load(std::memory_order_relaxed);
+    }
+    exit_operation(slot);
+    return static_cast<size_t>(num_keys);
+  }
+
+  // True if there are no elements
+  bool empty() const { return (size() == 0); }
+
+  /*** Operation and structure latches ***/
+
+ private:
+  // Announces an operation of the calling thread, waiting while a structure
+  // modification is running. Pairs with latch_structure(): either the
+  // operation sees the structure latch, or the structure modification sees
+  // the operation.
+  ThreadSlot& enter_operation() const {
+    ThreadSlot& slot = thread_slots_[thread_shard_id() % kNumThreadSlots];
+    while (true) {
+      slot.num_active_operations.fetch_add(1, std::memory_order_seq_cst);
+      if (!structure_latched_.load(std::memory_order_seq_cst)) {
+        return slot;
+      }
+      slot.num_active_operations.fetch_sub(1, std::memory_order_release);
+      while (structure_latched_.load(std::memory_order_acquire)) {
+        _mm_pause();
+      }
+    }
+  }
+
+  void exit_operation(ThreadSlot& slot) const {
+    slot.num_active_operations.fetch_sub(1, std::memory_order_release);
+  }
+
+  // Blocks new operations and waits for in-flight operations to finish, so that
+  // alex_ can be used as if single-threaded.
+  // structure_mutex_ must be held.
+  void latch_structure() {
+    structure_latched_.store(true, std::memory_order_seq_cst);
+    long long num_pending_inserts = 0;
+    for (ThreadSlot& slot : thread_slots_) {
+      while (slot.num_active_operations.load(std::memory_order_seq_cst) > 0) {
+        _mm_pause();
+      }
+      num_pending_inserts +=
+          slot.num_pending_inserts.exchange(0, std::memory_order_relaxed);
+    }
+    alex_.stats_.num_keys += num_pending_inserts;
+    alex_.stats_.num_inserts += num_pending_inserts;
+  }
+
+  void unlatch_structure() {
+    structure_latched_.store(false, std::memory_order_release);
+  }
+
+  /*** Data node latches ***/
+
+ private:
+  // Waits until no writer holds the latch on the data node, then returns its
+  // version
+  static uint64_t read_version(const data_node_type* leaf) {
+    uint64_t version = leaf->version_.load(std::memory_order_acquire);
+    while (version & 1) {
+      _mm_pause();
+      version = leaf->version_.load(std::memory_order_acquire);
+    }
+    return version;
+  }
+
+  // Whether the data node was not modified since its version was read
+  static bool validate_version(const data_node_type* leaf, uint64_t version) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return leaf->version_.load(std::memory_order_relaxed) == version;
+  }
+
+  static void latch_leaf(data_node_type* leaf) {
+    uint64_t version = leaf->version_.load(std::memory_order_relaxed);
+    while ((version & 1) || !leaf->version_.compare_exchange_weak(
+                                version, version + 1,
+                                std::memory_order_acquire)) {
+      _mm_pause();
+      version = leaf->version_.load(std::memory_order_relaxed);
+    }
+  }
+
+  static void unlatch_leaf(data_node_type* leaf) {
+    leaf->version_.fetch_add(1, std::memory_order_release);
+  }
+
+  /*** Traversal ***/
+
+ private:
+  // Same as Alex::get_leaf(), but does not update any statistics, and reads the
+  // keys of neighboring data nodes under their versions.
+  // Must only be called between enter_operation() and exit_operation().
+  data_node_type* get_leaf(const T& key) const {
+    AlexNode<T, P>* cur = alex_.root_node_;
+    if (cur->is_leaf_) {
+      return static_cast<data_node_type*>(cur);
+    }
+
+    while (true) {
+      auto node = static_cast<model_node_type*>(cur);
+      double bucketID_prediction = node->model_.predict_double(key);
+      int bucketID = static_cast<int>(bucketID_prediction);
+      bucketID =
+          std::min<int>(std::max<int>(bucketID, 0), node->num_children_ - 1);
+      cur = node->children_[bucketID];
+      if (cur->is_leaf_) {
+        auto leaf = static_cast<data_node_type*>(cur);
+#if ALEX_SAFE_LOOKUP
+        int bucketID_prediction_rounded =
+            static_cast<int>(bucketID_prediction + 0.5);
+        double tolerance =
+            10 * std::numeric_limits<double>::epsilon() * bucketID_prediction +
+            LinearModel<T>::kPredictionError;
+        if (std::abs(bucketID_prediction - bucketID_prediction_rounded) <=
+            tolerance) {
+          if (bucketID_prediction_rounded <= bucketID_prediction) {
+            if (leaf->prev_leaf_ &&
+                !key_less(read_boundary_key(leaf->prev_leaf_, true), key)) {
+              return leaf->prev_leaf_;
+            }
+          } else {
+            if (leaf->next_leaf_ &&
+                !key_less(key, read_boundary_key(leaf->next_leaf_, false))) {
+              return leaf->next_leaf_;
+            }
+          }
+        }
+#endif
+        return leaf;
+      }
+    }
+  }
+
+  // Reads the last key of a data node if last is true, otherwise the first key
+  static T read_boundary_key(const data_node_type* leaf, bool last) {
+    while (true) {
+      uint64_t version = read_version(leaf);
+      T key = last ? leaf->last_key() : leaf->first_key();
+      if (validate_version(leaf, version)) {
+        return key;
+      }
+    }
+  }
+
+  bool key_less(const T& a, const T& b) const { return alex_.key_less_(a, b); }
+};
+}
@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Streaming ingest into an ALEX index, for loads that are too large to hold
+ * in memory at once or whose input is parsed on the fly.
+ *
+ * An IngestSession moves chunks of key-payload pairs from producer threads
+ * into an index through a bounded queue. submit() sorts a chunk in the thread
+ * of its producer and queues it, waiting while the queue is full. A consumer
+ * thread owned by the session inserts the queued chunks with
+ * Alex::insert_sorted(), one at a time in queue order. Reading and parsing the
+ * input, sorting chunks and inserting them all overlap, so ingest runs at the
+ * speed of the slowest stage. Memory stays bounded: at most
+ * max_queued_chunks chunks wait in the queue, and inserted chunks are handed
+ * back to producers by get_chunk() with their capacity, up to the same
+ * number.
+ *
+ * Producers may be any number of threads. The index must not be used by
+ * other threads until finish() returns.
+ *
+ * User-facing API of IngestSession:
+ * - IngestSession(Index& index, size_t max_queued_chunks)
+ * - Chunk get_chunk()  // empty, possibly with capacity from an earlier chunk
+ * - bool submit(Chunk chunk)
+ * - long long finish()  // returns the number of inserted keys
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "alex_base.h"
+
+namespace alex {
+
+template <class Index>
+class IngestSession {
+ public:
+  typedef typename Index::V V;
+  typedef std::vector<V> Chunk;
+
+  explicit IngestSession(Index& index, size_t max_queued_chunks = 4)
+      : index_(index),
+        max_queued_chunks_(std::max<size_t>(max_queued_chunks, 1)) {
+    consumer_ = std::thread([this] { run_consumer(); });
+  }
+
+  IngestSession(const IngestSession& other) = delete;
+  IngestSession& operator=(const IngestSession& other) = delete;
+
+  // Inserts the chunks that are still queued. Errors are dropped, so call
+  // finish() to see them.
+  ~IngestSession() {
+    close();
+    if (consumer_.joinable()) {
+      consumer_.join();
+    }
+  }
+
+  // Returns an empty chunk. Chunks that were inserted are reused, so that
+  // producers do not allocate a chunk per submit().
+  Chunk get_chunk() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_chunks_.empty()) {
+      return Chunk();
+    }
+    Chunk chunk = std::move(free_chunks_.back());
+    free_chunks_.pop_back();
+    return chunk;
+  }
+
+  // Sorts the chunk and queues it for insertion, waiting while the queue is
+  // full. Equal keys keep their order within the chunk, and chunks are
+  // inserted in the order they are queued. Returns false if the chunk was
+  // dropped because the session finished or an insert failed.
+  bool submit(Chunk chunk) {
+    auto key_less = index_.key_comp();
+    auto value_less = [&key_less](const V& a, const V& b) {
+      return key_less(a.first, b.first);
+    };
+    if (!std::is_sorted(chunk.begin(), chunk.end(), value_less)) {
+      // Stable sort so that the first of several equal keys is kept when
+      // duplicates are not allowed
+      std::stable_sort(chunk.begin(), chunk.end(), value_less);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] {
+      return closed_ || queue_.size() < max_queued_chunks_;
+    });
+    if (closed_) {
+      return false;
+    }
+    queue_.push_back(std::move(chunk));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Waits until all queued chunks are inserted and stops the consumer. Chunks
+  // submitted afterwards are dropped. Returns the number of inserted keys.
+  // Rethrows the exception of an insert that failed, e.g. std::bad_alloc, in
+  // which case the chunks queued after it were dropped.
+  long long finish() {
+    close();
+    if (consumer_.joinable()) {
+      consumer_.join();
+    }
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+    return num_inserted_;
+  }
+
+ private:
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_one();
+  }
+
+  void run_consumer() {
+    while (true) {
+      Chunk chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        chunk = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+      }
+      try {
+        num_inserted_ += index_.insert_sorted(
+            chunk.data(), static_cast<long long>(chunk.size()));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::current_exception();
+        closed_ = true;
+        queue_.clear();
+        not_full_.notify_all();
+        return;
+      }
+      chunk.clear();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_chunks_.size() < max_queued_chunks_) {
+        free_chunks_.push_back(std::move(chunk));
+      }
+    }
+  }
+
+  Index& index_;
+  const size_t max_queued_chunks_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<Chunk> queue_;
+  std::vector<Chunk> free_chunks_;
+  // Set by finish() or by a failed insert, after which no chunk is queued
+  bool closed_ = false;
+  // Only written by the consumer, and read after it was joined
+  long long num_inserted_ = 0;
+  std::exception_ptr error_;
+  std::thread consumer_;
+};
+}
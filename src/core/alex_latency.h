@@ -0,0 +1,254 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Latency histograms for instrumenting ALEX operations.
+ *
+ * A LatencyHistogram counts nanosecond latencies in log-linear buckets: each
+ * power of two is divided into kSubBuckets buckets, so a bucket spans at most
+ * 1/kSubBuckets of its lower bound, as in HDR histograms. Recording a latency
+ * is one relaxed atomic add per counter and never takes a lock, and snapshots
+ * read the counters while other threads keep recording.
+ *
+ * LatencyStats holds one histogram per operation type and one per phase of an
+ * insert. Alex records into it when latency tracking is turned on (see
+ * Alex::set_track_latency()).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "alex_base.h"
+
+namespace alex {
+
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 3;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // Latencies below kSubBuckets ns each have their own bucket, larger
+  // latencies have kSubBuckets buckets per power of two
+  static const int kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  // Counters read at one point in time. Counters are read one at a time, so
+  // latencies that are recorded while the snapshot is taken may be counted in
+  // some fields but not in others.
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    std::vector<uint64_t> bucket_counts;
+
+    double mean_ns() const {
+      return count == 0 ? 0 : static_cast<double>(sum_ns) / count;
+    }
+
+    // Upper bound of the bucket that holds the latency at quantile q in
+    // [0, 1], e.g. q = 0.99 for p99. Never more than max_ns.
+    uint64_t percentile_ns(double q) const {
+      uint64_t total = 0;
+      for (uint64_t bucket_count : bucket_counts) {
+        total += bucket_count;
+      }
+      if (total == 0) {
+        return 0;
+      }
+      auto rank =
+          static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+      rank = std::min(std::max<uint64_t>(rank, 1), total);
+      uint64_t seen = 0;
+      for (int i = 0; i < static_cast<int>(bucket_counts.size()); i++) {
+        seen += bucket_counts[i];
+        if (seen >= rank) {
+          return std::min(bucket_upper_bound(i), max_ns);
+        }
+      }
+      return max_ns;
+    }
+
+    void merge(const Snapshot& other) {
+      count += other.count;
+      sum_ns += other.sum_ns;
+      max_ns = std::max(max_ns, other.max_ns);
+      bucket_counts.resize(kNumBuckets);
+      for (size_t i = 0; i < other.bucket_counts.size(); i++) {
+        bucket_counts[i] += other.bucket_counts[i];
+      }
+    }
+  };
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram& other) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram& other) = delete;
+
+  // Records num_ops operations that took latency_ns each
+  void record(uint64_t latency_ns, uint64_t num_ops = 1) {
+    buckets_[bucket_index(latency_ns)].fetch_add(num_ops,
+                                                 std::memory_order_relaxed);
+    count_.fetch_add(num_ops, std::memory_order_relaxed);
+    sum_ns_.fetch_add(latency_ns * num_ops, std::memory_order_relaxed);
+    uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (latency_ns > max_ns &&
+           !max_ns_.compare_exchange_weak(max_ns, latency_ns,
+                                          std::memory_order_relaxed)) {
+    }
+  }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+    snapshot.max_ns = max_ns_.load(std::memory_order_relaxed);
+    snapshot.bucket_counts.resize(kNumBuckets);
+    for (int i = 0; i < kNumBuckets; i++) {
+      snapshot.bucket_counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+  }
+
+  // Not atomic with respect to concurrent record()
+  void reset() {
+    for (std::atomic<uint64_t>& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+  }
+
+  /*** Buckets ***/
+
+  static int bucket_index(uint64_t latency_ns) {
+    if (latency_ns < kSubBuckets) {
+      return static_cast<int>(latency_ns);
+    }
+    int log = 63 - __builtin_clzll(latency_ns);
+    int sub_bucket =
+        static_cast<int>(latency_ns >> (log - kSubBucketBits)) - kSubBuckets;
+    return (log - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+  }
+
+  static uint64_t bucket_lower_bound(int index) {
+    if (index < kSubBuckets) {
+      return static_cast<uint64_t>(index);
+    }
+    int log = index / kSubBuckets + kSubBucketBits - 1;
+    uint64_t sub_bucket = index % kSubBuckets;
+    return (kSubBuckets + sub_bucket) << (log - kSubBucketBits);
+  }
+
+  // Largest latency that falls into the bucket
+  static uint64_t bucket_upper_bound(int index) {
+    return index + 1 < kNumBuckets ? bucket_lower_bound(index + 1) - 1
+                                   : std::numeric_limits<uint64_t>::max();
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_ns_{0};
+  std::atomic<uint64_t> max_ns_{0};
+};
+
+// Operation types whose latency is tracked
+enum LatencyOp {
+  kLookupOp,  // find, get_payload(s), lower_bound, upper_bound
+  kInsertOp,
+  kEraseOp,
+  kRangeOp,  // count_range, scan_range, aggregate_range, sum_range
+  kNumLatencyOps
+};
+
+// Phases of an insert
+enum InsertPhase {
+  kTraversalPhase,      // finding the data node
+  kShiftPhase,          // inserting into the data node, including shifts
+  kExpandPhase,         // expanding a data node, with or without retraining
+  kSplitPhase,          // splitting a data node
+  kRootExpansionPhase,  // expanding the root for keys outside the key domain
+  kNumInsertPhases
+};
+
+class LatencyStats {
+ public:
+  struct Snapshot {
+    LatencyHistogram::Snapshot ops[kNumLatencyOps];
+    LatencyHistogram::Snapshot insert_phases[kNumInsertPhases];
+  };
+
+  LatencyHistogram& op(LatencyOp op) { return ops_[op]; }
+
+  LatencyHistogram& insert_phase(InsertPhase phase) {
+    return insert_phases_[phase];
+  }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    for (int i = 0; i < kNumLatencyOps; i++) {
+      snapshot.ops[i] = ops_[i].snapshot();
+    }
+    for (int i = 0; i < kNumInsertPhases; i++) {
+      snapshot.insert_phases[i] = insert_phases_[i].snapshot();
+    }
+    return snapshot;
+  }
+
+  void reset() {
+    for (LatencyHistogram& histogram : ops_) {
+      histogram.reset();
+    }
+    for (LatencyHistogram& histogram : insert_phases_) {
+      histogram.reset();
+    }
+  }
+
+  static const char* op_name(int op) {
+    static const char* const kNames[] = {"lookup", "insert", "erase", "range"};
+    return kNames[op];
+  }
+
+  static const char* insert_phase_name(int phase) {
+    static const char* const kNames[] = {"traversal", "shift", "expand",
+                                         "split", "root_expansion"};
+    return kNames[phase];
+  }
+
+  // Timestamp for measuring latencies
+  static uint64_t now_ns() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+ private:
+  LatencyHistogram ops_[kNumLatencyOps];
+  LatencyHistogram insert_phases_[kNumInsertPhases];
+};
+
+// Records the latency of an operation from construction to destruction into
+// stats, unless stats is null
+class LatencyTimer {
+ public:
+  LatencyTimer(LatencyStats* stats, LatencyOp op)
+      : stats_(stats), op_(op), start_ns_(stats ? LatencyStats::now_ns() : 0) {}
+
+  LatencyTimer(const LatencyTimer& other) = delete;
+  LatencyTimer& operator=(const LatencyTimer& other) = delete;
+
+  ~LatencyTimer() {
+    if (stats_) {
+      stats_->op(op_).record(LatencyStats::now_ns() - start_ns_);
+    }
+  }
+
+ private:
+  LatencyStats* stats_;
+  LatencyOp op_;
+  uint64_t start_ns_;
+};
+}
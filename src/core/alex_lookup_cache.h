@@ -0,0 +1,120 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * A small cache of hot keys in front of the lookups of an ALEX index, for
+ * skewed workloads where a few keys receive most lookups.
+ *
+ * The cache is set-associative: a key hashes to one set, which fills one
+ * cache line and holds kWays entries. An entry remembers where a key was
+ * found, i.e. the data node and the position of the key in it, so a hit skips
+ * the traversal and the search in the data node. An entry is only used while
+ * - the structure epoch of the index is the same as when the entry was made.
+ *   The index bumps it whenever it frees a data node, so the data node of a
+ *   valid entry is never freed memory.
+ * - the epoch of the data node is the same as when the entry was made. Data
+ *   nodes bump their epoch whenever keys move or are removed.
+ * Each set replaces its least recently used entry. Epochs are 32 bits, so an
+ * entry could become valid again after 2^32 bumps without being used in
+ * between, which is treated as impossible.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "alex_base.h"
+
+namespace alex {
+
+template <class T, class Leaf>
+class LookupCache {
+ public:
+  static const int kWays = 2;
+
+  // Holds at least num_entries entries, rounded up to a power of two
+  explicit LookupCache(size_t num_entries) {
+    size_t num_sets = 2;
+    while (num_sets * kWays < num_entries) {
+      num_sets *= 2;
+    }
+    shift_ = 64;
+    for (size_t s = num_sets; s > 1; s /= 2) {
+      shift_--;
+    }
+    sets_.resize(num_sets);
+  }
+
+  size_t num_entries() const { return sets_.size() * kWays; }
+
+  long long size_bytes() const {
+    return static_cast<long long>(sets_.size() * sizeof(Set));
+  }
+
+  // Sets leaf and pos to where key is, and returns true, if the cache has a
+  // valid entry for key
+  bool find(const T& key, uint32_t structure_epoch, Leaf** leaf, int* pos) {
+    Set& set = set_of(key);
+    for (int w = 0; w < kWays; w++) {
+      Leaf* cached_leaf = set.leaves[w];
+      if (cached_leaf != nullptr && set.keys[w] == key &&
+          set.structure_epochs[w] == structure_epoch &&
+          set.leaf_epochs[w] == cached_leaf->epoch_) {
+        if (set.recent != w) {
+          set.recent = static_cast<uint8_t>(w);
+        }
+        *leaf = cached_leaf;
+        *pos = set.positions[w];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Remembers that key is at position pos of leaf
+  void insert(const T& key, Leaf* leaf, int pos, uint32_t structure_epoch) {
+    Set& set = set_of(key);
+    int w = 0;
+    while (w < kWays && set.leaves[w] != nullptr && !(set.keys[w] == key)) {
+      w++;
+    }
+    if (w == kWays) {
+      w = (set.recent + 1) % kWays;
+    }
+    set.keys[w] = key;
+    set.leaves[w] = leaf;
+    set.positions[w] = pos;
+    set.leaf_epochs[w] = leaf->epoch_;
+    set.structure_epochs[w] = structure_epoch;
+    set.recent = static_cast<uint8_t>(w);
+  }
+
+  void clear() {
+    for (Set& set : sets_) {
+      set = Set();
+    }
+  }
+
+ private:
+  struct alignas(64) Set {
+    T keys[kWays] = {};
+    Leaf* leaves[kWays] = {};
+    int positions[kWays] = {};
+    uint32_t leaf_epochs[kWays] = {};
+    uint32_t structure_epochs[kWays] = {};
+    uint8_t recent = 0;  // most recently used way
+  };
+
+  // Fibonacci hashing of the bits of the key, whose top bits pick the set
+  Set& set_of(const T& key) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &key,
+                sizeof(T) < sizeof(bits) ? sizeof(T) : sizeof(bits));
+    return sets_[(bits * 0x9E3779B97F4A7C15ULL) >> shift_];
+  }
+
+  std::vector<Set> sets_;
+  int shift_;
+};
+}
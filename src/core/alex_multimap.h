@@ -1,223 +1,521 @@
-// Copyright (c) Microsoft Corporation.
-// Licensed under the MIT license.
-
-/*
- * Implements the STL multimap. It can be used as a near drop-in
- * replacement for std::multimap, with a few important differences:
- * 1) The iterators are ForwardIterators instead of BidirectionalIterators.
- * 2) Keys and payloads are stored separately, so dereferencing the iterator
- *  does not return a reference.
- */
-
-#pragma once
-
-#include "alex.h"
-
-namespace alex {
-
-template <class T, class P, class Compare = AlexCompare,
-          class Alloc = std::allocator<std::pair<T, P>>>
-class AlexMultimap {
-  static_assert(std::is_arithmetic<T>::value, "ALEX key type must be numeric.");
-  static_assert(std::is_same<Compare,AlexCompare>::value, "Must use AlexCompare.");
-
- public:
-  // Value type, returned by dereferencing an iterator
-  typedef std::pair<T, P> V;
-
-  // ALEX class aliases
-  typedef AlexMultimap<T, P, Compare, Alloc> self_type;
-  typedef Alex<T, P, Compare, Alloc, true> alex_impl;
-  typedef typename alex_impl::Iterator iterator;
-  typedef typename alex_impl::ConstIterator const_iterator;
-  typedef typename alex_impl::ReverseIterator reverse_iterator;
-  typedef typename alex_impl::ConstReverseIterator const_reverse_iterator;
-
- private:
-  alex_impl alex_;
-
-  /*** Constructors and setters ***/
-
- public:
-  AlexMultimap() : alex_() {}
-
-  AlexMultimap(const Compare& comp, const Alloc& alloc = Alloc())
-      : alex_(comp, alloc) {}
-
-  AlexMultimap(const Alloc& alloc) : alex_(alloc) {}
-
-  ~AlexMultimap() {}
-
-  // Initializes with range [first, last). The range does not need to be
-  // sorted. This creates a temporary copy of the data. If possible, we
-  // recommend directly using bulk_load() instead.
-  template <class InputIterator>
-  explicit AlexMultimap(InputIterator first, InputIterator last,
-                        const Compare& comp, const Alloc& alloc = Alloc())
-      : alex_(first, last, comp, alloc) {}
-
-  // Initializes with range [first, last). The range does not need to be
-  // sorted. This creates a temporary copy of the data. If possible, we
-  // recommend directly using bulk_load() instead.
-  template <class InputIterator>
-  explicit AlexMultimap(InputIterator first, InputIterator last,
-                        const Alloc& alloc = Alloc())
-      : alex_(first, last, alloc) {}
-
-  explicit AlexMultimap(const self_type& other) : alex_(other.alex_) {}
-
-  AlexMultimap& operator=(const self_type& other) {
-    if (this != &other) {
-      alex_ = other.alex_;
-    }
-    return *this;
-  }
-
-  void swap(const self_type& other) { alex_.swap(other.alex_); }
-
- public:
-  // When bulk loading, Alex can use provided knowledge of the expected fraction
-  // of operations that will be inserts
-  // For simplicity, operations are either point lookups ("reads") or inserts
-  // ("writes)
-  // i.e., 0 means we expect a read-only workload, 1 means write-only
-  // This is only useful if you set it before bulk loading
-  void set_expected_insert_frac(double expected_insert_frac) {
-    alex_.set_expected_insert_frac(expected_insert_frac);
-  }
-
-  // Maximum node size, in bytes.
-  // Higher values result in better average throughput, but worse tail/max
-  // insert latency.
-  void set_max_node_size(int max_node_size) {
-    alex_.set_max_node_size(max_node_size);
-  }
-
-  // Bulk load faster by using sampling to train models.
-  // This is only useful if you set it before bulk loading.
-  void set_approximate_model_computation(bool approximate_model_computation) {
-    alex_.set_approximate_model_computation(approximate_model_computation);
-  }
-
-  // Bulk load faster by using sampling to compute cost.
-  // This is only useful if you set it before bulk loading.
-  void set_approximate_cost_computation(bool approximate_cost_computation) {
-    alex_.set_approximate_cost_computation(approximate_cost_computation);
-  }
-
-  /*** Allocators and comparators ***/
-
- public:
-  Alloc get_allocator() const { return alex_.get_allocator(); }
-
-  Compare key_comp() const { return alex_.key_comp(); }
-
-  /*** Bulk loading ***/
-
- public:
-  // values should be the sorted array of key-payload pairs.
-  // The number of elements should be num_keys.
-  // The index must be empty when calling this method.
-  void bulk_load(const V values[], int num_keys) {
-    alex_.bulk_load(values, num_keys);
-  }
-
-  /*** Lookup ***/
-
- public:
-  // Looks for an exact match of the key
-  // If the key does not exist, returns an end iterator
-  // If there are multiple keys with the same value, returns an iterator to the
-  // right-most key
-  // If you instead want an iterator to the left-most key with the input value,
-  // use lower_bound()
-  iterator find(const T& key) { return alex_.find(key); }
-
-  const_iterator find(const T& key) const { return alex_.find(key); }
-
-  size_t count(const T& key) { return alex_.size(key); }
-
-  // Returns an iterator to the first key no less than the input value
-  iterator lower_bound(const T& key) { return alex_.lower_bound(key); }
-
-  const_iterator lower_bound(const T& key) const {
-    return alex_.lower_bound(key);
-  }
-
-  // Returns an iterator to the first key greater than the input value
-  iterator upper_bound(const T& key) { return alex_.upper_bound(key); }
-
-  const_iterator upper_bound(const T& key) const {
-    return alex_.upper_bound(key);
-  }
-
-  std::pair<iterator, iterator> equal_range(const T& key) {
-    return alex_.equal_range(key);
-  }
-
-  std::pair<const_iterator, const_iterator> equal_range(const T& key) const {
-    return alex_.equal_range(key);
-  }
-
-  iterator begin() { return alex_.begin(); }
-
-  iterator end() { return alex_.end(); }
-
-  const_iterator cbegin() const { return alex_.cbegin(); }
-
-  const_iterator cend() const { return alex_.cend(); }
-
-  reverse_iterator rbegin() { return alex_.rbegin(); }
-
-  reverse_iterator rend() { return alex_.rend(); }
-
-  const_reverse_iterator crbegin() const { return alex_.crbegin(); }
-
-  const_reverse_iterator crend() const { return alex_.crend(); }
-
-  /*** Insert ***/
-
- public:
-  iterator insert(const V& value) { return alex_.insert(value).first; }
-
-  template <class InputIterator>
-  void insert(InputIterator first, InputIterator last) {
-    alex_.insert(first, last);
-  }
-
-  // This will NOT do an update of an existing key.
-  // To perform an update or read-modify-write, do a lookup and modify the
-  // payload's value.
-  iterator insert(const T& key, const P& payload) {
-    return alex_.insert(key, payload).first;
-  }
-
-  /*** Delete ***/
-
- public:
-  // Erases all keys with a certain key value
-  int erase(const T& key) { return alex_.erase(key); }
-
-  // Erases element pointed to by iterator
-  void erase(iterator it) { alex_.erase(it); }
-
-  // Removes all elements
-  void clear() { alex_.clear(); }
-
-  /*** Stats ***/
-
- public:
-  // Number of elements
-  size_t size() const { return alex_.size(); }
-
-  // True if there are no elements
-  bool empty() const { return alex_.empty(); }
-
-  // This is just a function required by the STL standard. ALEX can hold more
-  // items.
-  size_t max_size() const { return alex_.max_size(); }
-
-  // Return a const reference to the current statistics
-  const struct alex_impl::Stats& get_stats() const { return alex_.stats_; }
-};
-}
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Implements the STL multimap. It can be used as a near drop-in
+ * replacement for std::multimap, with a few important differences:
+ * 1) The iterators are ForwardIterators instead of BidirectionalIterators.
+ * 2) Keys and payloads are stored separately, so dereferencing the iterator
+ *  does not return a reference.
+ *
+ * Each distinct key is stored once, with the run of its payloads in insertion
+ * order. The index holds one slot per distinct key, so its models are trained
+ * on distinct keys only, and keys with many duplicates neither crowd their
+ * data nodes nor skew the models. The first payload of a run is stored in the
+ * slot, and the other payloads in a list out of line. Inserting a duplicate
+ * appends to the list of its key, and count() and equal_range() find the run
+ * with a single lookup, however long it is.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "alex.h"
+
+namespace alex {
+
+template <class T, class P, class Compare = AlexCompare,
+          class Alloc = std::allocator<std::pair<T, P>>>
+class AlexMultimap {
+  static_assert(std::is_arithmetic<T>::value, "ALEX key type must be numeric.");
+  static_assert(std::is_same<Compare,AlexCompare>::value, "Must use AlexCompare.");
+
+ public:
+  // Value type, returned by dereferencing an iterator
+  typedef std::pair<T, P> V;
+
+ private:
+  typedef std::vector<P, typename Alloc::template rebind<P>::other>
+      payload_list_type;
+  typedef typename Alloc::template rebind<payload_list_type>::other
+      payload_list_alloc_type;
+
+  // Payloads of one distinct key. The slot of the key only holds a pointer
+  // to the other payloads, so the data nodes copy runs cheaply when they move
+  // slots. The lists are owned by the multimap.
+  struct PayloadRun {
+    P first = P();
+    payload_list_type* rest = nullptr;  // null if there is a single payload
+
+    PayloadRun() = default;
+
+    explicit PayloadRun(const P& payload) : first(payload) {}
+
+    size_t size() const { return rest == nullptr ? 1 : rest->size() + 1; }
+
+    P& operator[](size_t i) { return i == 0 ? first : (*rest)[i - 1]; }
+
+    const P& operator[](size_t i) const {
+      return i == 0 ? first : (*rest)[i - 1];
+    }
+  };
+
+ public:
+  // ALEX class aliases
+  typedef AlexMultimap<T, P, Compare, Alloc> self_type;
+  typedef Alex<T, PayloadRun, Compare,
+               typename Alloc::template rebind<std::pair<T, PayloadRun>>::other,
+               false>
+      alex_impl;
+
+  // Iterates over the payloads of each run in insertion order, or in reverse
+  // order for reverse iterators
+  template <class LeafIterator, class Payload, bool reverse>
+  class RunIterator {
+   public:
+    RunIterator() {}
+
+    RunIterator(const LeafIterator& it, size_t idx) : it_(it), idx_(idx) {}
+
+    // Converts iterators to const iterators
+    template <class OtherIterator, class OtherPayload>
+    RunIterator(const RunIterator<OtherIterator, OtherPayload, reverse>& other)
+        : it_(other.it_), idx_(other.idx_) {}
+
+    RunIterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    RunIterator operator++(int) {
+      RunIterator tmp = *this;
+      advance();
+      return tmp;
+    }
+
+    V operator*() const { return V(key(), payload()); }
+
+    const T& key() const { return it_.key(); }
+
+    Payload& payload() const { return it_.payload()[idx_]; }
+
+    bool is_end() const { return it_.is_end(); }
+
+    bool operator==(const RunIterator& rhs) const {
+      return it_ == rhs.it_ && idx_ == rhs.idx_;
+    }
+
+    bool operator!=(const RunIterator& rhs) const { return !(*this == rhs); }
+
+   private:
+    template <class, class, bool>
+    friend class RunIterator;
+    friend class AlexMultimap;
+
+    // Iterator to the last payload of the run of it
+    static RunIterator last_of_run(const LeafIterator& it) {
+      return RunIterator(it, it.is_end() ? 0 : it.payload().size() - 1);
+    }
+
+    // Iterator to the first payload of the next key
+    void next_run() {
+      ++it_;
+      idx_ = 0;
+    }
+
+    void advance() {
+      if (reverse) {
+        if (idx_ > 0) {
+          idx_--;
+        } else {
+          ++it_;
+          *this = last_of_run(it_);
+        }
+      } else if (++idx_ == it_.payload().size()) {
+        next_run();
+      }
+    }
+
+    LeafIterator it_;
+    size_t idx_ = 0;  // position in the run of it_
+  };
+
+  typedef RunIterator<typename alex_impl::Iterator, P, false> iterator;
+  typedef RunIterator<typename alex_impl::ConstIterator, const P, false>
+      const_iterator;
+  typedef RunIterator<typename alex_impl::ReverseIterator, P, true>
+      reverse_iterator;
+  typedef RunIterator<typename alex_impl::ConstReverseIterator, const P, true>
+      const_reverse_iterator;
+
+ private:
+  alex_impl alex_;
+  Alloc allocator_;
+  size_t num_values_ = 0;  // key-payload pairs, including duplicates
+
+  /*** Constructors and setters ***/
+
+ public:
+  AlexMultimap() : alex_() {}
+
+  AlexMultimap(const Compare& comp, const Alloc& alloc = Alloc())
+      : alex_(comp, alloc), allocator_(alloc) {}
+
+  AlexMultimap(const Alloc& alloc) : alex_(alloc), allocator_(alloc) {}
+
+  ~AlexMultimap() { free_payload_lists(); }
+
+  // Initializes with range [first, last). The range does not need to be
+  // sorted. This creates a temporary copy of the data. If possible, we
+  // recommend directly using bulk_load() instead.
+  template <class InputIterator>
+  explicit AlexMultimap(InputIterator first, InputIterator last,
+                        const Compare& comp, const Alloc& alloc = Alloc())
+      : alex_(comp, alloc), allocator_(alloc) {
+    insert(first, last);
+  }
+
+  // Initializes with range [first, last). The range does not need to be
+  // sorted. This creates a temporary copy of the data. If possible, we
+  // recommend directly using bulk_load() instead.
+  template <class InputIterator>
+  explicit AlexMultimap(InputIterator first, InputIterator last,
+                        const Alloc& alloc = Alloc())
+      : alex_(alloc), allocator_(alloc) {
+    insert(first, last);
+  }
+
+  explicit AlexMultimap(const self_type& other)
+      : alex_(other.alex_),
+        allocator_(other.allocator_),
+        num_values_(other.num_values_) {
+    copy_payload_lists();
+  }
+
+  AlexMultimap& operator=(const self_type& other) {
+    if (this != &other) {
+      free_payload_lists();
+      alex_ = other.alex_;
+      allocator_ = other.allocator_;
+      num_values_ = other.num_values_;
+      copy_payload_lists();
+    }
+    return *this;
+  }
+
+  void swap(self_type& other) {
+    alex_.swap(other.alex_);
+    std::swap(allocator_, other.allocator_);
+    std::swap(num_values_, other.num_values_);
+  }
+
+ public:
+  // When bulk loading, Alex can use provided knowledge of the expected fraction
+  // of operations that will be inserts
+  // For simplicity, operations are either point lookups ("reads") or inserts
+  // ("writes)
+  // i.e., 0 means we expect a read-only workload, 1 means write-only
+  // This is only useful if you set it before bulk loading
+  void set_expected_insert_frac(double expected_insert_frac) {
+    alex_.set_expected_insert_frac(expected_insert_frac);
+  }
+
+  // Maximum node size, in bytes.
+  // Higher values result in better average throughput, but worse tail/max
+  // insert latency.
+  void set_max_node_size(long long max_node_size) {
+    alex_.set_max_node_size(max_node_size);
+  }
+
+  // Bulk load faster by using sampling to train models.
+  // This is only useful if you set it before bulk loading.
+  void set_approximate_model_computation(bool approximate_model_computation) {
+    alex_.set_approximate_model_computation(approximate_model_computation);
+  }
+
+  // Bulk load faster by using sampling to compute cost.
+  // This is only useful if you set it before bulk loading.
+  void set_approximate_cost_computation(bool approximate_cost_computation) {
+    alex_.set_approximate_cost_computation(approximate_cost_computation);
+  }
+
+  /*** Allocators and comparators ***/
+
+ public:
+  Alloc get_allocator() const { return allocator_; }
+
+  Compare key_comp() const { return alex_.key_comp(); }
+
+  /*** Bulk loading ***/
+
+ public:
+  // values should be the sorted array of key-payload pairs.
+  // The number of elements should be num_keys.
+  // The index must be empty when calling this method.
+  void bulk_load(const V values[], long long num_keys) {
+    std::vector<std::pair<T, PayloadRun>> runs = make_runs(values, num_keys);
+    alex_.bulk_load(runs.data(), static_cast<long long>(runs.size()));
+    num_values_ = static_cast<size_t>(num_keys);
+  }
+
+  /*** Lookup ***/
+
+ public:
+  // Looks for an exact match of the key
+  // If the key does not exist, returns an end iterator
+  // If there are multiple keys with the same value, returns an iterator to the
+  // right-most key
+  // If you instead want an iterator to the left-most key with the input value,
+  // use lower_bound()
+  iterator find(const T& key) {
+    return iterator::last_of_run(alex_.find(key));
+  }
+
+  const_iterator find(const T& key) const {
+    return const_iterator::last_of_run(alex_.find(key));
+  }
+
+  size_t count(const T& key) const {
+    const PayloadRun* run = alex_.get_payload(key);
+    return run == nullptr ? 0 : run->size();
+  }
+
+  // Returns an iterator to the first key no less than the input value
+  iterator lower_bound(const T& key) {
+    return iterator(alex_.lower_bound(key), 0);
+  }
+
+  const_iterator lower_bound(const T& key) const {
+    return const_iterator(alex_.lower_bound(key), 0);
+  }
+
+  // Returns an iterator to the first key greater than the input value
+  iterator upper_bound(const T& key) {
+    return iterator(alex_.upper_bound(key), 0);
+  }
+
+  const_iterator upper_bound(const T& key) const {
+    return const_iterator(alex_.upper_bound(key), 0);
+  }
+
+  // The run of key is found with one lookup
+  std::pair<iterator, iterator> equal_range(const T& key) {
+    return equal_range_of(lower_bound(key), key);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(const T& key) const {
+    return equal_range_of(lower_bound(key), key);
+  }
+
+  iterator begin() { return iterator(alex_.begin(), 0); }
+
+  iterator end() { return iterator(alex_.end(), 0); }
+
+  const_iterator cbegin() const { return const_iterator(alex_.cbegin(), 0); }
+
+  const_iterator cend() const { return const_iterator(alex_.cend(), 0); }
+
+  reverse_iterator rbegin() {
+    return reverse_iterator::last_of_run(alex_.rbegin());
+  }
+
+  reverse_iterator rend() { return reverse_iterator(alex_.rend(), 0); }
+
+  const_reverse_iterator crbegin() const {
+    return const_reverse_iterator::last_of_run(alex_.crbegin());
+  }
+
+  const_reverse_iterator crend() const {
+    return const_reverse_iterator(alex_.crend(), 0);
+  }
+
+  /*** Insert ***/
+
+ public:
+  iterator insert(const V& value) { return insert(value.first, value.second); }
+
+  // Payloads of keys that already exist are appended to their runs, and the
+  // new keys are inserted with Alex::insert_sorted().
+  template <class InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    std::vector<V> values;
+    for (auto it = first; it != last; ++it) {
+      values.push_back(*it);
+    }
+    Compare key_less = key_comp();
+    auto value_less = [&key_less](const V& a, const V& b) {
+      return key_less(a.first, b.first);
+    };
+    if (!std::is_sorted(values.begin(), values.end(), value_less)) {
+      // Stable sort so that equal keys keep their order in the range
+      std::stable_sort(values.begin(), values.end(), value_less);
+    }
+    std::vector<std::pair<T, PayloadRun>> new_runs;
+    for (size_t i = 0; i < values.size();) {
+      const T& key = values[i].first;
+      PayloadRun* run = alex_.get_payload(key);
+      if (run == nullptr) {
+        new_runs.emplace_back(key, PayloadRun(values[i].second));
+        run = &new_runs.back().second;
+        i++;
+      }
+      for (; i < values.size() && !key_less(key, values[i].first); i++) {
+        append(*run, values[i].second);
+      }
+    }
+    alex_.insert_sorted(new_runs.data(),
+                        static_cast<long long>(new_runs.size()));
+    num_values_ += values.size();
+  }
+
+  // This will NOT do an update of an existing key.
+  // To perform an update or read-modify-write, do a lookup and modify the
+  // payload's value.
+  // Returns an iterator to the inserted payload, which is the last of its run.
+  iterator insert(const T& key, const P& payload) {
+    auto ret = alex_.upsert(key, PayloadRun(payload),
+                            [this](PayloadRun& run, const PayloadRun& other) {
+                              append(run, other.first);
+                            });
+    num_values_++;
+    if (ret.first.is_end()) {
+      // The key went into the buffer of a deferred split
+      return find(key);
+    }
+    return iterator::last_of_run(ret.first);
+  }
+
+  /*** Delete ***/
+
+ public:
+  // Erases all keys with a certain key value
+  int erase(const T& key) {
+    PayloadRun* run = alex_.get_payload(key);
+    if (run == nullptr) {
+      return 0;
+    }
+    int num_erased = static_cast<int>(run->size());
+    free_payload_list(*run);
+    alex_.erase(key);
+    num_values_ -= num_erased;
+    return num_erased;
+  }
+
+  // Erases element pointed to by iterator
+  void erase(iterator it) {
+    if (it.is_end()) {
+      return;
+    }
+    PayloadRun& run = it.it_.payload();
+    if (run.rest == nullptr) {
+      alex_.erase(it.it_);
+    } else {
+      if (it.idx_ == 0) {
+        run.first = std::move(run.rest->front());
+        run.rest->erase(run.rest->begin());
+      } else {
+        run.rest->erase(run.rest->begin() + (it.idx_ - 1));
+      }
+      if (run.rest->empty()) {
+        free_payload_list(run);
+      }
+    }
+    num_values_--;
+  }
+
+  // Removes all elements
+  void clear() {
+    free_payload_lists();
+    alex_.clear();
+    num_values_ = 0;
+  }
+
+  /*** Stats ***/
+
+ public:
+  // Number of elements
+  size_t size() const { return num_values_; }
+
+  // True if there are no elements
+  bool empty() const { return num_values_ == 0; }
+
+  // This is just a function required by the STL standard. ALEX can hold more
+  // items.
+  size_t max_size() const { return alex_.max_size(); }
+
+  // Return a const reference to the current statistics. The index only holds
+  // distinct keys, so num_keys counts distinct keys, while size() counts
+  // key-payload pairs.
+  const struct alex_impl::Stats& get_stats() const { return alex_.stats_; }
+
+  /*** Payload runs ***/
+
+ private:
+  // One run per distinct key of the sorted values
+  std::vector<std::pair<T, PayloadRun>> make_runs(const V values[],
+                                                  long long num_keys) {
+    Compare key_less = key_comp();
+    std::vector<std::pair<T, PayloadRun>> runs;
+    for (long long i = 0; i < num_keys; i++) {
+      if (runs.empty() || key_less(runs.back().first, values[i].first)) {
+        runs.emplace_back(values[i].first, PayloadRun(values[i].second));
+      } else {
+        append(runs.back().second, values[i].second);
+      }
+    }
+    return runs;
+  }
+
+  template <class Iterator>
+  std::pair<Iterator, Iterator> equal_range_of(Iterator first,
+                                               const T& key) const {
+    Iterator last = first;
+    if (!last.is_end() && !key_comp()(key, last.key())) {
+      last.next_run();
+    }
+    return std::pair<Iterator, Iterator>(first, last);
+  }
+
+  void append(PayloadRun& run, const P& payload) {
+    if (run.rest == nullptr) {
+      payload_list_alloc_type list_allocator(allocator_);
+      payload_list_type* list = list_allocator.allocate(1);
+      new (list) payload_list_type(allocator_);
+      run.rest = list;
+    }
+    run.rest->push_back(payload);
+  }
+
+  void free_payload_list(PayloadRun& run) {
+    if (run.rest == nullptr) {
+      return;
+    }
+    payload_list_alloc_type list_allocator(allocator_);
+    run.rest->~payload_list_type();
+    list_allocator.deallocate(run.rest, 1);
+    run.rest = nullptr;
+  }
+
+  void free_payload_lists() {
+    for (auto it = alex_.begin(); !it.is_end(); ++it) {
+      free_payload_list(it.payload());
+    }
+  }
+
+  // Gives each run its own copy of the list that it shares with the index
+  // that this was copied from
+  void copy_payload_lists() {
+    for (auto it = alex_.begin(); !it.is_end(); ++it) {
+      PayloadRun& run = it.payload();
+      if (run.rest != nullptr) {
+        const payload_list_type* other_list = run.rest;
+        run.rest = nullptr;
+        for (const P& payload : *other_list) {
+          append(run, payload);
+        }
+      }
+    }
+  }
+};
+}
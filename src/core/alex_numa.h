@@ -0,0 +1,250 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * NUMA topology, thread pinning and memory placement for ALEX.
+ *
+ * On machines with several NUMA nodes, e.g. one per socket, memory is
+ * attached to one node and is slower to reach from the CPUs of the other
+ * nodes. ALEX places memory on nodes in two ways:
+ * - ArenaOptions::numa_node puts all arenas of an ArenaAllocator on one node.
+ *   Giving each tenant of a PartitionedAlex, or each partition of the key
+ *   space, an allocator on the node of the threads that use it keeps its
+ *   nodes and slots in local memory.
+ * - Alex::set_numa_replication() keeps one copy of the frozen model nodes per
+ *   node, and lookups traverse the copy of the node they run on.
+ * Threads find their node with current_numa_node(). Threads pinned with
+ * pin_thread_to_numa_node() know their node without asking the OS.
+ *
+ * The topology is read from /sys on Linux. On other platforms, or if the
+ * kernel does not report a topology, there is a single node, placement has
+ * no effect and pinning fails.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "alex_base.h"
+
+#if defined(__linux__) && defined(SYS_mbind)
+#define ALEX_HAS_NUMA 1
+#else
+#define ALEX_HAS_NUMA 0
+#endif
+
+namespace alex {
+
+class NumaTopology {
+ public:
+  // The topology of this machine, read on first use
+  static const NumaTopology& get() {
+    static const NumaTopology topology;
+    return topology;
+  }
+
+  // Node ids are in [0, num_nodes()). Nodes may have no CPUs.
+  int num_nodes() const { return static_cast<int>(node_cpus_.size()); }
+
+  const std::vector<int>& cpus(int node) const { return node_cpus_[node]; }
+
+  // Node of the CPU, or 0 if the CPU is unknown
+  int node_of_cpu(int cpu) const {
+    return cpu >= 0 && cpu < static_cast<int>(cpu_nodes_.size())
+               ? cpu_nodes_[cpu]
+               : 0;
+  }
+
+ private:
+  NumaTopology() {
+#ifdef __linux__
+    const std::string node_dir = "/sys/devices/system/node/";
+    for (int node : read_list(node_dir + "online")) {
+      if (node >= static_cast<int>(node_cpus_.size())) {
+        node_cpus_.resize(node + 1);
+      }
+      node_cpus_[node] =
+          read_list(node_dir + "node" + std::to_string(node) + "/cpulist");
+      for (int cpu : node_cpus_[node]) {
+        if (cpu >= static_cast<int>(cpu_nodes_.size())) {
+          cpu_nodes_.resize(cpu + 1, 0);
+        }
+        cpu_nodes_[cpu] = node;
+      }
+    }
+#endif
+    if (node_cpus_.empty()) {
+      node_cpus_.resize(1);
+      int num_cpus = std::max<int>(std::thread::hardware_concurrency(), 1);
+      for (int cpu = 0; cpu < num_cpus; cpu++) {
+        node_cpus_[0].push_back(cpu);
+      }
+    }
+  }
+
+  // Reads a list such as "0-3,8,10-11" from the file, or nothing if it does
+  // not exist
+  static std::vector<int> read_list(const std::string& path) {
+    std::vector<int> list;
+    std::ifstream in(path);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+      size_t dash = range.find('-');
+      try {
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos
+                       ? first
+                       : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; i++) {
+          list.push_back(i);
+        }
+      } catch (const std::exception&) {
+        return std::vector<int>();
+      }
+    }
+    return list;
+  }
+
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<int> cpu_nodes_;
+};
+
+// Node that the calling thread was pinned to by pin_thread_to_numa_node(), or
+// -1
+inline int& pinned_numa_node() {
+  thread_local int node = -1;
+  return node;
+}
+
+// Restricts the calling thread to the CPUs of node. Returns false if the
+// thread could not be pinned.
+inline bool pin_thread_to_numa_node(int node) {
+#ifdef __linux__
+  const NumaTopology& topology = NumaTopology::get();
+  if (node < 0 || node >= topology.num_nodes() ||
+      topology.cpus(node).empty()) {
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : topology.cpus(node)) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    return false;
+  }
+  pinned_numa_node() = node;
+  return true;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+// Node of the CPU that the calling thread runs on. Threads that are not
+// pinned can move to another node right after this returns.
+inline int current_numa_node() {
+  int node = pinned_numa_node();
+  if (node >= 0) {
+    return node;
+  }
+#ifdef __linux__
+  return NumaTopology::get().node_of_cpu(sched_getcpu());
+#else
+  return 0;
+#endif
+}
+
+// Has the OS back the pages of [p, p + num_bytes) with memory of node when
+// they are first touched, or of another node if node runs out of memory. p
+// must be aligned to the page size. Returns false if the range was not bound.
+inline bool bind_to_numa_node(void* p, size_t num_bytes, int node) {
+#if ALEX_HAS_NUMA
+  const int kMpolPreferred = 1;
+  const int kMaxNodes = 1024;
+  const int kBitsPerWord = 8 * sizeof(unsigned long);
+  if (node < 0 || node >= kMaxNodes ||
+      NumaTopology::get().num_nodes() <= 1) {
+    return false;
+  }
+  unsigned long node_mask[kMaxNodes / kBitsPerWord] = {};
+  node_mask[node / kBitsPerWord] = 1UL << (node % kBitsPerWord);
+  return syscall(SYS_mbind, p, num_bytes, kMpolPreferred, node_mask,
+                 kMaxNodes + 1, 0) == 0;
+#else
+  (void)p;
+  (void)num_bytes;
+  (void)node;
+  return false;
+#endif
+}
+
+// Memory on one NUMA node, for data that is read by the threads of that node
+class NumaBuffer {
+ public:
+  NumaBuffer() = default;
+
+  NumaBuffer(size_t num_bytes, int node) : size_(num_bytes) {
+    if (num_bytes == 0) {
+      return;
+    }
+#ifdef __linux__
+    data_ = mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      throw std::bad_alloc();
+    }
+    bind_to_numa_node(data_, num_bytes, node);
+#else
+    (void)node;
+    data_ = ::operator new(num_bytes);
+#endif
+  }
+
+  NumaBuffer(const NumaBuffer& other) = delete;
+  NumaBuffer& operator=(const NumaBuffer& other) = delete;
+
+  NumaBuffer(NumaBuffer&& other) noexcept { swap(other); }
+
+  NumaBuffer& operator=(NumaBuffer&& other) noexcept {
+    NumaBuffer(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  ~NumaBuffer() {
+    if (data_ == nullptr) {
+      return;
+    }
+#ifdef __linux__
+    munmap(data_, size_);
+#else
+    ::operator delete(data_);
+#endif
+  }
+
+  void swap(NumaBuffer& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+  }
+
+  char* data() const { return static_cast<char*>(data_); }
+
+  size_t size() const { return size_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+}
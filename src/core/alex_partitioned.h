@@ -0,0 +1,407 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * A multi-tenant index that keeps a separate ALEX per tenant.
+ *
+ * Keys of different tenants usually follow different distributions, and
+ * mixing them in one ALEX makes its models less accurate for every tenant.
+ * PartitionedAlex routes every operation by tenant id to the tenant's own
+ * partition, so each partition is fitted to a single distribution.
+ *
+ * PartitionedAlex is thread-safe. Each partition has its own latch, so
+ * operations on different tenants run in parallel and inserts of one tenant
+ * never wait for, or slow down, lookups of another tenant. Operations on the
+ * same tenant are serialized. Range queries across tenants read each
+ * partition under its own latch, so they see each tenant at a single point in
+ * time, but not all tenants at the same point in time.
+ *
+ * Every partition gets a copy of the allocator. Copies of an ArenaAllocator
+ * share arenas, so to give each tenant its own arenas, create tenants with
+ * add_tenant() and a separate allocator.
+ *
+ * User-facing API of PartitionedAlex:
+ * - PartitionedAlex()
+ * - bool add_tenant(Tenant tenant)
+ * - bool drop_tenant(Tenant tenant)
+ * - bool bulk_load(Tenant tenant, V values[], long long num_keys)
+ * - void bulk_load_all(TenantValues batches[], int num_batches, int threads)
+ * - bool insert(Tenant tenant, T key, P payload)
+ * - long long insert_all(TenantValues batches[], int num_batches, int threads)
+ * - bool get_payload(Tenant tenant, T key, P* payload)  // copies the payload
+ * - int erase(Tenant tenant, T key)
+ * - size_t range_query(T low, T high, std::vector<Entry>* results)
+ * - size_t size(Tenant tenant)
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "alex.h"
+#include "alex_task_pool.h"
+
+namespace alex {
+
+template <class Tenant, class T, class P, class Compare = AlexCompare,
+          class Alloc = std::allocator<std::pair<T, P>>,
+          bool allow_duplicates = true>
+class PartitionedAlex {
+ public:
+  // Value type
+  typedef std::pair<T, P> V;
+
+  // ALEX class aliases
+  typedef PartitionedAlex<Tenant, T, P, Compare, Alloc, allow_duplicates>
+      self_type;
+  typedef Alex<T, P, Compare, Alloc, allow_duplicates> partition_type;
+
+  // The sorted key-payload pairs of one tenant, for loading or inserting
+  // several tenants at once
+  struct TenantValues {
+    Tenant tenant;
+    const V* values;
+    long long num_keys;
+  };
+
+  // One key returned by a range query
+  struct Entry {
+    Tenant tenant;
+    T key;
+    P payload;
+  };
+
+ private:
+  struct Partition {
+    Partition(const Tenant& t, const Compare& comp, const Alloc& alloc)
+        : tenant(t), index(comp, alloc) {}
+
+    const Tenant tenant;
+    std::mutex mutex;
+    partition_type index;
+  };
+
+  // Operations hold a reference to their partition, so a dropped partition is
+  // freed once the last operation on it finishes
+  typedef std::shared_ptr<Partition> PartitionRef;
+
+  Compare key_less_;
+  Alloc allocator_;
+  std::unordered_map<Tenant, PartitionRef> partitions_;
+  // Protects partitions_, not the partitions themselves
+  mutable std::shared_mutex partitions_mutex_;
+
+  /*** Constructors ***/
+
+ public:
+  PartitionedAlex() {}
+
+  PartitionedAlex(const Compare& comp, const Alloc& alloc = Alloc())
+      : key_less_(comp), allocator_(alloc) {}
+
+  PartitionedAlex(const Alloc& alloc) : allocator_(alloc) {}
+
+  PartitionedAlex(const self_type& other) = delete;
+  PartitionedAlex& operator=(const self_type& other) = delete;
+
+  /*** Tenants ***/
+
+ public:
+  // Creates an empty partition for the tenant.
+  // Returns false if the tenant already exists.
+  bool add_tenant(const Tenant& tenant) {
+    return add_tenant(tenant, allocator_);
+  }
+
+  // Same as above, but the partition allocates its nodes with alloc
+  bool add_tenant(const Tenant& tenant, const Alloc& alloc) {
+    auto partition = std::make_shared<Partition>(tenant, key_less_, alloc);
+    std::unique_lock<std::shared_mutex> lock(partitions_mutex_);
+    return partitions_.emplace(tenant, std::move(partition)).second;
+  }
+
+  // Removes the tenant and all of its keys.
+  // The tenant is unlinked in constant time; its nodes are freed after the
+  // latch is released, or by the last running operation on the tenant.
+  // Returns false if the tenant does not exist.
+  bool drop_tenant(const Tenant& tenant) {
+    PartitionRef partition;
+    {
+      std::unique_lock<std::shared_mutex> lock(partitions_mutex_);
+      auto it = partitions_.find(tenant);
+      if (it == partitions_.end()) {
+        return false;
+      }
+      partition = std::move(it->second);
+      partitions_.erase(it);
+    }
+    return true;
+  }
+
+  bool has_tenant(const Tenant& tenant) const {
+    return get_partition(tenant) != nullptr;
+  }
+
+  size_t num_tenants() const {
+    std::shared_lock<std::shared_mutex> lock(partitions_mutex_);
+    return partitions_.size();
+  }
+
+  std::vector<Tenant> tenants() const {
+    std::vector<Tenant> result;
+    for (const PartitionRef& partition : get_all_partitions()) {
+      result.push_back(partition->tenant);
+    }
+    return result;
+  }
+
+  // Runs f(partition) with exclusive access to the tenant's partition, e.g. to
+  // change its parameters or iterate over it.
+  // Returns false if the tenant does not exist.
+  template <class F>
+  bool with_tenant(const Tenant& tenant, F f) {
+    PartitionRef partition = get_partition(tenant);
+    if (!partition) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    f(partition->index);
+    return true;
+  }
+
+  /*** Bulk loading ***/
+
+ public:
+  // values should be the sorted array of the tenant's key-payload pairs.
+  // Creates the tenant if it does not exist.
+  // Returns false if the tenant's partition is not empty.
+  bool bulk_load(const Tenant& tenant, const V values[],
+                 long long num_keys) {
+    PartitionRef partition = get_or_add_partition(tenant);
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    if (!partition->index.empty()) {
+      return false;
+    }
+    partition->index.bulk_load(values, num_keys);
+    return true;
+  }
+
+  // Bulk loads several tenants, with up to num_threads tenants at a time.
+  // Batches of tenants whose partitions are not empty are skipped.
+  void bulk_load_all(const TenantValues batches[], int num_batches,
+                     int num_threads) {
+    for_each_batch(batches, num_batches, num_threads,
+                   [this](const TenantValues& batch) {
+                     bulk_load(batch.tenant, batch.values, batch.num_keys);
+                   });
+  }
+
+  /*** Insert ***/
+
+ public:
+  // Creates the tenant if it does not exist.
+  // Returns whether the insert happened. Insert does not happen if duplicates
+  // are not allowed and duplicate is found.
+  bool insert(const Tenant& tenant, const T& key, const P& payload) {
+    PartitionRef partition = get_or_add_partition(tenant);
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    return partition->index.insert(key, payload).second;
+  }
+
+  // Inserts the values of several tenants, with up to num_threads tenants at a
+  // time. Each batch is inserted under a single latch of its partition.
+  // Returns the number of inserted keys.
+  long long insert_all(const TenantValues batches[], int num_batches,
+                       int num_threads) {
+    std::atomic<long long> num_inserted{0};
+    for_each_batch(batches, num_batches, num_threads,
+                   [this, &num_inserted](const TenantValues& batch) {
+                     PartitionRef partition =
+                         get_or_add_partition(batch.tenant);
+                     std::lock_guard<std::mutex> lock(partition->mutex);
+                     long long n = 0;
+                     for (long long i = 0; i < batch.num_keys; i++) {
+                       n += partition->index
+                                .insert(batch.values[i].first,
+                                        batch.values[i].second)
+                                .second;
+                     }
+                     num_inserted.fetch_add(n, std::memory_order_relaxed);
+                   });
+    return num_inserted.load(std::memory_order_relaxed);
+  }
+
+  /*** Lookup ***/
+
+ public:
+  // Copies the payload of an exact match of the key into payload.
+  // Returns whether the key was found.
+  bool get_payload(const Tenant& tenant, const T& key, P* payload) const {
+    PartitionRef partition = get_partition(tenant);
+    if (!partition) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    P* found = partition->index.get_payload(key);
+    if (found == nullptr) {
+      return false;
+    }
+    *payload = *found;
+    return true;
+  }
+
+  // Appends the keys in [low, high) of all tenants to results, sorted by key.
+  // Keys that are equal are ordered by tenant in an unspecified order.
+  // Returns the number of appended keys.
+  size_t range_query(const T& low, const T& high,
+                     std::vector<Entry>* results) const {
+    return range_query(low, high, get_all_partitions(), results);
+  }
+
+  // Same as above, but only for the given tenants. Tenants that do not exist
+  // are ignored.
+  size_t range_query(const T& low, const T& high,
+                     const std::vector<Tenant>& tenants,
+                     std::vector<Entry>* results) const {
+    std::vector<PartitionRef> partitions;
+    for (const Tenant& tenant : tenants) {
+      PartitionRef partition = get_partition(tenant);
+      if (partition) {
+        partitions.push_back(std::move(partition));
+      }
+    }
+    return range_query(low, high, partitions, results);
+  }
+
+  /*** Delete ***/
+
+ public:
+  // Erases all keys of the tenant with a certain key value.
+  // Returns the number of keys erased.
+  int erase(const Tenant& tenant, const T& key) {
+    PartitionRef partition = get_partition(tenant);
+    if (!partition) {
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    return partition->index.erase(key);
+  }
+
+  /*** Stats ***/
+
+ public:
+  // Number of elements of the tenant
+  size_t size(const Tenant& tenant) const {
+    PartitionRef partition = get_partition(tenant);
+    if (!partition) {
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(partition->mutex);
+    return partition->index.size();
+  }
+
+  // Number of elements of all tenants
+  size_t size() const {
+    size_t num_keys = 0;
+    for (const PartitionRef& partition : get_all_partitions()) {
+      std::lock_guard<std::mutex> lock(partition->mutex);
+      num_keys += partition->index.size();
+    }
+    return num_keys;
+  }
+
+  bool empty() const { return (size() == 0); }
+
+  /*** Helpers ***/
+
+ private:
+  PartitionRef get_partition(const Tenant& tenant) const {
+    std::shared_lock<std::shared_mutex> lock(partitions_mutex_);
+    auto it = partitions_.find(tenant);
+    return it == partitions_.end() ? nullptr : it->second;
+  }
+
+  PartitionRef get_or_add_partition(const Tenant& tenant) {
+    PartitionRef partition = get_partition(tenant);
+    if (partition) {
+      return partition;
+    }
+    auto new_partition =
+        std::make_shared<Partition>(tenant, key_less_, allocator_);
+    std::unique_lock<std::shared_mutex> lock(partitions_mutex_);
+    // Another thread may have added the tenant in the meantime
+    return partitions_.emplace(tenant, std::move(new_partition)).first->second;
+  }
+
+  std::vector<PartitionRef> get_all_partitions() const {
+    std::shared_lock<std::shared_mutex> lock(partitions_mutex_);
+    std::vector<PartitionRef> partitions;
+    partitions.reserve(partitions_.size());
+    for (const auto& kv : partitions_) {
+      partitions.push_back(kv.second);
+    }
+    return partitions;
+  }
+
+  // Calls f(batch) for every batch, on up to num_threads threads
+  template <class F>
+  static void for_each_batch(const TenantValues batches[], int num_batches,
+                             int num_threads, const F& f) {
+    if (num_threads <= 1 || num_batches <= 1) {
+      for (int i = 0; i < num_batches; i++) {
+        f(batches[i]);
+      }
+      return;
+    }
+    TaskPool pool(std::min(num_threads, num_batches));
+    pool.parallel_for(0, num_batches, 1, [&](int i) { f(batches[i]); });
+  }
+
+  // Copies the keys in [low, high) of each partition, then merges the copies
+  // by key
+  size_t range_query(const T& low, const T& high,
+                     const std::vector<PartitionRef>& partitions,
+                     std::vector<Entry>* results) const {
+    std::vector<std::vector<Entry>> partition_results(partitions.size());
+    for (size_t i = 0; i < partitions.size(); i++) {
+      Partition& partition = *partitions[i];
+      std::lock_guard<std::mutex> lock(partition.mutex);
+      for (auto it = partition.index.lower_bound(low);
+           !it.is_end() && key_less_(it.key(), high); ++it) {
+        partition_results[i].push_back(
+            {partition.tenant, it.key(), it.payload()});
+      }
+    }
+
+    // Position in partition_results
+    typedef std::pair<size_t, size_t> Cursor;
+    auto cursor_greater = [&](const Cursor& a, const Cursor& b) {
+      return key_less_(partition_results[b.first][b.second].key,
+                       partition_results[a.first][a.second].key);
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(cursor_greater)>
+        cursors(cursor_greater);
+    size_t num_results = 0;
+    for (size_t i = 0; i < partition_results.size(); i++) {
+      num_results += partition_results[i].size();
+      if (!partition_results[i].empty()) {
+        cursors.push({i, 0});
+      }
+    }
+    results->reserve(results->size() + num_results);
+    while (!cursors.empty()) {
+      Cursor cursor = cursors.top();
+      cursors.pop();
+      results->push_back(partition_results[cursor.first][cursor.second]);
+      if (++cursor.second < partition_results[cursor.first].size()) {
+        cursors.push(cursor);
+      }
+    }
+    return num_results;
+  }
+};
+}
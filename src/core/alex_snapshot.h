@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Read-only point-in-time views of an ALEX index (see Alex::snapshot()).
+ *
+ * A snapshot shares the data nodes of the index instead of copying them. It
+ * holds the data nodes in key order, with the first key of each, and finds
+ * the data node of a key by binary search over these first keys, so it does
+ * not use the model nodes of the index, which keep changing.
+ *
+ * Data nodes are copied on write: before the index changes a data node that a
+ * live snapshot shares, it replaces the data node by a copy and changes the
+ * copy. The index also keeps data nodes that it no longer uses while a
+ * snapshot may still read them. This is epoch-based reclamation, with the
+ * version of each snapshot as its epoch:
+ * - Each snapshot has a version, and registers it in the SnapshotRegistry of
+ *   the index for as long as it lives.
+ * - A data node remembers the version of the last snapshot that shares it,
+ *   and is shared as long as a snapshot of that version or an older one
+ *   lives.
+ * - A data node that the index stops using is retired with the next version.
+ *   It is freed once the oldest live snapshot is at least that version.
+ * Snapshots can be read and destroyed in other threads while the index keeps
+ * changing in its own thread, because the index never writes to a data node
+ * that a live snapshot shares.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "alex_base.h"
+
+namespace alex {
+
+// Versions of the live snapshots of an index. Shared by the index and its
+// snapshots, so that snapshots can be destroyed after the index.
+class SnapshotRegistry {
+ public:
+  static constexpr uint64_t kNoSnapshot = std::numeric_limits<uint64_t>::max();
+
+  void add(uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    versions_.insert(version);
+    oldest_.store(*versions_.begin(), std::memory_order_release);
+  }
+
+  void remove(uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    versions_.erase(versions_.find(version));
+    oldest_.store(versions_.empty() ? kNoSnapshot : *versions_.begin(),
+                  std::memory_order_release);
+  }
+
+  // Version of the oldest live snapshot, or kNoSnapshot if there is none
+  uint64_t oldest() const { return oldest_.load(std::memory_order_acquire); }
+
+ private:
+  std::mutex mutex_;
+  std::multiset<uint64_t> versions_;
+  std::atomic<uint64_t> oldest_{kNoSnapshot};
+};
+
+template <class T, class P, class Leaf>
+class AlexSnapshot {
+ public:
+  class Iterator {
+   public:
+    Iterator() = default;
+
+    Iterator(const AlexSnapshot* snapshot, size_t leaf_idx, int pos)
+        : snapshot_(snapshot), leaf_idx_(leaf_idx), pos_(pos) {}
+
+    const T& key() const { return leaf()->get_key(pos_); }
+
+    const P& payload() const { return leaf()->get_payload(pos_); }
+
+    void operator++(int) {
+      pos_ = leaf()->get_next_filled_position(pos_, true);
+      if (pos_ == leaf()->data_capacity_) {
+        leaf_idx_++;
+        pos_ = leaf_idx_ < snapshot_->leaves_.size()
+                   ? snapshot_->leaves_[leaf_idx_]->first_pos()
+                   : 0;
+      }
+    }
+
+    Iterator& operator++() {
+      (*this)++;
+      return *this;
+    }
+
+    bool is_end() const {
+      return snapshot_ == nullptr || leaf_idx_ == snapshot_->leaves_.size();
+    }
+
+    bool operator==(const Iterator& rhs) const {
+      if (is_end() || rhs.is_end()) {
+        return is_end() == rhs.is_end();
+      }
+      return leaf_idx_ == rhs.leaf_idx_ && pos_ == rhs.pos_;
+    }
+
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+
+   private:
+    const Leaf* leaf() const { return snapshot_->leaves_[leaf_idx_]; }
+
+    const AlexSnapshot* snapshot_ = nullptr;
+    size_t leaf_idx_ = 0;
+    int pos_ = 0;
+  };
+
+  // An empty snapshot
+  AlexSnapshot() = default;
+
+  // Made by Alex::snapshot(). leaves are the non-empty data nodes in key
+  // order, and registry must already hold version.
+  AlexSnapshot(std::shared_ptr<SnapshotRegistry> registry, uint64_t version,
+               std::vector<const Leaf*> leaves, size_t num_keys)
+      : registry_(std::move(registry)),
+        version_(version),
+        leaves_(std::move(leaves)),
+        num_keys_(num_keys) {
+    first_keys_.reserve(leaves_.size());
+    for (const Leaf* leaf : leaves_) {
+      first_keys_.push_back(leaf->get_key(leaf->first_pos()));
+    }
+  }
+
+  AlexSnapshot(const AlexSnapshot& other) = delete;
+  AlexSnapshot& operator=(const AlexSnapshot& other) = delete;
+
+  AlexSnapshot(AlexSnapshot&& other) noexcept { swap(other); }
+
+  AlexSnapshot& operator=(AlexSnapshot&& other) noexcept {
+    AlexSnapshot(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  ~AlexSnapshot() {
+    if (registry_) {
+      registry_->remove(version_);
+    }
+  }
+
+  void swap(AlexSnapshot& other) noexcept {
+    std::swap(registry_, other.registry_);
+    std::swap(version_, other.version_);
+    std::swap(leaves_, other.leaves_);
+    std::swap(first_keys_, other.first_keys_);
+    std::swap(num_keys_, other.num_keys_);
+  }
+
+  size_t size() const { return num_keys_; }
+
+  bool empty() const { return num_keys_ == 0; }
+
+  uint64_t version() const { return version_; }
+
+  Iterator begin() const {
+    return leaves_.empty() ? end()
+                           : Iterator(this, 0, leaves_[0]->first_pos());
+  }
+
+  Iterator end() const { return Iterator(this, leaves_.size(), 0); }
+
+  // First key no less than key
+  Iterator lower_bound(const T& key) const {
+    // Keys equal to key may end the data node before the first data node
+    // that starts with key
+    size_t leaf_idx =
+        std::lower_bound(first_keys_.begin(), first_keys_.end(), key) -
+        first_keys_.begin();
+    if (leaf_idx > 0) {
+      leaf_idx--;
+    }
+    for (; leaf_idx < leaves_.size(); leaf_idx++) {
+      const Leaf* leaf = leaves_[leaf_idx];
+      int pos = leaf->exponential_search_lower_bound(
+          leaf->predict_position(key), key, nullptr);
+      if (pos < leaf->data_capacity_) {
+        pos = leaf->get_next_filled_position(pos, false);
+      }
+      if (pos < leaf->data_capacity_) {
+        return Iterator(this, leaf_idx, pos);
+      }
+    }
+    return end();
+  }
+
+  // First key greater than key
+  Iterator upper_bound(const T& key) const {
+    Iterator it = lower_bound(key);
+    while (!it.is_end() && !(key < it.key())) {
+      ++it;
+    }
+    return it;
+  }
+
+  // The first key equal to key, or the end iterator
+  Iterator find(const T& key) const {
+    Iterator it = lower_bound(key);
+    if (it.is_end() || key < it.key()) {
+      return end();
+    }
+    return it;
+  }
+
+  // Payload of the first key equal to key, or null
+  const P* get_payload(const T& key) const {
+    Iterator it = find(key);
+    return it.is_end() ? nullptr : &it.payload();
+  }
+
+ private:
+  std::shared_ptr<SnapshotRegistry> registry_;
+  uint64_t version_ = 0;
+  std::vector<const Leaf*> leaves_;
+  std::vector<T> first_keys_;
+  size_t num_keys_ = 0;
+};
+}
@@ -0,0 +1,333 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Snapshots of the structure of an ALEX index, for tuning and monitoring.
+ *
+ * A StructureSnapshot holds the stats of all nodes in columns, i.e. one vector
+ * per stat with one entry per node, and summary histograms of the depth,
+ * fanout, density and model error of the nodes. Alex::export_structure()
+ * takes a snapshot in one pass over the nodes without reading any keys, so it
+ * costs about as much as get_stats() on the nodes, not a scan of the index.
+ *
+ * write() stores a snapshot in a compact binary format:
+ * - SnapshotHeader
+ * - Each histogram: the number of buckets (uint32), the lower bound of each
+ *   bucket (double) and the count of each bucket (uint64)
+ * - Each column: the length of its name (uint8), the name, the size of an
+ *   entry in bytes (uint8), and the entries, one per node
+ * All values are in the byte order of the machine that wrote the file.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "alex_base.h"
+
+namespace alex {
+
+// Counts of values by bucket. Bucket i holds values in
+// [lower_bounds[i], lower_bounds[i + 1]), the last bucket has no upper bound,
+// and values below the first bound are counted in the first bucket.
+struct StructureHistogram {
+  std::vector<double> lower_bounds;
+  std::vector<uint64_t> counts;
+
+  StructureHistogram() = default;
+
+  explicit StructureHistogram(std::vector<double> bounds)
+      : lower_bounds(std::move(bounds)), counts(lower_bounds.size(), 0) {}
+
+  void add(double value) {
+    auto it = std::upper_bound(lower_bounds.begin(), lower_bounds.end(), value);
+    counts[std::max<long>(it - lower_bounds.begin() - 1, 0)]++;
+  }
+};
+
+template <class T>
+struct StructureSnapshot {
+  static const uint32_t kVersion = 1;
+
+  // Stats of data nodes, in key order
+  struct DataNodeColumns {
+    std::vector<int16_t> depth;  // the root has depth 0
+    std::vector<uint8_t> duplication_factor;
+    std::vector<int32_t> data_capacity;
+    std::vector<int32_t> num_keys;
+    std::vector<int64_t> num_shifts;
+    std::vector<int64_t> num_exp_search_iterations;
+    std::vector<int32_t> num_lookups;
+    std::vector<int32_t> num_inserts;
+    std::vector<int32_t> num_resizes;
+    std::vector<double> expected_avg_shifts;
+    std::vector<double> expected_avg_exp_search_iterations;
+    std::vector<double> model_a;
+    std::vector<double> model_b;
+    // Segments of a piecewise linear model, or 0 if model_a and model_b
+    // predict positions
+    std::vector<int16_t> num_model_segments;
+    std::vector<T> min_key;
+    std::vector<T> max_key;
+    std::vector<int64_t> size_bytes;  // node, slots and bitmap
+  };
+
+  // Stats of model nodes, in pre-order
+  struct ModelNodeColumns {
+    std::vector<int16_t> depth;
+    std::vector<uint8_t> duplication_factor;
+    std::vector<int32_t> num_children;  // slots, including duplicates
+    std::vector<int32_t> fanout;        // distinct children
+    std::vector<double> model_a;
+    std::vector<double> model_b;
+    std::vector<int64_t> size_bytes;
+  };
+
+  struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_size;
+    uint64_t num_data_nodes;
+    uint64_t num_model_nodes;
+    int64_t num_keys;
+    int64_t num_deferred_keys;  // in deferred splits, not yet in data nodes
+    int64_t data_size_bytes;
+    int64_t model_size_bytes;
+    int32_t max_depth;
+    uint32_t num_histograms;
+    uint32_t num_data_node_columns;
+    uint32_t num_model_node_columns;
+  };
+
+  DataNodeColumns data_nodes;
+  ModelNodeColumns model_nodes;
+
+  int64_t num_keys = 0;
+  int64_t num_deferred_keys = 0;
+  int64_t data_size_bytes = 0;
+  int64_t model_size_bytes = 0;
+  int max_depth = 0;
+
+  // Data nodes by depth
+  StructureHistogram depth_histogram;
+  // Model nodes by number of distinct children
+  StructureHistogram fanout_histogram;
+  // Data nodes by num_keys / data_capacity
+  StructureHistogram density_histogram;
+  // Data nodes by exponential search iterations per operation, which is about
+  // the log2 of the model error. Nodes without operations since they were
+  // built count with the expected number of iterations.
+  StructureHistogram model_error_histogram;
+
+  StructureSnapshot()
+      : depth_histogram(linear_bounds(0, 1, 16)),
+        fanout_histogram(power_of_two_bounds(24)),
+        density_histogram(linear_bounds(0, 0.1, 10)),
+        model_error_histogram(linear_bounds(0, 0.5, 24)) {}
+
+  size_t num_data_nodes() const { return data_nodes.depth.size(); }
+  size_t num_model_nodes() const { return model_nodes.depth.size(); }
+
+  // Returns whether the snapshot was written successfully
+  bool write(std::ostream& out) const {
+    SnapshotHeader header = SnapshotHeader();
+    std::memcpy(header.magic, "ALEXSTR", sizeof(header.magic));
+    header.version = kVersion;
+    header.key_size = sizeof(T);
+    header.num_data_nodes = num_data_nodes();
+    header.num_model_nodes = num_model_nodes();
+    header.num_keys = num_keys;
+    header.num_deferred_keys = num_deferred_keys;
+    header.data_size_bytes = data_size_bytes;
+    header.model_size_bytes = model_size_bytes;
+    header.max_depth = max_depth;
+    header.num_histograms = 4;
+    header.num_data_node_columns = 0;
+    header.num_model_node_columns = 0;
+    for_each_data_node_column(
+        *this, [&](const char*, auto&) { header.num_data_node_columns++; });
+    for_each_model_node_column(
+        *this, [&](const char*, auto&) { header.num_model_node_columns++; });
+    auto write_bytes = [&](const void* data, size_t num_bytes) {
+      out.write(static_cast<const char*>(data), num_bytes);
+    };
+    write_bytes(&header, sizeof(header));
+
+    for (const StructureHistogram* histogram :
+         {&depth_histogram, &fanout_histogram, &density_histogram,
+          &model_error_histogram}) {
+      auto num_buckets = static_cast<uint32_t>(histogram->counts.size());
+      write_bytes(&num_buckets, sizeof(num_buckets));
+      write_bytes(histogram->lower_bounds.data(),
+                  num_buckets * sizeof(double));
+      write_bytes(histogram->counts.data(), num_buckets * sizeof(uint64_t));
+    }
+
+    auto write_column = [&](const char* name, auto& column) {
+      auto name_size = static_cast<uint8_t>(std::strlen(name));
+      auto entry_size = static_cast<uint8_t>(sizeof(column[0]));
+      write_bytes(&name_size, sizeof(name_size));
+      write_bytes(name, name_size);
+      write_bytes(&entry_size, sizeof(entry_size));
+      write_bytes(column.data(), column.size() * entry_size);
+    };
+    for_each_data_node_column(*this, write_column);
+    for_each_model_node_column(*this, write_column);
+    return static_cast<bool>(out);
+  }
+
+  // Reads a snapshot written by write(). Columns are matched by name, so
+  // columns that this version does not know are skipped, and unknown columns
+  // of this version are left empty. Returns false if the stream does not hold
+  // a snapshot with keys of the same size.
+  bool read(std::istream& in) {
+    *this = StructureSnapshot();
+    SnapshotHeader header;
+    auto read_bytes = [&](void* data, size_t num_bytes) {
+      in.read(static_cast<char*>(data), num_bytes);
+      return static_cast<bool>(in);
+    };
+    if (!read_bytes(&header, sizeof(header)) ||
+        std::memcmp(header.magic, "ALEXSTR", sizeof(header.magic)) != 0 ||
+        header.key_size != sizeof(T)) {
+      return false;
+    }
+    num_keys = header.num_keys;
+    num_deferred_keys = header.num_deferred_keys;
+    data_size_bytes = header.data_size_bytes;
+    model_size_bytes = header.model_size_bytes;
+    max_depth = header.max_depth;
+
+    StructureHistogram* known_histograms[] = {
+        &depth_histogram, &fanout_histogram, &density_histogram,
+        &model_error_histogram};
+    for (uint32_t i = 0; i < header.num_histograms; i++) {
+      uint32_t num_buckets;
+      if (!read_bytes(&num_buckets, sizeof(num_buckets))) {
+        return false;
+      }
+      StructureHistogram histogram;
+      histogram.lower_bounds.resize(num_buckets);
+      histogram.counts.resize(num_buckets);
+      if (!read_bytes(histogram.lower_bounds.data(),
+                      num_buckets * sizeof(double)) ||
+          !read_bytes(histogram.counts.data(),
+                      num_buckets * sizeof(uint64_t))) {
+        return false;
+      }
+      if (i < sizeof(known_histograms) / sizeof(known_histograms[0])) {
+        *known_histograms[i] = std::move(histogram);
+      }
+    }
+
+    auto read_columns = [&](uint32_t num_columns, size_t num_entries,
+                            auto for_each_column) {
+      for (uint32_t i = 0; i < num_columns; i++) {
+        uint8_t name_size;
+        char name[256];
+        uint8_t entry_size;
+        if (!read_bytes(&name_size, sizeof(name_size)) ||
+            !read_bytes(name, name_size) ||
+            !read_bytes(&entry_size, sizeof(entry_size))) {
+          return false;
+        }
+        name[name_size] = '\0';
+        bool found = false;
+        bool ok = true;
+        for_each_column([&](const char* column_name, auto& column) {
+          if (found || std::strcmp(column_name, name) != 0) {
+            return;
+          }
+          found = true;
+          if (entry_size != sizeof(column[0])) {
+            ok = false;
+            return;
+          }
+          column.resize(num_entries);
+          ok = read_bytes(column.data(), num_entries * entry_size);
+        });
+        if (!found) {
+          ok = static_cast<bool>(
+              in.ignore(static_cast<std::streamsize>(num_entries) *
+                        entry_size));
+        }
+        if (!ok) {
+          return false;
+        }
+      }
+      return true;
+    };
+    auto data_node_columns = [this](auto f) {
+      for_each_data_node_column(*this, f);
+    };
+    auto model_node_columns = [this](auto f) {
+      for_each_model_node_column(*this, f);
+    };
+    return read_columns(header.num_data_node_columns, header.num_data_nodes,
+                        data_node_columns) &&
+           read_columns(header.num_model_node_columns, header.num_model_nodes,
+                        model_node_columns);
+  }
+
+  // Calls f(name, column) for each data node column of snapshot, which may be
+  // const
+  template <class Snapshot, class F>
+  static void for_each_data_node_column(Snapshot& snapshot, F f) {
+    auto& c = snapshot.data_nodes;
+    f("depth", c.depth);
+    f("duplication_factor", c.duplication_factor);
+    f("data_capacity", c.data_capacity);
+    f("num_keys", c.num_keys);
+    f("num_shifts", c.num_shifts);
+    f("num_exp_search_iterations", c.num_exp_search_iterations);
+    f("num_lookups", c.num_lookups);
+    f("num_inserts", c.num_inserts);
+    f("num_resizes", c.num_resizes);
+    f("expected_avg_shifts", c.expected_avg_shifts);
+    f("expected_avg_exp_search_iterations",
+      c.expected_avg_exp_search_iterations);
+    f("model_a", c.model_a);
+    f("model_b", c.model_b);
+    f("num_model_segments", c.num_model_segments);
+    f("min_key", c.min_key);
+    f("max_key", c.max_key);
+    f("size_bytes", c.size_bytes);
+  }
+
+  // Calls f(name, column) for each model node column of snapshot
+  template <class Snapshot, class F>
+  static void for_each_model_node_column(Snapshot& snapshot, F f) {
+    auto& c = snapshot.model_nodes;
+    f("depth", c.depth);
+    f("duplication_factor", c.duplication_factor);
+    f("num_children", c.num_children);
+    f("fanout", c.fanout);
+    f("model_a", c.model_a);
+    f("model_b", c.model_b);
+    f("size_bytes", c.size_bytes);
+  }
+
+ private:
+  static std::vector<double> linear_bounds(double first, double step,
+                                           int num_buckets) {
+    std::vector<double> bounds(num_buckets);
+    for (int i = 0; i < num_buckets; i++) {
+      bounds[i] = first + step * i;
+    }
+    return bounds;
+  }
+
+  static std::vector<double> power_of_two_bounds(int num_buckets) {
+    std::vector<double> bounds(num_buckets);
+    for (int i = 0; i < num_buckets; i++) {
+      bounds[i] = static_cast<double>(1ULL << i);
+    }
+    return bounds;
+  }
+};
+}
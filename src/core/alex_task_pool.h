@@ -0,0 +1,243 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * A work-stealing task pool used to parallelize bulk loading, and a parallel
+ * sort for preparing bulk load input.
+ *
+ * Tasks are spawned into a TaskGroup and the spawning thread waits for the
+ * group, running tasks itself while it waits. Every thread has its own task
+ * deque: a thread runs the task it spawned last first, and steals the oldest
+ * task of another thread when its own deque is empty. Since tasks spawned
+ * first are usually the largest, stealing moves large pieces of work at once.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "alex_base.h"
+
+namespace alex {
+
+class TaskPool {
+ public:
+  // Tracks the unfinished tasks that were spawned into it
+  class TaskGroup {
+   public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup& other) = delete;
+    TaskGroup& operator=(const TaskGroup& other) = delete;
+
+   private:
+    friend class TaskPool;
+    std::atomic<int> num_pending_{0};
+  };
+
+  // num_threads includes the thread that creates the pool, which runs tasks
+  // while it waits for a task group
+  explicit TaskPool(int num_threads) : queues_(std::max(num_threads, 1)) {
+    for (int i = 1; i < num_threads; i++) {
+      workers_.emplace_back([this, i] { run_worker(i); });
+    }
+  }
+
+  TaskPool(const TaskPool& other) = delete;
+  TaskPool& operator=(const TaskPool& other) = delete;
+
+  ~TaskPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    wake_up_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  int num_threads() const { return static_cast<int>(queues_.size()); }
+
+  template <class F>
+  void spawn(TaskGroup& group, F&& task) {
+    group.num_pending_.fetch_add(1, std::memory_order_relaxed);
+    TaskQueue& queue = queues_[current_queue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back({std::function<void()>(std::forward<F>(task)),
+                             &group});
+    }
+    // Pairs with the check of num_queued_ by a worker that is going to sleep:
+    // either the worker sees the task, or this sees the sleeping worker
+    num_queued_.fetch_add(1, std::memory_order_seq_cst);
+    if (num_sleeping_.load(std::memory_order_seq_cst) > 0) {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      wake_up_.notify_one();
+    }
+  }
+
+  // Returns once all tasks of the group have finished
+  void wait(TaskGroup& group) {
+    int queue = current_queue();
+    while (group.num_pending_.load(std::memory_order_acquire) > 0) {
+      if (!run_one_task(queue)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Calls body(i) for every i in [begin, end), split into tasks of at least
+  // min_chunk_size iterations
+  template <class F>
+  void parallel_for(int begin, int end, int min_chunk_size, const F& body) {
+    int num_iterations = end - begin;
+    int chunk_size = std::max(
+        {min_chunk_size, 1, num_iterations / (4 * num_threads())});
+    if (num_iterations <= chunk_size) {
+      for (int i = begin; i < end; i++) {
+        body(i);
+      }
+      return;
+    }
+    TaskGroup group;
+    for (int chunk_begin = begin; chunk_begin < end;
+         chunk_begin += chunk_size) {
+      int chunk_end = std::min(end, chunk_begin + chunk_size);
+      spawn(group, [&body, chunk_begin, chunk_end] {
+        for (int i = chunk_begin; i < chunk_end; i++) {
+          body(i);
+        }
+      });
+    }
+    wait(group);
+  }
+
+ private:
+  struct Task {
+    std::function<void()> run;
+    TaskGroup* group;
+  };
+
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Identifies the pool that the calling thread works for, if any
+  struct WorkerId {
+    const TaskPool* pool = nullptr;
+    int queue = 0;
+  };
+
+  static WorkerId& worker_id() {
+    thread_local WorkerId id;
+    return id;
+  }
+
+  // Threads that are not workers of this pool share the first queue
+  int current_queue() const {
+    const WorkerId& id = worker_id();
+    return id.pool == this ? id.queue : 0;
+  }
+
+  // Runs the newest task of the given queue, or else steals the oldest task of
+  // another queue. Returns false if there were no tasks.
+  bool run_one_task(int queue) {
+    Task task;
+    bool found = pop_task(queue, true, task);
+    for (int i = 1; !found && i < num_threads(); i++) {
+      found = pop_task((queue + i) % num_threads(), false, task);
+    }
+    if (!found) {
+      return false;
+    }
+    task.run();
+    task.group->num_pending_.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop_task(int queue, bool newest, Task& task) {
+    TaskQueue& task_queue = queues_[queue];
+    std::lock_guard<std::mutex> lock(task_queue.mutex);
+    if (task_queue.tasks.empty()) {
+      return false;
+    }
+    if (newest) {
+      task = std::move(task_queue.tasks.back());
+      task_queue.tasks.pop_back();
+    } else {
+      task = std::move(task_queue.tasks.front());
+      task_queue.tasks.pop_front();
+    }
+    num_queued_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void run_worker(int queue) {
+    worker_id() = {this, queue};
+    while (true) {
+      if (run_one_task(queue)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      num_sleeping_.fetch_add(1, std::memory_order_seq_cst);
+      wake_up_.wait(lock, [this] {
+        return stopping_ || num_queued_.load(std::memory_order_seq_cst) > 0;
+      });
+      num_sleeping_.fetch_sub(1, std::memory_order_relaxed);
+      if (stopping_) {
+        return;
+      }
+    }
+  }
+
+  std::deque<TaskQueue> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<int> num_queued_{0};
+  std::atomic<int> num_sleeping_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_up_;
+  bool stopping_ = false;
+};
+
+// Sorts [first, last) with up to num_threads threads. Sorts one chunk per
+// thread, then merges pairs of adjacent chunks in parallel until one remains.
+template <class RandomIt, class Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp,
+                   int num_threads) {
+  // Smaller inputs are sorted faster by one thread
+  const std::ptrdiff_t kMinChunkSize = 1 << 14;
+  std::ptrdiff_t n = last - first;
+  int num_chunks = static_cast<int>(std::max<std::ptrdiff_t>(
+      1, std::min<std::ptrdiff_t>(num_threads, n / kMinChunkSize)));
+  if (num_chunks <= 1) {
+    std::sort(first, last, comp);
+    return;
+  }
+  std::vector<std::ptrdiff_t> bounds(num_chunks + 1);
+  for (int i = 0; i <= num_chunks; i++) {
+    bounds[i] = n * i / num_chunks;
+  }
+  TaskPool pool(num_chunks);
+  pool.parallel_for(0, num_chunks, 1, [&](int i) {
+    std::sort(first + bounds[i], first + bounds[i + 1], comp);
+  });
+  for (size_t width = 1; width < bounds.size() - 1; width *= 2) {
+    int num_merges = static_cast<int>((bounds.size() - 1 + 2 * width - 1) /
+                                      (2 * width));
+    pool.parallel_for(0, num_merges, 1, [&](int i) {
+      size_t left = 2 * width * i;
+      size_t mid = std::min(left + width, bounds.size() - 1);
+      size_t right = std::min(left + 2 * width, bounds.size() - 1);
+      if (mid < right) {
+        std::inplace_merge(first + bounds[left], first + bounds[mid],
+                           first + bounds[right], comp);
+      }
+    });
+  }
+}
+}
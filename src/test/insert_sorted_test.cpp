@@ -0,0 +1,114 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Regression test for batch inserts while data nodes and subtrees are rebuilt
+ * in the background. Batches go through insert(first, last) and through an
+ * IngestSession, next to single inserts, with deferred splits, drift rebuilds,
+ * a memory budget, append mode and the lookup cache all enabled. The index is
+ * checked against a std::multimap at the end. Build it with
+ * -fsanitize=address to catch data nodes that are freed while a rebuild still
+ * reads them. Returns 0 if all checks pass.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+#include "../core/alex.h"
+#include "../core/alex_ingest.h"
+
+typedef uint64_t KEY_TYPE;
+typedef uint64_t PAYLOAD_TYPE;
+typedef std::pair<KEY_TYPE, PAYLOAD_TYPE> V;
+
+template <bool allow_duplicates>
+bool run(int seed, bool use_ingest_session) {
+  typedef alex::Alex<KEY_TYPE, PAYLOAD_TYPE, alex::AlexCompare,
+                     std::allocator<V>, allow_duplicates>
+      index_type;
+  index_type index;
+  index.set_append_mode(true);
+  index.set_lookup_cache_size(1024);
+  index.set_memory_budget(1 << 16);
+  index.set_drift_threshold(1.1);
+  index.set_defer_splits(true);
+
+  std::mt19937_64 gen(seed);
+  const KEY_TYPE key_range = 1ULL << 40;
+  std::vector<V> values;
+  for (int i = 0; i < 20000; i++) {
+    values.push_back({gen() % key_range, i});
+  }
+  auto key_less = [](const V& a, const V& b) { return a.first < b.first; };
+  auto key_equal = [](const V& a, const V& b) { return a.first == b.first; };
+  std::sort(values.begin(), values.end(), key_less);
+  values.erase(std::unique(values.begin(), values.end(), key_equal),
+               values.end());
+  index.bulk_load(values.data(), static_cast<long long>(values.size()));
+  std::multimap<KEY_TYPE, PAYLOAD_TYPE> expected(values.begin(), values.end());
+  auto expect = [&](KEY_TYPE key, PAYLOAD_TYPE payload) {
+    if (allow_duplicates || expected.find(key) == expected.end()) {
+      expected.insert({key, payload});
+    }
+  };
+
+  // Most keys of a batch fall into a region above the bulk loaded keys that
+  // moves between batches, so subtrees drift and large data nodes split
+  alex::IngestSession<index_type>* session =
+      use_ingest_session ? new alex::IngestSession<index_type>(index) : nullptr;
+  for (int batch = 0; batch < 300; batch++) {
+    KEY_TYPE base = key_range + batch * (1ULL << 30) * (gen() % 3);
+    std::vector<V> batch_values;
+    for (int i = 0; i < 3000; i++) {
+      KEY_TYPE key =
+          gen() % 4 == 0 ? gen() % key_range : base + gen() % (1ULL << 22);
+      if (gen() % 50 == 0 && !batch_values.empty()) {
+        key = batch_values.back().first;
+      }
+      batch_values.push_back({key, gen()});
+    }
+    std::stable_sort(batch_values.begin(), batch_values.end(), key_less);
+    for (const V& value : batch_values) {
+      expect(value.first, value.second);
+    }
+    if (session != nullptr) {
+      auto chunk = session->get_chunk();
+      chunk.assign(batch_values.begin(), batch_values.end());
+      session->submit(std::move(chunk));
+      continue;
+    }
+    std::shuffle(batch_values.begin(), batch_values.end(), gen);
+    index.insert(batch_values.begin(), batch_values.end());
+    for (int i = 0; i < 200; i++) {
+      KEY_TYPE key = base + gen() % (1ULL << 22);
+      expect(key, i);
+      index.insert(key, static_cast<PAYLOAD_TYPE>(i));
+    }
+  }
+  if (session != nullptr) {
+    session->finish();
+    delete session;
+  }
+  index.flush_deferred_splits();
+
+  bool ok = static_cast<size_t>(index.size()) == expected.size() &&
+            index.validate_structure(true);
+  auto expected_it = expected.begin();
+  for (auto it = index.begin(); ok && it != index.end(); it++, expected_it++) {
+    ok = it.key() == expected_it->first;
+  }
+  std::printf("duplicates %d seed %d ingest session %d: %s\n",
+              allow_duplicates, seed, use_ingest_session, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int, char**) {
+  bool ok = true;
+  for (int seed = 0; seed < 5; seed++) {
+    ok &= run<true>(seed, false);
+    ok &= run<false>(seed, false);
+    ok &= run<true>(seed, true);
+  }
+  return ok ? 0 : 1;
+}